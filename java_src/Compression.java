@@ -0,0 +1,148 @@
+import java.io.ByteArrayInputStream;
+import java.io.DataInputStream;
+import java.io.DataOutputStream;
+import java.io.IOException;
+
+/**
+ * Decodes messages compressed by libnxt, as described in {@code compress.h}.
+ * Once compression has been negotiated with {@link #negotiate()}, every
+ * message in either direction starts with a byte naming its codec: messages
+ * received are read through {@link #next()}, and messages sent must start
+ * with {@link #NONE}.
+ */
+public class Compression {
+
+    // Codecs.
+    public static final byte NONE = 0;
+    public static final byte RLE = 1;
+    public static final byte BITMAP = 2;
+    public static final byte DELTA = 3;
+
+    /**
+     * The set of codecs decoded, with bit i set for the codec numbered i.
+     */
+    public static final byte CODECS = 1 << RLE | 1 << BITMAP | 1 << DELTA;
+
+    // Start of the messages offering compression.
+    private static final byte[] OFFER = { (byte) 0xfe, 0x5a };
+
+    private final DataInputStream dis;
+
+    private final DataOutputStream dos;
+
+    private final byte[] buffer;
+
+    /**
+     * @param dis The stream of the connection from the Galileo.
+     * @param dos The stream of the connection to the Galileo.
+     * @param maxSize The size in bytes of the largest message that will be
+     * received compressed.
+     */
+    public Compression( DataInputStream dis, DataOutputStream dos,
+                        int maxSize ) {
+        this.dis = dis;
+        this.dos = dos;
+        buffer = new byte[maxSize];
+    }
+
+    /**
+     * Answer the offer of compression sent by the Galileo on connecting.
+     * @throws IOException If the first message was not an offer.
+     */
+    public void negotiate() throws IOException {
+        if ( dis.readByte() != OFFER[0] || dis.readByte() != OFFER[1] )
+            throw new IOException( "No offer of compression" );
+        dis.readByte();
+        dos.write( OFFER );
+        dos.writeByte( CODECS );
+        dos.flush();
+    }
+
+    /**
+     * Start reading the next message.
+     * @return The stream of the connection if the message was not compressed,
+     * or a stream of the message decompressed.
+     * @throws IOException If the message is corrupt or too large.
+     */
+    public DataInputStream next() throws IOException {
+        int codec = dis.readByte();
+        if ( codec == NONE )
+            return dis;
+        int length = readVarint();
+        if ( length > buffer.length )
+            throw new IOException( "Message too large" );
+        switch ( codec ) {
+            case RLE:
+                decodeRle( length );
+                break;
+            case BITMAP:
+                decodeBitmap( length );
+                break;
+            case DELTA:
+                decodeDelta( length );
+                break;
+            default:
+                throw new IOException( "Unknown codec" );
+        }
+        return new DataInputStream(
+            new ByteArrayInputStream( buffer, 0, length ) );
+    }
+
+    private int readVarint() throws IOException {
+        int value = 0;
+        for ( int shift = 0; shift < 35; shift += 7 ) {
+            int b = dis.readUnsignedByte();
+            value |= ( b & 0x7f ) << shift;
+            if ( ( b & 0x80 ) == 0 )
+                return value;
+        }
+        throw new IOException( "Corrupt varint" );
+    }
+
+    private void decodeRle( int length ) throws IOException {
+        int out = 0;
+        while ( out < length ) {
+            int control = dis.readUnsignedByte();
+            int count = ( control < 128 ? control + 1 : control - 125 );
+            if ( out + count > length )
+                throw new IOException( "Corrupt run" );
+            if ( control < 128 ) {
+                dis.readFully( buffer, out, count );
+            } else {
+                byte value = dis.readByte();
+                for ( int i = 0; i < count; i++ )
+                    buffer[out + i] = value;
+            }
+            out += count;
+        }
+    }
+
+    private void decodeBitmap( int length ) throws IOException {
+        int bits = 0;
+        for ( int i = 0; i < length; i++ ) {
+            if ( i % 8 == 0 )
+                bits = dis.readUnsignedByte();
+            buffer[i] = (byte) ( bits >>> ( 7 - i % 8 ) & 1 );
+        }
+    }
+
+    private void decodeDelta( int length ) throws IOException {
+        if ( length % 4 != 0 )
+            throw new IOException( "Corrupt coordinates" );
+        int x = 0;
+        int y = 0;
+        for ( int i = 0; i < length; i += 4 ) {
+            int zigzag = readVarint();
+            int delta = ( zigzag >>> 1 ) ^ -( zigzag & 1 );
+            int value;
+            if ( i / 4 % 2 == 0 )
+                value = x += delta;
+            else
+                value = y += delta;
+            buffer[i] = (byte) ( value >>> 24 );
+            buffer[i + 1] = (byte) ( value >>> 16 );
+            buffer[i + 2] = (byte) ( value >>> 8 );
+            buffer[i + 3] = (byte) value;
+        }
+    }
+}
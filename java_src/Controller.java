@@ -4,7 +4,6 @@ import java.io.IOException;
 import java.util.ArrayList;
 import java.util.Collection;
 import lejos.geom.Point;
-import lejos.geom.Rectangle;
 import lejos.nxt.Button;
 import lejos.nxt.SensorPort;
 import lejos.nxt.UltrasonicSensor;
@@ -12,6 +11,7 @@ import lejos.nxt.comm.NXTConnection;
 import lejos.nxt.comm.USB;
 import lejos.robotics.navigation.DestinationUnreachableException;
 import lejos.robotics.navigation.Pose;
+import lejos.robotics.navigation.Waypoint;
 import lejos.robotics.objectdetection.Feature;
 import lejos.robotics.objectdetection.FeatureDetector;
 import lejos.robotics.objectdetection.FeatureListener;
@@ -28,6 +28,7 @@ public class Controller implements FeatureListener, PlanListener {
     public NXTConnection connection;
     public DataInputStream dis;
     public DataOutputStream dos;
+    public Telemetry telemetry;
     // *********
     
     /**
@@ -35,6 +36,32 @@ public class Controller implements FeatureListener, PlanListener {
      */
     public static final float MAX_SENS_R = 34.0f;
     
+    /**
+     * Maximum distance at which the robot reports echoes while sensing
+     * continuously (cm): the largest reading of the ultrasonic sensor.
+     */
+    public static final float MAX_CONT_SENS_R = 254.0f;
+    
+    /**
+     * Flag, in the third byte of the first message, asking the robot to sense
+     * continuously.
+     */
+    public static final byte CONTINUOUS = 1;
+    
+    /**
+     * First byte of a message from the Galileo telling the robot that the node
+     * whose index follows, in two bytes, is blocked. The index is one the
+     * robot reported, so is below {@link Telemetry#NO_NODE}.
+     */
+    public static final byte BLOCKED = 1;
+    
+    /**
+     * Length of the first message when it gives the start and target nodes
+     * as 4-byte integers, for grids of more than 256 nodes, rather than as
+     * one byte each. Flags may follow in either form.
+     */
+    public static final int WIDE_JOB_LENGTH = 8;
+    
     /**
      * The number of milliseconds between pulses by the ultrasonic sensor.
      */
@@ -59,6 +86,8 @@ public class Controller implements FeatureListener, PlanListener {
     
     private FourWayGridMesh map;
     
+    private GridLocator locator;
+    
     private Node target;
     
     private Node start;
@@ -68,12 +97,15 @@ public class Controller implements FeatureListener, PlanListener {
     
     private MoveAndSense moveAndSense;
     
+    private RangeFeatureDetector sensor;
+    
     private boolean initialised;
     
     public Controller() {
         connection = USB.waitForConnection( 0, NXTConnection.PACKET );
         dis = connection.openDataInputStream();
         dos = connection.openDataOutputStream();
+        telemetry = new Telemetry( dos );
         
         pathFinder = new AstarSearchAlgorithm();
         initialised = false;
@@ -83,7 +115,6 @@ public class Controller implements FeatureListener, PlanListener {
         if ( ! initialised ) {            
             // Initialise long range sensor.
             UltrasonicSensor sonar = new UltrasonicSensor( SensorPort.S4 );
-            RangeFeatureDetector sensor;
             sensor = new RangeFeatureDetector( sonar, MAX_SENS_R, SENS_P );
             /*
              * Do not want to be notified of obstacles yet because the robot
@@ -104,9 +135,28 @@ public class Controller implements FeatureListener, PlanListener {
         }
     }
     
+    /**
+     * Choose how the robot looks for obstacles, before {@link #run}.
+     * @param continuous {@code true} to sense while driving and send every
+     * echo to the Galileo, which tells the robot when the node it is driving
+     * to is blocked; {@code false} to stop and scan at each way-point.
+     * @throws IllegalStateException if {@link #init()} has not been called.
+     */
+    public void setContinuous( boolean continuous ) {
+        if ( initialised ) {
+            moveAndSense.setContinuous( continuous );
+            sensor.setMaxDistance( continuous ? MAX_CONT_SENS_R : MAX_SENS_R );
+        } else {
+            throw new IllegalStateException();
+        }
+    }
+    
     public void run( FourWayGridMesh map, Node start, Node target ) 
             throws DestinationUnreachableException {
         if ( initialised ) {
+            if ( map != this.map ) {
+                locator = new GridLocator( map.getMesh() );
+            }
             this.map = map;
             Collection<Node> locations = map.getMesh();
             if ( locations.contains( start ) && locations.contains( target ) ) {
@@ -116,6 +166,7 @@ public class Controller implements FeatureListener, PlanListener {
                 Path plan = pathFinder.findPath( start, target );
                 if ( plan != null ) {
                     // Begin executing plan.
+                    telemetry.progress( Telemetry.STARTED, plan.size() );
                     moveAndSense.execute( plan );
                 } else {
                     throw new DestinationUnreachableException();
@@ -128,7 +179,12 @@ public class Controller implements FeatureListener, PlanListener {
     
 
     @Override
-    public void featureDetected( Feature feature, FeatureDetector detector ) {
+    public synchronized void featureDetected( Feature feature,
+                                             FeatureDetector detector ) {
+        if ( moveAndSense.isContinuous() ) {
+            reportRange( feature );
+            return;
+        }
         moveAndSense.stop();
         // The robot is no longer moving, so sensor can be turned off.
         detector.enableDetection( false );
@@ -141,86 +197,144 @@ public class Controller implements FeatureListener, PlanListener {
         if ( robotLoc != null ) {
             Node obstacleLoc = mapObstacle( robotLoc, detected );
             if ( obstacleLoc != null ) {
-                // *************************************************
-                String message = "Feature at ( " +
-                                 (int) obstacleLoc.x + ", " + 
-                                 (int) obstacleLoc.y + " )";
-                try {
-                    dos.writeBytes( message );
-                    dos.flush();
-                } catch (IOException ex) {
-                    System.out.println( "IO error" );
-                }
-                // *************************************************
+                telemetry.obstacle( obstacleLoc.x, obstacleLoc.y, realRange );
                 
                 map.removeNode( obstacleLoc );
+                locator.remove( obstacleLoc );
                 // TODO: Move path finding functionality to from NXT to Galileo.
                 Path newPlan = pathFinder.findPath( robotLoc, target );
                 if ( newPlan != null ) {
+                    telemetry.progress( Telemetry.REPLANNED, newPlan.size() );
                     moveAndSense.execute( newPlan );
                 } else {
+                    telemetry.error( Telemetry.NO_PATH );
                     System.out.println( NO_PATH );
                 }
             } else {
+                telemetry.error( Telemetry.MAPPING_FAIL );
                 System.out.println( MAPPING_FAIL );
             }
         } else {
+            telemetry.error( Telemetry.LOCALISE_FAIL );
             System.out.println( LOCALISE_FAIL );
         }
     }
 
+    /**
+     * Stop, and plan around a node the Galileo has found blocked from the
+     * readings sent while sensing continuously. Does nothing if the node has
+     * already been removed from the map.
+     * @param index The index of the node, as by {@link GridLocator#indexOf}.
+     */
+    public synchronized void blocked( int index ) {
+        Node obstacleLoc = locator.nodeAt( index );
+        if ( obstacleLoc == null ) {
+            return;
+        }
+        moveAndSense.halt();
+        Pose pose = moveAndSense.getPose();
+        float range = pose.distanceTo( new Point( obstacleLoc.x,
+                                                  obstacleLoc.y ) );
+        telemetry.obstacle( obstacleLoc.x, obstacleLoc.y, range );
+        
+        map.removeNode( obstacleLoc );
+        locator.remove( obstacleLoc );
+        Node robotLoc = localiseRobot( pose );
+        if ( robotLoc != null ) {
+            Path newPlan = pathFinder.findPath( robotLoc, target );
+            if ( newPlan != null ) {
+                telemetry.progress( Telemetry.REPLANNED, newPlan.size() );
+                moveAndSense.execute( newPlan );
+            } else {
+                telemetry.error( Telemetry.NO_PATH );
+                System.out.println( NO_PATH );
+            }
+        } else {
+            telemetry.error( Telemetry.LOCALISE_FAIL );
+            System.out.println( LOCALISE_FAIL );
+        }
+    }
+    
+    /**
+     * Act on the messages from the Galileo that follow the first, until the
+     * connection fails.
+     * @throws IOException if the connection fails.
+     */
+    public void listen() throws IOException {
+        byte[] command = new byte[3];
+        while ( true ) {
+            while ( dis.available() == 0 );
+            int length = dis.read( command, 0, command.length );
+            if ( length == command.length && command[0] == BLOCKED ) {
+                blocked( ( ( command[1] & 0xff ) << 8 ) |
+                         ( command[2] & 0xff ) );
+            }
+        }
+    }
+    
     @Override
     public void planExecuted() {
+        telemetry.progress( Telemetry.COMPLETE, 0 );
         try {
             // Follow the plan in reverse.
             run( map, target, start );
         } catch ( DestinationUnreachableException ex ) {
+            telemetry.error( Telemetry.NO_PATH );
             System.out.println( NO_PATH );
         }
     }
     
-    private Node localiseRobot( Pose pose ) {
-        double robotLocErr = Double.MAX_VALUE;
-        Node robotLoc = null;
-        for ( Node location : map.getMesh() ) {
-            Point locPoint = new Point( location.x, location.y );
-            double rd = pose.distanceTo( locPoint );
-            if ( rd < robotLocErr ) {
-                robotLocErr = rd;
-                robotLoc = location;
+    /**
+     * Send a reading to the Galileo, with the pose it was taken from and the
+     * node being driven to.
+     */
+    private void reportRange( Feature feature ) {
+        Pose pose = moveAndSense.getPose();
+        float realRange = feature.getRangeReading().getRange() + SENSOR_OFFSET;
+        int next = Telemetry.NO_NODE;
+        Waypoint waypoint = moveAndSense.getWaypoint();
+        if ( waypoint != null ) {
+            Node nextLoc = locator.cellContaining( waypoint.x, waypoint.y );
+            // A node whose index does not fit in the two bytes of the report,
+            // on a grid given by a wide job, is not reported, so the Galileo
+            // cannot mistake it for another and stop the robot for it.
+            int index = ( nextLoc != null ? locator.indexOf( nextLoc ) :
+                          Telemetry.NO_NODE );
+            if ( index < Telemetry.NO_NODE ) {
+                next = index;
             }
         }
-        return robotLoc;
+        telemetry.range( pose, realRange, next );
+    }
+    
+    /**
+     * Read a big-endian integer, as written by {@code DataOutputStream}.
+     * @param data
+     * @param offset The index of the first of its four bytes.
+     */
+    private static int readInt( byte[] data, int offset ) {
+        return ( ( data[offset] & 0xff ) << 24 ) |
+               ( ( data[offset + 1] & 0xff ) << 16 ) |
+               ( ( data[offset + 2] & 0xff ) << 8 ) |
+               ( data[offset + 3] & 0xff );
+    }
+    
+    private Node localiseRobot( Pose pose ) {
+        return locator.nearestNode( pose.getX(), pose.getY() );
     }
     
     private Node mapObstacle( Node robotLoc, Point detected ) {
-        Node obstacleLoc = null;
-        for ( Node neighbour : robotLoc.getNeighbors() ) {
-            /*
-             * The idea is to see if the point on the obstacle that was
-             * detected falls within any of the grid squares that neighbour
-             * the square containing the robot.
-             */
-            Rectangle gridSquare;
-            /*
-             * TODO: 17.0 here is half the side length of grid squares.
-             * We use it to get the coordinates of the top-left corner of
-             * each grid square neighbouring the square containing the robot.
-             * Where to store this value so the magic constant is not used?
-             */
-            float xCoord = neighbour.x - 17.0f;
-            float yCoord = neighbour.y - 17.0f;
-            /*
-             * TODO: 34.0 here is the side length of the grid squares.
-             * Where to store this value so the magic constant is not used?
-             */
-            gridSquare = new Rectangle( xCoord, yCoord, 34.0f, 34.0f );
-            if ( gridSquare.contains( detected ) ) {
-                obstacleLoc = neighbour;
-                break;
-            }
+        /*
+         * The idea is to see if the point on the obstacle that was
+         * detected falls within any of the grid squares that neighbour
+         * the square containing the robot.
+         */
+        Node obstacleLoc = locator.cellContaining( detected.x, detected.y );
+        if ( obstacleLoc != null &&
+             robotLoc.getNeighbors().contains( obstacleLoc ) ) {
+            return obstacleLoc;
         }
-        return obstacleLoc;
+        return null;
     }
     
     public static void main( String[] args ) {
@@ -235,15 +349,36 @@ public class Controller implements FeatureListener, PlanListener {
         
         Controller ctrlr = new Controller();  
         try {
-            byte[] endPoints = new byte[2];
+            // The start and target nodes, and optionally flags.
+            byte[] endPoints = new byte[WIDE_JOB_LENGTH + 1];
             int messageLen = 0;
             while ( ( messageLen = ctrlr.dis.available() ) == 0 );
-            ctrlr.dis.read( endPoints, 0, endPoints.length );
-            Node start = locations.get( endPoints[0] );
-            Node target = locations.get( endPoints[1] );
+            messageLen = ctrlr.dis.read( endPoints, 0, endPoints.length );
+            int startIndex, targetIndex, flagsAt;
+            if ( messageLen >= WIDE_JOB_LENGTH ) {
+                startIndex = readInt( endPoints, 0 );
+                targetIndex = readInt( endPoints, 4 );
+                flagsAt = WIDE_JOB_LENGTH;
+            } else {
+                startIndex = endPoints[0] & 0xff;
+                targetIndex = endPoints[1] & 0xff;
+                flagsAt = 2;
+            }
+            if ( startIndex < 0 || startIndex >= locations.size() ||
+                 targetIndex < 0 || targetIndex >= locations.size() ) {
+                throw new DestinationUnreachableException();
+            }
+            Node start = locations.get( startIndex );
+            Node target = locations.get( targetIndex );
+            boolean continuous = messageLen > flagsAt &&
+                                 ( endPoints[flagsAt] & CONTINUOUS ) != 0;
             
             ctrlr.init();
+            ctrlr.setContinuous( continuous );
             ctrlr.run( map, start, target );
+            if ( continuous ) {
+                ctrlr.listen();
+            }
         } catch ( DestinationUnreachableException ex ) {
             System.out.println( NO_PATH );
         } catch (IOException ex) {
@@ -0,0 +1,174 @@
+import java.util.Collection;
+import lejos.robotics.pathfinding.Node;
+
+/**
+ * Locates the nodes of a regular grid mesh, such as a {@code FourWayGridMesh},
+ * from coordinates, without scanning the mesh or allocating objects.
+ * Mirrors {@code grid_cell_at()} and {@code grid_nearest_node()} in libplan on
+ * the Galileo.
+ */
+public class GridLocator {
+
+    private final float originX;
+
+    private final float originY;
+
+    private final float spacing;
+
+    private final int width;
+
+    private final int height;
+
+    // Nodes by grid position, y * width + x; null where removed.
+    private final Node[] cells;
+
+    /**
+     * @param mesh The nodes of the mesh, which must lie on a regular grid and
+     * include at least two neighbouring nodes.
+     * @throws IllegalArgumentException if the spacing of the grid cannot be
+     * determined from {@code mesh}.
+     */
+    public GridLocator( Collection<Node> mesh ) {
+        float minX = Float.MAX_VALUE, minY = Float.MAX_VALUE;
+        float maxX = -Float.MAX_VALUE, maxY = -Float.MAX_VALUE;
+        float step = 0.0f;
+        for ( Node node : mesh ) {
+            minX = Math.min( minX, node.x );
+            minY = Math.min( minY, node.y );
+            maxX = Math.max( maxX, node.x );
+            maxY = Math.max( maxY, node.y );
+            if ( step == 0.0f ) {
+                for ( Node neighbour : node.getNeighbors() ) {
+                    step = Math.abs( neighbour.x - node.x ) +
+                           Math.abs( neighbour.y - node.y );
+                    break;
+                }
+            }
+        }
+        if ( ! ( step > 0.0f ) ) {
+            throw new IllegalArgumentException();
+        }
+        originX = minX;
+        originY = minY;
+        spacing = step;
+        width = Math.round( ( maxX - minX ) / step ) + 1;
+        height = Math.round( ( maxY - minY ) / step ) + 1;
+        cells = new Node[width * height];
+        for ( Node node : mesh ) {
+            int i = Math.round( ( node.x - originX ) / spacing );
+            int j = Math.round( ( node.y - originY ) / spacing );
+            cells[j * width + i] = node;
+        }
+    }
+
+    /**
+     * @return The distance between neighbouring nodes.
+     */
+    public float getSpacing() {
+        return spacing;
+    }
+
+    /**
+     * Stop locating a node, after it has been removed from the mesh.
+     * @param node
+     */
+    public void remove( Node node ) {
+        int i = Math.round( ( node.x - originX ) / spacing );
+        int j = Math.round( ( node.y - originY ) / spacing );
+        if ( i >= 0 && i < width && j >= 0 && j < height &&
+             cells[j * width + i] == node ) {
+            cells[j * width + i] = null;
+        }
+    }
+
+    /**
+     * @param node A node of the mesh.
+     * @return The index of the node's grid position, y * width + x, as used
+     * for the grid's nodes on the Galileo.
+     */
+    public int indexOf( Node node ) {
+        int i = Math.round( ( node.x - originX ) / spacing );
+        int j = Math.round( ( node.y - originY ) / spacing );
+        return j * width + i;
+    }
+
+    /**
+     * @param index The index of a grid position, as returned by
+     * {@link #indexOf(Node)}.
+     * @return The node at the position, or {@code null} if it has been
+     * removed or the index is outside the grid.
+     */
+    public Node nodeAt( int index ) {
+        if ( index < 0 || index >= cells.length ) {
+            return null;
+        }
+        return cells[index];
+    }
+
+    /**
+     * Get the node whose grid square contains a point. Takes constant time.
+     * @param x
+     * @param y
+     * @return The node, or {@code null} if the square has been removed or the
+     * point lies outside the grid.
+     */
+    public Node cellContaining( float x, float y ) {
+        int i = (int) Math.floor( ( x - originX ) / spacing + 0.5f );
+        int j = (int) Math.floor( ( y - originY ) / spacing + 0.5f );
+        if ( i < 0 || i >= width || j < 0 || j >= height ) {
+            return null;
+        }
+        return cells[j * width + i];
+    }
+
+    /**
+     * Get the node nearest to a point. The nearest grid position is computed
+     * directly; only if its node has been removed are the surrounding nodes
+     * searched, ring by ring, until no nearer node can remain.
+     * @param x
+     * @param y
+     * @return The node, or {@code null} if every node has been removed.
+     */
+    public Node nearestNode( float x, float y ) {
+        float fx = ( x - originX ) / spacing;
+        float fy = ( y - originY ) / spacing;
+        int cx = Math.min( Math.max( Math.round( fx ), 0 ), width - 1 );
+        int cy = Math.min( Math.max( Math.round( fy ), 0 ), height - 1 );
+        if ( cells[cy * width + cx] != null ) {
+            return cells[cy * width + cx];
+        }
+
+        float offset = Math.max( Math.abs( fx - cx ), Math.abs( fy - cy ) );
+        Node nearest = null;
+        float best = Float.MAX_VALUE;
+        int limit = Math.max( width, height );
+        for ( int r = 1; r <= limit; r++ ) {
+            // Every node of this ring is at least this far from the point.
+            float bound = r - offset;
+            if ( bound > 0.0f && bound * bound > best ) {
+                break;
+            }
+            for ( int dy = -r; dy <= r; dy++ ) {
+                int j = cy + dy;
+                if ( j < 0 || j >= height ) {
+                    continue;
+                }
+                // Inside the ring, only its left and right edges are searched.
+                int step = ( dy == -r || dy == r ) ? 1 : 2 * r;
+                for ( int dx = -r; dx <= r; dx += step ) {
+                    int i = cx + dx;
+                    if ( i < 0 || i >= width || cells[j * width + i] == null ) {
+                        continue;
+                    }
+                    float ex = i - fx;
+                    float ey = j - fy;
+                    if ( ex * ex + ey * ey < best ) {
+                        best = ex * ex + ey * ey;
+                        nearest = cells[j * width + i];
+                    }
+                }
+            }
+        }
+        return nearest;
+    }
+}
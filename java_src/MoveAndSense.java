@@ -1,6 +1,5 @@
 
 
-import java.io.IOException;
 import java.util.ArrayList;
 import lejos.nxt.LCD;
 import lejos.nxt.Motor;
@@ -37,6 +36,8 @@ public class MoveAndSense implements NavigationListener {
     
     private boolean stopped;
     
+    private boolean continuous;
+    
     private final ArrayList<PlanListener> listeners;
 
     /**
@@ -96,6 +97,24 @@ public class MoveAndSense implements NavigationListener {
         }
     }
     
+    /**
+     * Choose how the robot looks for obstacles in the plans it executes.
+     * @param continuous {@code true} to keep the sensor on while the robot
+     * drives, without stopping at way-points; the Galileo decides from the
+     * readings whether the robot must stop. {@code false} to stop at each
+     * way-point and scan for an obstacle on the next.
+     */
+    public void setContinuous( boolean continuous ) {
+        this.continuous = continuous;
+    }
+    
+    /**
+     * @return {@code true} if the sensor is kept on while the robot drives.
+     */
+    public boolean isContinuous() {
+        return continuous;
+    }
+    
     /**
      * Start the robot following the given plan, scanning for obstacles
      * while traveling.
@@ -106,6 +125,13 @@ public class MoveAndSense implements NavigationListener {
         if ( initialised ) {
             stopped = false;
             navigator.setPath( plan );
+            if ( continuous ) {
+                // Sense while driving, and drive through the way-points.
+                sensor.enableDetection( true );
+                navigator.singleStep( false );
+                navigator.followPath();
+                return;
+            }
             /*
              * Begin following the plan, stopping at each way-point to look
              * for obstacles. Can turn off sensor when moving between way-points
@@ -129,6 +155,22 @@ public class MoveAndSense implements NavigationListener {
         stopped = true;
     }
     
+    /**
+     * Stop the robot at once, even between way-points.
+     */
+    public void halt() {
+        stopped = true;
+        navigator.stop();
+    }
+    
+    /**
+     * @return The way-point the robot is driving to, or {@code null} if there
+     * is none.
+     */
+    public Waypoint getWaypoint() {
+        return navigator.getWaypoint();
+    }
+    
     /**
      * @return The current coordinates and heading of the robot.
      */
@@ -147,16 +189,9 @@ public class MoveAndSense implements NavigationListener {
     @Override
     public void atWaypoint( Waypoint waypoint, Pose pose, int sequence ) {
         Waypoint nextWaypoint = navigator.getWaypoint();
-        String message = "robot at ( " +
-                         (int) pose.getX() + ", " + (int) pose.getY() + " )";
-        try {
-            ctrlr.dos.writeBytes( message );
-            ctrlr.dos.flush();
-        } catch (IOException ex) {
-            System.out.println( "IO error" );
-        }
+        ctrlr.telemetry.pose( pose, sequence );
         
-        if ( nextWaypoint != null ) {
+        if ( nextWaypoint != null && ! continuous ) {
             // Another waypoint follows.
             float relativeBearing = pose.relativeBearing( nextWaypoint );
             // Turn the robot to face the next waypoint.
@@ -0,0 +1,174 @@
+import java.io.DataOutputStream;
+import java.io.IOException;
+import lejos.robotics.navigation.Pose;
+
+/**
+ * Sends reports to the Galileo as compact binary messages with a fixed layout,
+ * decoded by {@code telemetry.h} in libnxt. Each message is written from a
+ * single reusable buffer and sent in its own packet, so reporting allocates
+ * nothing on the NXT.
+ */
+public class Telemetry {
+
+    /**
+     * The version of the message layout. Later versions may only append
+     * fields to a message.
+     */
+    public static final byte VERSION = 1;
+
+    // Message types.
+    public static final byte POSE = 1;
+    public static final byte OBSTACLE = 2;
+    public static final byte PROGRESS = 3;
+    public static final byte ERROR = 4;
+    public static final byte RANGE = 5;
+
+    /**
+     * The node sent in a range message when the robot is not driving to one.
+     */
+    public static final int NO_NODE = 0xffff;
+
+    // Stages reported by progress messages.
+    public static final byte STARTED = 1;
+    public static final byte REPLANNED = 2;
+    public static final byte COMPLETE = 3;
+
+    // Faults reported by error messages.
+    public static final byte NO_PATH = 1;
+    public static final byte LOCALISE_FAIL = 2;
+    public static final byte MAPPING_FAIL = 3;
+    public static final byte IO_FAIL = 4;
+
+    // Size of the longest message: a range reading, behind its codec.
+    private static final int MAX_SIZE = 25;
+
+    private final DataOutputStream dos;
+
+    private final byte[] buffer;
+
+    private final long startTime;
+
+    private int length;
+
+    private boolean compressed;
+
+    /**
+     * @param dos The stream of the connection to the Galileo.
+     */
+    public Telemetry( DataOutputStream dos ) {
+        this.dos = dos;
+        buffer = new byte[MAX_SIZE];
+        startTime = System.currentTimeMillis();
+    }
+
+    /**
+     * Start each message with its codec, as required once compression has
+     * been negotiated.
+     * @see Compression
+     */
+    public synchronized void setCompressed( boolean compressed ) {
+        this.compressed = compressed;
+    }
+
+    /**
+     * Report that the robot has reached a waypoint.
+     * @param pose The coordinates and heading of the robot.
+     * @param sequence The sequence number of the waypoint.
+     */
+    public synchronized void pose( Pose pose, int sequence ) {
+        begin( POSE );
+        putFloat( pose.getX() );
+        putFloat( pose.getY() );
+        putFloat( pose.getHeading() );
+        putShort( sequence );
+        send();
+    }
+
+    /**
+     * Report that an obstacle has been detected on a node of the grid.
+     * @param x
+     * @param y
+     * @param range The distance of the obstacle from the centre of the robot.
+     */
+    public synchronized void obstacle( float x, float y, float range ) {
+        begin( OBSTACLE );
+        putFloat( x );
+        putFloat( y );
+        putFloat( range );
+        send();
+    }
+
+    /**
+     * Report an echo heard while sensing continuously.
+     * @param pose The coordinates and heading of the robot.
+     * @param range The distance of the echo from the centre of the robot.
+     * @param next The index of the node being driven to, or {@link #NO_NODE}.
+     */
+    public synchronized void range( Pose pose, float range, int next ) {
+        begin( RANGE );
+        putFloat( pose.getX() );
+        putFloat( pose.getY() );
+        putFloat( pose.getHeading() );
+        putFloat( range );
+        putShort( next );
+        send();
+    }
+
+    /**
+     * Report progress through a plan.
+     * @param stage One of {@link #STARTED}, {@link #REPLANNED} or
+     * {@link #COMPLETE}.
+     * @param waypoints The number of waypoints in the plan.
+     */
+    public synchronized void progress( byte stage, int waypoints ) {
+        begin( PROGRESS );
+        buffer[length++] = stage;
+        putShort( waypoints );
+        send();
+    }
+
+    /**
+     * Report that the robot could not continue its plan.
+     * @param fault One of {@link #NO_PATH}, {@link #LOCALISE_FAIL},
+     * {@link #MAPPING_FAIL} or {@link #IO_FAIL}.
+     */
+    public synchronized void error( byte fault ) {
+        begin( ERROR );
+        buffer[length++] = fault;
+        send();
+    }
+
+    private void begin( byte type ) {
+        length = 0;
+        if ( compressed )
+            buffer[length++] = Compression.NONE;
+        buffer[length++] = VERSION;
+        buffer[length++] = type;
+        putInt( (int) ( System.currentTimeMillis() - startTime ) );
+    }
+
+    private void putShort( int value ) {
+        buffer[length++] = (byte) ( value >>> 8 );
+        buffer[length++] = (byte) value;
+    }
+
+    private void putInt( int value ) {
+        buffer[length++] = (byte) ( value >>> 24 );
+        buffer[length++] = (byte) ( value >>> 16 );
+        buffer[length++] = (byte) ( value >>> 8 );
+        buffer[length++] = (byte) value;
+    }
+
+    private void putFloat( float value ) {
+        putInt( Float.floatToIntBits( value ) );
+    }
+
+    private void send() {
+        try {
+            dos.write( buffer, 0, length );
+            dos.flush();
+        } catch ( IOException ex ) {
+            System.out.println( "IO error" );
+        }
+    }
+}
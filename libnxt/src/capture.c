@@ -0,0 +1,512 @@
+#include "capture.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Size of the magic at the start of a log.
+#define MAGIC_SIZE 8
+// Size a log is first extended to; it doubles whenever full.
+#define INITIAL_SIZE ( 1 << 20 )
+// Time between writing the mapping back to the file, in ms.
+#define SYNC_INTERVAL 1000
+
+// State of a link that records its traffic.
+typedef struct capture_link {
+    nxt_comm * inner;
+    // Protects the log, which reads and writes from different threads share.
+    pthread_mutex_t lock;
+    int fd;
+    unsigned char * map;
+    size_t mapped;
+    // Bytes of the log written.
+    size_t used;
+    // Boolean flag: the log could not be extended, so recording has stopped.
+    int failed;
+    struct timespec start;
+    struct timespec lastSync;
+} capture_link;
+
+// A record of a log being played.
+typedef struct replay_record {
+    int direction;
+    const unsigned char * data;
+    size_t length;
+    // Time since the record before, in ns.
+    uint64_t gap;
+    // Bytes the host wrote before the record.
+    size_t sentBefore;
+} replay_record;
+
+// State of a link that plays back a log.
+typedef struct replay_link {
+    // Protects the position in the log, which reads and writes share.
+    pthread_mutex_t lock;
+    // Signalled when the host writes.
+    pthread_cond_t written;
+    unsigned char * map;
+    size_t mapped;
+    double speed;
+
+    replay_record * records;
+    size_t count;
+
+    // The next record to be read, and the bytes of it already read.
+    size_t readRecord;
+    size_t readOffset;
+
+    // The next record to compare writes with, and the bytes of it compared.
+    size_t writeRecord;
+    size_t writeOffset;
+    // Bytes the host has written.
+    size_t sent;
+    size_t mismatches;
+
+    // When the last record was played: read in full, or written by the host.
+    struct timespec lastEvent;
+} replay_link;
+
+/*
+ * Operations of the capture transport; state is a capture_link.
+ */
+static libnxt_error capture_read( void * state, unsigned char * buf,
+                                  size_t offset, size_t maxLength, int timeout,
+                                  int * transferred );
+static libnxt_error capture_write( void * state, unsigned char * buf,
+                                   size_t offset, size_t length, int timeout,
+                                   int * transferred );
+static libnxt_error capture_set_async( void * state, size_t depth );
+static void capture_close( void * state );
+static libnxt_error capture_reopen( void * state, int timeout );
+
+static const nxt_transport CAPTURE_TRANSPORT = {
+    capture_read, capture_write, capture_set_async, capture_close,
+    capture_reopen
+};
+
+/*
+ * Operations of the replay transport; state is a replay_link. Asynchronous
+ * reads are not supported.
+ */
+static libnxt_error replay_read( void * state, unsigned char * buf,
+                                 size_t offset, size_t maxLength, int timeout,
+                                 int * transferred );
+static libnxt_error replay_write( void * state, unsigned char * buf,
+                                  size_t offset, size_t length, int timeout,
+                                  int * transferred );
+static void replay_close( void * state );
+
+static const nxt_transport REPLAY_TRANSPORT = {
+    replay_read, replay_write, NULL, replay_close, NULL
+};
+
+/*
+ * Write or read big-endian fields.
+ */
+static void put_u32( unsigned char * dest, uint32_t value );
+static void put_u64( unsigned char * dest, uint64_t value );
+static uint32_t get_u32( const unsigned char * src );
+static uint64_t get_u64( const unsigned char * src );
+
+/*
+ * Time in ns from one time to another.
+ */
+static int64_t ns_between( const struct timespec * from,
+                           const struct timespec * to );
+
+/*
+ * Add a time in ns to a time.
+ */
+static void add_ns( struct timespec * time, uint64_t ns );
+
+/*
+ * Map a larger part of the file of a log. Must be called with the lock held.
+ * return: Non-zero if the log now has room for needed bytes more.
+ */
+static int extend_log( capture_link * link, size_t needed );
+
+/*
+ * Append a record of a transfer to the log.
+ */
+static void record_transfer( capture_link * link, int direction,
+                             const unsigned char * data, size_t length );
+
+/*
+ * Index the records of a log.
+ * return: LIBNXT_SUCCESS, or
+ *         LIBNXT_OTHER_ERROR if the file is not a log, or memory could not
+ *         be allocated.
+ */
+static libnxt_error index_log( replay_link * link );
+
+static void put_u32( unsigned char * dest, uint32_t value ) {
+    dest[0] = (unsigned char) ( value >> 24 );
+    dest[1] = (unsigned char) ( value >> 16 );
+    dest[2] = (unsigned char) ( value >> 8 );
+    dest[3] = (unsigned char) value;
+}
+
+static void put_u64( unsigned char * dest, uint64_t value ) {
+    put_u32( dest, (uint32_t) ( value >> 32 ) );
+    put_u32( dest + 4, (uint32_t) value );
+}
+
+static uint32_t get_u32( const unsigned char * src ) {
+    return (uint32_t) src[0] << 24 | (uint32_t) src[1] << 16 |
+           (uint32_t) src[2] << 8 | src[3];
+}
+
+static uint64_t get_u64( const unsigned char * src ) {
+    return (uint64_t) get_u32( src ) << 32 | get_u32( src + 4 );
+}
+
+static int64_t ns_between( const struct timespec * from,
+                           const struct timespec * to ) {
+    return (int64_t) ( to->tv_sec - from->tv_sec ) * 1000000000LL +
+           ( to->tv_nsec - from->tv_nsec );
+}
+
+static void add_ns( struct timespec * time, uint64_t ns ) {
+    time->tv_sec += (time_t) ( ns / 1000000000ULL );
+    time->tv_nsec += (long) ( ns % 1000000000ULL );
+    if ( time->tv_nsec >= 1000000000L ) {
+        time->tv_sec++;
+        time->tv_nsec -= 1000000000L;
+    }
+}
+
+static int extend_log( capture_link * link, size_t needed ) {
+    size_t size = link->mapped * 2;
+    while ( size < link->used + needed )
+        size *= 2;
+    // The old mapping stays valid until the new one is made.
+    if ( ftruncate( link->fd, (off_t) size ) )
+        return 0;
+    void * map = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       link->fd, 0 );
+    if ( map == MAP_FAILED )
+        return 0;
+    munmap( link->map, link->mapped );
+    link->map = (unsigned char *) map;
+    link->mapped = size;
+    return 1;
+}
+
+static void record_transfer( capture_link * link, int direction,
+                             const unsigned char * data, size_t length ) {
+    if ( length == 0 || length > UINT32_MAX )
+        return;
+    // Timed under the lock, so that records are in order of time.
+    pthread_mutex_lock( &link->lock );
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    size_t needed = CAPTURE_RECORD_SIZE + length;
+    if ( ! link->failed && link->used + needed > link->mapped )
+        link->failed = ! extend_log( link, needed );
+    if ( ! link->failed ) {
+        unsigned char * record = link->map + link->used;
+        put_u32( record + 1, (uint32_t) length );
+        put_u64( record + 5, (uint64_t) ns_between( &link->start, &now ) );
+        memcpy( record + CAPTURE_RECORD_SIZE, data, length );
+        // The direction is written last, so a record is only part of the log
+        // once complete.
+        record[0] = (unsigned char) direction;
+        link->used += needed;
+        if ( ns_between( &link->lastSync, &now ) >=
+             SYNC_INTERVAL * 1000000LL ) {
+            msync( link->map, link->used, MS_ASYNC );
+            link->lastSync = now;
+        }
+    }
+    pthread_mutex_unlock( &link->lock );
+}
+
+libnxt_error open_capture_comm( nxt_comm * inner, const char * path,
+                                nxt_comm ** comm ) {
+    *comm = NULL;
+    capture_link * link = (capture_link *) calloc( 1, sizeof ( capture_link ) );
+    if ( link == NULL || pthread_mutex_init( &link->lock, NULL ) ) {
+        free( link );
+        close_comm_at( inner );
+        return LIBNXT_OTHER_ERROR;
+    }
+    link->fd = open( path, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    link->map = MAP_FAILED;
+    if ( link->fd >= 0 && ! ftruncate( link->fd, INITIAL_SIZE ) )
+        link->map = (unsigned char *) mmap( NULL, INITIAL_SIZE,
+                                            PROT_READ | PROT_WRITE, MAP_SHARED,
+                                            link->fd, 0 );
+    if ( link->map == MAP_FAILED ) {
+        if ( link->fd >= 0 )
+            close( link->fd );
+        pthread_mutex_destroy( &link->lock );
+        free( link );
+        close_comm_at( inner );
+        return LIBNXT_IO_ERROR;
+    }
+    memcpy( link->map, CAPTURE_MAGIC, MAGIC_SIZE );
+    link->mapped = INITIAL_SIZE;
+    link->used = MAGIC_SIZE;
+    link->inner = inner;
+    clock_gettime( CLOCK_MONOTONIC, &link->start );
+    link->lastSync = link->start;
+    return open_comm_with( &CAPTURE_TRANSPORT, link, comm );
+}
+
+static libnxt_error capture_read( void * state, unsigned char * buf,
+                                  size_t offset, size_t maxLength, int timeout,
+                                  int * transferred ) {
+    capture_link * link = (capture_link *) state;
+    libnxt_error errorCode = comm_read( link->inner, buf, offset, maxLength,
+                                        timeout, transferred );
+    if ( *transferred > 0 )
+        record_transfer( link, CAPTURE_RECEIVED, buf + offset,
+                         (size_t) *transferred );
+    return errorCode;
+}
+
+static libnxt_error capture_write( void * state, unsigned char * buf,
+                                   size_t offset, size_t length, int timeout,
+                                   int * transferred ) {
+    capture_link * link = (capture_link *) state;
+    libnxt_error errorCode = comm_write( link->inner, buf, offset, length,
+                                         timeout, transferred );
+    if ( *transferred > 0 )
+        record_transfer( link, CAPTURE_SENT, buf + offset,
+                         (size_t) *transferred );
+    return errorCode;
+}
+
+static libnxt_error capture_set_async( void * state, size_t depth ) {
+    capture_link * link = (capture_link *) state;
+    return comm_set_async( link->inner, depth );
+}
+
+static libnxt_error capture_reopen( void * state, int timeout ) {
+    capture_link * link = (capture_link *) state;
+    return comm_reopen( link->inner, timeout );
+}
+
+static void capture_close( void * state ) {
+    capture_link * link = (capture_link *) state;
+    close_comm_at( link->inner );
+    msync( link->map, link->used, MS_SYNC );
+    munmap( link->map, link->mapped );
+    // Cut off the space reserved beyond the last record; should that fail,
+    // the log still ends at the first direction of 0.
+    int truncated = ftruncate( link->fd, (off_t) link->used );
+    (void) truncated;
+    close( link->fd );
+    pthread_mutex_destroy( &link->lock );
+    free( link );
+}
+
+static libnxt_error index_log( replay_link * link ) {
+    if ( link->mapped < MAGIC_SIZE ||
+         memcmp( link->map, CAPTURE_MAGIC, MAGIC_SIZE ) )
+        return LIBNXT_OTHER_ERROR;
+
+    // Count the records, then index them.
+    int pass;
+    for ( pass = 0; pass < 2; pass++ ) {
+        size_t position = MAGIC_SIZE;
+        size_t count = 0;
+        size_t sent = 0;
+        uint64_t previous = 0;
+        while ( position + CAPTURE_RECORD_SIZE <= link->mapped ) {
+            const unsigned char * header = link->map + position;
+            int direction = header[0];
+            size_t length = get_u32( header + 1 );
+            if ( ( direction != CAPTURE_RECEIVED &&
+                   direction != CAPTURE_SENT ) ||
+                 length > link->mapped - position - CAPTURE_RECORD_SIZE )
+                break;
+            if ( pass == 1 ) {
+                replay_record * record = &link->records[count];
+                uint64_t time = get_u64( header + 5 );
+                record->direction = direction;
+                record->data = header + CAPTURE_RECORD_SIZE;
+                record->length = length;
+                record->gap = ( time > previous ? time - previous : 0 );
+                record->sentBefore = sent;
+                previous = time;
+            }
+            if ( direction == CAPTURE_SENT )
+                sent += length;
+            position += CAPTURE_RECORD_SIZE + length;
+            count++;
+        }
+        if ( pass == 0 ) {
+            link->records =
+                (replay_record *) calloc( count + 1, sizeof ( replay_record ) );
+            if ( link->records == NULL )
+                return LIBNXT_OTHER_ERROR;
+        }
+        link->count = count;
+    }
+    return LIBNXT_SUCCESS;
+}
+
+libnxt_error open_replay_comm( const char * path, double speed,
+                               nxt_comm ** comm ) {
+    *comm = NULL;
+    if ( speed < 0 )
+        return LIBNXT_ILLEGAL_ARG;
+    replay_link * link = (replay_link *) calloc( 1, sizeof ( replay_link ) );
+    if ( link == NULL )
+        return LIBNXT_OTHER_ERROR;
+
+    int fd = open( path, O_RDONLY );
+    struct stat info;
+    if ( fd < 0 || fstat( fd, &info ) || info.st_size == 0 ) {
+        if ( fd >= 0 )
+            close( fd );
+        free( link );
+        return ( fd < 0 ? LIBNXT_IO_ERROR : LIBNXT_OTHER_ERROR );
+    }
+    link->mapped = (size_t) info.st_size;
+    link->map = (unsigned char *) mmap( NULL, link->mapped, PROT_READ,
+                                        MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if ( link->map == MAP_FAILED ) {
+        free( link );
+        return LIBNXT_IO_ERROR;
+    }
+
+    // Waits for writes are timed against the monotonic clock.
+    pthread_condattr_t attributes;
+    libnxt_error errorCode = index_log( link );
+    if ( ! errorCode && ( pthread_mutex_init( &link->lock, NULL ) ||
+                          pthread_condattr_init( &attributes ) ) )
+        errorCode = LIBNXT_OTHER_ERROR;
+    if ( ! errorCode ) {
+        if ( pthread_condattr_setclock( &attributes, CLOCK_MONOTONIC ) ||
+             pthread_cond_init( &link->written, &attributes ) )
+            errorCode = LIBNXT_OTHER_ERROR;
+        pthread_condattr_destroy( &attributes );
+    }
+    if ( errorCode ) {
+        munmap( link->map, link->mapped );
+        free( link->records );
+        free( link );
+        return errorCode;
+    }
+    link->speed = speed;
+    clock_gettime( CLOCK_MONOTONIC, &link->lastEvent );
+    return open_comm_with( &REPLAY_TRANSPORT, link, comm );
+}
+
+size_t replay_mismatches( nxt_comm * comm ) {
+    replay_link * link = (replay_link *) comm_state( comm, &REPLAY_TRANSPORT );
+    if ( link == NULL )
+        return 0;
+    pthread_mutex_lock( &link->lock );
+    size_t mismatches = link->mismatches;
+    pthread_mutex_unlock( &link->lock );
+    return mismatches;
+}
+
+static libnxt_error replay_read( void * state, unsigned char * buf,
+                                 size_t offset, size_t maxLength, int timeout,
+                                 int * transferred ) {
+    replay_link * link = (replay_link *) state;
+    *transferred = 0;
+    struct timespec deadline;
+    clock_gettime( CLOCK_MONOTONIC, &deadline );
+    add_ns( &deadline, (uint64_t) timeout * 1000000ULL );
+
+    pthread_mutex_lock( &link->lock );
+    while ( link->readRecord < link->count &&
+            link->records[link->readRecord].direction != CAPTURE_RECEIVED )
+        link->readRecord++;
+    if ( link->readRecord == link->count ) {
+        pthread_mutex_unlock( &link->lock );
+        return LIBNXT_DISCONNECTED;
+    }
+    replay_record * record = &link->records[link->readRecord];
+
+    // Wait for the host to write what it wrote before, then for the delay
+    // there was since the record before, counted from when that was played.
+    for ( ;; ) {
+        struct timespec now;
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        int ready = ( link->sent >= record->sentBefore );
+        struct timespec wake = deadline;
+        if ( ready ) {
+            if ( link->speed == 0 || link->readOffset > 0 )
+                break;
+            struct timespec due = link->lastEvent;
+            add_ns( &due, (uint64_t) ( record->gap / link->speed ) );
+            if ( ns_between( &now, &due ) <= 0 )
+                break;
+            if ( timeout == 0 || ns_between( &due, &deadline ) > 0 )
+                wake = due;
+        }
+        if ( timeout != 0 && ns_between( &deadline, &now ) >= 0 ) {
+            pthread_mutex_unlock( &link->lock );
+            return LIBNXT_TIMEOUT;
+        }
+        if ( timeout == 0 && ! ready )
+            pthread_cond_wait( &link->written, &link->lock );
+        else
+            pthread_cond_timedwait( &link->written, &link->lock, &wake );
+    }
+
+    size_t length = record->length - link->readOffset;
+    if ( length > maxLength )
+        length = maxLength;
+    memcpy( buf + offset, record->data + link->readOffset, length );
+    link->readOffset += length;
+    if ( link->readOffset == record->length ) {
+        if ( link->speed > 0 )
+            add_ns( &link->lastEvent,
+                    (uint64_t) ( record->gap / link->speed ) );
+        link->readRecord++;
+        link->readOffset = 0;
+    }
+    *transferred = (int) length;
+    pthread_mutex_unlock( &link->lock );
+    return LIBNXT_SUCCESS;
+}
+
+static libnxt_error replay_write( void * state, unsigned char * buf,
+                                  size_t offset, size_t length, int timeout,
+                                  int * transferred ) {
+    replay_link * link = (replay_link *) state;
+    // Writes are compared with the capture as they come, so never wait.
+    (void) timeout;
+    pthread_mutex_lock( &link->lock );
+    size_t i;
+    for ( i = 0; i < length; i++ ) {
+        while ( link->writeRecord < link->count &&
+                ( link->records[link->writeRecord].direction != CAPTURE_SENT ||
+                  link->writeOffset ==
+                  link->records[link->writeRecord].length ) ) {
+            link->writeRecord++;
+            link->writeOffset = 0;
+        }
+        if ( link->writeRecord == link->count ||
+             link->records[link->writeRecord].data[link->writeOffset++] !=
+             buf[offset + i] )
+            link->mismatches++;
+    }
+    link->sent += length;
+    clock_gettime( CLOCK_MONOTONIC, &link->lastEvent );
+    pthread_cond_broadcast( &link->written );
+    pthread_mutex_unlock( &link->lock );
+    *transferred = (int) length;
+    return LIBNXT_SUCCESS;
+}
+
+static void replay_close( void * state ) {
+    replay_link * link = (replay_link *) state;
+    pthread_cond_destroy( &link->written );
+    pthread_mutex_destroy( &link->lock );
+    munmap( link->map, link->mapped );
+    free( link->records );
+    free( link );
+}
@@ -0,0 +1,109 @@
+/*! \file
+ * \brief Transports that record all traffic on a link to a file, and play a
+ * recording back in place of the NXT.
+ *
+ * A capture link wraps another link, and appends every transfer made through
+ * it to a log, so that a field run that goes wrong can be examined afterwards.
+ * The log is a file mapped into memory: appending a transfer is a copy, with
+ * no system call, and the mapping is written back to the file periodically,
+ * and when the link is closed.
+ *
+ * A replay link plays the part of the NXT from a log, so that the host stack
+ * can be tested and benchmarked against real traffic without a robot. The data
+ * the NXT sent is returned by reads, each transfer only once the host has
+ * written everything it wrote before that transfer in the log, and after the
+ * same delay as in the log, scaled by a speed. The data the host writes is
+ * compared with the data it wrote in the log, and any difference counted.
+ *
+ * The log starts with the 8 bytes `#CAPTURE_MAGIC`, followed by a record of
+ * each transfer, in network (big-endian) byte order:
+ *
+ * | Offset | Size   | Field                                                |
+ * |--------|--------|------------------------------------------------------|
+ * | 0      | 1      | direction, `#CAPTURE_RECEIVED` or `#CAPTURE_SENT`    |
+ * | 1      | 4      | length of the data                                   |
+ * | 5      | 8      | time of the transfer in ns since the capture started |
+ * | 13     | length | the data                                             |
+ *
+ * A direction of 0 ends the log: the log of a capture that was not closed
+ * ends with the last record completed.
+ */
+#ifndef CAPTURE_H
+#define CAPTURE_H
+#include "nxt_comm.h"
+
+/*! \def CAPTURE_MAGIC
+ * The first 8 bytes of a log: "NXTCAP", then the format version 1, then 0.
+ */
+#define CAPTURE_MAGIC "NXTCAP\1"
+
+/*! \def CAPTURE_RECEIVED
+ * Direction of data read from the NXT.
+ */
+#define CAPTURE_RECEIVED 1
+
+/*! \def CAPTURE_SENT
+ * Direction of data written to the NXT.
+ */
+#define CAPTURE_SENT 2
+
+/*! \def CAPTURE_RECORD_SIZE
+ * Size of the header of each record.
+ */
+#define CAPTURE_RECORD_SIZE 13
+
+/*! \brief Open a link that wraps another, recording its traffic to a file.
+ *
+ * Recording continues until the link is closed with `close_comm_at()`. If the
+ * file cannot be extended, recording stops, but traffic still passes.
+ * \param [in] inner The link to wrap, which is closed when the new link is
+ * closed.
+ * \param [in] path The file to record to, which is replaced.
+ * \param [out] comm Output location for the opened link. Set to NULL when the
+ * return code is non-zero, indicating an error.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_IO_ERROR} if the file could not be created; `inner` is
+ * closed
+ *
+ * \linkerror{LIBNXT_OTHER_ERROR} if memory could not be allocated; `inner` is
+ * closed.
+ * \endparblock
+ */
+libnxt_error open_capture_comm( nxt_comm * inner, const char * path,
+                                nxt_comm ** comm );
+
+/*! \brief Open a link that plays back a log in place of the NXT.
+ *
+ * Once all the data the NXT sent has been read, reads return
+ * \linkerror{LIBNXT_DISCONNECTED}.
+ * \param [in] path The log to play.
+ * \param [in] speed How many times faster than recorded to play the log, or 0
+ * to return data as soon as the host has written what it wrote before.
+ * \param [out] comm Output location for the opened link. Set to NULL when the
+ * return code is non-zero, indicating an error.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_ILLEGAL_ARG} if `speed` is negative
+ *
+ * \linkerror{LIBNXT_IO_ERROR} if the file could not be read
+ *
+ * \linkerror{LIBNXT_OTHER_ERROR} if the file is not a log, or memory could
+ * not be allocated.
+ * \endparblock
+ */
+libnxt_error open_replay_comm( const char * path, double speed,
+                               nxt_comm ** comm );
+
+/*! \brief Count the bytes written to a replay link that differ from those
+ * written in the log, including any written beyond the end of the log.
+ *
+ * \return The count, or 0 if `comm` was not opened by `open_replay_comm()`.
+ */
+size_t replay_mismatches( nxt_comm * comm );
+
+#endif
@@ -0,0 +1,306 @@
+#include "compress.h"
+#include <stdint.h>
+#include <string.h>
+
+// Longest literal run, and shortest and longest repeated run, of RLE.
+#define MAX_LITERAL 128
+#define MIN_REPEAT 3
+#define MAX_REPEAT 130
+
+/*
+ * Write a varint, or only measure it if dest is NULL.
+ * return: The number of bytes written, or 0 if they do not fit in capacity.
+ */
+static size_t put_varint( unsigned char * dest, size_t capacity,
+                          uint32_t value );
+
+/*
+ * Read a varint of up to 32 bits.
+ * return: The number of bytes read, or 0 if the data ends first or the value
+ *         is too large.
+ */
+static size_t get_varint( const unsigned char * src, size_t length,
+                          uint32_t * value );
+
+/*
+ * Compress a message with one codec, after its varint length, or only measure
+ * the compressed data if dest is NULL.
+ * return: The size of the compressed data, or 0 if the codec does not apply
+ *         or the data does not fit in capacity.
+ */
+static size_t encode_rle( const unsigned char * src, size_t length,
+                          unsigned char * dest, size_t capacity );
+static size_t encode_bitmap( const unsigned char * src, size_t length,
+                             unsigned char * dest, size_t capacity );
+static size_t encode_delta( const unsigned char * src, size_t length,
+                            unsigned char * dest, size_t capacity );
+
+/*
+ * Compress a message with the given codec, as one of the functions above.
+ */
+static size_t encode( int codec, const unsigned char * src, size_t length,
+                      unsigned char * dest, size_t capacity );
+
+/*
+ * Decompress data of one codec, following its varint length, into exactly
+ * decoded bytes.
+ * return: Non-zero if the data was consistent with its length.
+ */
+static int decode_rle( const unsigned char * src, size_t length,
+                       unsigned char * dest, size_t decoded );
+static int decode_bitmap( const unsigned char * src, size_t length,
+                          unsigned char * dest, size_t decoded );
+static int decode_delta( const unsigned char * src, size_t length,
+                         unsigned char * dest, size_t decoded );
+
+static size_t put_varint( unsigned char * dest, size_t capacity,
+                          uint32_t value ) {
+    size_t i = 0;
+    do {
+        if ( i == capacity )
+            return 0;
+        if ( dest != NULL )
+            dest[i] = (unsigned char) ( ( value & 0x7F ) |
+                                        ( value > 0x7F ? 0x80 : 0 ) );
+        value >>= 7;
+        i++;
+    } while ( value );
+    return i;
+}
+
+static size_t get_varint( const unsigned char * src, size_t length,
+                          uint32_t * value ) {
+    uint32_t result = 0;
+    size_t i;
+    for ( i = 0; i < length && i < 5; i++ ) {
+        // The fifth byte holds the top 4 bits of a 32-bit value.
+        if ( i == 4 && ( src[i] & 0x70 ) )
+            return 0;
+        result |= (uint32_t) ( src[i] & 0x7F ) << ( 7 * i );
+        if ( ! ( src[i] & 0x80 ) ) {
+            *value = result;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static size_t encode_rle( const unsigned char * src, size_t length,
+                          unsigned char * dest, size_t capacity ) {
+    size_t out = 0;
+    size_t i = 0;
+    // Start of the literal run not yet written.
+    size_t literal = 0;
+    while ( i <= length ) {
+        size_t run = 1;
+        while ( i + run < length && run < MAX_REPEAT &&
+                src[i + run] == src[i] )
+            run++;
+        // Write out the pending literals at a repeated run, at the end, or
+        // when they reach the longest literal run.
+        if ( i == length || run >= MIN_REPEAT ||
+             i - literal == MAX_LITERAL ) {
+            size_t count = i - literal;
+            if ( count > 0 ) {
+                if ( out + 1 + count > capacity )
+                    return 0;
+                if ( dest != NULL ) {
+                    dest[out] = (unsigned char) ( count - 1 );
+                    memcpy( dest + out + 1, src + literal, count );
+                }
+                out += 1 + count;
+            }
+            literal = i;
+        }
+        if ( i == length )
+            break;
+        if ( run >= MIN_REPEAT ) {
+            if ( out + 2 > capacity )
+                return 0;
+            if ( dest != NULL ) {
+                dest[out] = (unsigned char) ( run + 125 );
+                dest[out + 1] = src[i];
+            }
+            out += 2;
+            i += run;
+            literal = i;
+        } else {
+            i++;
+        }
+    }
+    return out;
+}
+
+static size_t encode_bitmap( const unsigned char * src, size_t length,
+                             unsigned char * dest, size_t capacity ) {
+    size_t out = ( length + 7 ) / 8;
+    if ( out > capacity )
+        return 0;
+    if ( dest != NULL )
+        memset( dest, 0, out );
+    size_t i;
+    for ( i = 0; i < length; i++ ) {
+        if ( src[i] > 1 )
+            return 0;
+        if ( dest != NULL )
+            dest[i / 8] |= (unsigned char) ( src[i] << ( 7 - i % 8 ) );
+    }
+    return out;
+}
+
+static size_t encode_delta( const unsigned char * src, size_t length,
+                            unsigned char * dest, size_t capacity ) {
+    if ( length % 4 )
+        return 0;
+    size_t out = 0;
+    // The last x and y coordinates.
+    uint32_t previous[2] = { 0, 0 };
+    size_t i;
+    for ( i = 0; i < length; i += 4 ) {
+        uint32_t value = (uint32_t) src[i] << 24 |
+                         (uint32_t) src[i + 1] << 16 |
+                         (uint32_t) src[i + 2] << 8 | src[i + 3];
+        int32_t delta = (int32_t) ( value - previous[i / 4 % 2] );
+        uint32_t zigzag = (uint32_t) delta << 1 ^ (uint32_t) ( delta >> 31 );
+        size_t written = put_varint( ( dest != NULL ? dest + out : NULL ),
+                                     capacity - out, zigzag );
+        if ( written == 0 )
+            return 0;
+        out += written;
+        previous[i / 4 % 2] = value;
+    }
+    return out;
+}
+
+static size_t encode( int codec, const unsigned char * src, size_t length,
+                      unsigned char * dest, size_t capacity ) {
+    switch ( codec ) {
+        case COMPRESS_RLE:
+            return encode_rle( src, length, dest, capacity );
+        case COMPRESS_BITMAP:
+            return encode_bitmap( src, length, dest, capacity );
+        case COMPRESS_DELTA:
+            return encode_delta( src, length, dest, capacity );
+        default:
+            return 0;
+    }
+}
+
+static int decode_rle( const unsigned char * src, size_t length,
+                       unsigned char * dest, size_t decoded ) {
+    size_t in = 0;
+    size_t out = 0;
+    while ( in < length ) {
+        unsigned char control = src[in++];
+        if ( control < MAX_LITERAL ) {
+            size_t count = (size_t) control + 1;
+            if ( in + count > length || out + count > decoded )
+                return 0;
+            memcpy( dest + out, src + in, count );
+            in += count;
+            out += count;
+        } else {
+            size_t count = (size_t) control - 125;
+            if ( in == length || out + count > decoded )
+                return 0;
+            memset( dest + out, src[in++], count );
+            out += count;
+        }
+    }
+    return out == decoded;
+}
+
+static int decode_bitmap( const unsigned char * src, size_t length,
+                          unsigned char * dest, size_t decoded ) {
+    if ( length != ( decoded + 7 ) / 8 )
+        return 0;
+    size_t i;
+    for ( i = 0; i < decoded; i++ )
+        dest[i] = src[i / 8] >> ( 7 - i % 8 ) & 1;
+    return 1;
+}
+
+static int decode_delta( const unsigned char * src, size_t length,
+                         unsigned char * dest, size_t decoded ) {
+    if ( decoded % 4 )
+        return 0;
+    size_t in = 0;
+    uint32_t previous[2] = { 0, 0 };
+    size_t out;
+    for ( out = 0; out < decoded; out += 4 ) {
+        uint32_t zigzag;
+        size_t read = get_varint( src + in, length - in, &zigzag );
+        if ( read == 0 )
+            return 0;
+        in += read;
+        uint32_t value = previous[out / 4 % 2] +
+                         ( ( zigzag >> 1 ) ^ ( 0U - ( zigzag & 1 ) ) );
+        previous[out / 4 % 2] = value;
+        dest[out] = (unsigned char) ( value >> 24 );
+        dest[out + 1] = (unsigned char) ( value >> 16 );
+        dest[out + 2] = (unsigned char) ( value >> 8 );
+        dest[out + 3] = (unsigned char) value;
+    }
+    return in == length;
+}
+
+size_t compress_message( unsigned int codecs, const unsigned char * src,
+                         size_t length, unsigned char * dest, size_t capacity,
+                         int * codec ) {
+    *codec = COMPRESS_NONE;
+    if ( length > UINT32_MAX )
+        return 0;
+    size_t header = put_varint( dest, capacity, (uint32_t) length );
+    if ( header == 0 )
+        return 0;
+
+    // Each codec is measured in turn, and only beats the best so far by
+    // fitting in less; the best is then written.
+    size_t best = 0;
+    int candidate;
+    for ( candidate = COMPRESS_RLE; candidate <= COMPRESS_DELTA;
+          candidate++ ) {
+        if ( ! ( codecs & 1U << candidate ) )
+            continue;
+        size_t size = encode( candidate, src, length, NULL,
+                              ( best ? best - 1 : capacity - header ) );
+        if ( size > 0 ) {
+            best = size;
+            *codec = candidate;
+        }
+    }
+    if ( best == 0 )
+        return 0;
+    encode( *codec, src, length, dest + header, best );
+    return header + best;
+}
+
+libnxt_error decompress_message( int codec, const unsigned char * src,
+                                 size_t length, unsigned char * dest,
+                                 size_t capacity, size_t * decoded ) {
+    uint32_t size;
+    size_t header = get_varint( src, length, &size );
+    if ( header == 0 )
+        return LIBNXT_OTHER_ERROR;
+    if ( size > capacity )
+        return LIBNXT_ILLEGAL_ARG;
+    int valid;
+    switch ( codec ) {
+        case COMPRESS_RLE:
+            valid = decode_rle( src + header, length - header, dest, size );
+            break;
+        case COMPRESS_BITMAP:
+            valid = decode_bitmap( src + header, length - header, dest, size );
+            break;
+        case COMPRESS_DELTA:
+            valid = decode_delta( src + header, length - header, dest, size );
+            break;
+        default:
+            valid = 0;
+            break;
+    }
+    if ( ! valid )
+        return LIBNXT_OTHER_ERROR;
+    *decoded = size;
+    return LIBNXT_SUCCESS;
+}
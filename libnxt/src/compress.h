@@ -0,0 +1,97 @@
+/*! \file
+ * \brief Small codecs for compressing messages to the NXT, simple enough to be
+ * decoded on the NXT without allocating.
+ *
+ * A message longer than one USB packet takes several packets to send, so maps
+ * and long lists of waypoints are slow to send as they are. Each codec suits
+ * one kind of data:
+ *
+ * - `#COMPRESS_RLE` codes runs of repeated bytes, such as the free and unknown
+ *   regions of an occupancy grid.
+ * - `#COMPRESS_BITMAP` packs messages of bytes that are all 0 or 1, such as
+ *   grids of blocked cells, 8 to a byte.
+ * - `#COMPRESS_DELTA` codes a message of 32-bit big-endian coordinates, such
+ *   as a list of waypoints, as the differences between successive points in
+ *   variable-length form, so nearby points take a byte or two per coordinate.
+ *
+ * Compressed data starts with the length of the message decoded, as an
+ * unsigned LEB128 varint: 7 bits per byte, least significant first, with the
+ * top bit set on every byte but the last.
+ */
+#ifndef COMPRESS_H
+#define COMPRESS_H
+#include "error_codes.h"
+#include <stddef.h>
+
+/*! \def COMPRESS_NONE
+ * The message is sent as it is.
+ */
+#define COMPRESS_NONE 0
+
+/*! \def COMPRESS_RLE
+ * The message is coded in runs. Each run starts with a control byte c: if c
+ * is below 128, c + 1 bytes follow to be copied; otherwise one byte follows,
+ * to be repeated c - 125 times.
+ */
+#define COMPRESS_RLE 1
+
+/*! \def COMPRESS_BITMAP
+ * Every byte of the message is 0 or 1, and they are packed 8 to a byte, the
+ * first in the most significant bit.
+ */
+#define COMPRESS_BITMAP 2
+
+/*! \def COMPRESS_DELTA
+ * The message is a sequence of 32-bit big-endian integers, taken as pairs of
+ * x and y coordinates. Each is coded as a varint of its difference from the
+ * same coordinate of the pair before, or from 0 for the first pair, zigzag
+ * coded so that small negative differences are small too: the difference d is
+ * coded as 2d if it is not negative, and as -2d - 1 otherwise.
+ */
+#define COMPRESS_DELTA 3
+
+/*! \def COMPRESS_CODECS
+ * The set of every codec, with bit i set for the codec numbered i.
+ */
+#define COMPRESS_CODECS \
+    ( 1 << COMPRESS_RLE | 1 << COMPRESS_BITMAP | 1 << COMPRESS_DELTA )
+
+/*! \brief Compress a message with whichever allowed codec makes it smallest.
+ *
+ * \param [in] codecs The set of codecs that may be used.
+ * \param [in] src The message.
+ * \param [in] length Size of the message in bytes.
+ * \param [out] dest Output location for the compressed data.
+ * \param [in] capacity Size of `dest` in bytes; data any larger is no use.
+ * \param [out] codec Output location for the codec used.
+ * \return The size of the compressed data, or 0 if no codec could make it fit
+ * in `capacity`.
+ */
+size_t compress_message( unsigned int codecs, const unsigned char * src,
+                         size_t length, unsigned char * dest, size_t capacity,
+                         int * codec );
+
+/*! \brief Decompress a message.
+ *
+ * \param [in] codec The codec used to compress it, other than
+ * `#COMPRESS_NONE`.
+ * \param [in] src The compressed data.
+ * \param [in] length Size of the compressed data in bytes.
+ * \param [out] dest Output location for the message.
+ * \param [in] capacity Size of `dest` in bytes.
+ * \param [out] decoded Output location for the size of the message.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_ILLEGAL_ARG} if the message does not fit in `capacity`
+ *
+ * \linkerror{LIBNXT_OTHER_ERROR} if the codec is unknown, or the data is
+ * corrupt.
+ * \endparblock
+ */
+libnxt_error decompress_message( int codec, const unsigned char * src,
+                                 size_t length, unsigned char * dest,
+                                 size_t capacity, size_t * decoded );
+
+#endif
@@ -1,35 +1,177 @@
+#include "allocate.h"
 #include "messaging.h"
+#include "route_check.h"
+#include "stats.h"
+#include "telemetry.h"
 #include <stdio.h>
+#include <string.h>
+
+/*
+ * The grid Controller.java plans on.
+ */
+#define GRID_SIZE 3
+#define GRID_SQUARE_SIDE 34.0f
+
+/*
+ * Send a job to the robot over the messaging connection.
+ * in: context - The route_checker, if the robot is to sense continuously,
+ * or NULL.
+ */
+static int send_job( void * context, uint32_t robot, unsigned char * message,
+		uint16_t length );
+
+/*
+ * Print a report received from the robot and, if it is a range reading, tell
+ * the robot to stop if the node it is driving to is blocked.
+ * in: data - The report.
+ * in: length - Size of the report in bytes.
+ * in: checker - Checks the robot's range readings.
+ */
+static void handle_report( const unsigned char * data, uint16_t length,
+		route_checker * checker );
+
+/*
+ * Print a decoded report.
+ */
+static void print_report( const telemetry_message * report );
+
+static void handle_report( const unsigned char * data, uint16_t length,
+		route_checker * checker ) {
+	telemetry_message report;
+	libnxt_error error = decode_telemetry( data, length, &report );
+	if ( error ) {
+		printf( "Bad report: %s\n", libnxt_error_message( error ) );
+		return;
+	}
+	print_report( &report );
+	if ( report.type != TELEMETRY_RANGE )
+		return;
+
+	occupancy_reading reading;
+	reading.x = report.range.x;
+	reading.y = report.range.y;
+	reading.heading = report.range.heading;
+	reading.range = report.range.range;
+	grid_node next = ( report.range.next == TELEMETRY_NO_NODE ? GRID_NO_NODE :
+			report.range.next );
+	if ( route_check_reading( checker, &reading, next ) == PLAN_SUCCESS ) {
+		unsigned char message[ROUTE_MESSAGE_SIZE];
+		uint16_t stopLength = route_check_stop_message( next, message );
+		printf( "Node %u is blocked\n", (unsigned) next );
+		error = send( message, stopLength );
+		if ( error )
+			printf( "Error sending stop: %s\n",
+					libnxt_error_message( error ) );
+	}
+}
+
+static void print_report( const telemetry_message * report ) {
+	const telemetry_message message = *report;
+	printf( "[%u ms] ", (unsigned) message.time );
+	switch ( message.type ) {
+		case TELEMETRY_POSE:
+			printf( "robot at ( %.0f, %.0f ) heading %.0f, waypoint %u\n",
+					message.pose.x, message.pose.y, message.pose.heading,
+					(unsigned) message.pose.waypoint );
+			break;
+		case TELEMETRY_OBSTACLE:
+			printf( "Feature at ( %.0f, %.0f ), range %.1f\n",
+					message.obstacle.x, message.obstacle.y,
+					message.obstacle.range );
+			break;
+		case TELEMETRY_PROGRESS:
+			printf( "plan stage %d, %u waypoints\n",
+					(int) message.progress.stage,
+					(unsigned) message.progress.waypoints );
+			break;
+		case TELEMETRY_ERROR:
+			printf( "robot fault %d\n", (int) message.error.fault );
+			break;
+		case TELEMETRY_RANGE:
+			printf( "echo at range %.1f from ( %.0f, %.0f ) heading %.0f\n",
+					message.range.range, message.range.x, message.range.y,
+					message.range.heading );
+			break;
+	}
+}
+
+static int send_job( void * context, uint32_t robot, unsigned char * message,
+		uint16_t length ) {
+	unsigned char job[ROUTE_MESSAGE_SIZE];
+	(void) robot;
+	if ( context != NULL && length == 2 ) {
+		route_check_job_message( message[0], message[1], job );
+		message = job;
+		length = ROUTE_MESSAGE_SIZE;
+	}
+	libnxt_error error = send( message, length );
+	if ( error )
+		printf( "Error sending job: %s\n", libnxt_error_message( error ) );
+	return error;
+}
 
 int main( int argc, char ** argv ) {
 
+	// With -c, the robot senses while it drives, and the readings it sends
+	// are checked here.
+	int continuous = ( argc > 1 && strcmp( argv[1], "-c" ) == 0 );
+	if ( continuous ) {
+		argv++;
+		argc--;
+	}
+
+	// The nodes to repair are given as arguments, or else the far corner.
+	grid_map map;
+	repair_allocator allocator;
+	route_checker checker;
+	if ( square_grid_map( &map, GRID_SIZE, GRID_SQUARE_SIDE ) ||
+			init_allocator( &allocator, &map, 1, argc > 1 ? argc - 1 : 1 ) ||
+			init_route_checker( &checker, &map, 4, 0.8f ) ) {
+		printf( "Error allocating the plan\n" );
+		return 1;
+	}
+	int i;
+	for ( i = 1; i < argc || i == 1; i++ ) {
+		grid_node node = ( argc > 1 ? (grid_node) atoi( argv[i] ) :
+				grid_node_count( &map ) - 1 );
+		repair_site site;
+		if ( allocator_add_site( &allocator, node, &site ) ) {
+			printf( "No node %s to repair\n", argv[i] );
+			return 1;
+		}
+	}
+	if ( allocator_assign( &allocator ) == PLAN_NO_PATH )
+		printf( "Some nodes cannot be reached\n" );
+
 	libnxt_error error = init_messaging();
 	if ( error ) {
 		printf( "Error initialising: %s\n", libnxt_error_message( error ) );
 		return 1;
 	}
 
-	unsigned char endPoints[2] = {0, 8};
-	error = send( endPoints, sizeof ( endPoints ) );
+	// The robot takes the first job only.
+	allocator_dispatch( &allocator, send_job, continuous ? &checker : NULL );
 
-	unsigned char * report = NULL;
-	uint16_t reportLength = 0;
+	message_view report;
+	report.length = 0;
 
-	size_t i;
 	do {
-		error = receive( &report, &reportLength );
+		error = receive_view( NULL, 0, &report );
 		if ( error ) {
 			printf( "Error receiving: %s\n", libnxt_error_message( error ) );
-		} else {
-			for ( i = 0; i < reportLength; i++ ) {
-				printf( "%c", report[i] );
-			}
-			printf( "\n" );
-			free_message( report );
-			report = NULL;
+		} else if ( report.length > 0 ) {
+			handle_report( report.data, report.length, &checker );
+			release_view();
 		}
-	} while( ( ! error ) && reportLength > 0 );
+	} while( ( ! error ) && report.length > 0 );
 
 	exit_messaging();
+	free_route_checker( &checker );
+	free_allocator( &allocator );
+	free_grid_map( &map );
+
+	libnxt_stats stats;
+	libnxt_get_stats( &stats );
+	print_stats( &stats, stdout );
 	return ( error ? 1 : 0 );
 }
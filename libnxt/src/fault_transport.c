@@ -0,0 +1,217 @@
+#include "fault_transport.h"
+#include <string.h>
+
+// Size of the longest packet: a header and 65535 bytes.
+#define MAX_PACKET ( 2 + 0xffff )
+
+// State of a link that injects faults.
+typedef struct fault_link {
+    nxt_comm * inner;
+    // State of the xorshift generator choosing faults; never 0.
+    uint32_t random;
+    // Boolean flag: faults are enabled, so writes are split into packets.
+    int enabled;
+    fault_options options;
+    // The packet being assembled from writes.
+    unsigned char * packet;
+    size_t filled;
+    // A packet held back for reordering, if heldLength is non-zero.
+    unsigned char * held;
+    size_t heldLength;
+} fault_link;
+
+/*
+ * Operations of the fault transport; state is a fault_link.
+ */
+static libnxt_error fault_read( void * state, unsigned char * buf,
+                                size_t offset, size_t maxLength, int timeout,
+                                int * transferred );
+static libnxt_error fault_write( void * state, unsigned char * buf,
+                                 size_t offset, size_t length, int timeout,
+                                 int * transferred );
+static libnxt_error fault_set_async( void * state, size_t depth );
+static void fault_close( void * state );
+static libnxt_error fault_reopen( void * state, int timeout );
+
+static const nxt_transport FAULT_TRANSPORT = {
+    fault_read, fault_write, fault_set_async, fault_close, fault_reopen
+};
+
+/*
+ * Draw a random number in [0, 1).
+ */
+static double chance( fault_link * link );
+
+/*
+ * Write all of a buffer to the wrapped link.
+ */
+static libnxt_error write_all( fault_link * link, unsigned char * data,
+                               size_t length, int timeout );
+
+/*
+ * Send the packet just assembled, subject to faults.
+ */
+static libnxt_error deliver_packet( fault_link * link, int timeout );
+
+/*
+ * Send the packet held back, if there is one.
+ */
+static libnxt_error release_held( fault_link * link, int timeout );
+
+static double chance( fault_link * link ) {
+    uint32_t x = link->random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    link->random = x;
+    return ( x >> 8 ) / 16777216.0;
+}
+
+static libnxt_error write_all( fault_link * link, unsigned char * data,
+                               size_t length, int timeout ) {
+    libnxt_error errorCode;
+    size_t total = 0;
+    int written;
+    while ( total < length ) {
+        written = 0;
+        errorCode = comm_write( link->inner, data, total, length - total,
+                                timeout, &written );
+        if ( errorCode && errorCode != LIBNXT_TIMEOUT )
+            return errorCode;
+        if ( written == 0 )
+            return LIBNXT_TIMEOUT;
+        total += written;
+    }
+    return LIBNXT_SUCCESS;
+}
+
+static libnxt_error release_held( fault_link * link, int timeout ) {
+    if ( link->heldLength == 0 )
+        return LIBNXT_SUCCESS;
+    size_t length = link->heldLength;
+    link->heldLength = 0;
+    return write_all( link, link->held, length, timeout );
+}
+
+static libnxt_error deliver_packet( fault_link * link, int timeout ) {
+    size_t length = link->filled;
+    link->filled = 0;
+    libnxt_error errorCode;
+    // EOF is never faulted, so the connection can always close.
+    if ( length == 2 ) {
+        errorCode = release_held( link, timeout );
+        if ( ! errorCode )
+            errorCode = write_all( link, link->packet, length, timeout );
+        return errorCode;
+    }
+
+    if ( chance( link ) < link->options.drop )
+        return LIBNXT_SUCCESS;
+    if ( link->heldLength == 0 && chance( link ) < link->options.reorder ) {
+        memcpy( link->held, link->packet, length );
+        link->heldLength = length;
+        return LIBNXT_SUCCESS;
+    }
+
+    errorCode = write_all( link, link->packet, length, timeout );
+    if ( ! errorCode && chance( link ) < link->options.duplicate )
+        errorCode = write_all( link, link->packet, length, timeout );
+    if ( ! errorCode )
+        errorCode = release_held( link, timeout );
+    return errorCode;
+}
+
+libnxt_error open_fault_comm( nxt_comm * inner, uint32_t seed,
+                              nxt_comm ** comm ) {
+    *comm = NULL;
+    fault_link * link = (fault_link *) calloc( 1, sizeof ( fault_link ) );
+    if ( link != NULL ) {
+        link->packet = (unsigned char *) malloc( MAX_PACKET );
+        link->held = (unsigned char *) malloc( MAX_PACKET );
+    }
+    if ( link == NULL || link->packet == NULL || link->held == NULL ) {
+        if ( link != NULL ) {
+            free( link->packet );
+            free( link->held );
+            free( link );
+        }
+        close_comm_at( inner );
+        return LIBNXT_OTHER_ERROR;
+    }
+    link->inner = inner;
+    link->random = ( seed != 0 ? seed : 1 );
+    return open_comm_with( &FAULT_TRANSPORT, link, comm );
+}
+
+libnxt_error set_comm_faults( nxt_comm * comm, const fault_options * options ) {
+    fault_link * link = (fault_link *) comm_state( comm, &FAULT_TRANSPORT );
+    if ( link == NULL )
+        return LIBNXT_ILLEGAL_ARG;
+
+    link->filled = 0;
+    if ( options == NULL ) {
+        link->enabled = 0;
+        return release_held( link, 0 );
+    }
+    link->options = *options;
+    link->enabled = 1;
+    return LIBNXT_SUCCESS;
+}
+
+static libnxt_error fault_read( void * state, unsigned char * buf,
+                                size_t offset, size_t maxLength, int timeout,
+                                int * transferred ) {
+    fault_link * link = (fault_link *) state;
+    return comm_read( link->inner, buf, offset, maxLength, timeout,
+                      transferred );
+}
+
+static libnxt_error fault_write( void * state, unsigned char * buf,
+                                 size_t offset, size_t length, int timeout,
+                                 int * transferred ) {
+    fault_link * link = (fault_link *) state;
+    if ( ! link->enabled )
+        return comm_write( link->inner, buf, offset, length, timeout,
+                           transferred );
+
+    libnxt_error errorCode = LIBNXT_SUCCESS;
+    size_t total = 0;
+    while ( ! errorCode && total < length ) {
+        // Collect the header, then the rest of the packet it announces.
+        size_t needed = 2;
+        if ( link->filled >= 2 )
+            needed += link->packet[0] | ( link->packet[1] << 8 );
+        size_t span = needed - link->filled;
+        if ( span > length - total )
+            span = length - total;
+        memcpy( link->packet + link->filled, buf + offset + total, span );
+        link->filled += span;
+        total += span;
+        if ( link->filled >= 2 && link->filled ==
+             2 + (size_t) ( link->packet[0] | ( link->packet[1] << 8 ) ) )
+            errorCode = deliver_packet( link, timeout );
+    }
+    *transferred = total;
+    return errorCode;
+}
+
+static libnxt_error fault_set_async( void * state, size_t depth ) {
+    fault_link * link = (fault_link *) state;
+    return comm_set_async( link->inner, depth );
+}
+
+static libnxt_error fault_reopen( void * state, int timeout ) {
+    fault_link * link = (fault_link *) state;
+    // Packets of the old connection are never delivered.
+    link->filled = 0;
+    link->heldLength = 0;
+    return comm_reopen( link->inner, timeout );
+}
+
+static void fault_close( void * state ) {
+    fault_link * link = (fault_link *) state;
+    close_comm_at( link->inner );
+    free( link->packet );
+    free( link->held );
+    free( link );
+}
@@ -0,0 +1,66 @@
+/*! \file
+ * \brief A transport that wraps another link and injects faults into the
+ * packets written to it.
+ *
+ * Packets can be dropped, sent twice, or held back and sent after the packet
+ * that follows them, at random with given probabilities, to exercise the
+ * reliable channels of `reliable.h` the way a lossy, reordering link would.
+ * Faults are off until enabled with `set_comm_faults()`, so that the handshake
+ * into packet mode, which is not made of packets, passes untouched. Reads pass
+ * straight through to the wrapped link.
+ */
+#ifndef FAULT_TRANSPORT_H
+#define FAULT_TRANSPORT_H
+#include "nxt_comm.h"
+#include <stdint.h>
+
+/*! \brief Probabilities of each fault, applied to each packet written.
+ *
+ * _EOF_ packets are never faulted.
+ */
+typedef struct fault_options {
+    double drop; /*!< Probability that a packet is lost. */
+    double duplicate; /*!< Probability that a packet is sent twice. */
+    double reorder; /*!< Probability that a packet is held back and sent after
+                     * the next packet. */
+} fault_options;
+
+/*! \brief Open a link that wraps another, with faults disabled.
+ *
+ * \param [in] inner The link to wrap, which is closed when the new link is
+ * closed with `close_comm_at()`.
+ * \param [in] seed Seeds the choice of faults, so that a run can be repeated.
+ * \param [out] comm Output location for the opened link. Set to NULL when the
+ * return code is non-zero, indicating an error.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_OTHER_ERROR} if memory could not be allocated; `inner` is
+ * closed.
+ * \endparblock
+ */
+libnxt_error open_fault_comm( nxt_comm * inner, uint32_t seed,
+                              nxt_comm ** comm );
+
+/*! \brief Enable or disable faults on a link opened by `open_fault_comm()`.
+ *
+ * Must be called between packets, and not while another thread writes to the
+ * link: the next byte written is taken to start a packet header.
+ * \param [in] comm
+ * \param [in] options The probabilities of each fault, or NULL to disable
+ * faults. A packet held back for reordering is sent before faults are
+ * disabled.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_ILLEGAL_ARG} if `comm` was not opened by
+ * `open_fault_comm()`
+ *
+ * Any error returned by `comm_write()` while sending a held packet.
+ * \endparblock
+ */
+libnxt_error set_comm_faults( nxt_comm * comm, const fault_options * options );
+
+#endif
@@ -0,0 +1,160 @@
+#include "fd_transport.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// State of a link over a file descriptor.
+typedef struct fd_link {
+    int fd;
+    // Boolean flag: reads with a timeout do not wait.
+    int async;
+} fd_link;
+
+/*
+ * Operations of the file descriptor transport; state is an fd_link.
+ */
+static libnxt_error fd_read( void * state, unsigned char * buf, size_t offset,
+                             size_t maxLength, int timeout, int * transferred );
+static libnxt_error fd_write( void * state, unsigned char * buf,
+                              size_t offset, size_t length, int timeout,
+                              int * transferred );
+static libnxt_error fd_set_async( void * state, size_t depth );
+static void fd_close( void * state );
+
+static const nxt_transport FD_TRANSPORT = {
+    fd_read, fd_write, fd_set_async, fd_close, NULL
+};
+
+/*
+ * Wait for a file descriptor to become ready.
+ * in: events - The poll() events to wait for.
+ * in: wait - The longest time to wait in ms, or -1 to wait forever.
+ * return: LIBNXT_SUCCESS, or
+ *         LIBNXT_TIMEOUT, or
+ *         LIBNXT_DISCONNECTED if the other end hung up, or
+ *         LIBNXT_IO_ERROR.
+ */
+static libnxt_error wait_fd( int fd, short events, int wait );
+
+static libnxt_error wait_fd( int fd, short events, int wait ) {
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = events;
+    int ready;
+    do {
+        pfd.revents = 0;
+        ready = poll( &pfd, 1, wait );
+    } while ( ready < 0 && errno == EINTR );
+
+    if ( ready < 0 || ( pfd.revents & ( POLLERR | POLLNVAL ) ) )
+        return LIBNXT_IO_ERROR;
+    if ( ready == 0 )
+        return LIBNXT_TIMEOUT;
+    if ( ! ( pfd.revents & events ) && ( pfd.revents & POLLHUP ) )
+        return LIBNXT_DISCONNECTED;
+    return LIBNXT_SUCCESS;
+}
+
+libnxt_error open_fd_comm( int fd, nxt_comm ** comm ) {
+    *comm = NULL;
+    if ( fd < 0 )
+        return LIBNXT_ILLEGAL_ARG;
+
+    fd_link * link = (fd_link *) calloc( 1, sizeof ( fd_link ) );
+    if ( link == NULL )
+        return LIBNXT_OTHER_ERROR;
+    link->fd = fd;
+    return open_comm_with( &FD_TRANSPORT, link, comm );
+}
+
+libnxt_error open_socket_comm( const char * path, nxt_comm ** comm ) {
+    *comm = NULL;
+    struct sockaddr_un addr;
+    memset( &addr, 0, sizeof ( addr ) );
+    addr.sun_family = AF_UNIX;
+    if ( strlen( path ) >= sizeof ( addr.sun_path ) )
+        return LIBNXT_ILLEGAL_ARG;
+    strcpy( addr.sun_path, path );
+
+    int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if ( fd < 0 )
+        return LIBNXT_IO_ERROR;
+    if ( connect( fd, (struct sockaddr *) &addr, sizeof ( addr ) ) ) {
+        close( fd );
+        return LIBNXT_NOT_VISIBLE;
+    }
+    return open_fd_comm( fd, comm );
+}
+
+static libnxt_error fd_read( void * state, unsigned char * buf, size_t offset,
+                             size_t maxLength, int timeout,
+                             int * transferred ) {
+    fd_link * link = (fd_link *) state;
+    *transferred = 0;
+
+    int wait = -1;
+    if ( timeout )
+        wait = ( link->async ? 0 : timeout );
+    libnxt_error errorCode = wait_fd( link->fd, POLLIN, wait );
+    if ( errorCode )
+        return errorCode;
+
+    ssize_t count;
+    do {
+        count = read( link->fd, buf + offset, maxLength );
+    } while ( count < 0 && errno == EINTR );
+
+    if ( count < 0 )
+        return ( errno == EAGAIN ? LIBNXT_TIMEOUT : LIBNXT_IO_ERROR );
+    if ( count == 0 )
+        return LIBNXT_DISCONNECTED;
+    *transferred = count;
+    return LIBNXT_SUCCESS;
+}
+
+static libnxt_error fd_write( void * state, unsigned char * buf,
+                              size_t offset, size_t length, int timeout,
+                              int * transferred ) {
+    fd_link * link = (fd_link *) state;
+    libnxt_error errorCode = LIBNXT_SUCCESS;
+    size_t total = 0;
+    ssize_t count;
+    while ( total < length && ! errorCode ) {
+        errorCode = wait_fd( link->fd, POLLOUT, ( timeout ? timeout : -1 ) );
+        if ( errorCode )
+            break;
+        // sendto(), because send() is taken by messaging.h.
+        count = sendto( link->fd, buf + offset + total, length - total,
+                        MSG_NOSIGNAL, NULL, 0 );
+        if ( count < 0 && errno == ENOTSOCK )
+            count = write( link->fd, buf + offset + total, length - total );
+        if ( count < 0 ) {
+            if ( errno == EPIPE || errno == ECONNRESET )
+                errorCode = LIBNXT_DISCONNECTED;
+            else if ( errno != EINTR && errno != EAGAIN )
+                errorCode = LIBNXT_IO_ERROR;
+        } else {
+            total += count;
+        }
+    }
+
+    *transferred = total;
+    return errorCode;
+}
+
+static libnxt_error fd_set_async( void * state, size_t depth ) {
+    fd_link * link = (fd_link *) state;
+    int async = depth > 0;
+    if ( link->async == async )
+        return LIBNXT_NO_EFFECT;
+    link->async = async;
+    return LIBNXT_SUCCESS;
+}
+
+static void fd_close( void * state ) {
+    fd_link * link = (fd_link *) state;
+    close( link->fd );
+    free( link );
+}
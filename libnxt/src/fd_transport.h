@@ -0,0 +1,52 @@
+/*! \file
+ * \brief A transport for links over a file descriptor, such as one end of a
+ * Unix socketpair, a Unix domain socket or a pty.
+ *
+ * Allows the messaging layer to talk to an NXT simulator running in another
+ * process on the same machine, so that the host stack can be load-tested on a
+ * plain Linux box without a physical NXT.
+ */
+#ifndef FD_TRANSPORT_H
+#define FD_TRANSPORT_H
+#include "nxt_comm.h"
+
+/*! \brief Open a link over a file descriptor.
+ *
+ * The descriptor must be readable and writable, and is closed when the link is
+ * closed with `close_comm_at()`. End of file, or a hang-up, on the descriptor
+ * is reported as \linkerror{LIBNXT_DISCONNECTED}.
+ * \param [in] fd The file descriptor.
+ * \param [out] comm Output location for the opened link. Set to NULL when the
+ * return code is non-zero, indicating an error.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_ILLEGAL_ARG} if `fd` is negative
+ *
+ * \linkerror{LIBNXT_OTHER_ERROR} if memory could not be allocated.
+ * \endparblock
+ */
+libnxt_error open_fd_comm( int fd, nxt_comm ** comm );
+
+/*! \brief Open a link by connecting to a Unix domain stream socket.
+ *
+ * \param [in] path The path to which the socket is bound.
+ * \param [out] comm Output location for the opened link. Set to NULL when the
+ * return code is non-zero, indicating an error.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_ILLEGAL_ARG} if `path` is too long for a socket address
+ *
+ * \linkerror{LIBNXT_NOT_VISIBLE} if nothing is listening on the socket
+ *
+ * \linkerror{LIBNXT_IO_ERROR} if the socket could not be created
+ *
+ * \linkerror{LIBNXT_OTHER_ERROR} if memory could not be allocated.
+ * \endparblock
+ */
+libnxt_error open_socket_comm( const char * path, nxt_comm ** comm );
+
+#endif
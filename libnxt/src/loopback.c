@@ -0,0 +1,244 @@
+#include "loopback.h"
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+// Bytes in transit in one direction, held in a circular buffer.
+typedef struct loop_pipe {
+    unsigned char * data;
+    size_t capacity;
+    // Index of the oldest byte in data.
+    size_t head;
+    // Number of bytes in data.
+    size_t count;
+} loop_pipe;
+
+// State shared by both ends of a pair.
+typedef struct loop_shared {
+    pthread_mutex_t lock;
+    // Signalled whenever data is read or written, or an end is closed.
+    pthread_cond_t changed;
+    loop_pipe pipes[2];
+    // Number of ends still open.
+    int open;
+} loop_shared;
+
+// State of one end of a pair.
+typedef struct loop_end {
+    loop_shared * shared;
+    // The pipe this end reads from; it writes to the other.
+    loop_pipe * in;
+    loop_pipe * out;
+    // Boolean flag: reads with a timeout do not wait.
+    int async;
+} loop_end;
+
+/*
+ * Operations of the loopback transport; state is a loop_end.
+ */
+static libnxt_error loop_read( void * state, unsigned char * buf,
+                               size_t offset, size_t maxLength, int timeout,
+                               int * transferred );
+static libnxt_error loop_write( void * state, unsigned char * buf,
+                                size_t offset, size_t length, int timeout,
+                                int * transferred );
+static libnxt_error loop_set_async( void * state, size_t depth );
+static void loop_close( void * state );
+
+static const nxt_transport LOOPBACK_TRANSPORT = {
+    loop_read, loop_write, loop_set_async, loop_close, NULL
+};
+
+/*
+ * Wait for the state of a pair to change.
+ * in: deadline - Absolute time after which to stop waiting, or NULL to wait
+ *                forever.
+ * return: A non-zero integer if the deadline passed, otherwise 0.
+ */
+static int wait_change( loop_shared * shared,
+                        const struct timespec * deadline );
+
+/*
+ * Compute the absolute time the given number of ms from now.
+ */
+static void timeout_deadline( struct timespec * deadline, int timeout );
+
+static int wait_change( loop_shared * shared,
+                        const struct timespec * deadline ) {
+    if ( deadline == NULL ) {
+        pthread_cond_wait( &shared->changed, &shared->lock );
+        return 0;
+    }
+    return pthread_cond_timedwait( &shared->changed, &shared->lock,
+                                   deadline ) == ETIMEDOUT;
+}
+
+static void timeout_deadline( struct timespec * deadline, int timeout ) {
+    clock_gettime( CLOCK_REALTIME, deadline );
+    deadline->tv_sec += timeout / 1000;
+    deadline->tv_nsec += ( timeout % 1000 ) * 1000000L;
+    if ( deadline->tv_nsec >= 1000000000L ) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+libnxt_error open_loopback_pair( size_t capacity, nxt_comm ** host,
+                                 nxt_comm ** device ) {
+    *host = NULL;
+    *device = NULL;
+    if ( capacity == 0 )
+        return LIBNXT_ILLEGAL_ARG;
+
+    loop_shared * shared = (loop_shared *) calloc( 1, sizeof ( loop_shared ) );
+    loop_end * ends[2];
+    ends[0] = (loop_end *) calloc( 1, sizeof ( loop_end ) );
+    ends[1] = (loop_end *) calloc( 1, sizeof ( loop_end ) );
+    if ( shared != NULL ) {
+        shared->pipes[0].data = (unsigned char *) malloc( capacity );
+        shared->pipes[1].data = (unsigned char *) malloc( capacity );
+    }
+    if ( shared == NULL || ends[0] == NULL || ends[1] == NULL ||
+         shared->pipes[0].data == NULL || shared->pipes[1].data == NULL ) {
+        if ( shared != NULL ) {
+            free( shared->pipes[0].data );
+            free( shared->pipes[1].data );
+        }
+        free( shared );
+        free( ends[0] );
+        free( ends[1] );
+        return LIBNXT_OTHER_ERROR;
+    }
+
+    pthread_mutex_init( &shared->lock, NULL );
+    pthread_cond_init( &shared->changed, NULL );
+    shared->pipes[0].capacity = capacity;
+    shared->pipes[1].capacity = capacity;
+    shared->open = 2;
+
+    int i;
+    for ( i = 0; i < 2; i++ ) {
+        ends[i]->shared = shared;
+        ends[i]->in = &shared->pipes[i];
+        ends[i]->out = &shared->pipes[1 - i];
+    }
+
+    libnxt_error errorCode;
+    errorCode = open_comm_with( &LOOPBACK_TRANSPORT, ends[0], host );
+    if ( errorCode ) {
+        // ends[0] has been closed, so the pair is already half closed.
+        loop_close( ends[1] );
+        return errorCode;
+    }
+    errorCode = open_comm_with( &LOOPBACK_TRANSPORT, ends[1], device );
+    if ( errorCode ) {
+        close_comm_at( *host );
+        *host = NULL;
+        return errorCode;
+    }
+    return LIBNXT_SUCCESS;
+}
+
+static libnxt_error loop_read( void * state, unsigned char * buf,
+                               size_t offset, size_t maxLength, int timeout,
+                               int * transferred ) {
+    loop_end * end = (loop_end *) state;
+    loop_shared * shared = end->shared;
+    loop_pipe * in = end->in;
+    struct timespec deadline;
+    int expired = 0;
+    if ( timeout )
+        timeout_deadline( &deadline, timeout );
+
+    pthread_mutex_lock( &shared->lock );
+    while ( in->count == 0 && shared->open == 2 && ! expired ) {
+        if ( timeout && end->async )
+            break;
+        expired = wait_change( shared, ( timeout ? &deadline : NULL ) );
+    }
+
+    size_t total = ( in->count < maxLength ? in->count : maxLength );
+    size_t first = in->capacity - in->head;
+    if ( first > total )
+        first = total;
+    memcpy( buf + offset, in->data + in->head, first );
+    memcpy( buf + offset + first, in->data, total - first );
+    in->head = ( in->head + total ) % in->capacity;
+    in->count -= total;
+    int closed = shared->open < 2;
+    if ( total > 0 )
+        pthread_cond_broadcast( &shared->changed );
+    pthread_mutex_unlock( &shared->lock );
+
+    *transferred = total;
+    if ( total > 0 )
+        return LIBNXT_SUCCESS;
+    return ( closed ? LIBNXT_DISCONNECTED : LIBNXT_TIMEOUT );
+}
+
+static libnxt_error loop_write( void * state, unsigned char * buf,
+                                size_t offset, size_t length, int timeout,
+                                int * transferred ) {
+    loop_end * end = (loop_end *) state;
+    loop_shared * shared = end->shared;
+    loop_pipe * out = end->out;
+    struct timespec deadline;
+    int expired = 0;
+    if ( timeout )
+        timeout_deadline( &deadline, timeout );
+
+    size_t total = 0;
+    size_t span;
+    size_t tail;
+    pthread_mutex_lock( &shared->lock );
+    while ( total < length && shared->open == 2 && ! expired ) {
+        if ( out->count == out->capacity ) {
+            expired = wait_change( shared, ( timeout ? &deadline : NULL ) );
+            continue;
+        }
+        tail = ( out->head + out->count ) % out->capacity;
+        span = ( tail >= out->head ? out->capacity - tail : out->head - tail );
+        if ( span > length - total )
+            span = length - total;
+        memcpy( out->data + tail, buf + offset + total, span );
+        out->count += span;
+        total += span;
+        pthread_cond_broadcast( &shared->changed );
+    }
+    int closed = shared->open < 2;
+    pthread_mutex_unlock( &shared->lock );
+
+    *transferred = total;
+    if ( closed )
+        return LIBNXT_DISCONNECTED;
+    return ( total < length ? LIBNXT_TIMEOUT : LIBNXT_SUCCESS );
+}
+
+static libnxt_error loop_set_async( void * state, size_t depth ) {
+    loop_end * end = (loop_end *) state;
+    int async = depth > 0;
+    if ( end->async == async )
+        return LIBNXT_NO_EFFECT;
+    end->async = async;
+    return LIBNXT_SUCCESS;
+}
+
+static void loop_close( void * state ) {
+    loop_end * end = (loop_end *) state;
+    loop_shared * shared = end->shared;
+
+    pthread_mutex_lock( &shared->lock );
+    int remaining = --shared->open;
+    pthread_cond_broadcast( &shared->changed );
+    pthread_mutex_unlock( &shared->lock );
+
+    if ( remaining == 0 ) {
+        pthread_cond_destroy( &shared->changed );
+        pthread_mutex_destroy( &shared->lock );
+        free( shared->pipes[0].data );
+        free( shared->pipes[1].data );
+        free( shared );
+    }
+    free( end );
+}
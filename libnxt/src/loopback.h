@@ -0,0 +1,35 @@
+/*! \file
+ * \brief An in-memory transport for links between two ends in one process.
+ *
+ * A loopback pair is two links joined back to back: bytes written to one end
+ * are read from the other. One end can be handed to the messaging layer while
+ * the other plays the part of the NXT, so that the host stack can be exercised
+ * and load-tested without a physical NXT, at rates the real link can't reach.
+ * The two ends may be used from different threads.
+ */
+#ifndef LOOPBACK_H
+#define LOOPBACK_H
+#include "nxt_comm.h"
+
+/*! \brief Open a pair of links joined back to back.
+ *
+ * Close each end with `close_comm_at()`. Once one end is closed, the other
+ * can read any data still in transit, after which its reads and writes return
+ * \linkerror{LIBNXT_DISCONNECTED}.
+ * \param [in] capacity The number of bytes that may be in transit in each
+ * direction before writes wait for the other end to read.
+ * \param [out] host Output location for one end of the pair.
+ * \param [out] device Output location for the other end of the pair.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_ILLEGAL_ARG} if `capacity` is 0
+ *
+ * \linkerror{LIBNXT_OTHER_ERROR} if memory could not be allocated.
+ * \endparblock
+ */
+libnxt_error open_loopback_pair( size_t capacity, nxt_comm ** host,
+                                 nxt_comm ** device );
+
+#endif
@@ -1,90 +1,326 @@
 #include "messaging.h"
+#include "capture.h"
+#include "compress.h"
 #include "nxt_comm.h"
+#include "ring_buffer.h"
+#include "stats.h"
+#include <string.h>
+#include <time.h>
 
-// Buffers can hold 512 bytes at a time.
+// Buffers hold 512 bytes unless configured otherwise.
 #define BUFFER_SIZE 512
+// Read timeout of the pump thread in ms, bounding how long it takes to stop.
+#define PUMP_INTERVAL 100
+// Shortest adaptive read timeout, in ms.
+#define MIN_RTO 10
+// Least margin for variation in round trips in the adaptive timeout, in us.
+#define RTO_GRANULARITY 1000
+// Messages this long or longer are compressed unless configured otherwise: a
+// shorter message fits in one USB packet anyway.
+#define COMPRESS_THRESHOLD 64
 // LCP command type for command to enter packet transfer mode.
 #define SYSTEM_COMMAND_REPLY 0x01
 // System command to enter packet mode.
 #define NXJ_PACKET_MODE 0xff
 // Expected reply to request to enter packet mode.
 static const unsigned char CONFIRM_PACKET_MODE_REPLY[] = { 0x02, 0xfe, 0xef };
+// Start of the message offering compression, and of the reply accepting it;
+// followed by the set of codecs the sender decodes.
+static const unsigned char COMPRESSION_OFFER[] = { 0xfe, 0x5a };
 
-static unsigned char * inBuf;
+struct nxt_conn {
+    // The link to the NXT.
+    nxt_comm * comm;
 
-static unsigned char * outBuf;
+    /* Data received from the NXT and not yet consumed. Filled by the pump
+     * thread when there is one, otherwise by fill_buffer().
+     */
+    spsc_ring inRing;
 
-// Number of bytes of data in inBuf.
-static size_t inCount = 0;
+    // Data waiting to be sent to the NXT by flush_buffer().
+    spsc_ring outRing;
 
-/* Location in inBuf of the next byte to read. Bytes are never removed, but
- * overwritten by calls to fill_buffer().
- */
-static size_t readOffset = 0;
+    // Boolean flag indicating whether a view into inRing has been lent out.
+    int viewHeld;
+
+    // Bytes of inRing to consume when the view is released.
+    size_t viewLength;
+
+    // Length of a frame too long to lend out of inRing whose header has been
+    // consumed, or 0, and the number of its bytes copied out so far. The next
+    // receive resumes copying it.
+    uint16_t longLength;
+    size_t longCopied;
+
+    // The memory conn_receive() copies such a frame into, kept while the
+    // frame is part read.
+    unsigned char * longMessage;
+
+    // Holds a copy of a frame that wraps around the end of inRing while it is
+    // lent out, so that it can be viewed in one piece; as long as inRing.
+    unsigned char * wrapBuffer;
+
+    // Boolean flag indicating whether a pump thread fills inRing.
+    int pumped;
+
+    // Boolean flag: a pump thread is started whenever the link is connected.
+    int keepPumped;
+
+    // The pump thread.
+    pthread_t pump;
+
+    // Boolean flag telling the pump thread to finish.
+    atomic_int pumpStop;
+
+    // The error that stopped the pump thread, if any.
+    atomic_int pumpError;
+
+    // Boolean flag for deferring flushes of outRing until flush_messages().
+    int corked;
+
+    // Boolean flag for playing the part of the NXT in the handshake.
+    int device;
+
+    // Boolean flag: the other end has sent EOF, so will send nothing more.
+    int eofReceived;
+
+    // Boolean flag for reads that only collect data that has already arrived.
+    int async;
+
+    // Longest time to wait for each read and write, in ms; 0 waits forever.
+    int readTimeout;
+    int writeTimeout;
+
+    // Boolean flag for shortening read timeouts to fit measured round trips.
+    int adaptive;
+
+    // Smoothed round trip time and its mean deviation, in us.
+    long srtt;
+    long rttvar;
+
+    // Number of round trips measured.
+    size_t rttSamples;
+
+    // Boolean flag: messages have been sent since a message was last received.
+    int awaitingReply;
+
+    // When the first of those messages was sent.
+    struct timespec sentAt;
+
+    // Boolean flag: messages have been sent that are not yet all written.
+    int pending;
+
+    // When the first of those messages was sent.
+    struct timespec pendingSince;
+
+    // Boolean flag: compression was negotiated, so every message is sent and
+    // received behind the codec of its data.
+    int compressing;
 
-// Number of bytes of data in outBuf
-static size_t outCount = 0;
+    // The codecs the other end decodes.
+    unsigned int sendCodecs;
 
-// Boolean flag for 20 second timeout on IO operations. TIMEOUT DISABLED.
-static int timeout = 0;
+    // Messages at least this long are compressed.
+    size_t compressThreshold;
 
-// Boolean flag indicating whether the connection is open or closed.
-static int eof = 1;
+    // Hold a message being compressed, and one decompressed, respectively.
+    unsigned char * compressBuffer;
+    unsigned char * decompressBuffer;
+
+    // Boolean flag for resuming the connection when the NXT reconnects.
+    int reconnect;
+
+    // Longest time to wait for the NXT to reconnect, in ms; 0 waits forever.
+    int reconnectTimeout;
+
+    /* Bytes at the front of outRing that have been written but not consumed.
+     * To resume after a disconnection, outRing is only consumed a whole frame
+     * at a time, so that frames cut off can be sent again.
+     */
+    size_t outWritten;
+
+    // Bytes of the frame at the front of outRing not yet consumed, or 0 if its
+    // header has not been read.
+    size_t headLeft;
+
+    // Boolean flag: some of that frame has been consumed, as it is too long
+    // to keep in outRing.
+    int headCut;
+
+    // Total bytes consumed from outRing.
+    size_t outConsumed;
+
+    // How long each phase of opening the connection took.
+    startup_timing timing;
+};
+
+// The connection used by the functions that do not take an nxt_conn.
+static nxt_conn * defaultConn = NULL;
+
+// Settings to apply to defaultConn when it is opened.
+static int defaultCorked = 0;
+static int defaultReadTimeout = 0;
+static int defaultWriteTimeout = 0;
+static int defaultAdaptive = 0;
+static int defaultPersistent = 0;
+
+// A default connection kept open between sessions by set_persistent().
+static nxt_conn * keptConn = NULL;
 
 // EOF packet header: sent to indicate end of communication.
 static unsigned char EOF_HEADER[] = { 0x00, 0x00 };
 
 /*
- * return: A non-zero integer if inBuf is empty, otherwise 0.
+ * Read bytes from the NXT into the free space of the inRing until it is either
+ * full, the read operation times out, or there is an error. Only used when
+ * there is no pump thread.
+ * return: LIBNXT_SUCCESS, or
+ *         LIBNXT_NO_EFFECT if the inRing is already full, or
+ *         LIBNXT_DISCONNECTED if the NXT disconnected during the call, or
+ *         LIBNXT_IO_ERROR, or
+ *         LIBNXT_TIMEOUT.
+ */
+static libnxt_error fill_buffer( nxt_conn * conn );
+
+/*
+ * Fill the inRing, or wait for the pump thread to fill it, until it holds at
+ * least the given number of bytes, without consuming any of them.
+ * in: count - Number of bytes required; no more than the inRing capacity.
+ * return: LIBNXT_SUCCESS, or
+ *         LIBNXT_TIMEOUT if the bytes did not all arrive, or
+ *         LIBNXT_DISCONNECTED if the NXT disconnected during the call, or
+ *         LIBNXT_IO_ERROR.
  */
-static int in_buffer_empty( void );
+static libnxt_error buffer_bytes( nxt_conn * conn, size_t count );
 
 /*
- * Read bytes from the NXT into the inBuf until it is either full, the
- * read operation times out, or there is an error.
+ * Write bytes from the outRing to the NXT until it is empty, the
+ * write operation times out, or there is an error. Bytes that could not be
+ * written stay at the front of the outRing.
  * return: LIBNXT_SUCCESS, or
+ *         LIBNXT_NO_EFFECT if the outRing is already empty, or
  *         LIBNXT_DISCONNECTED if the NXT disconnected during the call, or
  *         LIBNXT_IO_ERROR, or
  *         LIBNXT_TIMEOUT.
  */
-static libnxt_error fill_buffer( void );
+static libnxt_error flush_buffer( nxt_conn * conn );
 
 /*
- * return: A non-zero integer if outBuf is full, otherwise 0.
+ * Consume the bytes of the outRing that have been written: all of them, or
+ * when resuming after disconnections, only the frames written whole and the
+ * written part of a frame too long to keep.
  */
-static int out_buffer_full( void );
+static void release_written( nxt_conn * conn );
 
 /*
- * Write bytes from the outBuf to the NXT until it is empty, the
- * write operation times out, or there is an error.
+ * Copy bytes of data out of the inRing in contiguous spans, filling the ring
+ * whenever it runs dry. Without a pump thread, spans of at least the ring
+ * capacity that remain once the ring is empty are read straight into dest.
+ * out: dest - Location to store the data.
+ * in: length - Number of bytes to copy.
+ * out: copied - Incremented by the number of bytes copied, even on error.
  * return: LIBNXT_SUCCESS, or
- *         LIBNXT_NO_EFFECT if the outBuf is already empty, or
+ *         LIBNXT_TIMEOUT if no data was available, or
  *         LIBNXT_DISCONNECTED if the NXT disconnected during the call, or
- *         LIBNXT_IO_ERROR, or
- *         LIBNXT_TIMEOUT.
+ *         LIBNXT_IO_ERROR.
  */
-static libnxt_error flush_buffer( void );
+static libnxt_error read_bytes( nxt_conn * conn, unsigned char * dest,
+                                size_t length, size_t * copied );
 
 /*
- * Fetch the next byte of data from the inBuf, filling the buffer if required.
- * out: byte - Location to store the data.
+ * Copy bytes of data into the outRing in contiguous spans, flushing the ring
+ * whenever it fills. Spans of at least the ring capacity that remain once the
+ * ring is empty are written straight from src.
+ * in: src - Data to store in the buffer.
+ * in: length - Number of bytes to copy.
  * return: LIBNXT_SUCCESS, or
- *         LIBNXT_NO_EFFECT if there was no data available, or
+ *         LIBNXT_TIMEOUT if the buffer could not be flushed, leaving no room
+ *                        for the new data, or
  *         LIBNXT_DISCONNECTED if the NXT disconnected during the call, or
  *         LIBNXT_IO_ERROR.
  */
-static libnxt_error read_byte( unsigned char * byte );
+static libnxt_error write_bytes( nxt_conn * conn, unsigned char * src,
+                                 size_t length );
+
+/*
+ * Time elapsed since the given time on the monotonic clock, in us.
+ */
+static long elapsed_us( const struct timespec * since );
+
+/*
+ * The timeout for the next read. While a reply is awaited in adaptive mode,
+ * this is what remains of the retransmission timeout of TCP (RFC 6298), as
+ * estimated from measured round trips, since the first message was sent.
+ * return: The timeout in ms, or 0 to wait forever.
+ */
+static int read_timeout( nxt_conn * conn );
+
+/*
+ * Note that the pending messages have reached the link, recording how long
+ * they took and starting a round trip if none is under way.
+ */
+static void mark_sent( nxt_conn * conn );
 
 /*
- * Put a byte into the outBuf, flushing the buffer if required.
- * in: byte - Data to store in the buffer.
+ * Update the round trip estimate with the round trip just completed.
+ */
+static void record_round_trip( nxt_conn * conn );
+
+/*
+ * Receive a message on a connection; see conn_receive_view().
+ */
+static libnxt_error receive_frame( nxt_conn * conn, unsigned char * scratch,
+                                   size_t scratchSize, message_view * view );
+
+/*
+ * Copy the rest of the frame of conn->longLength bytes into scratch, and lend
+ * it out once it is all there.
+ * in: scratch - Holds the conn->longCopied bytes copied so far.
+ * return: As read_bytes(), or as expand_view().
+ */
+static libnxt_error receive_long_frame( nxt_conn * conn,
+                                        unsigned char * scratch,
+                                        message_view * view );
+
+/*
+ * Body of the pump thread: read from the NXT into the inRing whenever it has
+ * free space, until told to stop or the link fails.
+ * in: arg - The nxt_conn to pump.
+ */
+static void * pump_reads( void * arg );
+
+/*
+ * Stop and join the pump thread, if there is one.
+ */
+static void stop_pump( nxt_conn * conn );
+
+/*
+ * Start a pump thread.
+ * return: LIBNXT_SUCCESS, or
+ *         LIBNXT_OTHER_ERROR if the thread could not be created.
+ */
+static libnxt_error start_pump( nxt_conn * conn );
+
+/*
+ * Prefix a message with its header and copy both into the outRing, flushing the
+ * buffer only when it fills.
+ * in: message - The message to frame.
+ * in: length - Size of the message in bytes.
  * return: LIBNXT_SUCCESS, or
- *         LIBNXT_NO_EFFECT if the buffer could not be flushed, leaving no room
- *                          for the new data, or
+ *         LIBNXT_TIMEOUT if the buffer could not be flushed, or
  *         LIBNXT_DISCONNECTED if the NXT disconnected during the call, or
  *         LIBNXT_IO_ERROR.
  */
-static libnxt_error write_byte( unsigned char byte );
+static libnxt_error frame_message( nxt_conn * conn, unsigned char * message,
+                                   uint16_t length );
+
+/*
+ * Take a frame cut off by a disconnection back out of the outRing, so that it
+ * can be framed again once the NXT is back.
+ * in: before - Bytes in the outRing before the frame was added.
+ * in: consumed - The outConsumed count before the frame was added.
+ */
+static void withdraw_frame( nxt_conn * conn, size_t before, size_t consumed );
 
 /*
  * Send a special packet to the NXT to indicate the connection should close.
@@ -92,212 +328,1172 @@ static libnxt_error write_byte( unsigned char byte );
  *         LIBNXT_DISCONNECTED if the NXT disconnected during the call, or
  *         LIBNXT_IO_ERROR.
  */
-static libnxt_error send_eof( void );
+static libnxt_error send_eof( nxt_conn * conn );
 
-static int in_buffer_empty( void ) {
-	return readOffset >= inCount;
-}
+/*
+ * Exchange offers of compression with the other end, after the handshake.
+ * return: LIBNXT_SUCCESS, or
+ *         LIBNXT_DISCONNECTED if the NXT disconnected during the call, or
+ *         LIBNXT_IO_ERROR, or
+ *         LIBNXT_TIMEOUT, or
+ *         LIBNXT_OTHER_ERROR if the other end did not offer compression, or
+ *         memory could not be allocated.
+ */
+static libnxt_error negotiate_compression( nxt_conn * conn );
+
+/*
+ * Replace a view of a message received behind its codec with a view of the
+ * message itself, decompressing it if need be. Releases the view on error.
+ * return: LIBNXT_SUCCESS, or
+ *         LIBNXT_OTHER_ERROR if the codec is unknown, the data corrupt, or the
+ *         message empty.
+ */
+static libnxt_error expand_view( nxt_conn * conn, message_view * view );
+
+/*
+ * Perform the handshake that puts the NXT into packet mode, or answer it if
+ * the connection plays the part of the NXT.
+ * return: LIBNXT_SUCCESS, or
+ *         LIBNXT_DISCONNECTED if the NXT disconnected during the call, or
+ *         LIBNXT_IO_ERROR, or
+ *         LIBNXT_OTHER_ERROR if the NXT gave an unexpected reply.
+ */
+static libnxt_error enter_packet_mode( nxt_conn * conn );
+
+/*
+ * Wait for the NXT to be connected again after it disconnected, then repeat
+ * the handshake and any negotiation of compression, and send the frames kept
+ * in the outRing unless corked.
+ * return: LIBNXT_SUCCESS, or
+ *         LIBNXT_DISCONNECTED if the NXT was not connected again in time, or
+ *         an error of comm_reopen(), enter_packet_mode(),
+ *         negotiate_compression() or start_pump().
+ */
+static libnxt_error reconnect( nxt_conn * conn );
+
+/*
+ * Reconnect if an operation failed because the NXT disconnected and the
+ * connection resumes after disconnections.
+ * in/out: errorCode - The error of the operation, replaced with that of
+ *                     reconnecting.
+ * return: A non-zero integer if the operation should be repeated.
+ */
+static int recovered( nxt_conn * conn, libnxt_error * errorCode );
 
-static libnxt_error fill_buffer( void ) {
-    inCount = 0;
-    readOffset = 0;
+/*
+ * Whether a connection kept open between sessions can be resumed: the NXT has
+ * not sent EOF, and no pump thread has found the link broken.
+ */
+static int resumable( nxt_conn * conn );
+
+/*
+ * Stop the pump thread, then release the link and buffers of a connection, and
+ * the connection itself.
+ */
+static void free_conn( nxt_conn * conn );
+
+static libnxt_error fill_buffer( nxt_conn * conn ) {
+    unsigned char * span;
+    size_t space = ring_writable( &conn->inRing, &span );
+    if ( space == 0 )
+        return LIBNXT_NO_EFFECT;
+
+    stats_count( STAT_FILLS, 1 );
+    int read = 0;
     libnxt_error errorCode;
-    errorCode = raw_read( inBuf, 0, BUFFER_SIZE, timeout, &inCount );
+    errorCode = comm_read( conn->comm, span, 0, space, read_timeout( conn ),
+                           &read );
+    ring_produce( &conn->inRing, read );
     return errorCode;
 }
 
-static int out_buffer_full( void ) {
-	return outCount >= BUFFER_SIZE;
+static libnxt_error buffer_bytes( nxt_conn * conn, size_t count ) {
+    libnxt_error errorCode;
+    size_t before;
+    int wait;
+    while ( ring_count( &conn->inRing ) < count ) {
+        if ( conn->pumped ) {
+            wait = read_timeout( conn );
+            if ( wait == 0 )
+                wait = -1;
+            else if ( conn->async )
+                wait = 0;
+            if ( ring_wait_data( &conn->inRing, count, wait ) )
+                break;
+            errorCode = atomic_load( &conn->pumpError );
+            return ( errorCode ? errorCode : LIBNXT_TIMEOUT );
+        }
+
+        before = ring_count( &conn->inRing );
+        errorCode = fill_buffer( conn );
+        if ( errorCode && errorCode != LIBNXT_TIMEOUT )
+            return errorCode;
+        // A full ring may still be short of a span that wraps: fill again.
+        if ( ring_count( &conn->inRing ) == before && errorCode )
+            return LIBNXT_TIMEOUT;
+    }
+    return LIBNXT_SUCCESS;
 }
 
-static libnxt_error flush_buffer( void ) {
-    if ( outCount == 0 ) {
+static libnxt_error flush_buffer( nxt_conn * conn ) {
+    if ( ring_count( &conn->outRing ) == conn->outWritten ) {
         return LIBNXT_NO_EFFECT;
     }
-    int written = 0;
-    libnxt_error errorCode;
-    errorCode = raw_write( outBuf, 0, outCount, timeout, &written );
-    outCount -= written;
+    stats_count( STAT_FLUSHES, 1 );
+    unsigned char * span;
+    size_t length;
+    int written;
+    libnxt_error errorCode = LIBNXT_SUCCESS;
+    while ( ! errorCode &&
+            ( length = ring_readable_at( &conn->outRing, conn->outWritten,
+                                         &span ) ) > 0 ) {
+        written = 0;
+        errorCode = comm_write( conn->comm, span, 0, length,
+                                conn->writeTimeout, &written );
+        conn->outWritten += written;
+        release_written( conn );
+        if ( ! errorCode && (size_t) written < length )
+            errorCode = LIBNXT_TIMEOUT;
+    }
     return errorCode;
 }
 
-static libnxt_error read_byte( unsigned char * byte ) {
+static void release_written( nxt_conn * conn ) {
+    size_t release;
+    if ( ! conn->reconnect ) {
+        release = conn->outWritten;
+        ring_consume( &conn->outRing, release );
+        conn->outConsumed += release;
+        conn->outWritten = 0;
+        return;
+    }
+
+    unsigned char header[2];
+    while ( conn->outWritten > 0 ) {
+        if ( conn->headLeft == 0 ) {
+            // The rest of the header may not be in the outRing yet.
+            if ( ring_count( &conn->outRing ) < sizeof ( header ) )
+                break;
+            ring_peek( &conn->outRing, 0, header, sizeof ( header ) );
+            conn->headLeft = sizeof ( header ) +
+                             (size_t) ( header[0] | header[1] << 8 );
+        }
+        // A frame that fits is kept until it has all been written.
+        if ( conn->headLeft <= conn->outRing.capacity &&
+             conn->outWritten < conn->headLeft )
+            break;
+        release = ( conn->outWritten < conn->headLeft ? conn->outWritten :
+                                                        conn->headLeft );
+        ring_consume( &conn->outRing, release );
+        conn->outConsumed += release;
+        conn->outWritten -= release;
+        conn->headLeft -= release;
+        conn->headCut = ( conn->headLeft > 0 );
+    }
+}
+
+static libnxt_error read_bytes( nxt_conn * conn, unsigned char * dest,
+                                size_t length, size_t * copied ) {
+    libnxt_error errorCode;
+    unsigned char * src;
+    size_t span;
+    int read;
+    while ( length > 0 ) {
+        span = ring_readable( &conn->inRing, &src );
+        if ( span == 0 ) {
+            if ( ! conn->pumped && length >= conn->inRing.capacity ) {
+                // Bypass the inRing; it would only be copied out again.
+                read = 0;
+                errorCode = comm_read( conn->comm, dest, 0, length,
+                                       read_timeout( conn ), &read );
+                if ( errorCode && errorCode != LIBNXT_TIMEOUT )
+                    return errorCode;
+                if ( read == 0 )
+                    return LIBNXT_TIMEOUT;
+                dest += read;
+                length -= read;
+                *copied += read;
+                continue;
+            }
+            errorCode = buffer_bytes( conn, 1 );
+            if ( errorCode )
+                return errorCode;
+            continue;
+        }
+        if ( span > length )
+            span = length;
+        memcpy( dest, src, span );
+        ring_consume( &conn->inRing, span );
+        dest += span;
+        length -= span;
+        *copied += span;
+    }
+    return LIBNXT_SUCCESS;
+}
+
+static libnxt_error write_bytes( nxt_conn * conn, unsigned char * src,
+                                 size_t length ) {
     libnxt_error errorCode;
-    int error = 0;
-    if ( in_buffer_empty() ) {
-        errorCode = fill_buffer();
-        error = errorCode && errorCode != LIBNXT_TIMEOUT;
+    unsigned char * dest;
+    size_t span;
+    int written;
+    while ( length > 0 ) {
+        span = ring_writable( &conn->outRing, &dest );
+        if ( span == 0 ) {
+            errorCode = flush_buffer( conn );
+            if ( errorCode && errorCode != LIBNXT_TIMEOUT )
+                return errorCode;
+            if ( ring_writable( &conn->outRing, &dest ) == 0 )
+                return LIBNXT_TIMEOUT;
+            continue;
+        }
+        // Frames kept to resume after a disconnection must all pass through
+        // the outRing.
+        if ( ! conn->reconnect && ring_count( &conn->outRing ) == 0 &&
+             length >= conn->outRing.capacity ) {
+            // Bypass the outRing; it would only be copied out again.
+            written = 0;
+            errorCode = comm_write( conn->comm, src, 0, length,
+                                    conn->writeTimeout, &written );
+            if ( errorCode && errorCode != LIBNXT_TIMEOUT )
+                return errorCode;
+            if ( written == 0 )
+                return LIBNXT_TIMEOUT;
+            src += written;
+            length -= written;
+            continue;
+        }
+        if ( span > length )
+            span = length;
+        memcpy( dest, src, span );
+        ring_produce( &conn->outRing, span );
+        src += span;
+        length -= span;
     }
+    return LIBNXT_SUCCESS;
+}
 
-    if ( ! error ) {
-		if ( in_buffer_empty() ) {
-		    return LIBNXT_TIMEOUT;
-		} else {
-		    *byte = inBuf[readOffset++];
-            return LIBNXT_SUCCESS;
-		}
+static long elapsed_us( const struct timespec * since ) {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return ( now.tv_sec - since->tv_sec ) * 1000000L +
+           ( now.tv_nsec - since->tv_nsec ) / 1000L;
+}
+
+static int read_timeout( nxt_conn * conn ) {
+    if ( ! ( conn->adaptive && conn->awaitingReply && conn->rttSamples > 0 ) )
+        return conn->readTimeout;
+
+    long margin = 4 * conn->rttvar;
+    if ( margin < RTO_GRANULARITY )
+        margin = RTO_GRANULARITY;
+    long rto = ( conn->srtt + margin ) / 1000;
+    if ( rto < MIN_RTO )
+        rto = MIN_RTO;
+    if ( conn->readTimeout > 0 && rto > conn->readTimeout )
+        rto = conn->readTimeout;
+
+    long remaining = rto - elapsed_us( &conn->sentAt ) / 1000;
+    // 0 would wait forever, so a timeout that has passed is kept just above.
+    return ( remaining > 0 ? (int) remaining : 1 );
+}
+
+static void mark_sent( nxt_conn * conn ) {
+    stats_record( STAT_SEND_TO_FLUSH, elapsed_us( &conn->pendingSince ) );
+    conn->pending = 0;
+    if ( ! conn->awaitingReply ) {
+        clock_gettime( CLOCK_MONOTONIC, &conn->sentAt );
+        conn->awaitingReply = 1;
+    }
+}
+
+static void record_round_trip( nxt_conn * conn ) {
+    long sample = elapsed_us( &conn->sentAt );
+    if ( conn->rttSamples == 0 ) {
+        conn->srtt = sample;
+        conn->rttvar = sample / 2;
     } else {
-		return errorCode;
-	}
+        long deviation = conn->srtt - sample;
+        if ( deviation < 0 )
+            deviation = -deviation;
+        conn->rttvar += ( deviation - conn->rttvar ) / 4;
+        conn->srtt += ( sample - conn->srtt ) / 8;
+    }
+    conn->rttSamples++;
+    conn->awaitingReply = 0;
 }
 
-static libnxt_error write_byte( unsigned char byte ) {
+static void * pump_reads( void * arg ) {
+    nxt_conn * conn = (nxt_conn *) arg;
+    unsigned char * span;
+    size_t space;
+    int read;
     libnxt_error errorCode;
-    int error = 0;
-    if ( out_buffer_full() ) {
-        errorCode = flush_buffer();
-        error = errorCode && errorCode != LIBNXT_TIMEOUT;
+    while ( ! atomic_load( &conn->pumpStop ) ) {
+        if ( ! ring_wait_space( &conn->inRing, &conn->pumpStop ) )
+            continue;
+        space = ring_writable( &conn->inRing, &span );
+        read = 0;
+        // Always time out, so that a request to stop is noticed.
+        errorCode = comm_read( conn->comm, span, 0, space, PUMP_INTERVAL,
+                               &read );
+        if ( read > 0 )
+            ring_produce( &conn->inRing, read );
+        if ( errorCode && errorCode != LIBNXT_TIMEOUT ) {
+            atomic_store( &conn->pumpError, errorCode );
+            break;
+        }
     }
+    close_ring( &conn->inRing );
+    return NULL;
+}
 
-    if ( ! error ) {
-		if ( out_buffer_full() ) {
-			return LIBNXT_TIMEOUT;
-		} else {
-            outBuf[outCount++] = byte;
-            return LIBNXT_SUCCESS;
-		}
-    } else {
-        return errorCode;
+static libnxt_error start_pump( nxt_conn * conn ) {
+    atomic_store( &conn->pumpStop, 0 );
+    atomic_store( &conn->pumpError, LIBNXT_SUCCESS );
+    if ( pthread_create( &conn->pump, NULL, pump_reads, conn ) )
+        return LIBNXT_OTHER_ERROR;
+    conn->pumped = 1;
+    return LIBNXT_SUCCESS;
+}
+
+static void stop_pump( nxt_conn * conn ) {
+    if ( conn->pumped ) {
+        atomic_store( &conn->pumpStop, 1 );
+        ring_wake( &conn->inRing );
+        pthread_join( conn->pump, NULL );
+        conn->pumped = 0;
     }
 }
 
-static libnxt_error send_eof( void ) {
+static libnxt_error frame_message( nxt_conn * conn, unsigned char * message,
+                                   uint16_t length ) {
+    libnxt_error errorCode;
+    unsigned char header[3];
+    size_t headerLength = 2;
+    uint16_t frameLength = length;
+    // An empty message is the EOF, sent without a codec.
+    if ( conn->compressing && length > 0 ) {
+        int codec = COMPRESS_NONE;
+        size_t compressed = 0;
+        // Compressed data is only worth sending if it is shorter.
+        if ( length >= conn->compressThreshold && conn->sendCodecs )
+            compressed = compress_message( conn->sendCodecs, message, length,
+                                           conn->compressBuffer, length - 1,
+                                           &codec );
+        if ( compressed > 0 ) {
+            stats_count( STAT_COMPRESSED_FRAMES, 1 );
+            stats_count( STAT_COMPRESSION_SAVED, length - compressed );
+            message = conn->compressBuffer;
+            length = (uint16_t) compressed;
+        } else if ( length == UINT16_MAX ) {
+            return LIBNXT_ILLEGAL_ARG;
+        }
+        header[2] = (unsigned char) codec;
+        headerLength = 3;
+        frameLength = (uint16_t) ( length + 1 );
+    }
+    header[0] = (unsigned char) ( frameLength & 0xFF ); // LSB
+    header[1] = (unsigned char) ( frameLength >> 8 ); // MSB
+
+    size_t before = ring_count( &conn->outRing );
+    size_t consumed = conn->outConsumed;
+    errorCode = write_bytes( conn, header, headerLength );
+    if ( ! errorCode )
+        errorCode = write_bytes( conn, message, length );
+    if ( ! errorCode )
+        stats_count( STAT_FRAMES_SENT, 1 );
+    else if ( errorCode == LIBNXT_DISCONNECTED && conn->reconnect )
+        withdraw_frame( conn, before, consumed );
+    return errorCode;
+}
+
+static void withdraw_frame( nxt_conn * conn, size_t before, size_t consumed ) {
+    consumed = conn->outConsumed - consumed;
+    // Once any of the frame has been consumed, the rest cannot be kept.
+    size_t keep = ( consumed <= before ? before - consumed : 0 );
+    ring_truncate( &conn->outRing, keep );
+    if ( conn->outWritten > keep )
+        conn->outWritten = keep;
+    if ( keep == 0 ) {
+        conn->headLeft = 0;
+        conn->headCut = 0;
+    }
+}
+
+static libnxt_error send_eof( nxt_conn * conn ) {
     libnxt_error errorCode;
     int sent = 0;
     // Always wait for EOF to be successfully sent.
-    errorCode = raw_write( EOF_HEADER, 0, sizeof ( EOF_HEADER ), 0, &sent );
+    errorCode = comm_write( conn->comm, EOF_HEADER, 0, sizeof ( EOF_HEADER ), 0,
+                            &sent );
     return ( errorCode ? errorCode : LIBNXT_SUCCESS );
 }
 
-void set_timeout( int enabled ) {
-    timeout = enabled;
+static libnxt_error enter_packet_mode( nxt_conn * conn ) {
+    libnxt_error errorCode;
+    unsigned char request[] = { SYSTEM_COMMAND_REPLY, NXJ_PACKET_MODE };
+    int transferred = 0;
+    if ( conn->device ) {
+        unsigned char received[sizeof ( request )];
+        size_t total = 0;
+        errorCode = LIBNXT_SUCCESS;
+        while ( ! errorCode && total < sizeof ( received ) ) {
+            errorCode = comm_read( conn->comm, received, total,
+                                   sizeof ( received ) - total, 0,
+                                   &transferred );
+            total += (size_t) transferred;
+        }
+        if ( errorCode )
+            return errorCode;
+        if ( memcmp( received, request, sizeof ( request ) ) )
+            return LIBNXT_OTHER_ERROR;
+        errorCode = comm_write( conn->comm,
+                                (unsigned char *) CONFIRM_PACKET_MODE_REPLY, 0,
+                                sizeof ( CONFIRM_PACKET_MODE_REPLY ), 0,
+                                &transferred );
+        return ( errorCode ? errorCode : LIBNXT_SUCCESS );
+    }
+    errorCode = comm_write( conn->comm, request, 0, sizeof ( request ), 0,
+                            &transferred );
+    if ( errorCode )
+        return errorCode;
+
+    // Over a stream, the reply may arrive in parts, or be followed at once by
+    // frames an NXT kept while reconnecting; those are left in the inRing.
+    unsigned char reply[BUFFER_SIZE];
+    size_t expected = sizeof ( CONFIRM_PACKET_MODE_REPLY );
+    size_t maxRead = expected + conn->inRing.capacity -
+                     ring_count( &conn->inRing );
+    if ( maxRead > sizeof ( reply ) )
+        maxRead = sizeof ( reply );
+    size_t total = 0;
+    while ( ! errorCode && total < expected ) {
+        errorCode = comm_read( conn->comm, reply, total, maxRead - total, 0,
+                               &transferred );
+        if ( ! errorCode )
+            total += (size_t) transferred;
+    }
+    if ( errorCode )
+        return errorCode;
+    if ( memcmp( reply, CONFIRM_PACKET_MODE_REPLY, expected ) )
+        return LIBNXT_OTHER_ERROR;
+    size_t kept = expected;
+    while ( kept < total ) {
+        unsigned char * span;
+        size_t space = ring_writable( &conn->inRing, &span );
+        if ( space > total - kept )
+            space = total - kept;
+        memcpy( span, reply + kept, space );
+        ring_produce( &conn->inRing, space );
+        kept += space;
+    }
+    return LIBNXT_SUCCESS;
 }
 
-libnxt_error init_messaging( void ) {
-    if ( ! eof )
-        return LIBNXT_NO_EFFECT;
+static libnxt_error negotiate_compression( nxt_conn * conn ) {
+    // The offer is framed here and written directly, so that it goes ahead of
+    // any frames kept in the outRing when resuming after a disconnection.
+    unsigned char offer[2 + sizeof ( COMPRESSION_OFFER ) + 1];
+    offer[0] = (unsigned char) ( sizeof ( offer ) - 2 );
+    offer[1] = 0;
+    memcpy( offer + 2, COMPRESSION_OFFER, sizeof ( COMPRESSION_OFFER ) );
+    offer[sizeof ( offer ) - 1] = COMPRESS_CODECS;
 
-    libnxt_error errorCode = open_comm();
+    if ( conn->compressBuffer == NULL )
+        conn->compressBuffer = (unsigned char *) malloc( UINT16_MAX );
+    if ( conn->decompressBuffer == NULL )
+        conn->decompressBuffer = (unsigned char *) malloc( UINT16_MAX );
+    if ( conn->compressBuffer == NULL || conn->decompressBuffer == NULL )
+        return LIBNXT_OTHER_ERROR;
+
+    // The NXT answers the offer of the host.
+    libnxt_error errorCode = LIBNXT_SUCCESS;
+    int written = 0;
+    if ( ! conn->device )
+        errorCode = comm_write( conn->comm, offer, 0, sizeof ( offer ), 0,
+                                &written );
+    message_view view;
+    unsigned char reply[sizeof ( offer ) - 2];
+    if ( ! errorCode )
+        errorCode = receive_frame( conn, reply, sizeof ( reply ), &view );
+    if ( errorCode == LIBNXT_ILLEGAL_ARG )
+        return LIBNXT_OTHER_ERROR;
     if ( errorCode )
         return errorCode;
+    int valid = ( view.length == sizeof ( reply ) &&
+                  ! memcmp( view.data, COMPRESSION_OFFER,
+                            sizeof ( COMPRESSION_OFFER ) ) );
+    unsigned int codecs = ( valid ? view.data[view.length - 1] : 0 );
+    conn_release_view( conn );
+    if ( ! valid )
+        return LIBNXT_OTHER_ERROR;
+    if ( conn->device ) {
+        errorCode = comm_write( conn->comm, offer, 0, sizeof ( offer ), 0,
+                                &written );
+        if ( errorCode )
+            return errorCode;
+    }
 
-    eof = 0;
+    conn->sendCodecs = codecs & COMPRESS_CODECS;
+    conn->compressing = 1;
+    return LIBNXT_SUCCESS;
+}
 
-    inBuf = (unsigned char *) calloc( BUFFER_SIZE, sizeof( char ) );
-    outBuf = (unsigned char *) calloc( BUFFER_SIZE, sizeof( char ) );
+static libnxt_error expand_view( nxt_conn * conn, message_view * view ) {
+    int codec = ( view->length > 0 ? view->data[0] : -1 );
+    if ( codec == COMPRESS_NONE && view->length > 1 ) {
+        view->data++;
+        view->length--;
+        return LIBNXT_SUCCESS;
+    }
+    size_t decoded = 0;
+    libnxt_error errorCode = LIBNXT_OTHER_ERROR;
+    if ( codec > 0 )
+        errorCode = decompress_message( codec, view->data + 1,
+                                        view->length - 1,
+                                        conn->decompressBuffer, UINT16_MAX,
+                                        &decoded );
+    // An empty message would be taken for the end of the connection, and is
+    // never sent behind a codec.
+    if ( errorCode || decoded == 0 ) {
+        conn_release_view( conn );
+        return LIBNXT_OTHER_ERROR;
+    }
+    view->data = conn->decompressBuffer;
+    view->length = (uint16_t) decoded;
+    return LIBNXT_SUCCESS;
+}
 
-    unsigned char request[] = { SYSTEM_COMMAND_REPLY, NXJ_PACKET_MODE };
-    int transferred = 0;
-    errorCode = raw_write( request, 0, sizeof ( request ), 0, &transferred );
+static libnxt_error reconnect( nxt_conn * conn ) {
+    struct timespec start;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    stop_pump( conn );
+    libnxt_error errorCode = comm_reopen( conn->comm,
+                                          conn->reconnectTimeout );
+    if ( errorCode )
+        return ( errorCode == LIBNXT_TIMEOUT ? LIBNXT_DISCONNECTED :
+                                               errorCode );
+
+    // Whatever was on its way from the NXT is lost.
+    reset_ring( &conn->inRing );
+    conn->viewHeld = 0;
+    conn->viewLength = 0;
+    conn->longLength = 0;
+    conn->longCopied = 0;
+    conn->eofReceived = 0;
+    conn->awaitingReply = 0;
+    conn->compressing = 0;
+    // Frames kept are sent again whole, but the rest of a frame too long to
+    // keep is of no use.
+    if ( conn->headCut ) {
+        ring_consume( &conn->outRing, conn->headLeft );
+        conn->outConsumed += conn->headLeft;
+    }
+    conn->outWritten = 0;
+    conn->headLeft = 0;
+    conn->headCut = 0;
+
+    errorCode = enter_packet_mode( conn );
+    // Compression was negotiated before if its buffers were allocated.
+    if ( ! errorCode && conn->compressBuffer != NULL )
+        errorCode = negotiate_compression( conn );
+    if ( ! errorCode && conn->keepPumped )
+        errorCode = start_pump( conn );
+    if ( ! errorCode && ! conn->corked ) {
+        errorCode = flush_buffer( conn );
+        // Frames that could not be written yet are sent with the next flush.
+        if ( errorCode == LIBNXT_NO_EFFECT || errorCode == LIBNXT_TIMEOUT )
+            errorCode = LIBNXT_SUCCESS;
+    }
     if ( ! errorCode ) {
-        unsigned char reply[BUFFER_SIZE];
-        errorCode = raw_read( reply, 0, sizeof ( reply ), 0, &transferred );
-        if ( ! errorCode ) {
-			int valid = 1;
-            if ( transferred == sizeof ( CONFIRM_PACKET_MODE_REPLY ) ) {
-                size_t i;
-                for ( i = 0; i < transferred; i++ ) {
-                    if ( reply[i] != CONFIRM_PACKET_MODE_REPLY[i] ) {
-                        valid = 0;
-                        break;
-                    }
-                }
-            } else {
-				valid = 0;
-			}
-
-            if ( ! valid ) {
-                errorCode = LIBNXT_OTHER_ERROR;
-			}
-        }
+        stats_count( STAT_RECONNECTS, 1 );
+        stats_record( STAT_RECOVERY, elapsed_us( &start ) );
+    }
+    return errorCode;
+}
+
+static int recovered( nxt_conn * conn, libnxt_error * errorCode ) {
+    if ( *errorCode != LIBNXT_DISCONNECTED || ! conn->reconnect )
+        return 0;
+    *errorCode = reconnect( conn );
+    return ( *errorCode == LIBNXT_SUCCESS );
+}
+
+static int resumable( nxt_conn * conn ) {
+    return ! conn->eofReceived &&
+           ! ( conn->pumped && atomic_load( &conn->pumpError ) );
+}
+
+static void free_conn( nxt_conn * conn ) {
+    stop_pump( conn );
+    close_comm_at( conn->comm );
+    free_ring( &conn->inRing );
+    free_ring( &conn->outRing );
+    free( conn->compressBuffer );
+    free( conn->decompressBuffer );
+    free( conn->longMessage );
+    free( conn->wrapBuffer );
+    free( conn );
+}
+
+libnxt_error count_nxts( size_t * count ) {
+    return count_comms( count );
+}
+
+libnxt_error conn_init_messaging( size_t index,
+                                  const messaging_options * options,
+                                  nxt_conn ** conn ) {
+    *conn = NULL;
+
+    nxt_comm * comm;
+    libnxt_error errorCode;
+    if ( options != NULL && options->port > 0 )
+        errorCode = open_comm_on_port( options->bus, options->port, &comm );
+    else
+        errorCode = open_comm_at( index, &comm );
+    if ( errorCode )
+        return errorCode;
+
+    return conn_init_messaging_on( comm, options, conn );
+}
+
+libnxt_error conn_init_messaging_on( nxt_comm * comm,
+                                     const messaging_options * options,
+                                     nxt_conn ** conn ) {
+    *conn = NULL;
+    struct timespec start;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    startup_timing timing;
+    comm_get_startup_timing( comm, &timing );
+
+    // Recording starts before the handshake, so a replay can repeat it.
+    if ( options != NULL && options->capture != NULL ) {
+        libnxt_error errorCode = open_capture_comm( comm, options->capture,
+                                                    &comm );
+        if ( errorCode )
+            return errorCode;
+    }
+
+    nxt_conn * ret = (nxt_conn *) calloc( 1, sizeof ( nxt_conn ) );
+    if ( ret == NULL ) {
+        close_comm_at( comm );
+        return LIBNXT_OTHER_ERROR;
+    }
+    ret->comm = comm;
+    ret->timing = timing;
+
+    size_t bufferSize = BUFFER_SIZE;
+    if ( options != NULL ) {
+        if ( options->bufferSize > 0 )
+            bufferSize = options->bufferSize;
+        ret->readTimeout = options->readTimeout;
+        ret->writeTimeout = options->writeTimeout;
+        ret->adaptive = options->adaptive;
+        ret->device = options->device;
+        ret->compressThreshold = options->compressThreshold;
+        ret->keepPumped = options->pump;
+        ret->reconnect = options->reconnect;
+        ret->reconnectTimeout = ( options->reconnectTimeout > 0 ?
+                                  options->reconnectTimeout : 0 );
+    }
+    if ( ret->compressThreshold == 0 )
+        ret->compressThreshold = COMPRESS_THRESHOLD;
+
+    libnxt_error errorCode = init_ring( &ret->inRing, bufferSize );
+    if ( ! errorCode ) {
+        errorCode = init_ring( &ret->outRing, bufferSize );
+        if ( errorCode )
+            free_ring( &ret->inRing );
+    }
+    if ( errorCode ) {
+        close_comm_at( comm );
+        free( ret );
+        return errorCode;
+    }
+
+    // The handshake is done before the pump thread takes over reading.
+    struct timespec phase;
+    clock_gettime( CLOCK_MONOTONIC, &phase );
+    errorCode = enter_packet_mode( ret );
+    ret->timing.handshake = elapsed_us( &phase );
+    if ( ! errorCode && options != NULL && options->compression ) {
+        clock_gettime( CLOCK_MONOTONIC, &phase );
+        errorCode = negotiate_compression( ret );
+        ret->timing.negotiation = elapsed_us( &phase );
     }
+    if ( ! errorCode && ret->keepPumped )
+        errorCode = start_pump( ret );
 
     if ( errorCode ) {
-        close_comm();
-        eof = 1;
-        free( inBuf );
-        free( outBuf );
+        free_conn( ret );
         return errorCode;
     } else {
+        ret->timing.total += elapsed_us( &start );
+        *conn = ret;
         return LIBNXT_SUCCESS;
     }
 }
 
-void exit_messaging( void ) {
-    if ( ! eof ) {
-		// Temporarily disable timeout if enabled.
-		int tmpTimeout = timeout;
-		set_timeout( 0 );
-        if ( ! flush_buffer() ) {
-            if ( ! send_eof() ) {
-                unsigned char * dataIn;
-                uint16_t length = 0;
-                do {
-                    if ( receive( &dataIn, &length ) )
-                        break;
-                } while ( length > 0 );
-            }
+void conn_exit_messaging( nxt_conn * conn ) {
+    if ( conn == NULL )
+        return;
+
+    // Any outstanding view is invalidated by closing.
+    conn_release_view( conn );
+    // Disable timeouts if enabled; the connection will not be used again.
+    conn_set_timeouts( conn, 0, 0 );
+    conn_set_adaptive_timeout( conn, 0 );
+    // Messages left corked in the outRing are sent ahead of the EOF.
+    if ( flush_buffer( conn ) >= LIBNXT_SUCCESS ) {
+        // The reply to an EOF received need not be waited for.
+        if ( ! send_eof( conn ) && ! conn->eofReceived ) {
+            unsigned char * dataIn;
+            uint16_t length = 0;
+            do {
+                if ( conn_receive( conn, &dataIn, &length ) )
+                    break;
+                free_message( dataIn );
+            } while ( length > 0 );
         }
-        close_comm();
-        eof = 1;
-        free( inBuf );
-        free( outBuf );
-        // Re-establish previous timeout setting.
-        set_timeout( tmpTimeout );
     }
+    free_conn( conn );
 }
 
-libnxt_error receive( unsigned char ** message, uint16_t * length ) {
-    if ( eof )
+void conn_set_timeout( nxt_conn * conn, int enabled ) {
+    int timeout = ( enabled ? COMM_TIMEOUT : 0 );
+    conn_set_timeouts( conn, timeout, timeout );
+}
+
+void conn_set_timeouts( nxt_conn * conn, int readTimeout, int writeTimeout ) {
+    conn->readTimeout = ( readTimeout > 0 ? readTimeout : 0 );
+    conn->writeTimeout = ( writeTimeout > 0 ? writeTimeout : 0 );
+}
+
+void conn_get_timeouts( nxt_conn * conn, int * readTimeout,
+                        int * writeTimeout ) {
+    *readTimeout = conn->readTimeout;
+    *writeTimeout = conn->writeTimeout;
+}
+
+void conn_get_startup_timing( nxt_conn * conn, startup_timing * timing ) {
+    *timing = conn->timing;
+}
+
+void conn_set_adaptive_timeout( nxt_conn * conn, int enabled ) {
+    conn->adaptive = enabled;
+}
+
+void conn_set_corked( nxt_conn * conn, int enabled ) {
+    conn->corked = enabled;
+}
+
+libnxt_error conn_set_async( nxt_conn * conn, size_t depth ) {
+    if ( conn == NULL )
         return LIBNXT_NOT_OPENED;
+    // The pump thread already keeps reads going in the background.
+    if ( conn->pumped )
+        return LIBNXT_NO_EFFECT;
 
-    libnxt_error errorCode;
-    size_t i;
+    libnxt_error errorCode = comm_set_async( conn->comm, depth );
+    if ( ! errorCode )
+        conn->async = ( depth > 0 );
+    return errorCode;
+}
 
-    char lenLSB, lenMSB;
+libnxt_error get_messaging_pollfds( struct pollfd * fds, size_t maxCount,
+                                    size_t * count ) {
+    return get_comm_pollfds( fds, maxCount, count );
+}
 
-    if ( ! ( errorCode = read_byte( &lenLSB ) ) )
-        errorCode = read_byte( &lenMSB );
+libnxt_error handle_messaging_events( int timeout ) {
+    return handle_comm_events( timeout );
+}
 
-    if ( ! errorCode ) {
-        *length = ( lenMSB << 8 ) | lenLSB;
-        if ( *length == 0 ) {
-            *message = REQUEST_EXIT;
+libnxt_error conn_receive( nxt_conn * conn, unsigned char ** message,
+                           uint16_t * length ) {
+    message_view view;
+    libnxt_error errorCode = conn_receive_view( conn, NULL, 0, &view );
+    if ( errorCode == LIBNXT_ILLEGAL_ARG ) {
+        // Too long for the inRing; read it into its own memory, which is kept
+        // until the message has all been read.
+        unsigned char * ret;
+        if ( conn->longLength > 0 ) {
+            *length = conn->longLength;
         } else {
-            unsigned char * ret;
-            ret = (unsigned char *) calloc( *length, sizeof( char ) );
-            for ( i = 0; ! errorCode && i < *length; i++ ) {
-                errorCode = read_byte( &ret[i] );
+            unsigned char header[2];
+            ring_peek( &conn->inRing, 0, header, sizeof ( header ) );
+            *length = ( header[1] << 8 ) | header[0];
+            free( conn->longMessage );
+            conn->longMessage = (unsigned char *) malloc( *length );
+            if ( conn->longMessage == NULL )
+                return LIBNXT_OTHER_ERROR;
+        }
+        errorCode = conn_receive_view( conn, conn->longMessage, *length,
+                                       &view );
+        if ( errorCode ) {
+            if ( conn->longLength == 0 ) {
+                free( conn->longMessage );
+                conn->longMessage = NULL;
             }
-            if ( ! errorCode ) {
-                *message = ret;
+            return errorCode;
+        }
+        ret = conn->longMessage;
+        conn->longMessage = NULL;
+        // A message received behind its codec is not left where it was read.
+        if ( view.data != ret ) {
+            unsigned char * copy = (unsigned char *) malloc( view.length );
+            if ( copy == NULL ) {
+                free( ret );
+                conn_release_view( conn );
+                return LIBNXT_OTHER_ERROR;
             }
+            memcpy( copy, view.data, view.length );
+            free( ret );
+            ret = copy;
         }
-	}
+        *length = view.length;
+        conn_release_view( conn );
+        *message = ret;
+        return errorCode;
+    }
 
-    return ( errorCode ? errorCode : LIBNXT_SUCCESS );
+    if ( ! errorCode ) {
+        *length = view.length;
+        if ( view.length == 0 ) {
+            *message = REQUEST_EXIT;
+        } else {
+            *message = (unsigned char *) malloc( view.length );
+            if ( *message == NULL )
+                errorCode = LIBNXT_OTHER_ERROR;
+            else
+                memcpy( *message, view.data, view.length );
+        }
+        conn_release_view( conn );
+    }
+    return errorCode;
 }
 
-void free_message( unsigned char * message ) {
-    free( message );
+libnxt_error conn_receive_view( nxt_conn * conn, unsigned char * scratch,
+                                size_t scratchSize, message_view * view ) {
+    if ( conn == NULL )
+        return LIBNXT_NOT_OPENED;
+
+    int measuring = conn->awaitingReply;
+    int adaptive = measuring && conn->adaptive && conn->rttSamples > 0;
+    struct timespec start;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    libnxt_error errorCode;
+    do {
+        errorCode = receive_frame( conn, scratch, scratchSize, view );
+    } while ( recovered( conn, &errorCode ) );
+    if ( ! errorCode ) {
+        stats_count( STAT_FRAMES_RECEIVED, 1 );
+        stats_record( STAT_RECEIVE_WAIT, elapsed_us( &start ) );
+    }
+    if ( measuring && ! errorCode ) {
+        record_round_trip( conn );
+    } else if ( adaptive && errorCode == LIBNXT_TIMEOUT ) {
+        // The reply is late; later receives wait for the full read timeout.
+        conn->awaitingReply = 0;
+    }
+    return errorCode;
 }
 
-libnxt_error send( unsigned char * message, uint16_t length ) {
-    if ( eof )
+static libnxt_error receive_frame( nxt_conn * conn, unsigned char * scratch,
+                                   size_t scratchSize, message_view * view ) {
+    if ( conn->viewHeld )
+        return LIBNXT_NO_EFFECT;
+    if ( conn->longLength > 0 ) {
+        if ( scratch == NULL || scratchSize < conn->longLength )
+            return LIBNXT_ILLEGAL_ARG;
+        return receive_long_frame( conn, scratch, view );
+    }
+
+    // Nothing is consumed until the whole message is available, unless it is
+    // too long to fit in the inRing.
+    libnxt_error errorCode = buffer_bytes( conn, 2 );
+    if ( errorCode )
+        return errorCode;
+
+    unsigned char header[2];
+    ring_peek( &conn->inRing, 0, header, sizeof ( header ) );
+    uint16_t length = ( header[1] << 8 ) | header[0];
+    if ( length == 0 ) {
+        ring_consume( &conn->inRing, 2 );
+        conn->eofReceived = 1;
+        view->data = REQUEST_EXIT;
+        view->length = 0;
+        return LIBNXT_SUCCESS;
+    }
+
+    int fits = ( 2 + (size_t) length <= conn->inRing.capacity );
+    if ( fits ) {
+        errorCode = buffer_bytes( conn, 2 + (size_t) length );
+        if ( errorCode )
+            return errorCode;
+    }
+
+    // Lend out the message in place, unless it wraps around the inRing, when
+    // it is lent out of a copy in one piece.
+    unsigned char * span;
+    size_t contiguous = ring_readable( &conn->inRing, &span );
+    if ( fits && contiguous <= 2 ) {
+        view->data = conn->inRing.data + ( 2 - contiguous );
+        conn->viewLength = length;
+        ring_consume( &conn->inRing, 2 );
+    } else if ( fits && contiguous >= 2 + (size_t) length ) {
+        view->data = span + 2;
+        conn->viewLength = length;
+        ring_consume( &conn->inRing, 2 );
+    } else if ( fits ) {
+        if ( conn->wrapBuffer == NULL ) {
+            conn->wrapBuffer = (unsigned char *) malloc(
+                conn->inRing.capacity );
+            if ( conn->wrapBuffer == NULL )
+                return LIBNXT_OTHER_ERROR;
+        }
+        ring_peek( &conn->inRing, 2, conn->wrapBuffer, length );
+        view->data = conn->wrapBuffer;
+        conn->viewLength = length;
+        ring_consume( &conn->inRing, 2 );
+    } else {
+        if ( scratch == NULL || scratchSize < length )
+            return LIBNXT_ILLEGAL_ARG;
+        // From here, the frame is resumed if it is not all read.
+        ring_consume( &conn->inRing, 2 );
+        conn->longLength = length;
+        conn->longCopied = 0;
+        return receive_long_frame( conn, scratch, view );
+    }
+    view->length = length;
+    conn->viewHeld = 1;
+    if ( conn->compressing )
+        return expand_view( conn, view );
+    return LIBNXT_SUCCESS;
+}
+
+static libnxt_error receive_long_frame( nxt_conn * conn,
+                                        unsigned char * scratch,
+                                        message_view * view ) {
+    libnxt_error errorCode = read_bytes( conn, scratch + conn->longCopied,
+                                         conn->longLength - conn->longCopied,
+                                         &conn->longCopied );
+    if ( errorCode )
+        return errorCode;
+    view->data = scratch;
+    view->length = conn->longLength;
+    conn->viewLength = 0;
+    conn->longLength = 0;
+    conn->longCopied = 0;
+    conn->viewHeld = 1;
+    if ( conn->compressing )
+        return expand_view( conn, view );
+    return LIBNXT_SUCCESS;
+}
+
+void conn_release_view( nxt_conn * conn ) {
+    if ( conn->viewHeld ) {
+        // The space of the message is only now handed back to the producer.
+        ring_consume( &conn->inRing, conn->viewLength );
+        conn->viewLength = 0;
+        conn->viewHeld = 0;
+    }
+}
+
+libnxt_error conn_send( nxt_conn * conn, unsigned char * message,
+                        uint16_t length ) {
+    message_vec single;
+    single.data = message;
+    single.length = length;
+    return conn_send_batch( conn, &single, 1 );
+}
+
+libnxt_error conn_send_batch( nxt_conn * conn, const message_vec * messages,
+                              size_t count ) {
+    if ( conn == NULL )
+        return LIBNXT_NOT_OPENED;
+
+    if ( count > 0 && ! conn->pending ) {
+        clock_gettime( CLOCK_MONOTONIC, &conn->pendingSince );
+        conn->pending = 1;
+    }
+
+    libnxt_error errorCode = LIBNXT_SUCCESS;
+    size_t i = 0;
+    int flushed = conn->corked;
+    int cutLast;
+    while ( ! errorCode && ( i < count || ! flushed ) ) {
+        cutLast = 0;
+        if ( i < count ) {
+            errorCode = frame_message( conn, messages[i].data,
+                                       messages[i].length );
+            if ( ! errorCode )
+                i++;
+        } else {
+            errorCode = flush_buffer( conn );
+            // The messages may have bypassed the outRing, leaving nothing to
+            // flush.
+            if ( errorCode == LIBNXT_NO_EFFECT )
+                errorCode = LIBNXT_SUCCESS;
+            flushed = ! errorCode;
+            // All that is left is the rest of the last message, which is too
+            // long to be kept.
+            cutLast = ( count > 0 && conn->headCut &&
+                        ring_count( &conn->outRing ) == conn->headLeft );
+        }
+        // Once the NXT is back, a message cut off is framed again.
+        if ( errorCode && recovered( conn, &errorCode ) && cutLast )
+            i--;
+    }
+
+    if ( ! errorCode && ! conn->corked && conn->pending )
+        mark_sent( conn );
+    return errorCode;
+}
+
+libnxt_error conn_flush_messages( nxt_conn * conn ) {
+    if ( conn == NULL )
         return LIBNXT_NOT_OPENED;
 
     libnxt_error errorCode;
-    size_t i;
+    do {
+        errorCode = flush_buffer( conn );
+    } while ( recovered( conn, &errorCode ) );
+    // Corked messages may have bypassed the outRing, leaving nothing to flush.
+    if ( errorCode >= 0 && conn->pending )
+        mark_sent( conn );
+    return errorCode;
+}
 
-    errorCode = write_byte( (unsigned char) ( length & 0xFF ) ); // LSB
-    if ( ! errorCode )
-        write_byte( (unsigned char) ( length >> 8 ) ); // MSB
+void set_timeout( int enabled ) {
+    int timeout = ( enabled ? COMM_TIMEOUT : 0 );
+    set_timeouts( timeout, timeout );
+}
 
-    if ( ! errorCode ) {
-        for ( i = 0; ! ( errorCode || i >= length ); i++ ) {
-            errorCode = write_byte( message[i] );
+void set_timeouts( int readTimeout, int writeTimeout ) {
+    defaultReadTimeout = ( readTimeout > 0 ? readTimeout : 0 );
+    defaultWriteTimeout = ( writeTimeout > 0 ? writeTimeout : 0 );
+    if ( defaultConn != NULL )
+        conn_set_timeouts( defaultConn, readTimeout, writeTimeout );
+}
+
+void set_adaptive_timeout( int enabled ) {
+    defaultAdaptive = enabled;
+    if ( defaultConn != NULL )
+        conn_set_adaptive_timeout( defaultConn, enabled );
+}
+
+void set_corked( int enabled ) {
+    defaultCorked = enabled;
+    if ( defaultConn != NULL )
+        conn_set_corked( defaultConn, enabled );
+}
+
+libnxt_error set_async( size_t depth ) {
+    return conn_set_async( defaultConn, depth );
+}
+
+void set_persistent( int enabled ) {
+    defaultPersistent = enabled;
+    if ( ! enabled && keptConn != NULL ) {
+        conn_exit_messaging( keptConn );
+        keptConn = NULL;
+    }
+}
+
+libnxt_error get_startup_timing( startup_timing * timing ) {
+    if ( defaultConn == NULL )
+        return LIBNXT_NOT_OPENED;
+    conn_get_startup_timing( defaultConn, timing );
+    return LIBNXT_SUCCESS;
+}
+
+libnxt_error init_messaging( void ) {
+    return init_messaging_with( NULL );
+}
+
+libnxt_error init_messaging_with( const messaging_options * options ) {
+    if ( defaultConn != NULL )
+        return LIBNXT_NO_EFFECT;
+
+    // Settings left unset in the options take those made before opening.
+    messaging_options settings;
+    memset( &settings, 0, sizeof ( messaging_options ) );
+    if ( options != NULL )
+        settings = *options;
+    if ( settings.readTimeout == 0 )
+        settings.readTimeout = defaultReadTimeout;
+    if ( settings.writeTimeout == 0 )
+        settings.writeTimeout = defaultWriteTimeout;
+    if ( ! settings.adaptive )
+        settings.adaptive = defaultAdaptive;
+
+    if ( keptConn != NULL ) {
+        struct timespec start;
+        clock_gettime( CLOCK_MONOTONIC, &start );
+        nxt_conn * kept = keptConn;
+        keptConn = NULL;
+        if ( resumable( kept ) ) {
+            conn_set_timeouts( kept, settings.readTimeout,
+                               settings.writeTimeout );
+            conn_set_adaptive_timeout( kept, settings.adaptive );
+            conn_set_corked( kept, defaultCorked );
+            memset( &kept->timing, 0, sizeof ( startup_timing ) );
+            kept->timing.resumed = 1;
+            kept->timing.total = elapsed_us( &start );
+            defaultConn = kept;
+            return LIBNXT_SUCCESS;
         }
+        conn_exit_messaging( kept );
+    }
+
+    libnxt_error errorCode = conn_init_messaging( 0, &settings, &defaultConn );
+    if ( ! errorCode )
+        conn_set_corked( defaultConn, defaultCorked );
+    return errorCode;
+}
+
+void exit_messaging( void ) {
+    if ( defaultPersistent && defaultConn != NULL &&
+         resumable( defaultConn ) ) {
+        // The session ends, but the connection is kept for the next.
+        conn_release_view( defaultConn );
+        conn_flush_messages( defaultConn );
+        keptConn = defaultConn;
+        defaultConn = NULL;
+        return;
     }
+    conn_exit_messaging( defaultConn );
+    defaultConn = NULL;
+}
+
+libnxt_error receive( unsigned char ** message, uint16_t * length ) {
+    return conn_receive( defaultConn, message, length );
+}
+
+libnxt_error receive_view( unsigned char * scratch, size_t scratchSize,
+                           message_view * view ) {
+    return conn_receive_view( defaultConn, scratch, scratchSize, view );
+}
+
+void release_view( void ) {
+    if ( defaultConn != NULL )
+        conn_release_view( defaultConn );
+}
+
+void free_message( unsigned char * message ) {
+    free( message );
+}
+
+libnxt_error send( unsigned char * message, uint16_t length ) {
+    return conn_send( defaultConn, message, length );
+}
+
+libnxt_error send_batch( const message_vec * messages, size_t count ) {
+    return conn_send_batch( defaultConn, messages, count );
+}
 
-    return ( errorCode ? errorCode : flush_buffer() );
+libnxt_error flush_messages( void ) {
+    return conn_flush_messages( defaultConn );
 }
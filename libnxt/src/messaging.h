@@ -8,12 +8,24 @@
  * When using this packet-based communication, either device can indicate a
  * need to close the connection by sending a specially formatted _EOF_ packet.
  *
- * I/O functions are blocking.
+ * Each NXT is reached through an `nxt_conn`, which owns its own buffers and
+ * link, so that many NXTs can be driven from one process. The functions that
+ * do not take an `nxt_conn` operate on a single default connection to the
+ * first NXT found, for use when only one NXT is connected.
+ *
+ * I/O functions are blocking. Each connection buffers data in a ring per
+ * direction, whose size is set by `messaging_options`. Optionally, a pump
+ * thread keeps reading from the NXT into the receive ring while the
+ * application processes earlier messages, so that messages sent back-to-back
+ * by the NXT are not held up waiting for the host.
  */
 #ifndef MESSAGING_H
 #define MESSAGING_H
 #include "error_codes.h"
+#include "nxt_comm.h"
 #include <stdint.h>
+#include <stdlib.h>
+#include <poll.h>
 
 /*! \def REQUEST_EXIT
  * Check against messages returned by `receive()` if the NXT is requesting to
@@ -21,6 +33,90 @@
  */
 #define REQUEST_EXIT NULL
 
+/*! \brief A packet-based connection with one NXT.
+ *
+ * Obtained using `conn_init_messaging()` and released using
+ * `conn_exit_messaging()`.
+ */
+typedef struct nxt_conn nxt_conn;
+
+/*! \brief A read-only view of a message received from the NXT.
+ *
+ * Returned by `receive_view()`. The data remains valid until `release_view()`
+ * is called.
+ */
+typedef struct message_view {
+    const unsigned char * data; /*!< The message, or `#REQUEST_EXIT`. */
+    uint16_t length; /*!< Size of the message in bytes. */
+} message_view;
+
+/*! \brief One of a batch of messages passed to `send_batch()`.
+ */
+typedef struct message_vec {
+    unsigned char * data; /*!< The message to send. */
+    uint16_t length; /*!< Size of the message in bytes. */
+} message_vec;
+
+/*! \brief Settings for a connection, given when it is opened.
+ *
+ * Fields left as 0 take their default values.
+ */
+typedef struct messaging_options {
+    /*! Minimum size in bytes of each of the send and receive rings; rounded up
+     * to a power of two. Defaults to 512. */
+    size_t bufferSize;
+    /*! Boolean flag to start a pump thread that reads from the NXT in the
+     * background. Defaults to off, in which case data is only read while a
+     * message is being received. */
+    int pump;
+    /*! Longest time in ms to wait for data from the NXT. Defaults to no
+     * timeout. */
+    int readTimeout;
+    /*! Longest time in ms to wait for data to be sent to the NXT. Defaults to
+     * no timeout. */
+    int writeTimeout;
+    /*! Boolean flag to adapt the read timeout to measured round trips; see
+     * `set_adaptive_timeout()`. Defaults to off. */
+    int adaptive;
+    /*! Boolean flag to play the part of the NXT: answer the handshake that
+     * puts the link into packet mode instead of starting it. For hosts that
+     * simulate an NXT. Defaults to off. */
+    int device;
+    /*! Boolean flag to offer compression of messages once in packet mode;
+     * the other end must offer it too. Messages are then compressed with the
+     * codecs of `compress.h` that make them smallest, and each is sent behind
+     * a byte naming its codec, so the longest message is one byte shorter.
+     * Defaults to off. */
+    int compression;
+    /*! Size in bytes of the shortest message to compress. Defaults to 64, the
+     * size of a USB packet: a shorter message takes one packet anyway. */
+    size_t compressThreshold;
+    /*! Path of a file to record all traffic on the link to, as by
+     * `open_capture_comm()`, or NULL not to record. Defaults to NULL. */
+    const char * capture;
+    /*! Boolean flag to resume the connection when the NXT disconnects, as when
+     * it reboots or its cable is unplugged. A send, flush or receive that
+     * finds the NXT gone waits for it to be connected again, as by
+     * `comm_reopen()`, repeats the handshake and any negotiation of
+     * compression, and carries on. Messages queued to be sent are kept, and
+     * any cut off part way is sent again whole, except that a message longer
+     * than the send ring is lost if it is cut off after its send returned.
+     * Messages on their way from the NXT are lost, and a view held is no
+     * longer valid. Defaults to off, in which case such calls return
+     * \linkerror{LIBNXT_DISCONNECTED}. */
+    int reconnect;
+    /*! Longest time in ms to wait for the NXT to be connected again, after
+     * which the call that found it gone returns
+     * \linkerror{LIBNXT_DISCONNECTED}. Defaults to no timeout. */
+    int reconnectTimeout;
+    /*! The USB port of the NXT to open, as given by `comm_get_port()`. With a
+     * port other than 0, `conn_init_messaging()` opens the NXT on that port as
+     * by `open_comm_on_port()`, ignoring its index, and `init_messaging_with()`
+     * opens it in place of the first NXT. Defaults to 0. */
+    uint8_t bus;
+    uint8_t port;
+} messaging_options;
+
 /*! \brief Open communications with the NXT and perform handshake to
  * establish packet-based communication.
  *
@@ -43,12 +139,25 @@
  */
 libnxt_error init_messaging( void );
 
+/*! \brief Open communications with the NXT with the given settings.
+ *
+ * Behaves as `init_messaging()`, and additionally returns
+ * \linkerror{LIBNXT_OTHER_ERROR} if the buffers or the pump thread could not
+ * be created.
+ * \param [in] options Settings for the connection, or NULL for the defaults.
+ * \see init_messaging()
+ */
+libnxt_error init_messaging_with( const messaging_options * options );
+
 /*! \brief Close communications with the NXT.
  *
  * Send the _EOF_ packet and wait to receive it in response before closing the
- * connection and freeing resources.
+ * connection and freeing resources. If the NXT sent _EOF_ first, the _EOF_ is
+ * sent as the response and nothing more is waited for.
  *
- * Because this function involves I/O with the NXT, it may block.
+ * Because this function involves I/O with the NXT, it may block. While
+ * persistence is enabled with `set_persistent()`, the connection is kept open
+ * instead, and nothing is sent.
  */
 void exit_messaging( void );
 
@@ -68,14 +177,77 @@ void exit_messaging( void );
  * \parblock
  * \linkerror{LIBNXT_SUCCESS} (and populate parameters)
  *
+ * \linkerror{LIBNXT_NO_EFFECT} if a view returned by `receive_view()` has
+ * not yet been released
+ *
  * \linkerror{LIBNXT_NOT_OPENED} if messaging has not yet been initialised
  *
  * \linkerror{LIBNXT_DISCONNECTED} if the NXT disconnected during the call
  *
+ * \linkerror{LIBNXT_OTHER_ERROR} if there was no memory for the message
+ *
  * \linkerror{LIBNXT_IO_ERROR}.
  */
 libnxt_error receive( unsigned char ** message, uint16_t * length );
 
+/*! \brief Receive a message from the NXT without copying it out of the
+ * receive buffer.
+ *
+ * Unlike `receive()`, no memory is allocated: `view` refers directly to the
+ * data held in the receive buffer. A message that wraps around the end of the
+ * receive buffer is lent out of a copy that the connection keeps, so that it
+ * is always in one piece. Only messages too long to be held in the receive
+ * buffer at once (longer than `messaging_options::bufferSize` less the 2 byte
+ * header) are copied into `scratch`. Either way, call `release_view()` once
+ * the message is no longer required; no further messages can be received
+ * until then. This function may block.
+ *
+ * If the call times out part-way through a message, the data received so far
+ * is kept, and a later call will resume where this one left off. A message
+ * being copied into `scratch` is resumed in the `scratch` of the later call,
+ * which must be the same buffer, still holding the part copied.
+ * \param [in] scratch A buffer to hold messages too long for the receive
+ * buffer. May be NULL if no message is longer than the receive buffer.
+ * \param [in] scratchSize Size of `scratch` in bytes.
+ * \param [out] view
+ * \parblock
+ * If `view->length` > 0: the message received from the NXT.
+ *
+ * If `view->length` = 0: `view->data` is `#REQUEST_EXIT`; `exit_messaging()`
+ * should be called. There is no need to call `release_view()`.
+ * \endparblock
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS} (and populate `view`)
+ *
+ * \linkerror{LIBNXT_NO_EFFECT} if the previous view has not yet been released
+ *
+ * \linkerror{LIBNXT_ILLEGAL_ARG} if the message is too long for the receive
+ * buffer and for `scratch`; the message is left in place
+ *
+ * \linkerror{LIBNXT_OTHER_ERROR} if there was no memory to copy a message that
+ * wraps around the end of the receive buffer; the message is left in place
+ *
+ * \linkerror{LIBNXT_NOT_OPENED} if messaging has not yet been initialised
+ *
+ * \linkerror{LIBNXT_DISCONNECTED} if the NXT disconnected during the call
+ *
+ * \linkerror{LIBNXT_IO_ERROR}
+ *
+ * \linkerror{LIBNXT_TIMEOUT}.
+ * \endparblock
+ */
+libnxt_error receive_view( unsigned char * scratch, size_t scratchSize,
+                           message_view * view );
+
+/*! \brief Allow the space taken up by the last message returned by
+ * `receive_view()` to be reused.
+ *
+ * The data of the view must not be accessed after this call. Since no I/O is
+ * performed, this function will not block.
+ */
+void release_view( void );
+
 /*! \brief Free the memory taken up by message when it is no longer required.
  *
  * Since no I/O is performed, this function will not block.
@@ -101,4 +273,331 @@ void free_message( unsigned char * message );
  */
 libnxt_error send( unsigned char * message, uint16_t length );
 
+/*! \brief Send several messages to the NXT in as few transfers as possible.
+ *
+ * Each message is prefixed with a header and packed into the send buffer, which
+ * is only flushed when it fills and once after the last message, so that a
+ * batch of small messages is coalesced into a single transfer. When corked,
+ * the final flush is deferred until `flush_messages()` is called. This
+ * function may block.
+ * \param [in] messages The messages to send, in order.
+ * \param [in] count Number of messages in `messages`.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_NOT_OPENED} if messaging has not yet been initialised
+ *
+ * \linkerror{LIBNXT_DISCONNECTED} if the NXT disconnected during the call
+ *
+ * \linkerror{LIBNXT_IO_ERROR}
+ *
+ * \linkerror{LIBNXT_TIMEOUT} if the send buffer could not be flushed.
+ * \endparblock
+ */
+libnxt_error send_batch( const message_vec * messages, size_t count );
+
+/*! \brief Enable or disable deferring transfers until `flush_messages()`.
+ *
+ * While corked, `send()` and `send_batch()` only transfer data when the send
+ * buffer fills. Uncorking does not flush the buffer. Since no I/O is performed,
+ * this function will not block.
+ * \param [in] enabled A boolean flag.
+ */
+void set_corked( int enabled );
+
+/*! \brief Transfer any messages held in the send buffer to the NXT.
+ *
+ * This function may block.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_NO_EFFECT} if there were no messages to transfer
+ *
+ * \linkerror{LIBNXT_NOT_OPENED} if messaging has not yet been initialised
+ *
+ * \linkerror{LIBNXT_DISCONNECTED} if the NXT disconnected during the call
+ *
+ * \linkerror{LIBNXT_IO_ERROR}
+ *
+ * \linkerror{LIBNXT_TIMEOUT}.
+ * \endparblock
+ */
+libnxt_error flush_messages( void );
+
+/*! \brief Enable or disable a timeout of `#COMM_TIMEOUT` ms on I/O operations.
+ *
+ * Timeouts are disabled by default. Since no I/O is performed, this function
+ * will not block.
+ * \param [in] enabled A boolean flag.
+ * \see set_timeouts()
+ */
+void set_timeout( int enabled );
+
+/*! \brief Set the timeouts on reads from and writes to the NXT.
+ *
+ * An operation that times out returns \linkerror{LIBNXT_TIMEOUT}. May be called
+ * before `init_messaging()`, in which case the timeouts apply once messaging
+ * is initialised. Since no I/O is performed, this function will not block.
+ * \param [in] readTimeout The longest time to wait for data from the NXT, in
+ * ms, or 0 to wait indefinitely.
+ * \param [in] writeTimeout The longest time to wait for data to be sent, in ms,
+ * or 0 to wait indefinitely.
+ */
+void set_timeouts( int readTimeout, int writeTimeout );
+
+/*! \brief Enable or disable adapting the read timeout to measured round trips.
+ *
+ * The time from sending messages to receiving the next message is measured,
+ * and while a reply is awaited, reads time out after the retransmission
+ * timeout that TCP would derive from these measurements: the smoothed round
+ * trip time plus four times its mean deviation. This detects a lost or
+ * stalled NXT in a few round trips instead of a fixed, worst-case interval.
+ * The read timeout set by `set_timeouts()` still bounds the adaptive timeout,
+ * and applies before any round trip has been measured and to reads that do
+ * not follow a send. Suited to request and reply exchanges; messages the NXT
+ * sends unprompted are measured as replies. Disabled by default.
+ * \param [in] enabled A boolean flag.
+ */
+void set_adaptive_timeout( int enabled );
+
+/*! \brief Switch between blocking and asynchronous reads from the NXT.
+ *
+ * In asynchronous mode, several reads are kept in flight, and data is collected
+ * from them as they complete while `handle_messaging_events()` is called.
+ * With a read timeout set, `receive_view()` then never blocks: it returns
+ * \linkerror{LIBNXT_TIMEOUT} until a whole message has arrived, keeping any
+ * partial message for the next call. This allows many connections to be served
+ * from one event loop that polls the descriptors given by
+ * `get_messaging_pollfds()`. Sends remain blocking. Has no effect on a
+ * connection with a pump thread, which already reads in the background.
+ * \param [in] depth The number of reads to keep in flight, or 0 to return to
+ * blocking reads.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_NO_EFFECT} if already in the requested mode
+ *
+ * \linkerror{LIBNXT_NOT_OPENED} if messaging has not yet been initialised
+ *
+ * \linkerror{LIBNXT_DISCONNECTED} if the NXT disconnected during the call
+ *
+ * \linkerror{LIBNXT_DEPENDENT_ERROR} if there was an error in underlying I/O
+ * library.
+ * \endparblock
+ */
+libnxt_error set_async( size_t depth );
+
+/*! \brief Enable or disable keeping the connection with the NXT open between
+ * sessions.
+ *
+ * For hosts that open and close communications often. While enabled,
+ * `exit_messaging()` sends any messages held in the send buffer, but neither
+ * sends _EOF_ nor closes the connection, so the NXT stays in packet mode. The
+ * next `init_messaging()` or `init_messaging_with()` resumes the connection:
+ * libusb, the device handle and the handshake are all kept, so none of the
+ * phases of `startup_timing` is repeated. Messages the NXT sent in between
+ * are received in the new session. Timeouts and corking are set anew, but the
+ * rest of the settings stay those the connection was opened with. A
+ * connection on which the NXT sent _EOF_ or disconnected is opened afresh.
+ *
+ * Disabling persistence closes a connection kept open, as
+ * `exit_messaging()` would otherwise have done.
+ * \param [in] enabled A boolean flag.
+ */
+void set_persistent( int enabled );
+
+/*! \brief Get how long each phase of opening the connection with the NXT
+ * took.
+ *
+ * \param [out] timing Output location for the timing of the current session.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_NOT_OPENED} if messaging has not yet been initialised.
+ * \endparblock
+ */
+libnxt_error get_startup_timing( startup_timing * timing );
+
+/*! \brief Get the file descriptors to poll for I/O events on connections in
+ * asynchronous mode.
+ *
+ * \param [out] fds A buffer to store the file descriptors and the events to
+ * poll them for.
+ * \param [in] maxCount Size of `fds`.
+ * \param [out] count The number of file descriptors that need polling, which
+ * may exceed `maxCount`.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS} (and populate `fds` and `count`)
+ *
+ * \linkerror{LIBNXT_DEPENDENT_ERROR} if there was an error in underlying I/O
+ * library.
+ * \endparblock
+ */
+libnxt_error get_messaging_pollfds( struct pollfd * fds, size_t maxCount,
+                                    size_t * count );
+
+/*! \brief Handle pending I/O events on connections in asynchronous mode.
+ *
+ * Call when any of the descriptors given by `get_messaging_pollfds()` becomes
+ * ready, then try to receive on each asynchronous connection.
+ * \param [in] timeout The longest time to wait for an event, in ms. 0 returns
+ * immediately after handling any events that are already pending.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_DEPENDENT_ERROR} if there was an error in underlying I/O
+ * library.
+ * \endparblock
+ */
+libnxt_error handle_messaging_events( int timeout );
+
+/*! \brief Count the NXTs that are physically connected to the Galileo.
+ *
+ * \param [out] count The number of NXTs found.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS} (and populate `count`)
+ *
+ * \linkerror{LIBNXT_DEPENDENT_ERROR} if there was an error in underlying I/O
+ * library.
+ * \endparblock
+ */
+libnxt_error count_nxts( size_t * count );
+
+/*! \brief Open a connection with one of the NXTs that are physically
+ * connected to the Galileo, and perform handshake to establish packet-based
+ * communication.
+ *
+ * Behaves as `init_messaging()`, except that any number of connections can be
+ * open at once. Because this function involves I/O with the NXT, it may block.
+ * \param [in] index Which of the NXTs counted by `count_nxts()` to connect to.
+ * \param [in] options Settings for the connection, or NULL for the defaults.
+ * \param [out] conn Output location for the new connection. Set to NULL when
+ * the return code is non-zero, indicating an error.
+ * \see init_messaging()
+ */
+libnxt_error conn_init_messaging( size_t index,
+                                  const messaging_options * options,
+                                  nxt_conn ** conn );
+
+/*! \brief Open a connection over an existing link, and perform handshake to
+ * establish packet-based communication.
+ *
+ * Allows messaging over any `nxt_transport`, such as a loopback pair or a
+ * socket to an NXT simulator. Because this function involves I/O with the
+ * NXT, it may block.
+ * \param [in] comm The link to use. Ownership passes to the connection, even
+ * on failure.
+ * \param [in] options Settings for the connection, or NULL for the defaults.
+ * \param [out] conn Output location for the new connection. Set to NULL when
+ * the return code is non-zero, indicating an error.
+ * \see conn_init_messaging()
+ */
+libnxt_error conn_init_messaging_on( nxt_comm * comm,
+                                     const messaging_options * options,
+                                     nxt_conn ** conn );
+
+/*! \brief Close a connection with an NXT and free the connection.
+ *
+ * Behaves as `exit_messaging()`. `conn` must not be used after this call.
+ */
+void conn_exit_messaging( nxt_conn * conn );
+
+/*! \brief Enable or disable the timeout on I/O operations of a connection.
+ *
+ * \see set_timeout()
+ */
+void conn_set_timeout( nxt_conn * conn, int enabled );
+
+/*! \brief Set the timeouts on I/O operations of a connection.
+ *
+ * \see set_timeouts()
+ */
+void conn_set_timeouts( nxt_conn * conn, int readTimeout, int writeTimeout );
+
+/*! \brief Get the timeouts on I/O operations of a connection.
+ *
+ * \param [in] conn
+ * \param [out] readTimeout Output location for the read timeout, in ms.
+ * \param [out] writeTimeout Output location for the write timeout, in ms.
+ */
+void conn_get_timeouts( nxt_conn * conn, int * readTimeout,
+                        int * writeTimeout );
+
+/*! \brief Get how long each phase of opening a connection took.
+ *
+ * Over a link opened with `open_comm_at()` or `open_comm_on_port()`, the
+ * phases of opening the link are included; see `comm_get_startup_timing()`.
+ * \param [in] conn
+ * \param [out] timing Output location for the timing.
+ */
+void conn_get_startup_timing( nxt_conn * conn, startup_timing * timing );
+
+/*! \brief Enable or disable the adaptive read timeout of a connection.
+ *
+ * \see set_adaptive_timeout()
+ */
+void conn_set_adaptive_timeout( nxt_conn * conn, int enabled );
+
+/*! \brief Switch a connection between blocking and asynchronous reads.
+ *
+ * \see set_async()
+ */
+libnxt_error conn_set_async( nxt_conn * conn, size_t depth );
+
+/*! \brief Receive a message on a connection.
+ *
+ * \see receive()
+ */
+libnxt_error conn_receive( nxt_conn * conn, unsigned char ** message,
+                           uint16_t * length );
+
+/*! \brief Receive a message on a connection without copying it.
+ *
+ * `scratch` is only needed for messages longer than the connection's receive
+ * buffer; messages that wrap around its end are viewed in one piece all the
+ * same.
+ * \see receive_view()
+ */
+libnxt_error conn_receive_view( nxt_conn * conn, unsigned char * scratch,
+                                size_t scratchSize, message_view * view );
+
+/*! \brief Release the last view returned by `conn_receive_view()`.
+ *
+ * \see release_view()
+ */
+void conn_release_view( nxt_conn * conn );
+
+/*! \brief Send a message on a connection.
+ *
+ * \see send()
+ */
+libnxt_error conn_send( nxt_conn * conn, unsigned char * message,
+                        uint16_t length );
+
+/*! \brief Send several messages on a connection.
+ *
+ * \see send_batch()
+ */
+libnxt_error conn_send_batch( nxt_conn * conn, const message_vec * messages,
+                              size_t count );
+
+/*! \brief Enable or disable corking on a connection.
+ *
+ * \see set_corked()
+ */
+void conn_set_corked( nxt_conn * conn, int enabled );
+
+/*! \brief Transfer any messages held in the send buffer of a connection.
+ *
+ * \see flush_messages()
+ */
+libnxt_error conn_flush_messages( nxt_conn * conn );
+
 #endif
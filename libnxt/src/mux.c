@@ -0,0 +1,355 @@
+#include "mux.h"
+#include <pthread.h>
+#include <string.h>
+
+// Settings used when none are given.
+#define DEFAULT_CHUNK_SIZE 256
+
+// A message queued on a channel.
+typedef struct mux_message {
+    struct mux_message * next;
+    uint16_t length;
+    // Bytes of the message already sent.
+    uint16_t sent;
+    unsigned char data[];
+} mux_message;
+
+typedef struct mux_channel {
+    unsigned int priority;
+    unsigned int weight;
+
+    // Messages waiting to be sent, oldest first.
+    mux_message * head;
+    mux_message * tail;
+    // Bytes of those messages not yet sent.
+    size_t queued;
+
+    // Bytes the channel may still send before the next channel of its
+    // priority takes a turn.
+    long deficit;
+    // Boolean flag: it is this channel's turn among those of its priority.
+    int turn;
+
+    // The chunks of the message being received.
+    unsigned char * partial;
+    size_t partialLength;
+    size_t partialCapacity;
+} mux_channel;
+
+struct mux_link {
+    nxt_conn * conn;
+
+    size_t chunkSize;
+    size_t maxQueued;
+
+    // Protects the send queues and the scheduling state.
+    pthread_mutex_t lock;
+
+    mux_channel channels[MUX_CHANNELS];
+
+    // A chunk and its header, being sent.
+    unsigned char * packet;
+    uint16_t packetLength;
+    // Boolean flag: the packet failed to send, and must be sent again.
+    int packetPending;
+
+    // Holds packets received that do not fit in the receive ring.
+    unsigned char * scratch;
+};
+
+/*
+ * Choose the channel to send the next chunk, giving it its share of the link.
+ * Must be called with the lock held.
+ * return: The channel, or -1 if nothing is queued.
+ */
+static int next_channel( mux_link * mux );
+
+/*
+ * Copy the next chunk of a channel into the packet, and remove it from the
+ * queue. Must be called with the lock held.
+ */
+static void take_chunk( mux_link * mux, unsigned int channel );
+
+/*
+ * Add a chunk received to the message being received on its channel.
+ * return: LIBNXT_SUCCESS, or
+ *         LIBNXT_OTHER_ERROR if memory could not be allocated, or the message
+ *         would be longer than any message sent; it is discarded.
+ */
+static libnxt_error add_chunk( mux_channel * channel,
+                               const unsigned char * data, size_t length );
+
+static int next_channel( mux_link * mux ) {
+    unsigned int best = 0;
+    int found = 0;
+    unsigned int i;
+    for ( i = 0; i < MUX_CHANNELS; i++ ) {
+        mux_channel * channel = &mux->channels[i];
+        if ( channel->head != NULL &&
+             ( ! found || channel->priority < best ) ) {
+            best = channel->priority;
+            found = 1;
+        }
+    }
+    if ( ! found )
+        return -1;
+
+    // Deficit round robin among the channels of the best priority: a channel
+    // keeps its turn while its deficit lasts, and each channel is granted its
+    // weight in chunks as its turn comes. Each priority keeps its own turn, so
+    // urgent traffic does not disturb the shares of the channels it preempts.
+    unsigned int current = MUX_CHANNELS - 1;
+    for ( i = 0; i < MUX_CHANNELS; i++ ) {
+        mux_channel * channel = &mux->channels[i];
+        if ( channel->turn && channel->priority == best ) {
+            if ( channel->head != NULL && channel->deficit > 0 )
+                return (int) i;
+            channel->turn = 0;
+            current = i;
+            break;
+        }
+    }
+    for ( ;; ) {
+        current = ( current + 1 ) % MUX_CHANNELS;
+        mux_channel * channel = &mux->channels[current];
+        if ( channel->head == NULL || channel->priority != best )
+            continue;
+        channel->deficit += (long) ( channel->weight * mux->chunkSize );
+        if ( channel->deficit > 0 ) {
+            channel->turn = 1;
+            return (int) current;
+        }
+    }
+}
+
+static void take_chunk( mux_link * mux, unsigned int channel ) {
+    mux_channel * queue = &mux->channels[channel];
+    mux_message * message = queue->head;
+    size_t length = message->length - message->sent;
+    if ( length > mux->chunkSize )
+        length = mux->chunkSize;
+
+    mux->packet[0] = (unsigned char) channel;
+    if ( message->sent + length < message->length )
+        mux->packet[0] |= MUX_MORE;
+    memcpy( mux->packet + MUX_HEADER_SIZE, message->data + message->sent,
+            length );
+    mux->packetLength = (uint16_t) ( MUX_HEADER_SIZE + length );
+    mux->packetPending = 1;
+
+    message->sent = (uint16_t) ( message->sent + length );
+    queue->queued -= length;
+    queue->deficit -= (long) length;
+    if ( message->sent == message->length ) {
+        queue->head = message->next;
+        if ( queue->head == NULL ) {
+            queue->tail = NULL;
+            // An idle channel does not save up its share.
+            queue->deficit = 0;
+        }
+        free( message );
+    }
+}
+
+static libnxt_error add_chunk( mux_channel * channel,
+                               const unsigned char * data, size_t length ) {
+    size_t needed = channel->partialLength + length;
+    if ( needed > UINT16_MAX ) {
+        channel->partialLength = 0;
+        return LIBNXT_OTHER_ERROR;
+    }
+    if ( needed > channel->partialCapacity ) {
+        size_t capacity = channel->partialCapacity * 2;
+        if ( capacity < needed )
+            capacity = needed;
+        unsigned char * partial =
+            (unsigned char *) realloc( channel->partial, capacity );
+        if ( partial == NULL )
+            return LIBNXT_OTHER_ERROR;
+        channel->partial = partial;
+        channel->partialCapacity = capacity;
+    }
+    memcpy( channel->partial + channel->partialLength, data, length );
+    channel->partialLength = needed;
+    return LIBNXT_SUCCESS;
+}
+
+libnxt_error open_mux( nxt_conn * conn, const mux_options * options,
+                       mux_link ** mux ) {
+    *mux = NULL;
+    size_t chunkSize = DEFAULT_CHUNK_SIZE;
+    size_t maxQueued = 0;
+    if ( options != NULL ) {
+        if ( options->chunkSize > 0 )
+            chunkSize = options->chunkSize;
+        maxQueued = options->maxQueued;
+    }
+    if ( chunkSize + MUX_HEADER_SIZE > UINT16_MAX )
+        return LIBNXT_ILLEGAL_ARG;
+
+    mux_link * ret = (mux_link *) calloc( 1, sizeof ( mux_link ) );
+    if ( ret == NULL )
+        return LIBNXT_OTHER_ERROR;
+    // The packet being sent, then the scratch space.
+    ret->packet = (unsigned char *)
+        malloc( 2 * ( chunkSize + MUX_HEADER_SIZE ) );
+    if ( ret->packet == NULL || pthread_mutex_init( &ret->lock, NULL ) ) {
+        free( ret->packet );
+        free( ret );
+        return LIBNXT_OTHER_ERROR;
+    }
+    ret->scratch = ret->packet + chunkSize + MUX_HEADER_SIZE;
+
+    unsigned int i;
+    for ( i = 0; i < MUX_CHANNELS; i++ )
+        ret->channels[i].weight = 1;
+    ret->conn = conn;
+    ret->chunkSize = chunkSize;
+    ret->maxQueued = maxQueued;
+    *mux = ret;
+    return LIBNXT_SUCCESS;
+}
+
+void close_mux( mux_link * mux ) {
+    if ( mux == NULL )
+        return;
+    unsigned int i;
+    for ( i = 0; i < MUX_CHANNELS; i++ ) {
+        mux_message * message = mux->channels[i].head;
+        while ( message != NULL ) {
+            mux_message * next = message->next;
+            free( message );
+            message = next;
+        }
+        free( mux->channels[i].partial );
+    }
+    pthread_mutex_destroy( &mux->lock );
+    free( mux->packet );
+    free( mux );
+}
+
+libnxt_error mux_configure( mux_link * mux, unsigned int channel,
+                            unsigned int priority, unsigned int weight ) {
+    if ( channel >= MUX_CHANNELS || weight == 0 )
+        return LIBNXT_ILLEGAL_ARG;
+    pthread_mutex_lock( &mux->lock );
+    mux->channels[channel].priority = priority;
+    mux->channels[channel].weight = weight;
+    pthread_mutex_unlock( &mux->lock );
+    return LIBNXT_SUCCESS;
+}
+
+libnxt_error mux_send( mux_link * mux, unsigned int channel,
+                       const unsigned char * message, uint16_t length ) {
+    if ( channel >= MUX_CHANNELS )
+        return LIBNXT_ILLEGAL_ARG;
+    mux_message * queued =
+        (mux_message *) malloc( sizeof ( mux_message ) + length );
+    if ( queued == NULL )
+        return LIBNXT_OTHER_ERROR;
+    queued->next = NULL;
+    queued->length = length;
+    queued->sent = 0;
+    memcpy( queued->data, message, length );
+
+    pthread_mutex_lock( &mux->lock );
+    mux_channel * queue = &mux->channels[channel];
+    if ( mux->maxQueued > 0 && queue->queued + length > mux->maxQueued &&
+         queue->head != NULL ) {
+        pthread_mutex_unlock( &mux->lock );
+        free( queued );
+        return LIBNXT_TIMEOUT;
+    }
+    if ( queue->tail == NULL )
+        queue->head = queued;
+    else
+        queue->tail->next = queued;
+    queue->tail = queued;
+    queue->queued += length;
+    pthread_mutex_unlock( &mux->lock );
+    return LIBNXT_SUCCESS;
+}
+
+libnxt_error mux_pump( mux_link * mux, size_t maxChunks ) {
+    libnxt_error errorCode = LIBNXT_NO_EFFECT;
+    size_t sent;
+    for ( sent = 0; maxChunks == 0 || sent < maxChunks; sent++ ) {
+        if ( ! mux->packetPending ) {
+            pthread_mutex_lock( &mux->lock );
+            int channel = next_channel( mux );
+            if ( channel >= 0 )
+                take_chunk( mux, (unsigned int) channel );
+            pthread_mutex_unlock( &mux->lock );
+            if ( channel < 0 )
+                break;
+        }
+        // The lock is not held while sending, so messages can be queued
+        // meanwhile; only this thread changes the packet.
+        libnxt_error sendError = conn_send( mux->conn, mux->packet,
+                                            mux->packetLength );
+        if ( sendError )
+            return sendError;
+        mux->packetPending = 0;
+        errorCode = LIBNXT_SUCCESS;
+    }
+    return errorCode;
+}
+
+size_t mux_queued( mux_link * mux, unsigned int channel ) {
+    if ( channel >= MUX_CHANNELS )
+        return 0;
+    pthread_mutex_lock( &mux->lock );
+    size_t queued = mux->channels[channel].queued;
+    pthread_mutex_unlock( &mux->lock );
+    return queued;
+}
+
+libnxt_error mux_receive( mux_link * mux, int * channel,
+                          unsigned char ** message, uint16_t * length ) {
+    *channel = -1;
+    *message = NULL;
+    *length = 0;
+    for ( ;; ) {
+        message_view view;
+        libnxt_error errorCode = conn_receive_view(
+            mux->conn, mux->scratch, mux->chunkSize + MUX_HEADER_SIZE, &view );
+        if ( errorCode == LIBNXT_ILLEGAL_ARG )
+            return LIBNXT_OTHER_ERROR;
+        if ( errorCode )
+            return errorCode;
+        if ( view.length == 0 )
+            return LIBNXT_SUCCESS;
+
+        unsigned int id = view.data[0] & ~MUX_MORE;
+        int more = view.data[0] & MUX_MORE;
+        if ( id >= MUX_CHANNELS ) {
+            conn_release_view( mux->conn );
+            return LIBNXT_OTHER_ERROR;
+        }
+        mux_channel * queue = &mux->channels[id];
+        errorCode = add_chunk( queue, view.data + MUX_HEADER_SIZE,
+                               view.length - MUX_HEADER_SIZE );
+        conn_release_view( mux->conn );
+        if ( errorCode )
+            return errorCode;
+        if ( more )
+            continue;
+
+        // Hand the buffer over whole, and start the next message afresh.
+        if ( queue->partial == NULL ) {
+            queue->partial = (unsigned char *) malloc( 1 );
+            queue->partialCapacity = 1;
+            if ( queue->partial == NULL ) {
+                queue->partialCapacity = 0;
+                return LIBNXT_OTHER_ERROR;
+            }
+        }
+        *channel = (int) id;
+        *message = queue->partial;
+        *length = (uint16_t) queue->partialLength;
+        queue->partial = NULL;
+        queue->partialLength = 0;
+        queue->partialCapacity = 0;
+        return LIBNXT_SUCCESS;
+    }
+}
@@ -0,0 +1,171 @@
+/*! \file
+ * \brief Logical channels with priorities over one packet-mode connection.
+ *
+ * Traffic of different kinds, such as control commands, reports and bulk map
+ * uploads, is sent on separate channels, each with its own queue. Messages are
+ * split into chunks, and a scheduler chooses the next chunk to send: always
+ * from the channels of the highest priority that have data queued, shared
+ * between them by deficit round robin in proportion to their weights. An
+ * urgent message therefore waits behind at most one chunk of bulk data, however
+ * large the upload, while bulk data streams at full rate when nothing else is
+ * queued.
+ *
+ * Each chunk is carried in one packet, behind a one-byte header: the channel
+ * in the low 7 bits, and `#MUX_MORE` set if further chunks of the message
+ * follow. The receiver reassembles the chunks of each channel.
+ *
+ * Messages may be queued from any thread, but only one thread at a time may
+ * call `mux_pump()`, and only one `mux_receive()`.
+ */
+#ifndef MUX_H
+#define MUX_H
+#include "messaging.h"
+
+/*! \def MUX_CHANNELS
+ * The number of channels.
+ */
+#define MUX_CHANNELS 16
+
+/*! \def MUX_MORE
+ * Flag of the header of a chunk that is not the last of its message.
+ */
+#define MUX_MORE 0x80
+
+/*! \def MUX_HEADER_SIZE
+ * Size of the header in front of each chunk.
+ */
+#define MUX_HEADER_SIZE 1
+
+/*! \brief A set of logical channels over a connection.
+ *
+ * Obtained using `open_mux()` and released using `close_mux()`.
+ */
+typedef struct mux_link mux_link;
+
+/*! \brief Settings for a set of channels, given when it is opened.
+ *
+ * Fields left as 0 take their default values. Both ends must use the same
+ * chunk size.
+ */
+typedef struct mux_options {
+    /*! Largest number of bytes of a message sent in one packet; bounds how
+     * long an urgent message waits behind bulk data. Defaults to 256. */
+    size_t chunkSize;
+    /*! Largest number of bytes that may be queued on each channel before
+     * `mux_send()` refuses more. Defaults to no limit. */
+    size_t maxQueued;
+} mux_options;
+
+/*! \brief Open a set of channels over a connection.
+ *
+ * Every channel starts with priority 0 and weight 1. The other end must open
+ * a set of channels too, and all messages on the connection must pass through
+ * them while they are open.
+ * \param [in] conn The connection, which remains owned by the caller.
+ * \param [in] options Settings, or NULL for the defaults.
+ * \param [out] mux Output location for the opened channels. Set to NULL when
+ * the return code is non-zero, indicating an error.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_ILLEGAL_ARG} if a chunk would not fit in a packet
+ *
+ * \linkerror{LIBNXT_OTHER_ERROR} if memory could not be allocated.
+ * \endparblock
+ */
+libnxt_error open_mux( nxt_conn * conn, const mux_options * options,
+                       mux_link ** mux );
+
+/*! \brief Close a set of channels, leaving the connection open.
+ *
+ * Messages still queued are discarded; call `mux_pump()` first to send them.
+ */
+void close_mux( mux_link * mux );
+
+/*! \brief Set how a channel is scheduled.
+ *
+ * \param [in] mux
+ * \param [in] channel The channel, less than `#MUX_CHANNELS`.
+ * \param [in] priority 0 for the most urgent traffic; higher values are sent
+ * only while no channel of a lower value has data queued.
+ * \param [in] weight The share of the link a channel gets relative to other
+ * channels of the same priority, from 1.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_ILLEGAL_ARG} if `channel` or `weight` is out of range.
+ * \endparblock
+ */
+libnxt_error mux_configure( mux_link * mux, unsigned int channel,
+                            unsigned int priority, unsigned int weight );
+
+/*! \brief Queue a message on a channel.
+ *
+ * Does not block: the message is copied, and sent by `mux_pump()`.
+ * \param [in] mux
+ * \param [in] channel The channel, less than `#MUX_CHANNELS`.
+ * \param [in] message The message to send.
+ * \param [in] length Size of the message in bytes.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_ILLEGAL_ARG} if `channel` is out of range
+ *
+ * \linkerror{LIBNXT_TIMEOUT} if the channel already has the most data queued
+ * that it may
+ *
+ * \linkerror{LIBNXT_OTHER_ERROR} if memory could not be allocated.
+ * \endparblock
+ */
+libnxt_error mux_send( mux_link * mux, unsigned int channel,
+                       const unsigned char * message, uint16_t length );
+
+/*! \brief Send queued chunks, in the order chosen by the scheduler.
+ *
+ * The choice is made afresh for each chunk, so a message queued meanwhile on
+ * a channel of higher priority goes next.
+ * \param [in] mux
+ * \param [in] maxChunks The most chunks to send, or 0 to send until every
+ * queue is empty.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_NO_EFFECT} if nothing was queued
+ *
+ * Any error returned by `conn_send()`; the chunk is sent again by the next
+ * call.
+ * \endparblock
+ */
+libnxt_error mux_pump( mux_link * mux, size_t maxChunks );
+
+/*! \brief Count the bytes of messages queued on a channel and not yet sent.
+ */
+size_t mux_queued( mux_link * mux, unsigned int channel );
+
+/*! \brief Receive the next whole message on any channel.
+ *
+ * \param [in] mux
+ * \param [out] channel Output location for the channel of the message, or -1
+ * if the other end has closed the connection.
+ * \param [out] message Output location for the message, which the caller must
+ * release with `free_message()`.
+ * \param [out] length Output location for the size of the message; 0 if the
+ * other end has closed the connection.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_OTHER_ERROR} if memory could not be allocated
+ *
+ * Any error returned by `conn_receive_view()`; chunks received so far are
+ * kept for the next call.
+ * \endparblock
+ */
+libnxt_error mux_receive( mux_link * mux, int * channel,
+                          unsigned char ** message, uint16_t * length );
+
+#endif
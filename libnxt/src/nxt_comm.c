@@ -1,47 +1,447 @@
 #include "nxt_comm.h"
 #include "nxt_usb.h"
+#include "stats.h"
+#include <string.h>
+#include <time.h>
 
-static libusb_device_handle * handle = NULL;
+struct nxt_comm {
+    const nxt_transport * transport;
+    void * state;
+    // How long the link took to open.
+    startup_timing timing;
+};
 
-libnxt_error open_comm( void ) {
-    if ( handle != NULL )
-        return LIBNXT_NO_EFFECT;
+// State of a link implemented by the USB transport.
+typedef struct usb_link {
+    libusb_device_handle * handle;
+    // Reads in flight in asynchronous mode, otherwise NULL.
+    nxt_async * async;
+    // Number of reads kept in flight in asynchronous mode, otherwise 0.
+    size_t depth;
+    // Where the NXT was found, to find it again: its bus and port, with a
+    // port of 0 if unknown, and its index among the NXTs found.
+    uint8_t bus;
+    uint8_t port;
+    size_t index;
+    // Set by the hot-plug callback when an NXT arrives.
+    int arrived;
+} usb_link;
+
+// The link used by the functions that do not take an nxt_comm.
+static nxt_comm * defaultComm = NULL;
+
+/*
+ * Convert the error code returned by libusb when opening a device.
+ */
+static libnxt_error open_error( int errorCode );
+
+/*
+ * Open a USB link to the NXT on the given port, or if port is 0, to the NXT
+ * at the given index; see open_comm_at() and open_comm_on_port().
+ */
+static libnxt_error open_usb( size_t index, uint8_t bus, uint8_t port,
+                              nxt_comm ** comm );
+
+/*
+ * Operations of the USB transport; state is a usb_link.
+ */
+static libnxt_error usb_read( void * state, unsigned char * buf, size_t offset,
+                              size_t maxLength, int timeout,
+                              int * transferred );
+static libnxt_error usb_write( void * state, unsigned char * buf,
+                               size_t offset, size_t length, int timeout,
+                               int * transferred );
+static libnxt_error usb_set_async( void * state, size_t depth );
+static void usb_close( void * state );
+static libnxt_error usb_reopen( void * state, int timeout );
+
+static const nxt_transport USB_TRANSPORT = {
+    usb_read, usb_write, usb_set_async, usb_close, usb_reopen
+};
+
+/*
+ * Open the NXT that a USB link was opened on, if it is connected.
+ * return: LIBNXT_NOT_VISIBLE if it is not connected, otherwise as
+ *         open_comm_at().
+ */
+static libnxt_error find_again( usb_link * link );
+
+/*
+ * Note the arrival of an NXT; userData is a usb_link.
+ */
+static int LIBUSB_CALL nxt_arrived( libusb_context * context,
+                                    libusb_device * device,
+                                    libusb_hotplug_event event,
+                                    void * userData );
+
+/*
+ * The time of a monotonic clock, in ms.
+ */
+static long long now_ms( void );
+
+/*
+ * Time elapsed since the given time on the monotonic clock, in us.
+ */
+static long elapsed_us( const struct timespec * since );
+
+/*
+ * Read in asynchronous mode; see comm_set_async().
+ */
+static libnxt_error async_read( usb_link * link, unsigned char * buf,
+                                size_t offset, size_t maxLength, int timeout,
+                                int * transferred );
+
+/*
+ * Convert the error code returned by libusb during I/O.
+ */
+static libnxt_error io_error( int errorCode );
+
+static libnxt_error open_error( int errorCode ) {
+    switch ( errorCode ) {
+        case LIBUSB_SUCCESS:
+            return LIBNXT_SUCCESS;
+        case LIBUSB_ERROR_NOT_FOUND:
+            return LIBNXT_NOT_VISIBLE;
+        case LIBUSB_ERROR_NO_DEVICE:
+            return LIBNXT_DISCONNECTED;
+        default:
+            return LIBNXT_DEPENDENT_ERROR;
+    }
+}
+
+static libnxt_error io_error( int errorCode ) {
+    return ( errorCode == LIBUSB_ERROR_NO_DEVICE ? LIBNXT_DISCONNECTED :
+                                                   LIBNXT_IO_ERROR );
+}
+
+static libnxt_error async_read( usb_link * link, unsigned char * buf,
+                                size_t offset, size_t maxLength, int timeout,
+                                int * transferred ) {
+    int errorCode = read_async_nxt( link->async, buf, offset, maxLength,
+                                    transferred );
+    if ( errorCode == LIBUSB_ERROR_TIMEOUT && ! timeout ) {
+        errorCode = wait_async_nxt( link->async, 0 );
+        if ( ! errorCode )
+            errorCode = read_async_nxt( link->async, buf, offset, maxLength,
+                                        transferred );
+    }
+
+    switch ( errorCode ) {
+        case LIBUSB_SUCCESS:
+            return LIBNXT_SUCCESS;
+        case LIBUSB_ERROR_TIMEOUT:
+            *transferred = 0;
+            return LIBNXT_TIMEOUT;
+        default:
+            return io_error( errorCode );
+    }
+}
+
+libnxt_error count_comms( size_t * count ) {
+    int errorCode = libusb_init( NULL );
+    if ( errorCode )
+        return LIBNXT_DEPENDENT_ERROR;
+
+    libusb_device ** nxts;
+    errorCode = find_nxts( &nxts, count );
+    if ( ! errorCode )
+        forget_nxts( nxts, *count );
+    libusb_exit( NULL );
+
+    if ( errorCode == LIBUSB_ERROR_NOT_FOUND ) {
+        *count = 0;
+        return LIBNXT_SUCCESS;
+    }
+    return ( errorCode ? LIBNXT_DEPENDENT_ERROR : LIBNXT_SUCCESS );
+}
+
+libnxt_error open_comm_at( size_t index, nxt_comm ** comm ) {
+    return open_usb( index, 0, 0, comm );
+}
+
+libnxt_error open_comm_on_port( uint8_t bus, uint8_t port, nxt_comm ** comm ) {
+    *comm = NULL;
+    if ( port == 0 )
+        return LIBNXT_ILLEGAL_ARG;
+    return open_usb( 0, bus, port, comm );
+}
+
+static libnxt_error open_usb( size_t index, uint8_t bus, uint8_t port,
+                              nxt_comm ** comm ) {
+    *comm = NULL;
+    startup_timing timing;
+    memset( &timing, 0, sizeof ( timing ) );
+    struct timespec start;
+    struct timespec phase;
+    clock_gettime( CLOCK_MONOTONIC, &start );
 
     int errorCode = libusb_init( NULL );
     if ( errorCode )
         return LIBNXT_DEPENDENT_ERROR;
 
     libusb_set_debug( NULL, 3 );
+    timing.init = elapsed_us( &start );
 
+    clock_gettime( CLOCK_MONOTONIC, &phase );
     libusb_device * nxt;
-    errorCode = find_nxt( &nxt );
-    if ( errorCode )
-		return ( errorCode == LIBUSB_ERROR_NOT_FOUND ? LIBNXT_NOT_VISIBLE :
-		                                               LIBNXT_DEPENDENT_ERROR );
+    if ( port > 0 ) {
+        errorCode = find_nxt_on_port( bus, port, &nxt );
+        if ( errorCode ) {
+            libusb_exit( NULL );
+            return open_error( errorCode );
+        }
+    } else {
+        libusb_device ** nxts;
+        size_t count;
+        errorCode = find_nxts( &nxts, &count );
+        if ( errorCode ) {
+            libusb_exit( NULL );
+            return open_error( errorCode );
+        }
+        if ( index >= count ) {
+            forget_nxts( nxts, count );
+            libusb_exit( NULL );
+            return LIBNXT_NOT_VISIBLE;
+        }
+        // Keep a reference to the chosen NXT once the rest are forgotten.
+        nxt = libusb_ref_device( nxts[index] );
+        forget_nxts( nxts, count );
+    }
+    timing.enumerate = elapsed_us( &phase );
+
+    usb_link * link = (usb_link *) calloc( 1, sizeof ( usb_link ) );
+    if ( link == NULL ) {
+        forget_nxt( nxt );
+        libusb_exit( NULL );
+        return LIBNXT_OTHER_ERROR;
+    }
+    link->bus = libusb_get_bus_number( nxt );
+    link->port = libusb_get_port_number( nxt );
+    link->index = index;
 
-    errorCode = open_nxt( nxt, &handle );
+    nxt_open_timing steps;
+    errorCode = open_nxt_timed( nxt, &link->handle, &steps );
     if ( errorCode ) {
         forget_nxt( nxt );
-        return ( errorCode == LIBUSB_ERROR_NO_DEVICE ? LIBNXT_DISCONNECTED :
-                                                       LIBNXT_DEPENDENT_ERROR );
+        free( link );
+        libusb_exit( NULL );
+        return open_error( errorCode );
     }
+    timing.open = steps.open;
+    timing.configure = steps.configure;
+    timing.drain = steps.drain;
+
+    libnxt_error ret = open_comm_with( &USB_TRANSPORT, link, comm );
+    if ( ! ret ) {
+        timing.total = elapsed_us( &start );
+        ( *comm )->timing = timing;
+    }
+    return ret;
+}
 
+libnxt_error open_comm_with( const nxt_transport * transport, void * state,
+                             nxt_comm ** comm ) {
+    *comm = NULL;
+    if ( transport == NULL || transport->read == NULL ||
+         transport->write == NULL || transport->close == NULL )
+        return LIBNXT_ILLEGAL_ARG;
+
+    nxt_comm * ret = (nxt_comm *) malloc( sizeof ( nxt_comm ) );
+    if ( ret == NULL ) {
+        transport->close( state );
+        return LIBNXT_OTHER_ERROR;
+    }
+    ret->transport = transport;
+    ret->state = state;
+    memset( &ret->timing, 0, sizeof ( startup_timing ) );
+    *comm = ret;
     return LIBNXT_SUCCESS;
 }
 
-void close_comm( void ) {
-    if ( handle != NULL ) {
-		libusb_device * nxt = libusb_get_device( handle );
-        close_handle( handle );
+void * comm_state( nxt_comm * comm, const nxt_transport * transport ) {
+    if ( comm == NULL || comm->transport != transport )
+        return NULL;
+    return comm->state;
+}
+
+libnxt_error comm_get_port( nxt_comm * comm, uint8_t * bus, uint8_t * port ) {
+    if ( comm == NULL )
+        return LIBNXT_NOT_OPENED;
+
+    usb_link * link = (usb_link *) comm_state( comm, &USB_TRANSPORT );
+    if ( link == NULL || link->port == 0 )
+        return LIBNXT_OTHER_ERROR;
+    *bus = link->bus;
+    *port = link->port;
+    return LIBNXT_SUCCESS;
+}
+
+void comm_get_startup_timing( nxt_comm * comm, startup_timing * timing ) {
+    *timing = comm->timing;
+}
+
+void close_comm_at( nxt_comm * comm ) {
+    if ( comm != NULL ) {
+        comm->transport->close( comm->state );
+        free( comm );
+    }
+}
+
+static void usb_close( void * state ) {
+    usb_link * link = (usb_link *) state;
+    usb_set_async( link, 0 );
+    // The handle is NULL if the link could not be opened again.
+    if ( link->handle != NULL ) {
+        libusb_device * nxt = libusb_get_device( link->handle );
+        close_handle( link->handle );
         forget_nxt( nxt );
-        libusb_exit( NULL );
-        handle = NULL;
     }
+    libusb_exit( NULL );
+    free( link );
 }
 
-libnxt_error raw_read( unsigned char * buf, size_t offset, size_t maxLength,
-                       int timeout, int * transferred ) {
-    if ( handle == NULL )
+libnxt_error comm_reopen( nxt_comm * comm, int timeout ) {
+    if ( comm == NULL )
+        return LIBNXT_NOT_OPENED;
+
+    if ( comm->transport->reopen == NULL )
+        return LIBNXT_OTHER_ERROR;
+    return comm->transport->reopen( comm->state, timeout );
+}
+
+static libnxt_error usb_reopen( void * state, int timeout ) {
+    usb_link * link = (usb_link *) state;
+    size_t depth = link->depth;
+    usb_set_async( link, 0 );
+    if ( link->handle != NULL ) {
+        libusb_device * nxt = libusb_get_device( link->handle );
+        close_handle( link->handle );
+        forget_nxt( nxt );
+        link->handle = NULL;
+    }
+
+    // Arrivals are noted from before the first search, so that none is
+    // missed between a search and the wait after it.
+    libusb_hotplug_callback_handle callback;
+    int hotplug = libusb_has_capability( LIBUSB_CAP_HAS_HOTPLUG ) &&
+                  ! libusb_hotplug_register_callback(
+                        NULL, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED,
+                        LIBUSB_HOTPLUG_NO_FLAGS, VENDOR_LEGO, PRODUCT_NXT,
+                        LIBUSB_HOTPLUG_MATCH_ANY, nxt_arrived, link,
+                        &callback );
+
+    long long deadline = now_ms() + timeout;
+    libnxt_error errorCode;
+    for ( ;; ) {
+        link->arrived = 0;
+        errorCode = find_again( link );
+        if ( ! errorCode )
+            break;
+
+        // Wait for the NXT to arrive, but poll for an NXT that is there but
+        // could not be opened, as it may just be settling.
+        long long wait = ( hotplug && errorCode == LIBNXT_NOT_VISIBLE ?
+                           60000 : REOPEN_POLL_INTERVAL );
+        if ( timeout ) {
+            long long left = deadline - now_ms();
+            if ( left <= 0 ) {
+                errorCode = LIBNXT_TIMEOUT;
+                break;
+            }
+            if ( wait > left )
+                wait = left;
+        }
+        if ( hotplug ) {
+            struct timeval tv;
+            tv.tv_sec = wait / 1000;
+            tv.tv_usec = ( wait % 1000 ) * 1000;
+            libusb_handle_events_timeout_completed( NULL, &tv,
+                                                    &link->arrived );
+        } else {
+            struct timespec ts;
+            ts.tv_sec = wait / 1000;
+            ts.tv_nsec = ( wait % 1000 ) * 1000000;
+            nanosleep( &ts, NULL );
+        }
+    }
+    if ( hotplug )
+        libusb_hotplug_deregister_callback( NULL, callback );
+
+    if ( ! errorCode && depth > 0 )
+        errorCode = usb_set_async( link, depth );
+    return errorCode;
+}
+
+static libnxt_error find_again( usb_link * link ) {
+    // An NXT in another port may be another robot, so the index is only
+    // trusted if ports cannot be told.
+    libusb_device * nxt = NULL;
+    int errorCode;
+    if ( link->port ) {
+        errorCode = find_nxt_on_port( link->bus, link->port, &nxt );
+        if ( errorCode )
+            return open_error( errorCode );
+    } else {
+        libusb_device ** nxts;
+        size_t count;
+        errorCode = find_nxts( &nxts, &count );
+        if ( errorCode )
+            return open_error( errorCode );
+        if ( link->index < count )
+            nxt = libusb_ref_device( nxts[link->index] );
+        forget_nxts( nxts, count );
+        if ( nxt == NULL )
+            return LIBNXT_NOT_VISIBLE;
+    }
+
+    errorCode = open_nxt( nxt, &link->handle );
+    if ( errorCode ) {
+        forget_nxt( nxt );
+        return open_error( errorCode );
+    }
+    return LIBNXT_SUCCESS;
+}
+
+static int LIBUSB_CALL nxt_arrived( libusb_context * context,
+                                    libusb_device * device,
+                                    libusb_hotplug_event event,
+                                    void * userData ) {
+    (void) context;
+    (void) device;
+    (void) event;
+    ( (usb_link *) userData )->arrived = 1;
+    // Stay registered until the wait is over.
+    return 0;
+}
+
+static long elapsed_us( const struct timespec * since ) {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return ( now.tv_sec - since->tv_sec ) * 1000000L +
+           ( now.tv_nsec - since->tv_nsec ) / 1000L;
+}
+
+static long long now_ms( void ) {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+libnxt_error open_comm( void ) {
+    if ( defaultComm != NULL )
+        return LIBNXT_NO_EFFECT;
+
+    return open_comm_at( 0, &defaultComm );
+}
+
+void close_comm( void ) {
+    close_comm_at( defaultComm );
+    defaultComm = NULL;
+}
+
+libnxt_error comm_read( nxt_comm * comm, unsigned char * buf, size_t offset,
+                        size_t maxLength, int timeout, int * transferred ) {
+    if ( comm == NULL )
         return LIBNXT_NOT_OPENED;
 
     if ( maxLength == 0 ) {
@@ -49,16 +449,61 @@ libnxt_error raw_read( unsigned char * buf, size_t offset, size_t maxLength,
         return LIBNXT_NO_EFFECT;
 	}
 
+    libnxt_error errorCode = comm->transport->read( comm->state, buf, offset,
+                                                    maxLength, timeout,
+                                                    transferred );
+    if ( errorCode == LIBNXT_SUCCESS || errorCode == LIBNXT_TIMEOUT ) {
+        stats_count( STAT_BYTES_RECEIVED, *transferred );
+        if ( (size_t) *transferred < maxLength )
+            stats_count( STAT_SHORT_READS, 1 );
+    }
+    return errorCode;
+}
+
+libnxt_error comm_write( nxt_comm * comm, unsigned char * buf, size_t offset,
+                         size_t length, int timeout, int * transferred ) {
+    if ( comm == NULL )
+        return LIBNXT_NOT_OPENED;
+
+    if ( length == 0 ) {
+		*transferred = 0;
+        return LIBNXT_NO_EFFECT;
+	}
+
+    libnxt_error errorCode = comm->transport->write( comm->state, buf, offset,
+                                                     length, timeout,
+                                                     transferred );
+    if ( errorCode == LIBNXT_SUCCESS || errorCode == LIBNXT_TIMEOUT ) {
+        stats_count( STAT_BYTES_SENT, *transferred );
+        if ( (size_t) *transferred < length )
+            stats_count( STAT_SHORT_WRITES, 1 );
+    }
+    return errorCode;
+}
+
+static libnxt_error usb_read( void * state, unsigned char * buf, size_t offset,
+                              size_t maxLength, int timeout,
+                              int * transferred ) {
+    usb_link * link = (usb_link *) state;
+    if ( link->handle == NULL )
+        return LIBNXT_DISCONNECTED;
+    if ( link->async != NULL )
+        return async_read( link, buf, offset, maxLength, timeout, transferred );
+
     int unfinished = 0;
     int errorCode;
     int total = 0;
     int read;
     int ioError = 0;
     int waitForData = ! timeout;
+    int attempts = 0;
     do {
+        if ( attempts++ > 0 )
+            stats_count( unfinished ? STAT_UNFINISHED_READS :
+                                      STAT_TIMEOUT_RETRIES, 1 );
 		read = 0;
-        errorCode = bulk_read_nxt( handle, buf, offset + total,
-                                   maxLength - total, &read );
+        errorCode = bulk_read_nxt( link->handle, buf, offset + total,
+                                   maxLength - total, timeout, &read );
         if ( errorCode && errorCode != LIBUSB_ERROR_TIMEOUT ) {
 			ioError = 1;
 		} else {
@@ -83,25 +528,24 @@ libnxt_error raw_read( unsigned char * buf, size_t offset, size_t maxLength,
     }
 }
 
-libnxt_error raw_write( unsigned char * buf, size_t offset, size_t length,
-                        int timeout, int * transferred ) {
-    if ( handle == NULL )
-        return LIBNXT_NOT_OPENED;
-
-    if ( length == 0 ) {
-		*transferred = 0;
-        return LIBNXT_NO_EFFECT;
-	}
-
+static libnxt_error usb_write( void * state, unsigned char * buf,
+                               size_t offset, size_t length, int timeout,
+                               int * transferred ) {
+    usb_link * link = (usb_link *) state;
+    if ( link->handle == NULL )
+        return LIBNXT_DISCONNECTED;
     int errorCode;
     int total = 0;
     int written;
     int ioError = 0;
     int waitForData = ! timeout;
+    int attempts = 0;
     do {
+        if ( attempts++ > 0 )
+            stats_count( STAT_TIMEOUT_RETRIES, 1 );
 		written = 0;
-        errorCode = bulk_write_nxt( handle, buf, offset + total, length - total,
-                                    &written );
+        errorCode = bulk_write_nxt( link->handle, buf, offset + total,
+                                    length - total, timeout, &written );
         if ( errorCode && errorCode != LIBUSB_ERROR_TIMEOUT ) {
             ioError = 1;
         } else {
@@ -118,3 +562,74 @@ libnxt_error raw_write( unsigned char * buf, size_t offset, size_t length,
                                                      LIBNXT_SUCCESS );
     }
 }
+
+libnxt_error comm_set_async( nxt_comm * comm, size_t depth ) {
+    if ( comm == NULL )
+        return LIBNXT_NOT_OPENED;
+
+    if ( comm->transport->set_async == NULL )
+        return LIBNXT_OTHER_ERROR;
+    return comm->transport->set_async( comm->state, depth );
+}
+
+static libnxt_error usb_set_async( void * state, size_t depth ) {
+    usb_link * link = (usb_link *) state;
+    if ( depth == 0 ) {
+        if ( link->async == NULL )
+            return LIBNXT_NO_EFFECT;
+        stop_async_reads( link->async );
+        link->async = NULL;
+        link->depth = 0;
+        return LIBNXT_SUCCESS;
+    }
+
+    if ( link->async != NULL )
+        return LIBNXT_NO_EFFECT;
+    if ( link->handle == NULL )
+        return LIBNXT_DISCONNECTED;
+    int errorCode = start_async_reads( link->handle, depth, &link->async );
+    if ( errorCode )
+        return ( errorCode == LIBUSB_ERROR_NO_DEVICE ? LIBNXT_DISCONNECTED :
+                                                       LIBNXT_DEPENDENT_ERROR );
+    link->depth = depth;
+    return LIBNXT_SUCCESS;
+}
+
+libnxt_error get_comm_pollfds( struct pollfd * fds, size_t maxCount,
+                               size_t * count ) {
+    const struct libusb_pollfd ** usbFds = libusb_get_pollfds( NULL );
+    if ( usbFds == NULL )
+        return LIBNXT_DEPENDENT_ERROR;
+
+    size_t i;
+    for ( i = 0; usbFds[i] != NULL; i++ ) {
+        if ( i < maxCount ) {
+            fds[i].fd = usbFds[i]->fd;
+            fds[i].events = usbFds[i]->events;
+            fds[i].revents = 0;
+        }
+    }
+    *count = i;
+    libusb_free_pollfds( usbFds );
+    return LIBNXT_SUCCESS;
+}
+
+libnxt_error handle_comm_events( int timeout ) {
+    struct timeval tv;
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = ( timeout % 1000 ) * 1000;
+    int errorCode = libusb_handle_events_timeout( NULL, &tv );
+    return ( errorCode && errorCode != LIBUSB_ERROR_INTERRUPTED ?
+             LIBNXT_DEPENDENT_ERROR : LIBNXT_SUCCESS );
+}
+
+libnxt_error raw_read( unsigned char * buf, size_t offset, size_t maxLength,
+                       int timeout, int * transferred ) {
+    return comm_read( defaultComm, buf, offset, maxLength, timeout,
+                      transferred );
+}
+
+libnxt_error raw_write( unsigned char * buf, size_t offset, size_t length,
+                        int timeout, int * transferred ) {
+    return comm_write( defaultComm, buf, offset, length, timeout, transferred );
+}
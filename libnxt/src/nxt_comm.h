@@ -3,16 +3,230 @@
  * NXT.
  *
  * Abstracts the medium of physical connection between the Galileo and an NXT,
- * allowing for implementations that use USB or bluethooth. Intended for
- * use when a single NXT is connected to the Galileo. All functions return
- * `#libnxt_error` codes.
- * codes.
+ * allowing for implementations that use USB or bluethooth. Each link to an NXT
+ * is represented by an `nxt_comm`, so that several NXTs can be connected to the
+ * Galileo at once. The functions that do not take an `nxt_comm` operate on a
+ * single default link, for use when only one NXT is connected. All functions
+ * return `#libnxt_error` codes.
+ *
+ * Links are implemented by an `nxt_transport`. USB links to physical NXTs are
+ * opened with `open_comm_at()`; other transports, such as those declared in
+ * `loopback.h` and `fd_transport.h`, are opened with `open_comm_with()`.
  */
 
 #ifndef NXT_COMM_H
 #define NXT_COMM_H
 #include "error_codes.h"
+#include <stdint.h>
 #include <stdlib.h>
+#include <poll.h>
+
+/*! \def COMM_TIMEOUT
+ * The timeout, in ms, used for I/O when timeouts are simply enabled, as by
+ * `set_timeout()`.
+ */
+#define COMM_TIMEOUT 20000
+
+/*! \def REOPEN_POLL_INTERVAL
+ * How often, in ms, `comm_reopen()` looks for a USB NXT when libusb cannot
+ * notify it of hot-plugged devices.
+ */
+#define REOPEN_POLL_INTERVAL 100
+
+/*! \brief An open communication link with one NXT.
+ *
+ * Obtained using `open_comm_at()` or `open_comm_with()` and released using
+ * `close_comm_at()`.
+ */
+typedef struct nxt_comm nxt_comm;
+
+/*! \brief How long each phase of opening a connection to an NXT took, in us.
+ *
+ * Phases that were not needed take 0, including every phase of a link not
+ * opened over USB.
+ */
+typedef struct startup_timing {
+    long init; /*!< Initialising libusb. */
+    long enumerate; /*!< Finding the NXT among the USB devices. */
+    long open; /*!< Opening the device. */
+    long configure; /*!< Setting its configuration, unless already set, and
+                     * claiming its interface. */
+    long drain; /*!< Discarding data the NXT sent before it was opened. */
+    long handshake; /*!< Putting the NXT into packet mode. */
+    long negotiation; /*!< Negotiating compression. */
+    long total; /*!< The whole of opening, including the phases above. */
+    int resumed; /*!< Boolean flag: a connection kept open between sessions was
+                  * resumed, so no phase was needed; see
+                  * `set_persistent()`. */
+} startup_timing;
+
+/*! \brief The operations that implement a link over a particular medium.
+ *
+ * Each operation is passed the `state` given to `open_comm_with()`. `read` and
+ * `write` must honour the contracts of `raw_read()` and `raw_write()`, except
+ * that they are never called with a length of 0.
+ */
+typedef struct nxt_transport {
+    /*! Read bytes; see `raw_read()`. */
+    libnxt_error ( * read )( void * state, unsigned char * buf, size_t offset,
+                             size_t maxLength, int timeout, int * transferred );
+    /*! Write bytes; see `raw_write()`. */
+    libnxt_error ( * write )( void * state, unsigned char * buf, size_t offset,
+                              size_t length, int timeout, int * transferred );
+    /*! Switch between blocking and asynchronous reads; see
+     * `comm_set_async()`. May be NULL if unsupported. */
+    libnxt_error ( * set_async )( void * state, size_t depth );
+    /*! Release `state` and any resources it holds. */
+    void ( * close )( void * state );
+    /*! Open the link again after the NXT disconnected; see `comm_reopen()`.
+     * May be NULL if unsupported. */
+    libnxt_error ( * reopen )( void * state, int timeout );
+} nxt_transport;
+
+/*!
+ * \brief Open a link implemented by the given transport.
+ *
+ * \param [in] transport The operations implementing the link. Must remain
+ * valid until the link is closed.
+ * \param [in] state Passed to each operation. Ownership passes to the link,
+ * which releases it with `transport->close` when closed.
+ * \param [out] comm Output location for the opened link. Set to NULL when the
+ * return code is non-zero, indicating an error.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_ILLEGAL_ARG} if `transport` lacks a required operation
+ *
+ * \linkerror{LIBNXT_OTHER_ERROR} if memory could not be allocated; `state` is
+ * released.
+ * \endparblock
+ */
+libnxt_error open_comm_with( const nxt_transport * transport, void * state,
+                             nxt_comm ** comm );
+
+/*!
+ * \brief Get the state of a link, if it is implemented by the given transport.
+ *
+ * Allows a transport to offer operations of its own on its links.
+ * \param [in] comm The link.
+ * \param [in] transport The transport expected to implement the link.
+ * \return The `state` given to `open_comm_with()`, or NULL if `comm` is NULL or
+ * implemented by another transport.
+ */
+void * comm_state( nxt_comm * comm, const nxt_transport * transport );
+
+/*!
+ * \brief Count the NXTs that are physically connected to the Galileo.
+ *
+ * \param [out] count The number of NXTs found.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS} (and populates `count`)
+ *
+ * \linkerror{LIBNXT_DEPENDENT_ERROR} if there was an error in dependent library
+ * \endparblock
+ */
+libnxt_error count_comms( size_t * count );
+
+/*!
+ * \brief Open communications with one of the NXTs that are physically
+ * connected to the Galileo.
+ *
+ * \param [in] index Which of the NXTs counted by `count_comms()` to open.
+ * \param [out] comm Output location for the opened link. Set to NULL when the
+ * return code is non-zero, indicating an error.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_DEPENDENT_ERROR} if there was an error in dependent library
+ *
+ * \linkerror{LIBNXT_NOT_VISIBLE} if fewer than `index` + 1 NXTs are
+ * physically connected
+ *
+ * \linkerror{LIBNXT_DISCONNECTED} if the NXT disconnected during the call.
+ * \endparblock
+ */
+libnxt_error open_comm_at( size_t index, nxt_comm ** comm );
+
+/*!
+ * \brief Open communications with the NXT plugged into the given USB port.
+ *
+ * Faster than `open_comm_at()` where other USB devices are connected, as
+ * only the device on that port is examined.
+ * \param [in] bus The number of the bus, as given by `comm_get_port()`.
+ * \param [in] port The number of the port on its hub, as given by
+ * `comm_get_port()`.
+ * \param [out] comm Output location for the opened link. Set to NULL when the
+ * return code is non-zero, indicating an error.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_ILLEGAL_ARG} if `port` is 0
+ *
+ * \linkerror{LIBNXT_DEPENDENT_ERROR} if there was an error in dependent library
+ *
+ * \linkerror{LIBNXT_NOT_VISIBLE} if no NXT is plugged into the port
+ *
+ * \linkerror{LIBNXT_DISCONNECTED} if the NXT disconnected during the call.
+ * \endparblock
+ */
+libnxt_error open_comm_on_port( uint8_t bus, uint8_t port, nxt_comm ** comm );
+
+/*!
+ * \brief Get the USB port that the NXT of a link is plugged into.
+ *
+ * \param [in] comm The link.
+ * \param [out] bus Output location for the number of the bus.
+ * \param [out] port Output location for the number of the port on its hub.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_NOT_OPENED} if `comm` is NULL
+ *
+ * \linkerror{LIBNXT_OTHER_ERROR} if the link is not over USB, or the port
+ * cannot be told.
+ * \endparblock
+ */
+libnxt_error comm_get_port( nxt_comm * comm, uint8_t * bus, uint8_t * port );
+
+/*!
+ * \brief Get how long each phase of opening a link took.
+ *
+ * Only the phases up to opening the device are filled in; the rest are 0.
+ * \param [in] comm The link.
+ * \param [out] timing Output location for the timing.
+ */
+void comm_get_startup_timing( nxt_comm * comm, startup_timing * timing );
+
+/*!
+ * \brief Close a link obtained using `open_comm_at()` or `open_comm_with()`.
+ *
+ * Release resources and perform necessary clean-up.
+ * \param [in] comm The link to close. Must not be used after this call.
+ */
+void close_comm_at( nxt_comm * comm );
+
+/*! \brief Read bytes from the NXT at the other end of a link.
+ *
+ * Behaves as `raw_read()`, except on the given link.
+ * \param [in] comm The link to read from.
+ * \see raw_read()
+ */
+libnxt_error comm_read( nxt_comm * comm, unsigned char * buf, size_t offset,
+                        size_t maxLength, int timeout, int * transferred );
+
+/*! \brief Write bytes to the NXT at the other end of a link.
+ *
+ * Behaves as `raw_write()`, except on the given link.
+ * \param [in] comm The link to write to.
+ * \see raw_write()
+ */
+libnxt_error comm_write( nxt_comm * comm, unsigned char * buf, size_t offset,
+                         size_t length, int timeout, int * transferred );
 
 /*!
  * \brief Open communications with an NXT if it is physically connected to the
@@ -49,7 +263,8 @@ void close_comm( void );
  * \param [in] offset The index in the buffer to store the first byte read.
  * \param [in] maxLength The maximum number of bytes to read. The actual number
  * of bytes that are read could be less.
- * \param [in] timeout A boolean flag for a timeout.
+ * \param [in] timeout The longest time to wait for data, in ms, or 0 to wait
+ * until data arrives.
  * \param [out] transferred The number of bytes successfully read.
  * \return
  * \parblock
@@ -74,7 +289,8 @@ libnxt_error raw_read( unsigned char * buf, size_t offset,
  * \param [in] buf A buffer containing bytes of data to write.
  * \param [in] offset The index in the buffer of first byte to write.
  * \param [in] length The number of bytes to write.
- * \param [in] timeout A boolean flag for a timeout.
+ * \param [in] timeout The longest time to wait, in ms, or 0 to wait until
+ * every byte is written.
  * \param [out] transferred The number of bytes successfully written.
  * \return
  * \parblock
@@ -92,4 +308,101 @@ libnxt_error raw_read( unsigned char * buf, size_t offset,
 libnxt_error raw_write( unsigned char * buf, size_t offset,
                                size_t length, int timeout, int * transferred );
 
+/*! \brief Switch a link between blocking and asynchronous reads.
+ *
+ * In asynchronous mode, several reads are kept in flight on the link, and data
+ * is collected from them as they complete while I/O events are handled. A read
+ * with a timeout then never blocks: it returns whatever data has already
+ * arrived, so that a host can multiplex many links from one event loop using
+ * `get_comm_pollfds()` and `handle_comm_events()`. A read without a timeout
+ * handles events until data arrives. Transports other than USB may have no
+ * events to handle, and only stop reads with a timeout from waiting.
+ * \param [in] comm The link to configure.
+ * \param [in] depth The number of reads to keep in flight, or 0 to return to
+ * blocking reads.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_NO_EFFECT} if the link was already in the requested mode
+ *
+ * \linkerror{LIBNXT_NOT_OPENED} if `comm` is NULL
+ *
+ * \linkerror{LIBNXT_DISCONNECTED} if the NXT disconnected during the call
+ *
+ * \linkerror{LIBNXT_DEPENDENT_ERROR} if there was an error in dependent
+ * library
+ *
+ * \linkerror{LIBNXT_OTHER_ERROR} if the transport of the link does not support
+ * asynchronous reads.
+ * \endparblock
+ */
+libnxt_error comm_set_async( nxt_comm * comm, size_t depth );
+
+/*! \brief Open a link again after its NXT disconnected, once the NXT is
+ * connected again.
+ *
+ * For use when an NXT reboots or its cable is unplugged and plugged back in.
+ * A USB link waits for an NXT to be plugged into the same port, or, if the
+ * port cannot be told, for an NXT to appear at the same index, as counted by
+ * `count_comms()`. Where libusb supports hot-plug notification, the NXT is
+ * opened as soon as it arrives; otherwise the bus is scanned every
+ * `#REOPEN_POLL_INTERVAL` ms. A link in asynchronous mode is returned to it.
+ * Data in flight when the NXT disconnected is lost, and the NXT must be
+ * handshaken with again.
+ * \param [in] comm The link to open again.
+ * \param [in] timeout The longest time to wait for the NXT, in ms, or 0 to
+ * wait until it is connected.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_NOT_OPENED} if `comm` is NULL
+ *
+ * \linkerror{LIBNXT_TIMEOUT} if the NXT was not connected in time; the link
+ * may be opened again later
+ *
+ * \linkerror{LIBNXT_DEPENDENT_ERROR} if there was an error in dependent
+ * library
+ *
+ * \linkerror{LIBNXT_OTHER_ERROR} if the transport of the link cannot open it
+ * again.
+ * \endparblock
+ */
+libnxt_error comm_reopen( nxt_comm * comm, int timeout );
+
+/*! \brief Get the file descriptors to poll for I/O events on asynchronous
+ * USB links.
+ *
+ * When any of them becomes ready, call `handle_comm_events()`.
+ * \param [out] fds A buffer to store the file descriptors and the events to
+ * poll them for.
+ * \param [in] maxCount Size of `fds`.
+ * \param [out] count The number of file descriptors that need polling, which
+ * may exceed `maxCount`.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS} (and populates `fds` and `count`)
+ *
+ * \linkerror{LIBNXT_DEPENDENT_ERROR} if there was an error in dependent
+ * library.
+ * \endparblock
+ */
+libnxt_error get_comm_pollfds( struct pollfd * fds, size_t maxCount,
+                               size_t * count );
+
+/*! \brief Handle pending I/O events on asynchronous USB links.
+ *
+ * \param [in] timeout The longest time to wait for an event, in ms. 0 returns
+ * immediately after handling any events that are already pending.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_DEPENDENT_ERROR} if there was an error in dependent
+ * library.
+ * \endparblock
+ */
+libnxt_error handle_comm_events( int timeout );
+
 #endif
@@ -1,11 +1,135 @@
 #include "nxt_usb.h"
+#include <string.h>
+#include <time.h>
 
-// The length of time to wait for an I/O function to return, in ms.
-#define TIMEOUT 20000
-// USB vendor ID for the Lego Company.
-#define VENDOR_LEGO 0x0694
-// Product ID for the NXT 2.0.
-#define PRODUCT_NXT 0x0002
+// The length of time to wait for the NXT to send data being discarded, in ms.
+#define DRAIN_TIMEOUT 10
+// The longest time to spend discarding data, in ms, so that an NXT that keeps
+// sending cannot hold up opening or closing it.
+#define DRAIN_LIMIT 200
+// The length of time to wait for libusb events in each wait_async_nxt() step.
+#define EVENT_STEP 100
+
+struct nxt_async {
+    libusb_device_handle * handle;
+    // Ring of transfers, each reading up to MAX_PKT_SIZE bytes.
+    struct libusb_transfer ** transfers;
+    // Boolean flags: whether each transfer has completed and is waiting for
+    // its data, if any, to be collected.
+    int * completed;
+    size_t depth;
+    // Index of the oldest transfer, which is the next to collect data from.
+    size_t head;
+    // Bytes of data already collected from the head transfer.
+    int collected;
+    // Number of transfers submitted and not yet returned by libusb.
+    size_t inFlight;
+    // The first error reported by a failed transfer, or LIBUSB_SUCCESS.
+    int error;
+};
+
+/*
+ * Discard any data the NXT has waiting to send, stopping as soon as a read
+ * finds no data, or after DRAIN_LIMIT ms.
+ */
+static void drain_nxt( libusb_device_handle * handle );
+
+/*
+ * Callback for completed read transfers: invoked by libusb while it handles
+ * events.
+ */
+static void LIBUSB_CALL read_complete( struct libusb_transfer * transfer );
+
+/*
+ * Submit one of the transfers of an nxt_async.
+ * return: LIBUSB_SUCCESS, or a LIBUSB_ERROR_CODE from libusb_submit_transfer().
+ */
+static int submit_read( nxt_async * async, size_t index );
+
+/*
+ * Submit the head transfer of an nxt_async again once all of its data has been
+ * collected, and move on to the next.
+ */
+static void next_read( nxt_async * async );
+
+/*
+ * Pass over completed transfers at the head of an nxt_async that brought no
+ * data, submitting each of them again in turn.
+ */
+static void skip_empty_reads( nxt_async * async );
+
+/*
+ * Time elapsed since the given time on the monotonic clock, in us.
+ */
+static long elapsed_us( const struct timespec * since );
+
+static void drain_nxt( libusb_device_handle * handle ) {
+    unsigned char buf[MAX_PKT_SIZE];
+    int read = 0;
+    int ioError = 0;
+    struct timespec start;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    do {
+        ioError = libusb_bulk_transfer( handle, BULK_READ_EP, buf,
+                                        MAX_PKT_SIZE, &read, DRAIN_TIMEOUT );
+    } while ( ! ioError && read > 0 &&
+              elapsed_us( &start ) < DRAIN_LIMIT * 1000L );
+}
+
+static void LIBUSB_CALL read_complete( struct libusb_transfer * transfer ) {
+    nxt_async * async = ( nxt_async * ) transfer->user_data;
+    size_t i;
+    for ( i = 0; i < async->depth && async->transfers[i] != transfer; i++ );
+    async->inFlight--;
+
+    switch ( transfer->status ) {
+        case LIBUSB_TRANSFER_COMPLETED:
+        case LIBUSB_TRANSFER_TIMED_OUT:
+            // Even with no data, the transfer is only submitted again once it
+            // reaches the head, as one submitted now would complete after the
+            // others and so take the place of data that is already on its way.
+            async->completed[i] = 1;
+            break;
+        case LIBUSB_TRANSFER_CANCELLED:
+            break;
+        case LIBUSB_TRANSFER_NO_DEVICE:
+            async->error = LIBUSB_ERROR_NO_DEVICE;
+            break;
+        default:
+            async->error = LIBUSB_ERROR_IO;
+            break;
+    }
+}
+
+static int submit_read( nxt_async * async, size_t index ) {
+    async->completed[index] = 0;
+    int errorCode = libusb_submit_transfer( async->transfers[index] );
+    if ( ! errorCode )
+        async->inFlight++;
+    return errorCode;
+}
+
+static void next_read( nxt_async * async ) {
+    async->collected = 0;
+    if ( ! async->error )
+        async->error = submit_read( async, async->head );
+    else
+        async->completed[async->head] = 0;
+    async->head = ( async->head + 1 ) % async->depth;
+}
+
+static void skip_empty_reads( nxt_async * async ) {
+    while ( async->completed[async->head] &&
+            async->transfers[async->head]->actual_length == 0 )
+        next_read( async );
+}
+
+static long elapsed_us( const struct timespec * since ) {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return ( now.tv_sec - since->tv_sec ) * 1000000L +
+           ( now.tv_nsec - since->tv_nsec ) / 1000L;
+}
 
 int find_nxt( libusb_device ** nxt ) {
 
@@ -46,37 +170,128 @@ int find_nxt( libusb_device ** nxt ) {
 	}
 }
 
+int find_nxts( libusb_device *** nxts, size_t * count ) {
+
+    int errorCode = LIBUSB_SUCCESS;
+
+    libusb_device ** list;
+    // NULL here refers to the default libusb context.
+    ssize_t listCount = libusb_get_device_list( NULL, &list );
+    if ( listCount < 0 )
+        // listCount contains error code.
+        return listCount;
+
+    libusb_device ** found;
+    found = ( libusb_device ** ) calloc( listCount + 1,
+                                         sizeof ( libusb_device * ) );
+    if ( found == NULL ) {
+        libusb_free_device_list( list, 1 );
+        return LIBUSB_ERROR_NO_MEM;
+    }
+
+    size_t foundCount = 0;
+    size_t i;
+    struct libusb_device_descriptor desc;
+    for ( i = 0; i < (size_t) listCount && ! errorCode; i++ ) {
+        errorCode = libusb_get_device_descriptor( list[i], &desc );
+        if ( ! errorCode && desc.idVendor == VENDOR_LEGO &&
+             desc.idProduct == PRODUCT_NXT ) {
+            found[foundCount++] = libusb_ref_device( list[i] );
+        }
+    }
+    libusb_free_device_list( list, 1 );
+
+    if ( ! errorCode && foundCount > 0 ) {
+        *nxts = found;
+        *count = foundCount;
+        return LIBUSB_SUCCESS;
+    } else {
+        forget_nxts( found, foundCount );
+        *nxts = NULL;
+        *count = 0;
+        return ( errorCode ? errorCode : LIBUSB_ERROR_NOT_FOUND );
+    }
+}
+
+int find_nxt_on_port( uint8_t bus, uint8_t port, libusb_device ** nxt ) {
+    *nxt = NULL;
+    libusb_device ** list;
+    // NULL here refers to the default libusb context.
+    ssize_t count = libusb_get_device_list( NULL, &list );
+    if ( count < 0 )
+        // Count contains error code.
+        return count;
+
+    int errorCode = LIBUSB_ERROR_NOT_FOUND;
+    ssize_t i;
+    struct libusb_device_descriptor desc;
+    for ( i = 0; i < count; i++ ) {
+        if ( libusb_get_bus_number( list[i] ) != bus ||
+             libusb_get_port_number( list[i] ) != port )
+            continue;
+        errorCode = libusb_get_device_descriptor( list[i], &desc );
+        if ( ! errorCode && ( desc.idVendor != VENDOR_LEGO ||
+                              desc.idProduct != PRODUCT_NXT ) )
+            errorCode = LIBUSB_ERROR_NOT_FOUND;
+        if ( ! errorCode )
+            *nxt = libusb_ref_device( list[i] );
+        break;
+    }
+    libusb_free_device_list( list, 1 );
+    return errorCode;
+}
+
 void forget_nxt( libusb_device * nxt ) {
     libusb_unref_device( nxt );
 }
 
+void forget_nxts( libusb_device ** nxts, size_t count ) {
+    size_t i;
+    for ( i = 0; i < count; i++ ) {
+        libusb_unref_device( nxts[i] );
+    }
+    free( nxts );
+}
+
 int open_nxt( libusb_device * nxt, libusb_device_handle ** handle ) {
+    return open_nxt_timed( nxt, handle, NULL );
+}
+
+int open_nxt_timed( libusb_device * nxt, libusb_device_handle ** handle,
+                    nxt_open_timing * timing ) {
+    nxt_open_timing steps;
+    memset( &steps, 0, sizeof ( steps ) );
+    struct timespec start;
+    clock_gettime( CLOCK_MONOTONIC, &start );
 
     int errorCode = libusb_open( nxt, handle );
     if ( errorCode ) {
         *handle = NULL;
         return errorCode;
     }
+    steps.open = elapsed_us( &start );
 
+    clock_gettime( CLOCK_MONOTONIC, &start );
     int interfaceClaimed = 0;
-    errorCode = libusb_set_configuration( *handle, CONFIGURATION );
+    int configuration = 0;
+    // Setting the configuration resets the NXT, so it is avoided if the
+    // configuration is already active.
+    errorCode = libusb_get_configuration( *handle, &configuration );
+    if ( errorCode || configuration != CONFIGURATION )
+        errorCode = libusb_set_configuration( *handle, CONFIGURATION );
     if ( ! errorCode ) {
         errorCode = libusb_claim_interface( *handle, INTERFACE );
         if ( ! errorCode ) {
             interfaceClaimed = 1;
+            steps.configure = elapsed_us( &start );
+            clock_gettime( CLOCK_MONOTONIC, &start );
             // Discard any data that NXT might initially send.
-            int read = 0;
-            int ioError = 0;
-            unsigned char * buf;
-            buf = ( unsigned char * ) calloc( MAX_PKT_SIZE, sizeof ( char ) );
-            size_t i;
-            do {
-                ioError = libusb_bulk_transfer( *handle, BULK_READ_EP, buf,
-                                                  MAX_PKT_SIZE, &read, 1000 );
-            } while ( ! ioError && read > 0 );
-            free( buf );
+            drain_nxt( *handle );
+            steps.drain = elapsed_us( &start );
         }
     }
+    if ( timing != NULL )
+        *timing = steps;
 
     if ( errorCode ) {
         if ( interfaceClaimed )
@@ -91,30 +306,141 @@ int open_nxt( libusb_device * nxt, libusb_device_handle ** handle ) {
 
 void close_handle( libusb_device_handle * handle ) {
 	// Discard any data that NXT might have left to send.
-    int read = 0;
-    int ioError = 0;
-    unsigned char * buf;
-    buf = ( unsigned char * ) calloc( MAX_PKT_SIZE, sizeof ( char ) );
-    size_t i;
-    do {
-        ioError = libusb_bulk_transfer( handle, BULK_READ_EP, buf,
-                                          MAX_PKT_SIZE, &read, 1000 );
-    } while ( ! ioError && read > 0 );
-    free( buf );
+    drain_nxt( handle );
     libusb_release_interface( handle, INTERFACE );
     libusb_close( handle );
 }
 
 int bulk_write_nxt( libusb_device_handle * handle, unsigned char * buf,
-                    size_t offset, size_t length, int * transferred ) {
+                    size_t offset, size_t length, unsigned int timeout,
+                    int * transferred ) {
 
     return libusb_bulk_transfer( handle, BULK_WRITE_EP, buf + offset, length,
-                                 transferred, TIMEOUT );
+                                 transferred, timeout );
 }
 
 int bulk_read_nxt( libusb_device_handle * handle, unsigned char * buf,
-                   size_t offset, size_t length, int * transferred ) {
+                   size_t offset, size_t length, unsigned int timeout,
+                   int * transferred ) {
 
     return libusb_bulk_transfer( handle, BULK_READ_EP, buf + offset, length,
-                                 transferred, TIMEOUT );
+                                 transferred, timeout );
+}
+
+int start_async_reads( libusb_device_handle * handle, size_t depth,
+                       nxt_async ** async ) {
+    *async = NULL;
+    if ( depth == 0 )
+        return LIBUSB_ERROR_INVALID_PARAM;
+
+    nxt_async * ret = ( nxt_async * ) calloc( 1, sizeof ( nxt_async ) );
+    if ( ret == NULL )
+        return LIBUSB_ERROR_NO_MEM;
+    ret->handle = handle;
+    ret->depth = depth;
+    ret->transfers = ( struct libusb_transfer ** )
+                     calloc( depth, sizeof ( struct libusb_transfer * ) );
+    ret->completed = ( int * ) calloc( depth, sizeof ( int ) );
+
+    int errorCode = ( ret->transfers == NULL || ret->completed == NULL ?
+                      LIBUSB_ERROR_NO_MEM : LIBUSB_SUCCESS );
+    size_t i;
+    unsigned char * buf;
+    for ( i = 0; i < depth && ! errorCode; i++ ) {
+        ret->transfers[i] = libusb_alloc_transfer( 0 );
+        buf = ( unsigned char * ) malloc( MAX_PKT_SIZE );
+        if ( ret->transfers[i] == NULL || buf == NULL ) {
+            free( buf );
+            errorCode = LIBUSB_ERROR_NO_MEM;
+        } else {
+            // A timeout of 0 keeps the transfer waiting until data arrives.
+            libusb_fill_bulk_transfer( ret->transfers[i], handle, BULK_READ_EP,
+                                       buf, MAX_PKT_SIZE, read_complete, ret,
+                                       0 );
+            errorCode = submit_read( ret, i );
+        }
+    }
+
+    if ( errorCode ) {
+        stop_async_reads( ret );
+        return errorCode;
+    }
+    *async = ret;
+    return LIBUSB_SUCCESS;
+}
+
+void stop_async_reads( nxt_async * async ) {
+    size_t i;
+    if ( async->transfers != NULL ) {
+        for ( i = 0; i < async->depth; i++ ) {
+            if ( async->transfers[i] != NULL )
+                libusb_cancel_transfer( async->transfers[i] );
+        }
+        struct timeval tv = { 0, EVENT_STEP * 1000 };
+        while ( async->inFlight > 0 ) {
+            if ( libusb_handle_events_timeout( NULL, &tv ) )
+                break;
+        }
+        for ( i = 0; i < async->depth; i++ ) {
+            if ( async->transfers[i] != NULL ) {
+                free( async->transfers[i]->buffer );
+                libusb_free_transfer( async->transfers[i] );
+            }
+        }
+    }
+    free( async->transfers );
+    free( async->completed );
+    free( async );
+}
+
+int read_async_nxt( nxt_async * async, unsigned char * buf, size_t offset,
+                    size_t length, int * transferred ) {
+    size_t total = 0;
+    size_t span;
+    struct libusb_transfer * head;
+    while ( total < length && async->completed[async->head] ) {
+        head = async->transfers[async->head];
+        span = (size_t) ( head->actual_length - async->collected );
+        if ( span > length - total )
+            span = length - total;
+        memcpy( buf + offset + total, head->buffer + async->collected, span );
+        total += span;
+        async->collected += (int) span;
+        if ( async->collected == head->actual_length )
+            next_read( async );
+    }
+
+    *transferred = (int) total;
+    if ( total > 0 )
+        return LIBUSB_SUCCESS;
+    return ( async->error ? async->error : LIBUSB_ERROR_TIMEOUT );
+}
+
+int wait_async_nxt( nxt_async * async, unsigned int timeout ) {
+    struct timeval start, now, tv;
+    gettimeofday( &start, NULL );
+    int errorCode;
+    long elapsed;
+    skip_empty_reads( async );
+    while ( ! async->completed[async->head] ) {
+        if ( async->error )
+            return async->error;
+        if ( async->inFlight == 0 )
+            // Nothing can arrive if there are no transfers left to complete.
+            return LIBUSB_ERROR_IO;
+        tv.tv_sec = 0;
+        tv.tv_usec = EVENT_STEP * 1000;
+        errorCode = libusb_handle_events_timeout( NULL, &tv );
+        if ( errorCode && errorCode != LIBUSB_ERROR_INTERRUPTED )
+            return errorCode;
+        skip_empty_reads( async );
+        if ( timeout > 0 ) {
+            gettimeofday( &now, NULL );
+            elapsed = ( now.tv_sec - start.tv_sec ) * 1000 +
+                      ( now.tv_usec - start.tv_usec ) / 1000;
+            if ( elapsed >= timeout && ! async->completed[async->head] )
+                return LIBUSB_ERROR_TIMEOUT;
+        }
+    }
+    return LIBUSB_SUCCESS;
 }
@@ -60,10 +60,16 @@
 #define NXT_USB_H
 #include <libusb.h>
 #include <stdlib.h>
+#include <sys/time.h>
 
 // The maximum USB bulk transfer data payload size supported by NXT.
 #define MAX_PKT_SIZE 64
 
+// USB vendor ID for the Lego Company.
+#define VENDOR_LEGO 0x0694
+// Product ID for the NXT 2.0.
+#define PRODUCT_NXT 0x0002
+
 /*
  * For more information on the following, see Chapter 9 of the
  * USB Specification 2.0.
@@ -95,6 +101,48 @@
  */
 int find_nxt( libusb_device ** nxt );
 
+/*! \brief Find every NXT device that is physically connected to the Galileo.
+ *
+ * Like `find_nxt()`, but returns all of the NXTs, in the order they are
+ * enumerated by libusb. The devices that are returned should be later freed by
+ * calling `forget_nxts()`.
+ * \param [out] nxts Output location for a newly allocated array of
+ * `libusb_device` pointers. Set to NULL when the return code is non-zero,
+ * indicating an error.
+ * \param [out] count Output location for the number of devices in `nxts`.
+ * \return
+ * \parblock
+ * LIBUSB_SUCCESS if at least one NXT was found
+ *
+ * LIBUSB_ERROR_NOT_FOUND if no NXT is connected to the Galileo
+ *
+ * LIBUSB_ERROR_NO_MEM if the array could not be allocated
+ *
+ * another LIBUSB_ERROR_CODE on other failure.
+ * \endparblock
+ */
+int find_nxts( libusb_device *** nxts, size_t * count );
+
+/*! \brief Find the NXT plugged into the given port, if any.
+ *
+ * Like `find_nxt()`, but only the device on the given port is examined, so
+ * the descriptors of the other devices are not read.
+ * \param [in] bus The number of the bus, as from `libusb_get_bus_number()`.
+ * \param [in] port The number of the port on its hub, as from
+ * `libusb_get_port_number()`.
+ * \param [out] nxt Output location for the returned `libusb_device` pointer.
+ * Set to NULL when the return code is non-zero, indicating an error.
+ * \return
+ * \parblock
+ * LIBUSB_SUCCESS if the NXT was found
+ *
+ * LIBUSB_ERROR_NOT_FOUND if no NXT is connected to that port
+ *
+ * another LIBUSB_ERROR_CODE on other failure.
+ * \endparblock
+ */
+int find_nxt_on_port( uint8_t bus, uint8_t port, libusb_device ** nxt );
+
 /*! \brief Free a `libusb_device` previously obtained using `find_nxt()`.
  *
  * Call this function after `close_handle()`.
@@ -102,11 +150,21 @@ int find_nxt( libusb_device ** nxt );
  */
 void forget_nxt( libusb_device * nxt );
 
+/*! \brief Free an array of devices previously obtained using `find_nxts()`.
+ *
+ * Devices that are still required should first be referenced again with
+ * `libusb_ref_device()`.
+ * \param [in] nxts An array returned by `find_nxts()`.
+ * \param [in] count Number of devices in `nxts`.
+ */
+void forget_nxts( libusb_device ** nxts, size_t count );
+
 /*! \brief Obtain a device handle that is required to perform I/O on an NXT.
  *
  * The handle that is returned must be passed to `bulk_read_nxt()` and
  * `bulk_write_nxt()`. To clean up after using the handle, call
- * `close_handle()` followed by `forget_nxt()`.
+ * `close_handle()` followed by `forget_nxt()`. The configuration of the NXT
+ * is only set if it is not already active, as setting it resets the device.
  *
  * \param [in] nxt A `libusb_device` corresponding to the NXT, returned by
  * `find_nxt()`.
@@ -123,6 +181,24 @@ void forget_nxt( libusb_device * nxt );
  */
 int open_nxt( libusb_device * nxt, libusb_device_handle ** handle );
 
+/*! \brief Time taken by each step of `open_nxt_timed()`, in us.
+ */
+typedef struct nxt_open_timing {
+    long open; /*!< Opening the device. */
+    long configure; /*!< Setting its configuration and claiming its
+                     * interface. */
+    long drain; /*!< Discarding data the NXT sent before it was opened. */
+} nxt_open_timing;
+
+/*! \brief Obtain a device handle as `open_nxt()` does, timing each step.
+ *
+ * \param [out] timing Output location for the time taken by each step, or
+ * NULL.
+ * \see open_nxt()
+ */
+int open_nxt_timed( libusb_device * nxt, libusb_device_handle ** handle,
+                    nxt_open_timing * timing );
+
 /*! \brief Close a handle previously obtained using `open_nxt()`.
  *
  * Should be called on all open handles before your application exits.
@@ -141,6 +217,7 @@ void close_handle( libusb_device_handle * handle );
  * \param [in] offset The index in the buffer to store the first byte read.
  * \param [in] length The maximum number of bytes to read. The actual number of
  * bytes that are read could be less.
+ * \param [in] timeout The longest time to wait, in ms, or 0 to wait forever.
  * \param transferred The number of bytes successfully read from the NXT.
  * \return
  * \parblock
@@ -156,7 +233,8 @@ void close_handle( libusb_device_handle * handle );
  * \endparblock
  */
 int bulk_read_nxt( libusb_device_handle * handle, unsigned char * buf,
-                          size_t offset, size_t length, int * transferred );
+                   size_t offset, size_t length, unsigned int timeout,
+                   int * transferred );
 
 /*! \brief Write data to the NXT using a bulk transfer pipe.
  *
@@ -168,6 +246,7 @@ int bulk_read_nxt( libusb_device_handle * handle, unsigned char * buf,
  * \param [in] buf A buffer containing bytes of data to write.
  * \param [in] offset The index in the buffer of the first byte to write.
  * \param [in] length The number of bytes to write.
+ * \param [in] timeout The longest time to wait, in ms, or 0 to wait forever.
  *\param [out] transferred The number of bytes successfully written to the NXT.
  * \return
  * \parblock
@@ -183,6 +262,96 @@ int bulk_read_nxt( libusb_device_handle * handle, unsigned char * buf,
  * \endparblock
  */
 int bulk_write_nxt( libusb_device_handle * handle, unsigned char * buf,
-                           size_t offset, size_t length, int * transferred );
+                    size_t offset, size_t length, unsigned int timeout,
+                    int * transferred );
+
+/*! \brief A set of read transfers kept in flight on an NXT using the
+ * asynchronous libusb API.
+ *
+ * Obtained using `start_async_reads()` and released using
+ * `stop_async_reads()`. Transfers complete only while libusb events are being
+ * handled, for example by `wait_async_nxt()` or
+ * `libusb_handle_events_timeout()`, and are resubmitted in the order they were
+ * submitted, as their data is collected. All functions taking an `nxt_async`
+ * must be called from the thread that handles libusb events.
+ */
+typedef struct nxt_async nxt_async;
+
+/*! \brief Begin keeping several read transfers in flight on an NXT.
+ *
+ * Do not call `bulk_read_nxt()` on the handle until `stop_async_reads()` has
+ * been called.
+ * \param [in] handle A handle for the NXT to read from, previously obtained
+ * using `open_nxt()`.
+ * \param [in] depth The number of transfers to keep in flight.
+ * \param [out] async Output location for the returned `nxt_async` pointer.
+ * Set to NULL when the return code is non-zero, indicating an error.
+ * \return
+ * \parblock
+ * LIBUSB_SUCCESS
+ *
+ * LIBUSB_ERROR_INVALID_PARAM if `depth` is 0
+ *
+ * LIBUSB_ERROR_NO_MEM if the transfers could not be allocated
+ *
+ * LIBUSB_ERROR_NO_DEVICE if the NXT disconnected
+ *
+ * another LIBUSB_ERROR_CODE on other failure.
+ * \endparblock
+ */
+int start_async_reads( libusb_device_handle * handle, size_t depth,
+                       nxt_async ** async );
+
+/*! \brief Cancel the read transfers in flight and free them.
+ *
+ * Blocks until libusb reports that every transfer has been cancelled. Data
+ * that has been read but not yet collected is discarded.
+ * \param [in] async An `nxt_async` returned by `start_async_reads()`.
+ */
+void stop_async_reads( nxt_async * async );
+
+/*! \brief Collect data from read transfers that have completed.
+ *
+ * Never blocks. Completed transfers are collected in the order they were
+ * submitted, and resubmitted once all of their data has been collected;
+ * transfers that completed with no data are passed over and resubmitted in
+ * their turn.
+ * \param [in] async An `nxt_async` returned by `start_async_reads()`.
+ * \param [out] buf A buffer to read bytes of data into.
+ * \param [in] offset The index in the buffer to store the first byte read.
+ * \param [in] length The maximum number of bytes to read.
+ * \param [out] transferred The number of bytes collected.
+ * \return
+ * \parblock
+ * LIBUSB_SUCCESS (and populates `transferred`)
+ *
+ * LIBUSB_ERROR_TIMEOUT if no data has arrived (and populates `transferred`)
+ *
+ * LIBUSB_ERROR_IO
+ *
+ * LIBUSB_ERROR_NO_DEVICE if the NXT disconnected
+ *
+ * another LIBUSB_ERROR_CODE on other failure.
+ * \endparblock
+ */
+int read_async_nxt( nxt_async * async, unsigned char * buf, size_t offset,
+                    size_t length, int * transferred );
+
+/*! \brief Handle libusb events until data can be collected by
+ * `read_async_nxt()`, a transfer fails, or a timeout expires.
+ *
+ * \param [in] async An `nxt_async` returned by `start_async_reads()`.
+ * \param [in] timeout The longest time to wait, in ms, or 0 to wait forever.
+ * \return
+ * \parblock
+ * LIBUSB_SUCCESS if data can be collected
+ *
+ * LIBUSB_ERROR_TIMEOUT
+ *
+ * another LIBUSB_ERROR_CODE if a transfer failed or events could not be
+ * handled.
+ * \endparblock
+ */
+int wait_async_nxt( nxt_async * async, unsigned int timeout );
 
 #endif
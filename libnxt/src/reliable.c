@@ -0,0 +1,641 @@
+#include "reliable.h"
+#include "stats.h"
+#include <string.h>
+#include <time.h>
+
+// Settings used when none are given.
+#define DEFAULT_WINDOW 8
+#define DEFAULT_MAX_MESSAGE 256
+#define DEFAULT_RTO 200
+// Bounds of the retransmission timeout, in ms.
+#define MIN_RTO 10
+#define MAX_RTO 5000
+// Later messages acknowledged selectively before a missing one is sent again.
+#define DUPLICATE_THRESHOLD 3
+
+// A message sent and not yet acknowledged.
+typedef struct send_slot {
+    // The packet: header and message.
+    unsigned char * packet;
+    uint16_t length;
+    // Boolean flag: the other end has acknowledged it selectively.
+    int sacked;
+    // Boolean flag: sent more than once, so its round trip is ambiguous.
+    int retransmitted;
+    // Boolean flag: already sent again for being overtaken.
+    int fastRetransmitted;
+    struct timespec sentAt;
+} send_slot;
+
+// A message received ahead of those before it, or not yet taken.
+typedef struct receive_slot {
+    unsigned char * data;
+    uint16_t length;
+    // Boolean flag: the slot holds a message.
+    int received;
+} receive_slot;
+
+struct reliable_channel {
+    nxt_conn * conn;
+
+    size_t window;
+    size_t maxMessage;
+
+    // Longest time to wait in a send or receive, in ms; 0 waits forever.
+    int timeout;
+
+    // The timeouts of the connection when the channel was opened.
+    int savedReadTimeout;
+    int savedWriteTimeout;
+
+    // Sequence numbers of the oldest unacknowledged message, and of the next
+    // message to send.
+    uint16_t sendBase;
+    uint16_t nextSeq;
+
+    // Slots by sequence number modulo the window, see slot_index().
+    send_slot * sendSlots;
+    receive_slot * receiveSlots;
+
+    // Sequence numbers of the next message to take, and of the first message
+    // not yet received in order: the cumulative ACK.
+    uint16_t receiveBase;
+    uint16_t receiveNext;
+
+    // Boolean flag: messages have been received that are not yet acknowledged.
+    int ackPending;
+
+    // Boolean flag: the other end has closed the connection.
+    int eof;
+
+    // Smoothed round trip time and its mean deviation, in us.
+    long srtt;
+    long rttvar;
+    size_t rttSamples;
+
+    // Retransmission timeout in ms, and the number of times it has doubled
+    // since a message was last acknowledged.
+    int rto;
+    int backoff;
+
+    // Holds packets received that do not fit in the receive ring.
+    unsigned char * scratch;
+    size_t scratchSize;
+};
+
+/*
+ * Compare sequence numbers, which wrap around.
+ * return: Non-zero if a comes before b.
+ */
+static int seq_before( uint16_t a, uint16_t b );
+
+/*
+ * Index of the slot of a sequence number. As the window is a power of two, it
+ * divides 65536, so slots stay in step across the wrap of sequence numbers.
+ */
+static size_t slot_index( const reliable_channel * channel, uint16_t seq );
+
+/*
+ * Write or read big-endian fields.
+ */
+static void put_u16( unsigned char * dest, uint16_t value );
+static void put_u32( unsigned char * dest, uint32_t value );
+static uint16_t get_u16( const unsigned char * src );
+static uint32_t get_u32( const unsigned char * src );
+
+/*
+ * Time in ms from now until the given time, negative once it has passed.
+ */
+static long ms_until( const struct timespec * time );
+
+/*
+ * Time in us since the given time.
+ */
+static long us_since( const struct timespec * time );
+
+/*
+ * Set a deadline the timeout of the channel from now.
+ * return: The deadline, or NULL if the channel has no timeout.
+ */
+static struct timespec * set_deadline( reliable_channel * channel,
+                                       struct timespec * deadline );
+
+/*
+ * Write a header carrying the latest acknowledgements.
+ * in: packet - Location of the header.
+ * in: kind - RELIABLE_DATA or RELIABLE_ACK.
+ * in: seq - Sequence number of the message carried.
+ */
+static void write_header( reliable_channel * channel, unsigned char * packet,
+                          unsigned char kind, uint16_t seq );
+
+/*
+ * Send, or send again, the message with the given sequence number.
+ */
+static libnxt_error transmit( reliable_channel * channel, uint16_t seq );
+
+/*
+ * Send the latest acknowledgements on their own.
+ */
+static libnxt_error send_ack( reliable_channel * channel );
+
+/*
+ * Update the round trip estimate with a round trip just completed.
+ */
+static void record_round_trip( reliable_channel * channel,
+                               const struct timespec * sentAt );
+
+/*
+ * Release the messages acknowledged by the other end, and send again any that
+ * later messages have overtaken.
+ * in: ack - The cumulative ACK.
+ * in: sacks - The selective ACKs.
+ */
+static libnxt_error handle_acks( reliable_channel * channel, uint16_t ack,
+                                 uint32_t sacks );
+
+/*
+ * Process a packet received.
+ */
+static libnxt_error handle_packet( reliable_channel * channel,
+                                   const unsigned char * packet,
+                                   uint16_t length );
+
+/*
+ * Send again the messages whose retransmission timeout has passed.
+ * out: wait - Time in ms until the next retransmission is due, or -1 if none
+ *             is.
+ */
+static libnxt_error retransmit_due( reliable_channel * channel, long * wait );
+
+/*
+ * Send any retransmissions due, then wait for a packet and process it.
+ * in: deadline - The latest time to wait until, or NULL to wait forever.
+ * in: poll - Boolean flag to wait as little as possible.
+ * return: LIBNXT_SUCCESS if a packet was processed, or
+ *         LIBNXT_TIMEOUT if none arrived, or
+ *         LIBNXT_DISCONNECTED if the other end has closed the connection, or
+ *         LIBNXT_OTHER_ERROR if a packet too long for the channel arrived, or
+ *         any error of conn_send() or conn_receive_view().
+ */
+static libnxt_error service( reliable_channel * channel,
+                             const struct timespec * deadline, int poll );
+
+static int seq_before( uint16_t a, uint16_t b ) {
+    return (int16_t) (uint16_t) ( a - b ) < 0;
+}
+
+static size_t slot_index( const reliable_channel * channel, uint16_t seq ) {
+    return seq & ( channel->window - 1 );
+}
+
+static void put_u16( unsigned char * dest, uint16_t value ) {
+    dest[0] = (unsigned char) ( value >> 8 );
+    dest[1] = (unsigned char) value;
+}
+
+static void put_u32( unsigned char * dest, uint32_t value ) {
+    put_u16( dest, (uint16_t) ( value >> 16 ) );
+    put_u16( dest + 2, (uint16_t) value );
+}
+
+static uint16_t get_u16( const unsigned char * src ) {
+    return (uint16_t) ( ( src[0] << 8 ) | src[1] );
+}
+
+static uint32_t get_u32( const unsigned char * src ) {
+    return ( (uint32_t) get_u16( src ) << 16 ) | get_u16( src + 2 );
+}
+
+static long ms_until( const struct timespec * time ) {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return ( time->tv_sec - now.tv_sec ) * 1000L +
+           ( time->tv_nsec - now.tv_nsec ) / 1000000L;
+}
+
+static long us_since( const struct timespec * time ) {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return ( now.tv_sec - time->tv_sec ) * 1000000L +
+           ( now.tv_nsec - time->tv_nsec ) / 1000L;
+}
+
+static struct timespec * set_deadline( reliable_channel * channel,
+                                       struct timespec * deadline ) {
+    if ( channel->timeout == 0 )
+        return NULL;
+    clock_gettime( CLOCK_MONOTONIC, deadline );
+    deadline->tv_sec += channel->timeout / 1000;
+    deadline->tv_nsec += ( channel->timeout % 1000 ) * 1000000L;
+    if ( deadline->tv_nsec >= 1000000000L ) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+    return deadline;
+}
+
+static void write_header( reliable_channel * channel, unsigned char * packet,
+                          unsigned char kind, uint16_t seq ) {
+    uint32_t sacks = 0;
+    size_t i;
+    for ( i = 0; i + 1 < channel->window; i++ ) {
+        uint16_t later = (uint16_t) ( channel->receiveNext + 1 + i );
+        if ( (uint16_t) ( later - channel->receiveBase ) >= channel->window )
+            break;
+        if ( channel->receiveSlots[slot_index( channel, later )].received )
+            sacks |= (uint32_t) 1 << i;
+    }
+    packet[0] = kind;
+    put_u16( packet + 1, seq );
+    put_u16( packet + 3, channel->receiveNext );
+    put_u32( packet + 5, sacks );
+}
+
+static libnxt_error transmit( reliable_channel * channel, uint16_t seq ) {
+    send_slot * slot = &channel->sendSlots[slot_index( channel, seq )];
+    write_header( channel, slot->packet, RELIABLE_DATA, seq );
+    clock_gettime( CLOCK_MONOTONIC, &slot->sentAt );
+    libnxt_error errorCode = conn_send( channel->conn, slot->packet,
+                                        slot->length );
+    if ( ! errorCode )
+        channel->ackPending = 0;
+    return errorCode;
+}
+
+static libnxt_error send_ack( reliable_channel * channel ) {
+    unsigned char packet[RELIABLE_HEADER_SIZE];
+    write_header( channel, packet, RELIABLE_ACK, 0 );
+    libnxt_error errorCode = conn_send( channel->conn, packet,
+                                        sizeof ( packet ) );
+    if ( ! errorCode )
+        channel->ackPending = 0;
+    return errorCode;
+}
+
+static void record_round_trip( reliable_channel * channel,
+                               const struct timespec * sentAt ) {
+    long sample = us_since( sentAt );
+    if ( channel->rttSamples == 0 ) {
+        channel->srtt = sample;
+        channel->rttvar = sample / 2;
+    } else {
+        long deviation = channel->srtt - sample;
+        if ( deviation < 0 )
+            deviation = -deviation;
+        channel->rttvar += ( deviation - channel->rttvar ) / 4;
+        channel->srtt += ( sample - channel->srtt ) / 8;
+    }
+    channel->rttSamples++;
+
+    long margin = 4 * channel->rttvar;
+    if ( margin < 1000 )
+        margin = 1000;
+    long rto = ( channel->srtt + margin ) / 1000;
+    if ( rto < MIN_RTO )
+        rto = MIN_RTO;
+    if ( rto > MAX_RTO )
+        rto = MAX_RTO;
+    channel->rto = (int) rto;
+}
+
+static libnxt_error handle_acks( reliable_channel * channel, uint16_t ack,
+                                 uint32_t sacks ) {
+    // Ignore acknowledgements of messages not yet sent.
+    if ( seq_before( channel->nextSeq, ack ) )
+        return LIBNXT_SUCCESS;
+
+    while ( seq_before( channel->sendBase, ack ) ) {
+        send_slot * slot =
+            &channel->sendSlots[slot_index( channel, channel->sendBase )];
+        // Karn's algorithm: the round trip of a message sent again is unknown.
+        // One acknowledged selectively has already been measured, and has
+        // since been waiting on a message before it.
+        if ( ! ( slot->retransmitted || slot->sacked ) )
+            record_round_trip( channel, &slot->sentAt );
+        channel->sendBase++;
+        channel->backoff = 0;
+    }
+
+    uint16_t seq;
+    size_t i;
+    for ( i = 0; i + 1 < channel->window; i++ ) {
+        seq = (uint16_t) ( ack + 1 + i );
+        // A stale ACK may cover slots since reused for later messages.
+        if ( ! ( ( sacks >> i & 1 ) && ! seq_before( seq, channel->sendBase ) &&
+                 seq_before( seq, channel->nextSeq ) ) )
+            continue;
+        send_slot * slot = &channel->sendSlots[slot_index( channel, seq )];
+        if ( ! ( slot->sacked || slot->retransmitted ) )
+            record_round_trip( channel, &slot->sentAt );
+        if ( ! slot->sacked )
+            channel->backoff = 0;
+        slot->sacked = 1;
+    }
+
+    // Send again each message that enough later messages have overtaken.
+    size_t overtaken = 0;
+    for ( seq = channel->nextSeq; seq != channel->sendBase; ) {
+        seq--;
+        send_slot * slot = &channel->sendSlots[slot_index( channel, seq )];
+        if ( slot->sacked ) {
+            overtaken++;
+        } else if ( overtaken >= DUPLICATE_THRESHOLD &&
+                    ! slot->fastRetransmitted ) {
+            slot->fastRetransmitted = 1;
+            slot->retransmitted = 1;
+            stats_count( STAT_RETRANSMITS, 1 );
+            libnxt_error errorCode = transmit( channel, seq );
+            if ( errorCode )
+                return errorCode;
+        }
+    }
+    return LIBNXT_SUCCESS;
+}
+
+static libnxt_error handle_packet( reliable_channel * channel,
+                                   const unsigned char * packet,
+                                   uint16_t length ) {
+    // Packets of another protocol are ignored.
+    if ( length < RELIABLE_HEADER_SIZE ||
+         ( packet[0] != RELIABLE_DATA && packet[0] != RELIABLE_ACK ) )
+        return LIBNXT_SUCCESS;
+
+    libnxt_error errorCode = handle_acks( channel, get_u16( packet + 3 ),
+                                          get_u32( packet + 5 ) );
+    if ( errorCode || packet[0] != RELIABLE_DATA )
+        return errorCode;
+
+    uint16_t seq = get_u16( packet + 1 );
+    uint16_t offset = (uint16_t) ( seq - channel->receiveBase );
+    // Acknowledge even a repeated message, in case its ACK was lost.
+    channel->ackPending = 1;
+    if ( seq_before( seq, channel->receiveNext ) ) {
+        stats_count( STAT_DUPLICATES, 1 );
+    } else if ( offset < channel->window ) {
+        receive_slot * slot =
+            &channel->receiveSlots[slot_index( channel, seq )];
+        if ( slot->received ) {
+            stats_count( STAT_DUPLICATES, 1 );
+        } else {
+            slot->length = length - RELIABLE_HEADER_SIZE;
+            memcpy( slot->data, packet + RELIABLE_HEADER_SIZE, slot->length );
+            slot->received = 1;
+        }
+    }
+    // Messages beyond the window, not yet taken, are sent again later.
+
+    while ( (uint16_t) ( channel->receiveNext - channel->receiveBase ) <
+                channel->window &&
+            channel->receiveSlots[slot_index( channel,
+                                              channel->receiveNext )].received )
+        channel->receiveNext++;
+    return LIBNXT_SUCCESS;
+}
+
+static libnxt_error retransmit_due( reliable_channel * channel, long * wait ) {
+    *wait = -1;
+    long rto = (long) channel->rto << channel->backoff;
+    if ( rto > MAX_RTO )
+        rto = MAX_RTO;
+
+    int expired = 0;
+    uint16_t seq;
+    for ( seq = channel->sendBase; seq != channel->nextSeq; seq++ ) {
+        send_slot * slot = &channel->sendSlots[slot_index( channel, seq )];
+        if ( slot->sacked )
+            continue;
+        long remaining = rto - us_since( &slot->sentAt ) / 1000;
+        if ( remaining <= 0 ) {
+            slot->retransmitted = 1;
+            stats_count( STAT_RETRANSMITS, 1 );
+            libnxt_error errorCode = transmit( channel, seq );
+            if ( errorCode )
+                return errorCode;
+            expired |= ( seq == channel->sendBase );
+            remaining = rto;
+        }
+        if ( *wait < 0 || remaining < *wait )
+            *wait = remaining;
+    }
+    // Back off while the oldest message goes unacknowledged, as the link may be
+    // congested.
+    if ( expired && ( (long) channel->rto << channel->backoff ) < MAX_RTO )
+        channel->backoff++;
+    return LIBNXT_SUCCESS;
+}
+
+static libnxt_error service( reliable_channel * channel,
+                             const struct timespec * deadline, int poll ) {
+    if ( channel->eof )
+        return LIBNXT_DISCONNECTED;
+
+    long wait;
+    libnxt_error errorCode = retransmit_due( channel, &wait );
+    if ( errorCode )
+        return errorCode;
+    if ( deadline != NULL ) {
+        long remaining = ms_until( deadline );
+        if ( wait < 0 || remaining < wait )
+            wait = remaining;
+    }
+    if ( poll )
+        wait = 1;
+    // A timeout of 0 waits forever, so one that has passed is kept above.
+    conn_set_timeouts( channel->conn, ( wait < 0 ? 0 : wait > 0 ? wait : 1 ),
+                       channel->savedWriteTimeout );
+
+    message_view view;
+    errorCode = conn_receive_view( channel->conn, channel->scratch,
+                                   channel->scratchSize, &view );
+    if ( errorCode == LIBNXT_ILLEGAL_ARG ) {
+        // The packet is too long for the scratch buffer, so it is read into
+        // memory of its own and dropped, or the channel would never get past
+        // it. A receive cut off by a timeout is resumed by the next call.
+        unsigned char * packet;
+        uint16_t length;
+        errorCode = conn_receive( channel->conn, &packet, &length );
+        if ( errorCode )
+            return errorCode;
+        free_message( packet );
+        return LIBNXT_OTHER_ERROR;
+    }
+    if ( errorCode )
+        return errorCode;
+    if ( view.length == 0 ) {
+        channel->eof = 1;
+        return LIBNXT_SUCCESS;
+    }
+    if ( view.length > channel->scratchSize ) {
+        conn_release_view( channel->conn );
+        return LIBNXT_OTHER_ERROR;
+    }
+
+    errorCode = handle_packet( channel, view.data, view.length );
+    conn_release_view( channel->conn );
+    if ( ! errorCode && channel->ackPending )
+        errorCode = send_ack( channel );
+    return errorCode;
+}
+
+libnxt_error open_reliable( nxt_conn * conn, const reliable_options * options,
+                            reliable_channel ** channel ) {
+    *channel = NULL;
+    size_t window = DEFAULT_WINDOW;
+    size_t maxMessage = DEFAULT_MAX_MESSAGE;
+    int timeout = 0;
+    int rto = DEFAULT_RTO;
+    if ( options != NULL ) {
+        if ( options->window > 0 )
+            window = options->window;
+        if ( options->maxMessage > 0 )
+            maxMessage = options->maxMessage;
+        if ( options->timeout > 0 )
+            timeout = options->timeout;
+        if ( options->initialRto > 0 )
+            rto = options->initialRto;
+    }
+    if ( window > RELIABLE_MAX_WINDOW || ( window & ( window - 1 ) ) != 0 ||
+         maxMessage + RELIABLE_HEADER_SIZE > UINT16_MAX )
+        return LIBNXT_ILLEGAL_ARG;
+
+    reliable_channel * ret =
+        (reliable_channel *) calloc( 1, sizeof ( reliable_channel ) );
+    if ( ret == NULL )
+        return LIBNXT_OTHER_ERROR;
+    ret->sendSlots = (send_slot *) calloc( window, sizeof ( send_slot ) );
+    ret->receiveSlots =
+        (receive_slot *) calloc( window, sizeof ( receive_slot ) );
+    ret->scratchSize = RELIABLE_HEADER_SIZE + maxMessage;
+    // The packets and messages of all slots, then the scratch space.
+    unsigned char * storage = (unsigned char *)
+        malloc( ( window * 2 + 1 ) * ret->scratchSize );
+    if ( ret->sendSlots == NULL || ret->receiveSlots == NULL ||
+         storage == NULL ) {
+        free( ret->sendSlots );
+        free( ret->receiveSlots );
+        free( storage );
+        free( ret );
+        return LIBNXT_OTHER_ERROR;
+    }
+
+    size_t i;
+    for ( i = 0; i < window; i++ ) {
+        ret->sendSlots[i].packet = storage + 2 * i * ret->scratchSize;
+        ret->receiveSlots[i].data = storage + ( 2 * i + 1 ) * ret->scratchSize;
+    }
+    ret->scratch = storage + 2 * window * ret->scratchSize;
+    ret->conn = conn;
+    ret->window = window;
+    ret->maxMessage = maxMessage;
+    ret->timeout = timeout;
+    ret->rto = rto;
+    conn_get_timeouts( conn, &ret->savedReadTimeout, &ret->savedWriteTimeout );
+    *channel = ret;
+    return LIBNXT_SUCCESS;
+}
+
+void close_reliable( reliable_channel * channel ) {
+    if ( channel == NULL )
+        return;
+    conn_set_timeouts( channel->conn, channel->savedReadTimeout,
+                       channel->savedWriteTimeout );
+    // The first send slot holds the storage of every slot.
+    free( channel->sendSlots[0].packet );
+    free( channel->sendSlots );
+    free( channel->receiveSlots );
+    free( channel );
+}
+
+libnxt_error reliable_send( reliable_channel * channel,
+                            const unsigned char * message, uint16_t length ) {
+    if ( length > channel->maxMessage )
+        return LIBNXT_ILLEGAL_ARG;
+
+    struct timespec time;
+    struct timespec * deadline = set_deadline( channel, &time );
+    libnxt_error errorCode;
+    while ( reliable_in_flight( channel ) >= channel->window ) {
+        errorCode = service( channel, deadline, 0 );
+        if ( errorCode == LIBNXT_TIMEOUT ) {
+            if ( deadline != NULL && ms_until( deadline ) <= 0 )
+                return LIBNXT_TIMEOUT;
+        } else if ( errorCode ) {
+            return errorCode;
+        }
+    }
+
+    uint16_t seq = channel->nextSeq;
+    send_slot * slot = &channel->sendSlots[slot_index( channel, seq )];
+    memcpy( slot->packet + RELIABLE_HEADER_SIZE, message, length );
+    slot->length = RELIABLE_HEADER_SIZE + length;
+    slot->sacked = 0;
+    slot->retransmitted = 0;
+    slot->fastRetransmitted = 0;
+    channel->nextSeq++;
+    // Once in the window, the message is sent again if this send fails.
+    return transmit( channel, seq );
+}
+
+libnxt_error reliable_receive( reliable_channel * channel, unsigned char * buf,
+                               size_t maxLength, uint16_t * length ) {
+    struct timespec time;
+    struct timespec * deadline = set_deadline( channel, &time );
+    libnxt_error errorCode;
+    for ( ;; ) {
+        receive_slot * slot =
+            &channel->receiveSlots[slot_index( channel, channel->receiveBase )];
+        if ( channel->receiveBase != channel->receiveNext ) {
+            if ( slot->length > maxLength )
+                return LIBNXT_ILLEGAL_ARG;
+            memcpy( buf, slot->data, slot->length );
+            *length = slot->length;
+            slot->received = 0;
+            channel->receiveBase++;
+            return LIBNXT_SUCCESS;
+        }
+        if ( channel->eof ) {
+            *length = 0;
+            return LIBNXT_SUCCESS;
+        }
+
+        errorCode = service( channel, deadline, 0 );
+        if ( errorCode == LIBNXT_TIMEOUT ) {
+            if ( deadline != NULL && ms_until( deadline ) <= 0 )
+                return LIBNXT_TIMEOUT;
+        } else if ( errorCode ) {
+            return errorCode;
+        }
+    }
+}
+
+libnxt_error reliable_flush( reliable_channel * channel ) {
+    if ( reliable_in_flight( channel ) == 0 )
+        return LIBNXT_NO_EFFECT;
+
+    struct timespec time;
+    struct timespec * deadline = set_deadline( channel, &time );
+    libnxt_error errorCode;
+    while ( reliable_in_flight( channel ) > 0 ) {
+        errorCode = service( channel, deadline, 0 );
+        if ( errorCode == LIBNXT_TIMEOUT ) {
+            if ( deadline != NULL && ms_until( deadline ) <= 0 )
+                return LIBNXT_TIMEOUT;
+        } else if ( errorCode ) {
+            return errorCode;
+        }
+    }
+    return LIBNXT_SUCCESS;
+}
+
+libnxt_error reliable_poll( reliable_channel * channel ) {
+    libnxt_error errorCode;
+    do {
+        errorCode = service( channel, NULL, 1 );
+    } while ( ! errorCode );
+    return ( errorCode == LIBNXT_TIMEOUT ? LIBNXT_SUCCESS : errorCode );
+}
+
+size_t reliable_in_flight( reliable_channel * channel ) {
+    return (uint16_t) ( channel->nextSeq - channel->sendBase );
+}
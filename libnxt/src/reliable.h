@@ -0,0 +1,203 @@
+/*! \file
+ * \brief Reliable, ordered delivery of messages over a packet-mode connection.
+ *
+ * Packet mode delivers each message whole, but nothing detects a message that
+ * is lost, repeated or overtaken on the way, as can happen when a link is
+ * reset or a simulator injects faults. A reliable channel numbers each message
+ * it sends, and keeps a copy until the other end acknowledges it. Up to a
+ * window of messages may be unacknowledged at once, so several commands are in
+ * flight instead of each waiting for the last to be acknowledged.
+ *
+ * Each message is carried in one packet, behind a header in network
+ * (big-endian) byte order:
+ *
+ * | Offset | Size | Field                                                  |
+ * |--------|------|--------------------------------------------------------|
+ * | 0      | 1    | kind, `#RELIABLE_DATA` or `#RELIABLE_ACK`              |
+ * | 1      | 2    | sequence number of the message; 0 in an ACK            |
+ * | 3      | 2    | cumulative ACK: the next sequence number expected      |
+ * | 5      | 4    | selective ACKs: bit i set if the message numbered the  |
+ * |        |      | cumulative ACK + 1 + i has been received               |
+ * | 9      |      | the message, in `#RELIABLE_DATA` packets               |
+ *
+ * Both ends acknowledge every message received, and every message sent
+ * carries the latest acknowledgements. A message is sent again when it has
+ * gone unacknowledged for the retransmission timeout, estimated from measured
+ * round trips as by TCP (RFC 6298), or as soon as three later messages are
+ * acknowledged selectively. Only the messages missing from the other end are
+ * sent again. A message is only accepted within a window of the next message
+ * to be taken by `reliable_receive()`, so a receiver that falls behind slows
+ * the sender down.
+ *
+ * A channel only makes progress while one of its functions is being called,
+ * so an application that is not sending or receiving should call
+ * `reliable_poll()` regularly.
+ */
+#ifndef RELIABLE_H
+#define RELIABLE_H
+#include "messaging.h"
+
+/*! \def RELIABLE_DATA
+ * Kind of a packet that carries a message.
+ */
+#define RELIABLE_DATA 1
+
+/*! \def RELIABLE_ACK
+ * Kind of a packet that only carries acknowledgements.
+ */
+#define RELIABLE_ACK 2
+
+/*! \def RELIABLE_HEADER_SIZE
+ * Size of the header in front of each message.
+ */
+#define RELIABLE_HEADER_SIZE 9
+
+/*! \def RELIABLE_MAX_WINDOW
+ * The largest number of messages that may be unacknowledged at once.
+ */
+#define RELIABLE_MAX_WINDOW 32
+
+/*! \brief A reliable channel over a connection.
+ *
+ * Obtained using `open_reliable()` and released using `close_reliable()`.
+ */
+typedef struct reliable_channel reliable_channel;
+
+/*! \brief Settings for a reliable channel, given when it is opened.
+ *
+ * Fields left as 0 take their default values. Both ends must use the same
+ * window.
+ */
+typedef struct reliable_options {
+    /*! The number of messages that may be unacknowledged at once: a power of
+     * two up to `#RELIABLE_MAX_WINDOW`. Defaults to 8. */
+    size_t window;
+    /*! The size in bytes of the largest message that will be sent or
+     * received. Defaults to 256. */
+    size_t maxMessage;
+    /*! Longest time in ms that a send waits for room in the window, or a
+     * receive for a message. Defaults to no timeout. */
+    int timeout;
+    /*! Retransmission timeout in ms before any round trip has been measured.
+     * Defaults to 200. */
+    int initialRto;
+} reliable_options;
+
+/*! \brief Open a reliable channel over a connection.
+ *
+ * The other end must open a channel too. While the channel is open, all
+ * messages on the connection must pass through it, and the connection must not
+ * be corked. The channel sets the read timeout of the connection as it waits,
+ * and restores it when closed.
+ * \param [in] conn The connection, which remains owned by the caller.
+ * \param [in] options Settings for the channel, or NULL for the defaults.
+ * \param [out] channel Output location for the opened channel. Set to NULL
+ * when the return code is non-zero, indicating an error.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_ILLEGAL_ARG} if the window is not a power of two or is
+ * larger than `#RELIABLE_MAX_WINDOW`, or the largest message does not fit in a
+ * packet
+ *
+ * \linkerror{LIBNXT_OTHER_ERROR} if memory could not be allocated.
+ * \endparblock
+ */
+libnxt_error open_reliable( nxt_conn * conn, const reliable_options * options,
+                            reliable_channel ** channel );
+
+/*! \brief Close a reliable channel, leaving its connection open.
+ *
+ * Messages not yet acknowledged are discarded; call `reliable_flush()` first
+ * to wait for them.
+ */
+void close_reliable( reliable_channel * channel );
+
+/*! \brief Send a message over a reliable channel.
+ *
+ * Returns once the message has been sent, without waiting for it to be
+ * acknowledged. If the window is full, first waits for the oldest message to
+ * be acknowledged, receiving messages meanwhile.
+ * \param [in] channel
+ * \param [in] message The message to send, which is copied.
+ * \param [in] length Size of the message in bytes.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_ILLEGAL_ARG} if the message is longer than the largest
+ * message set for the channel
+ *
+ * \linkerror{LIBNXT_TIMEOUT} if the window stayed full for the timeout
+ *
+ * Any error returned by `conn_send()` or `conn_receive_view()`.
+ * \endparblock
+ */
+libnxt_error reliable_send( reliable_channel * channel,
+                            const unsigned char * message, uint16_t length );
+
+/*! \brief Receive the next message, in the order sent, from a reliable
+ * channel.
+ *
+ * \param [in] channel
+ * \param [out] buf Output location for the message.
+ * \param [in] maxLength Size of `buf` in bytes.
+ * \param [out] length Output location for the size of the message, set to 0
+ * once the other end has closed the connection and every message sent before
+ * has been received.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_ILLEGAL_ARG} if the message is longer than `maxLength`;
+ * it is kept for the next call
+ *
+ * \linkerror{LIBNXT_TIMEOUT} if no message arrived within the timeout
+ *
+ * \linkerror{LIBNXT_OTHER_ERROR} if a packet too long for the channel was
+ * received; the packet is dropped, and the next call goes on to the packets
+ * after it
+ *
+ * Any error returned by `conn_send()` or `conn_receive_view()`.
+ * \endparblock
+ */
+libnxt_error reliable_receive( reliable_channel * channel, unsigned char * buf,
+                               size_t maxLength, uint16_t * length );
+
+/*! \brief Wait until every message sent has been acknowledged.
+ *
+ * Messages received meanwhile are kept for `reliable_receive()`, as far as
+ * the window allows.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_NO_EFFECT} if there was nothing to wait for
+ *
+ * \linkerror{LIBNXT_TIMEOUT} if messages were still unacknowledged after the
+ * timeout
+ *
+ * Any error returned by `conn_send()` or `conn_receive_view()`.
+ * \endparblock
+ */
+libnxt_error reliable_flush( reliable_channel * channel );
+
+/*! \brief Process packets that have arrived and send any retransmissions that
+ * are due, waiting at most 1 ms for packets.
+ *
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * Any error returned by `conn_send()` or `conn_receive_view()`, other than
+ * \linkerror{LIBNXT_TIMEOUT}.
+ * \endparblock
+ */
+libnxt_error reliable_poll( reliable_channel * channel );
+
+/*! \brief Count the messages sent over a channel but not yet acknowledged.
+ */
+size_t reliable_in_flight( reliable_channel * channel );
+
+#endif
@@ -0,0 +1,176 @@
+#include "ring_buffer.h"
+#include <string.h>
+#include <time.h>
+
+/*
+ * Wake any side sleeping on the ring, if there is one. Cheap when no side is
+ * sleeping, since only an atomic load is performed.
+ */
+static void wake_waiters( spsc_ring * ring );
+
+static void wake_waiters( spsc_ring * ring ) {
+    // Pairs with the fence in the waiting side, so one of them sees the other.
+    atomic_thread_fence( memory_order_seq_cst );
+    if ( atomic_load( &ring->waiters ) > 0 )
+        ring_wake( ring );
+}
+
+libnxt_error init_ring( spsc_ring * ring, size_t capacity ) {
+    if ( capacity == 0 )
+        return LIBNXT_ILLEGAL_ARG;
+
+    size_t rounded = 1;
+    while ( rounded < capacity )
+        rounded <<= 1;
+
+    ring->data = (unsigned char *) malloc( rounded );
+    if ( ring->data == NULL )
+        return LIBNXT_OTHER_ERROR;
+    ring->capacity = rounded;
+    ring->mask = rounded - 1;
+    atomic_init( &ring->head, 0 );
+    atomic_init( &ring->tail, 0 );
+    atomic_init( &ring->waiters, 0 );
+    atomic_init( &ring->closed, 0 );
+    pthread_mutex_init( &ring->lock, NULL );
+    pthread_cond_init( &ring->changed, NULL );
+    return LIBNXT_SUCCESS;
+}
+
+void free_ring( spsc_ring * ring ) {
+    if ( ring->data != NULL ) {
+        pthread_cond_destroy( &ring->changed );
+        pthread_mutex_destroy( &ring->lock );
+        free( ring->data );
+        ring->data = NULL;
+    }
+}
+
+void reset_ring( spsc_ring * ring ) {
+    atomic_store( &ring->head, 0 );
+    atomic_store( &ring->tail, 0 );
+    atomic_store( &ring->closed, 0 );
+}
+
+size_t ring_count( spsc_ring * ring ) {
+    return atomic_load_explicit( &ring->head, memory_order_acquire ) -
+           atomic_load_explicit( &ring->tail, memory_order_relaxed );
+}
+
+size_t ring_readable( spsc_ring * ring, unsigned char ** span ) {
+    size_t tail = atomic_load_explicit( &ring->tail, memory_order_relaxed );
+    size_t count = ring_count( ring );
+    size_t start = tail & ring->mask;
+    *span = ring->data + start;
+    return ( count < ring->capacity - start ? count : ring->capacity - start );
+}
+
+size_t ring_readable_at( spsc_ring * ring, size_t offset,
+                         unsigned char ** span ) {
+    size_t tail = atomic_load_explicit( &ring->tail, memory_order_relaxed );
+    size_t count = ring_count( ring );
+    if ( count <= offset )
+        return 0;
+    size_t start = ( tail + offset ) & ring->mask;
+    count -= offset;
+    *span = ring->data + start;
+    return ( count < ring->capacity - start ? count : ring->capacity - start );
+}
+
+void ring_peek( spsc_ring * ring, size_t offset, unsigned char * dest,
+                size_t length ) {
+    size_t tail = atomic_load_explicit( &ring->tail, memory_order_relaxed );
+    size_t start = ( tail + offset ) & ring->mask;
+    size_t first = ring->capacity - start;
+    if ( first > length )
+        first = length;
+    memcpy( dest, ring->data + start, first );
+    memcpy( dest + first, ring->data, length - first );
+}
+
+void ring_consume( spsc_ring * ring, size_t count ) {
+    atomic_fetch_add_explicit( &ring->tail, count, memory_order_release );
+    wake_waiters( ring );
+}
+
+size_t ring_writable( spsc_ring * ring, unsigned char ** span ) {
+    size_t head = atomic_load_explicit( &ring->head, memory_order_relaxed );
+    size_t used = head - atomic_load_explicit( &ring->tail,
+                                               memory_order_acquire );
+    size_t start = head & ring->mask;
+    size_t free = ring->capacity - used;
+    *span = ring->data + start;
+    return ( free < ring->capacity - start ? free : ring->capacity - start );
+}
+
+void ring_produce( spsc_ring * ring, size_t count ) {
+    atomic_fetch_add_explicit( &ring->head, count, memory_order_release );
+    wake_waiters( ring );
+}
+
+void ring_truncate( spsc_ring * ring, size_t count ) {
+    size_t tail = atomic_load_explicit( &ring->tail, memory_order_relaxed );
+    atomic_store_explicit( &ring->head, tail + count, memory_order_release );
+}
+
+void close_ring( spsc_ring * ring ) {
+    atomic_store( &ring->closed, 1 );
+    ring_wake( ring );
+}
+
+int ring_wait_data( spsc_ring * ring, size_t count, int timeout ) {
+    if ( ring_count( ring ) >= count )
+        return 1;
+    if ( timeout == 0 )
+        return 0;
+
+    struct timespec deadline;
+    if ( timeout > 0 ) {
+        clock_gettime( CLOCK_REALTIME, &deadline );
+        deadline.tv_sec += timeout / 1000;
+        deadline.tv_nsec += ( timeout % 1000 ) * 1000000L;
+        if ( deadline.tv_nsec >= 1000000000L ) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    int expired = 0;
+    pthread_mutex_lock( &ring->lock );
+    atomic_fetch_add( &ring->waiters, 1 );
+    atomic_thread_fence( memory_order_seq_cst );
+    // Re-check after registering, so a wake-up in between is not missed.
+    while ( ring_count( ring ) < count && ! atomic_load( &ring->closed ) &&
+            ! expired ) {
+        if ( timeout > 0 )
+            expired = pthread_cond_timedwait( &ring->changed, &ring->lock,
+                                              &deadline ) != 0;
+        else
+            pthread_cond_wait( &ring->changed, &ring->lock );
+    }
+    atomic_fetch_sub( &ring->waiters, 1 );
+    pthread_mutex_unlock( &ring->lock );
+    return ring_count( ring ) >= count;
+}
+
+int ring_wait_space( spsc_ring * ring, atomic_int * stop ) {
+    unsigned char * span;
+    if ( ring_writable( ring, &span ) > 0 )
+        return 1;
+
+    pthread_mutex_lock( &ring->lock );
+    atomic_fetch_add( &ring->waiters, 1 );
+    atomic_thread_fence( memory_order_seq_cst );
+    while ( ring_writable( ring, &span ) == 0 && ! atomic_load( stop ) ) {
+        pthread_cond_wait( &ring->changed, &ring->lock );
+    }
+    atomic_fetch_sub( &ring->waiters, 1 );
+    pthread_mutex_unlock( &ring->lock );
+    return ring_writable( ring, &span ) > 0;
+}
+
+void ring_wake( spsc_ring * ring ) {
+    pthread_mutex_lock( &ring->lock );
+    pthread_cond_broadcast( &ring->changed );
+    pthread_mutex_unlock( &ring->lock );
+}
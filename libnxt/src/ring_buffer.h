@@ -0,0 +1,158 @@
+/*! \file
+ * \brief A lock-free single-producer, single-consumer ring buffer of bytes.
+ *
+ * The producer and consumer may run on different threads without locking: the
+ * positions of each side are published with atomic operations, and each side
+ * only ever moves its own position. The mutex and condition variable are used
+ * only by a side that has to sleep because the ring is empty or full, and by
+ * the other side to wake it, so the data path never takes a lock while neither
+ * side is waiting.
+ *
+ * Space is exposed as contiguous spans, so that data can be read from or
+ * written to the NXT directly in the ring without further copies.
+ */
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+#include "error_codes.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+/*! \brief A ring buffer. Initialise with `init_ring()`.
+ */
+typedef struct spsc_ring {
+    unsigned char * data; /*!< Storage of `capacity` bytes. */
+    size_t capacity; /*!< Size of `data`; a power of two. */
+    size_t mask; /*!< `capacity` - 1. */
+    atomic_size_t head; /*!< Total bytes ever produced. */
+    atomic_size_t tail; /*!< Total bytes ever consumed. */
+    atomic_int waiters; /*!< Number of sides sleeping on `changed`. */
+    atomic_int closed; /*!< Boolean flag: the producer will produce no more. */
+    pthread_mutex_t lock; /*!< Held only to sleep on or signal `changed`. */
+    pthread_cond_t changed; /*!< Signalled when data is produced or consumed. */
+} spsc_ring;
+
+/*! \brief Allocate the storage of a ring.
+ *
+ * \param [out] ring The ring to initialise.
+ * \param [in] capacity The minimum capacity in bytes; rounded up to a power of
+ * two.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_ILLEGAL_ARG} if `capacity` is 0
+ *
+ * \linkerror{LIBNXT_OTHER_ERROR} if memory could not be allocated.
+ * \endparblock
+ */
+libnxt_error init_ring( spsc_ring * ring, size_t capacity );
+
+/*! \brief Free the storage of a ring initialised with `init_ring()`.
+ */
+void free_ring( spsc_ring * ring );
+
+/*! \brief Discard all data in a ring and reopen it.
+ *
+ * Must not be called while either side is using the ring.
+ */
+void reset_ring( spsc_ring * ring );
+
+/*! \return The number of bytes available to the consumer.
+ */
+size_t ring_count( spsc_ring * ring );
+
+/*! \brief Get the contiguous span of data at the front of the ring.
+ *
+ * Called by the consumer. The span may hold less than `ring_count()` bytes if
+ * the data wraps around the end of the storage.
+ * \param [out] span Location of the first byte of data.
+ * \return The number of bytes in the span.
+ */
+size_t ring_readable( spsc_ring * ring, unsigned char ** span );
+
+/*! \brief Get the contiguous span of data that follows the given number of
+ * bytes from the front of the ring.
+ *
+ * Called by the consumer, to go through data that it cannot yet consume.
+ * \param [in] offset Number of bytes from the front of the ring to skip.
+ * \param [out] span Location of the first byte of data after them.
+ * \return The number of bytes in the span, or 0 if the ring holds no more
+ * than `offset` bytes.
+ */
+size_t ring_readable_at( spsc_ring * ring, size_t offset,
+                         unsigned char ** span );
+
+/*! \brief Copy data out of the ring without consuming it.
+ *
+ * Called by the consumer. The data may wrap around the end of the storage.
+ * \param [in] offset Number of bytes from the front of the ring to skip.
+ * \param [out] dest Location to copy the data to.
+ * \param [in] length Number of bytes to copy; `offset` + `length` must not
+ * exceed `ring_count()`.
+ */
+void ring_peek( spsc_ring * ring, size_t offset, unsigned char * dest,
+                size_t length );
+
+/*! \brief Remove data from the front of the ring, making its space available
+ * to the producer.
+ *
+ * Called by the consumer.
+ * \param [in] count Number of bytes; no more than `ring_count()`.
+ */
+void ring_consume( spsc_ring * ring, size_t count );
+
+/*! \brief Get the contiguous span of free space at the back of the ring.
+ *
+ * Called by the producer.
+ * \param [out] span Location of the first free byte.
+ * \return The number of bytes in the span.
+ */
+size_t ring_writable( spsc_ring * ring, unsigned char ** span );
+
+/*! \brief Publish data written into the span given by `ring_writable()`.
+ *
+ * Called by the producer.
+ * \param [in] count Number of bytes written.
+ */
+void ring_produce( spsc_ring * ring, size_t count );
+
+/*! \brief Withdraw data from the back of the ring, keeping only the given
+ * number of bytes.
+ *
+ * Called by the producer, and only when the producer is also the consumer, so
+ * that none of the data can be consumed meanwhile.
+ * \param [in] count Number of bytes to keep; no more than `ring_count()`.
+ */
+void ring_truncate( spsc_ring * ring, size_t count );
+
+/*! \brief Indicate that the producer will produce no more data, and wake the
+ * consumer.
+ */
+void close_ring( spsc_ring * ring );
+
+/*! \brief Sleep until the ring holds at least the given number of bytes, the
+ * ring is closed, or a timeout expires.
+ *
+ * Called by the consumer.
+ * \param [in] count The number of bytes to wait for.
+ * \param [in] timeout The longest time to wait in ms, or a negative number to
+ * wait forever.
+ * \return A non-zero integer if the bytes are available, otherwise 0.
+ */
+int ring_wait_data( spsc_ring * ring, size_t count, int timeout );
+
+/*! \brief Sleep until the ring has free space, or `stop` becomes non-zero.
+ *
+ * Called by the producer. Waking the producer to stop is done with
+ * `ring_wake()`.
+ * \param [in] stop A flag that is checked on every wake-up.
+ * \return A non-zero integer if there is free space, otherwise 0.
+ */
+int ring_wait_space( spsc_ring * ring, atomic_int * stop );
+
+/*! \brief Wake any side sleeping on the ring.
+ */
+void ring_wake( spsc_ring * ring );
+
+#endif
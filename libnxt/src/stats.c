@@ -0,0 +1,271 @@
+#include "stats.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Bits of a value below its leading bit that select its sub-bucket.
+#define SUB_BUCKET_BITS 3
+// Largest value a histogram holds, in us.
+#define MAX_LATENCY 0xffffffffULL
+
+// A histogram being recorded into.
+typedef struct live_histogram {
+    _Atomic uint64_t counts[STATS_BUCKETS];
+    _Atomic uint64_t count;
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+} live_histogram;
+
+static _Atomic uint64_t counters[STAT_COUNTERS];
+static live_histogram histograms[STAT_HISTOGRAMS];
+
+static const char * COUNTER_NAMES[STAT_COUNTERS] = {
+    "bytes_sent", "bytes_received", "frames_sent", "frames_received", "fills",
+    "flushes", "short_reads", "short_writes", "timeout_retries",
+    "unfinished_reads", "retransmits", "duplicates", "compressed_frames",
+    "compression_saved", "reconnects"
+};
+
+static const char * HISTOGRAM_NAMES[STAT_HISTOGRAMS] = {
+    "send_to_flush_us", "receive_wait_us", "recovery_us"
+};
+
+// Held while the hook is replaced, so that one thread at a time replaces it.
+static pthread_mutex_t setLock = PTHREAD_MUTEX_INITIALIZER;
+// The periodic hook, and the thread calling it, guarded by hookLock.
+static pthread_mutex_t hookLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hookChanged = PTHREAD_COND_INITIALIZER;
+static pthread_t hookThread;
+static int hookRunning = 0;
+static int hookStop = 0;
+static stats_hook hookFunction = NULL;
+static void * hookContext = NULL;
+static int hookInterval = 0;
+
+/*
+ * Get the bucket of a histogram that counts a value.
+ */
+static size_t bucket_of( uint64_t value );
+
+/*
+ * Get the highest value counted by a bucket of a histogram.
+ */
+static uint64_t bucket_high( size_t bucket );
+
+/*
+ * Print the statistics to stderr; the hook used when none is given.
+ */
+static void print_hook( const libnxt_stats * stats, void * context );
+
+/*
+ * Body of the hook thread: call the hook every interval until stopped.
+ */
+static void * run_hook( void * arg );
+
+/*
+ * Stop the hook thread, if it is running. Called with hookLock held.
+ */
+static void stop_hook( void );
+
+static size_t bucket_of( uint64_t value ) {
+    if ( value < STATS_SUB_BUCKETS )
+        return (size_t) value;
+    if ( value > MAX_LATENCY )
+        value = MAX_LATENCY;
+    int exponent = 63 - __builtin_clzll( value );
+    size_t sub = (size_t) ( value >> ( exponent - SUB_BUCKET_BITS ) ) -
+                 STATS_SUB_BUCKETS;
+    return STATS_SUB_BUCKETS * ( exponent - SUB_BUCKET_BITS + 1 ) + sub;
+}
+
+static uint64_t bucket_high( size_t bucket ) {
+    if ( bucket < STATS_SUB_BUCKETS )
+        return bucket;
+    int shift = (int) ( bucket / STATS_SUB_BUCKETS ) - 1;
+    uint64_t low = (uint64_t) ( STATS_SUB_BUCKETS +
+                                bucket % STATS_SUB_BUCKETS ) << shift;
+    return low + ( (uint64_t) 1 << shift ) - 1;
+}
+
+void stats_count( nxt_counter counter, uint64_t amount ) {
+    atomic_fetch_add_explicit( &counters[counter], amount,
+                               memory_order_relaxed );
+}
+
+void stats_record( nxt_histogram histogram, uint64_t latency ) {
+    live_histogram * live = &histograms[histogram];
+    atomic_fetch_add_explicit( &live->counts[bucket_of( latency )], 1,
+                               memory_order_relaxed );
+    atomic_fetch_add_explicit( &live->count, 1, memory_order_relaxed );
+    atomic_fetch_add_explicit( &live->sum, latency, memory_order_relaxed );
+    uint64_t max = atomic_load_explicit( &live->max, memory_order_relaxed );
+    while ( latency > max &&
+            ! atomic_compare_exchange_weak_explicit( &live->max, &max, latency,
+                                                     memory_order_relaxed,
+                                                     memory_order_relaxed ) );
+}
+
+void libnxt_get_stats( libnxt_stats * stats ) {
+    size_t i, j;
+    for ( i = 0; i < STAT_COUNTERS; i++ )
+        stats->counters[i] = atomic_load_explicit( &counters[i],
+                                                   memory_order_relaxed );
+    for ( i = 0; i < STAT_HISTOGRAMS; i++ ) {
+        live_histogram * live = &histograms[i];
+        latency_histogram * snapshot = &stats->histograms[i];
+        for ( j = 0; j < STATS_BUCKETS; j++ )
+            snapshot->counts[j] =
+                atomic_load_explicit( &live->counts[j], memory_order_relaxed );
+        snapshot->count = atomic_load_explicit( &live->count,
+                                                memory_order_relaxed );
+        snapshot->sum = atomic_load_explicit( &live->sum,
+                                              memory_order_relaxed );
+        snapshot->max = atomic_load_explicit( &live->max,
+                                              memory_order_relaxed );
+    }
+}
+
+void libnxt_reset_stats( void ) {
+    size_t i, j;
+    for ( i = 0; i < STAT_COUNTERS; i++ )
+        atomic_store_explicit( &counters[i], 0, memory_order_relaxed );
+    for ( i = 0; i < STAT_HISTOGRAMS; i++ ) {
+        live_histogram * live = &histograms[i];
+        for ( j = 0; j < STATS_BUCKETS; j++ )
+            atomic_store_explicit( &live->counts[j], 0, memory_order_relaxed );
+        atomic_store_explicit( &live->count, 0, memory_order_relaxed );
+        atomic_store_explicit( &live->sum, 0, memory_order_relaxed );
+        atomic_store_explicit( &live->max, 0, memory_order_relaxed );
+    }
+}
+
+uint64_t histogram_percentile( const latency_histogram * histogram,
+                               double percentile ) {
+    if ( histogram->count == 0 )
+        return 0;
+
+    // The rank of the value sought, counting from 1.
+    uint64_t rank = (uint64_t) ( percentile / 100.0 * histogram->count + 0.5 );
+    if ( rank < 1 )
+        rank = 1;
+    uint64_t seen = 0;
+    size_t i;
+    for ( i = 0; i < STATS_BUCKETS; i++ ) {
+        seen += histogram->counts[i];
+        if ( seen >= rank ) {
+            uint64_t high = bucket_high( i );
+            return ( high < histogram->max ? high : histogram->max );
+        }
+    }
+    return histogram->max;
+}
+
+const char * counter_name( nxt_counter counter ) {
+    return ( counter < STAT_COUNTERS ? COUNTER_NAMES[counter] : NULL );
+}
+
+const char * histogram_name( nxt_histogram histogram ) {
+    return ( histogram < STAT_HISTOGRAMS ? HISTOGRAM_NAMES[histogram] : NULL );
+}
+
+void print_stats( const libnxt_stats * stats, FILE * stream ) {
+    size_t i;
+    for ( i = 0; i < STAT_COUNTERS; i++ )
+        fprintf( stream, "%s %llu\n", COUNTER_NAMES[i],
+                 (unsigned long long) stats->counters[i] );
+    for ( i = 0; i < STAT_HISTOGRAMS; i++ ) {
+        const latency_histogram * histogram = &stats->histograms[i];
+        unsigned long long mean = ( histogram->count == 0 ? 0 :
+                                    histogram->sum / histogram->count );
+        fprintf( stream, "%s count=%llu mean=%llu p50=%llu p90=%llu p99=%llu "
+                 "max=%llu\n", HISTOGRAM_NAMES[i],
+                 (unsigned long long) histogram->count, mean,
+                 (unsigned long long) histogram_percentile( histogram, 50 ),
+                 (unsigned long long) histogram_percentile( histogram, 90 ),
+                 (unsigned long long) histogram_percentile( histogram, 99 ),
+                 (unsigned long long) histogram->max );
+    }
+    fflush( stream );
+}
+
+static void print_hook( const libnxt_stats * stats, void * context ) {
+    (void) context;
+    print_stats( stats, stderr );
+}
+
+static void * run_hook( void * arg ) {
+    (void) arg;
+    // Too large to keep on the small stacks of embedded threads.
+    libnxt_stats * stats = (libnxt_stats *) malloc( sizeof ( libnxt_stats ) );
+    if ( stats == NULL )
+        return NULL;
+
+    pthread_mutex_lock( &hookLock );
+    while ( ! hookStop ) {
+        struct timespec deadline;
+        clock_gettime( CLOCK_REALTIME, &deadline );
+        deadline.tv_sec += hookInterval / 1000;
+        deadline.tv_nsec += ( hookInterval % 1000 ) * 1000000L;
+        if ( deadline.tv_nsec >= 1000000000L ) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while ( ! hookStop &&
+                pthread_cond_timedwait( &hookChanged, &hookLock,
+                                        &deadline ) == 0 );
+        if ( hookStop )
+            break;
+
+        stats_hook hook = hookFunction;
+        void * context = hookContext;
+        // Not held during the call, so a slow hook cannot stall a new one.
+        pthread_mutex_unlock( &hookLock );
+        libnxt_get_stats( stats );
+        hook( stats, context );
+        pthread_mutex_lock( &hookLock );
+    }
+    pthread_mutex_unlock( &hookLock );
+    free( stats );
+    return NULL;
+}
+
+static void stop_hook( void ) {
+    if ( ! hookRunning )
+        return;
+    hookStop = 1;
+    pthread_cond_broadcast( &hookChanged );
+    pthread_mutex_unlock( &hookLock );
+    pthread_join( hookThread, NULL );
+    pthread_mutex_lock( &hookLock );
+    hookRunning = 0;
+}
+
+libnxt_error libnxt_set_stats_hook( stats_hook hook, void * context,
+                                    int interval ) {
+    if ( interval < 0 )
+        return LIBNXT_ILLEGAL_ARG;
+
+    libnxt_error errorCode = LIBNXT_SUCCESS;
+    pthread_mutex_lock( &setLock );
+    pthread_mutex_lock( &hookLock );
+    if ( interval == 0 && ! hookRunning ) {
+        errorCode = LIBNXT_NO_EFFECT;
+    } else {
+        stop_hook();
+        if ( interval > 0 ) {
+            hookFunction = ( hook != NULL ? hook : print_hook );
+            hookContext = context;
+            hookInterval = interval;
+            hookStop = 0;
+            if ( pthread_create( &hookThread, NULL, run_hook, NULL ) )
+                errorCode = LIBNXT_OTHER_ERROR;
+            else
+                hookRunning = 1;
+        }
+    }
+    pthread_mutex_unlock( &hookLock );
+    pthread_mutex_unlock( &setLock );
+    return errorCode;
+}
@@ -0,0 +1,162 @@
+/*! \file
+ * \brief Counters and latency histograms kept by libnxt on its I/O paths.
+ *
+ * Statistics are always collected, for all connections in the process
+ * together. Recording one costs a relaxed atomic addition, so they can be left
+ * on in the field, and read with `libnxt_get_stats()` or dumped periodically
+ * with `libnxt_set_stats_hook()` to find out why communication is slow without
+ * attaching a debugger.
+ *
+ * Latencies are kept in histograms in the style of HdrHistogram: values below
+ * `#STATS_SUB_BUCKETS` us are counted exactly, and each power of two above is
+ * split into `#STATS_SUB_BUCKETS` buckets, so any value is recorded to within
+ * 12.5% in constant time and fixed memory, from 1 us to over an hour.
+ */
+#ifndef STATS_H
+#define STATS_H
+#include "error_codes.h"
+#include <stdint.h>
+#include <stdio.h>
+
+/*! \def STATS_SUB_BUCKETS
+ * The number of buckets each power of two is split into by a histogram.
+ */
+#define STATS_SUB_BUCKETS 8
+
+/*! \def STATS_BUCKETS
+ * The number of buckets of a histogram, covering values up to 2^32 us.
+ */
+#define STATS_BUCKETS ( STATS_SUB_BUCKETS * 30 )
+
+/*! \brief The counters kept by libnxt.
+ */
+typedef enum nxt_counter {
+    STAT_BYTES_SENT, /*!< Bytes written to NXTs, including headers. */
+    STAT_BYTES_RECEIVED, /*!< Bytes read from NXTs, including headers. */
+    STAT_FRAMES_SENT, /*!< Messages sent. */
+    STAT_FRAMES_RECEIVED, /*!< Messages received. */
+    STAT_FILLS, /*!< Reads into a receive buffer. */
+    STAT_FLUSHES, /*!< Writes from a send buffer. */
+    STAT_SHORT_READS, /*!< Reads that returned less data than there was room
+                       * for. */
+    STAT_SHORT_WRITES, /*!< Writes that sent less than the data given. */
+    STAT_TIMEOUT_RETRIES, /*!< USB transfers repeated after libusb timed
+                           * out. */
+    STAT_UNFINISHED_READS, /*!< USB reads repeated to complete data cut off by
+                            * a timeout. */
+    STAT_RETRANSMITS, /*!< Frames sent again by reliable channels. */
+    STAT_DUPLICATES, /*!< Frames received more than once by reliable
+                      * channels. */
+    STAT_COMPRESSED_FRAMES, /*!< Messages sent compressed. */
+    STAT_COMPRESSION_SAVED, /*!< Bytes saved by compressing messages. */
+    STAT_RECONNECTS, /*!< Connections resumed after their NXT reconnected. */
+    STAT_COUNTERS /*!< The number of counters. */
+} nxt_counter;
+
+/*! \brief The latency histograms kept by libnxt.
+ */
+typedef enum nxt_histogram {
+    STAT_SEND_TO_FLUSH, /*!< From a message being sent, or the first of a batch
+                         * or of corked messages, to all of them being
+                         * written. */
+    STAT_RECEIVE_WAIT, /*!< Time each successful receive took. */
+    STAT_RECOVERY, /*!< From a connection finding its NXT disconnected to
+                    * the connection being resumed. */
+    STAT_HISTOGRAMS /*!< The number of histograms. */
+} nxt_histogram;
+
+/*! \brief A snapshot of a latency histogram, in us.
+ */
+typedef struct latency_histogram {
+    uint64_t counts[STATS_BUCKETS]; /*!< Number of values in each bucket. */
+    uint64_t count; /*!< Number of values recorded. */
+    uint64_t sum; /*!< Sum of the values recorded. */
+    uint64_t max; /*!< Largest value recorded. */
+} latency_histogram;
+
+/*! \brief A snapshot of the statistics kept by libnxt.
+ */
+typedef struct libnxt_stats {
+    uint64_t counters[STAT_COUNTERS]; /*!< Indexed by `nxt_counter`. */
+    latency_histogram histograms[STAT_HISTOGRAMS]; /*!< Indexed by
+                                                    * `nxt_histogram`. */
+} libnxt_stats;
+
+/*! \brief Called periodically with a snapshot of the statistics.
+ *
+ * Runs on a thread of its own. `stats` is only valid during the call.
+ */
+typedef void ( * stats_hook )( const libnxt_stats * stats, void * context );
+
+/*! \brief Take a snapshot of the statistics.
+ *
+ * Counters and histograms are read one at a time while they may still be
+ * updated, so a snapshot taken during I/O may be slightly inconsistent.
+ * \param [out] stats Output location for the snapshot.
+ */
+void libnxt_get_stats( libnxt_stats * stats );
+
+/*! \brief Set every counter and histogram to zero.
+ */
+void libnxt_reset_stats( void );
+
+/*! \brief Estimate a percentile of a histogram.
+ *
+ * \param [in] histogram
+ * \param [in] percentile Between 0 and 100.
+ * \return The highest value of the bucket holding the percentile, or 0 if the
+ * histogram is empty.
+ */
+uint64_t histogram_percentile( const latency_histogram * histogram,
+                               double percentile );
+
+/*! \brief Get the name of a counter or histogram, such as "bytes_sent".
+ */
+const char * counter_name( nxt_counter counter );
+const char * histogram_name( nxt_histogram histogram );
+
+/*! \brief Write a snapshot of the statistics as text, one line each.
+ *
+ * Histograms are summarised by their count, mean, 50th, 90th and 99th
+ * percentiles and maximum, in us.
+ * \param [in] stats
+ * \param [in] stream
+ */
+void print_stats( const libnxt_stats * stats, FILE * stream );
+
+/*! \brief Call a function with the statistics at a regular interval.
+ *
+ * Replaces any hook already set.
+ * \param [in] hook The function to call, or NULL to print the statistics to
+ * stderr.
+ * \param [in] context Passed to `hook`.
+ * \param [in] interval Time between calls in ms, or 0 to stop calling the
+ * hook.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_NO_EFFECT} if `interval` is 0 and no hook is set
+ *
+ * \linkerror{LIBNXT_ILLEGAL_ARG} if `interval` is negative
+ *
+ * \linkerror{LIBNXT_OTHER_ERROR} if the thread calling the hook could not be
+ * started.
+ * \endparblock
+ */
+libnxt_error libnxt_set_stats_hook( stats_hook hook, void * context,
+                                    int interval );
+
+/*! \brief Add to a counter. Used by libnxt on its I/O paths.
+ */
+void stats_count( nxt_counter counter, uint64_t amount );
+
+/*! \brief Record a latency in a histogram. Used by libnxt on its I/O paths.
+ *
+ * \param [in] histogram
+ * \param [in] latency The latency in us; larger values than the histogram
+ * covers are counted in its last bucket.
+ */
+void stats_record( nxt_histogram histogram, uint64_t latency );
+
+#endif
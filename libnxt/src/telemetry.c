@@ -0,0 +1,173 @@
+#include "telemetry.h"
+#include <string.h>
+
+// Size of the fields common to every message.
+#define HEADER_SIZE 6
+// Size of each type of message, in version 1 of the layout.
+#define POSE_SIZE ( HEADER_SIZE + 14 )
+#define OBSTACLE_SIZE ( HEADER_SIZE + 12 )
+#define PROGRESS_SIZE ( HEADER_SIZE + 3 )
+#define ERROR_SIZE ( HEADER_SIZE + 1 )
+#define RANGE_SIZE ( HEADER_SIZE + 18 )
+
+/*
+ * Read big-endian fields.
+ * in: data - Location of the first byte of the field.
+ */
+static uint16_t read_u16( const unsigned char * data );
+static uint32_t read_u32( const unsigned char * data );
+static float read_float( const unsigned char * data );
+
+/*
+ * Write big-endian fields.
+ * out: data - Location of the first byte of the field.
+ */
+static void write_u16( unsigned char * data, uint16_t value );
+static void write_u32( unsigned char * data, uint32_t value );
+static void write_float( unsigned char * data, float value );
+
+static uint16_t read_u16( const unsigned char * data ) {
+    return (uint16_t) ( ( data[0] << 8 ) | data[1] );
+}
+
+static uint32_t read_u32( const unsigned char * data ) {
+    return ( (uint32_t) data[0] << 24 ) | ( (uint32_t) data[1] << 16 ) |
+           ( (uint32_t) data[2] << 8 ) | (uint32_t) data[3];
+}
+
+static float read_float( const unsigned char * data ) {
+    // Java writes floats as their IEEE 754 bits.
+    uint32_t bits = read_u32( data );
+    float value;
+    memcpy( &value, &bits, sizeof ( value ) );
+    return value;
+}
+
+static void write_u16( unsigned char * data, uint16_t value ) {
+    data[0] = (unsigned char) ( value >> 8 );
+    data[1] = (unsigned char) value;
+}
+
+static void write_u32( unsigned char * data, uint32_t value ) {
+    data[0] = (unsigned char) ( value >> 24 );
+    data[1] = (unsigned char) ( value >> 16 );
+    data[2] = (unsigned char) ( value >> 8 );
+    data[3] = (unsigned char) value;
+}
+
+static void write_float( unsigned char * data, float value ) {
+    uint32_t bits;
+    memcpy( &bits, &value, sizeof ( bits ) );
+    write_u32( data, bits );
+}
+
+libnxt_error decode_telemetry( const unsigned char * data, uint16_t length,
+                               telemetry_message * message ) {
+    if ( length < HEADER_SIZE )
+        return LIBNXT_ILLEGAL_ARG;
+    if ( data[0] != TELEMETRY_VERSION )
+        return LIBNXT_OTHER_ERROR;
+
+    message->version = data[0];
+    message->type = (telemetry_type) data[1];
+    message->time = read_u32( data + 2 );
+    const unsigned char * body = data + HEADER_SIZE;
+    switch ( message->type ) {
+        case TELEMETRY_POSE:
+            if ( length < POSE_SIZE )
+                return LIBNXT_ILLEGAL_ARG;
+            message->pose.x = read_float( body );
+            message->pose.y = read_float( body + 4 );
+            message->pose.heading = read_float( body + 8 );
+            message->pose.waypoint = read_u16( body + 12 );
+            return LIBNXT_SUCCESS;
+        case TELEMETRY_OBSTACLE:
+            if ( length < OBSTACLE_SIZE )
+                return LIBNXT_ILLEGAL_ARG;
+            message->obstacle.x = read_float( body );
+            message->obstacle.y = read_float( body + 4 );
+            message->obstacle.range = read_float( body + 8 );
+            return LIBNXT_SUCCESS;
+        case TELEMETRY_PROGRESS:
+            if ( length < PROGRESS_SIZE )
+                return LIBNXT_ILLEGAL_ARG;
+            message->progress.stage = (telemetry_progress) body[0];
+            message->progress.waypoints = read_u16( body + 1 );
+            return LIBNXT_SUCCESS;
+        case TELEMETRY_ERROR:
+            if ( length < ERROR_SIZE )
+                return LIBNXT_ILLEGAL_ARG;
+            message->error.fault = (telemetry_fault) body[0];
+            return LIBNXT_SUCCESS;
+        case TELEMETRY_RANGE:
+            if ( length < RANGE_SIZE )
+                return LIBNXT_ILLEGAL_ARG;
+            message->range.x = read_float( body );
+            message->range.y = read_float( body + 4 );
+            message->range.heading = read_float( body + 8 );
+            message->range.range = read_float( body + 12 );
+            message->range.next = read_u16( body + 16 );
+            return LIBNXT_SUCCESS;
+        default:
+            return LIBNXT_ILLEGAL_ARG;
+    }
+}
+
+size_t encode_telemetry( const telemetry_message * message,
+                         unsigned char * data, size_t capacity ) {
+    size_t length;
+    switch ( message->type ) {
+        case TELEMETRY_POSE:
+            length = POSE_SIZE;
+            break;
+        case TELEMETRY_OBSTACLE:
+            length = OBSTACLE_SIZE;
+            break;
+        case TELEMETRY_PROGRESS:
+            length = PROGRESS_SIZE;
+            break;
+        case TELEMETRY_ERROR:
+            length = ERROR_SIZE;
+            break;
+        case TELEMETRY_RANGE:
+            length = RANGE_SIZE;
+            break;
+        default:
+            return 0;
+    }
+    if ( length > capacity )
+        return 0;
+
+    data[0] = TELEMETRY_VERSION;
+    data[1] = (unsigned char) message->type;
+    write_u32( data + 2, message->time );
+    unsigned char * body = data + HEADER_SIZE;
+    switch ( message->type ) {
+        case TELEMETRY_POSE:
+            write_float( body, message->pose.x );
+            write_float( body + 4, message->pose.y );
+            write_float( body + 8, message->pose.heading );
+            write_u16( body + 12, message->pose.waypoint );
+            break;
+        case TELEMETRY_OBSTACLE:
+            write_float( body, message->obstacle.x );
+            write_float( body + 4, message->obstacle.y );
+            write_float( body + 8, message->obstacle.range );
+            break;
+        case TELEMETRY_PROGRESS:
+            body[0] = (unsigned char) message->progress.stage;
+            write_u16( body + 1, message->progress.waypoints );
+            break;
+        case TELEMETRY_ERROR:
+            body[0] = (unsigned char) message->error.fault;
+            break;
+        case TELEMETRY_RANGE:
+            write_float( body, message->range.x );
+            write_float( body + 4, message->range.y );
+            write_float( body + 8, message->range.heading );
+            write_float( body + 12, message->range.range );
+            write_u16( body + 16, message->range.next );
+            break;
+    }
+    return length;
+}
@@ -0,0 +1,149 @@
+/*! \file
+ * \brief Decodes the binary telemetry messages sent by the robot.
+ *
+ * Each message is sent in its own packet, and has a fixed layout in network
+ * (big-endian) byte order, as written by Java's `DataOutputStream`:
+ *
+ * | Offset | Size | Field                                     |
+ * |--------|------|-------------------------------------------|
+ * | 0      | 1    | version, `#TELEMETRY_VERSION`             |
+ * | 1      | 1    | type, a `telemetry_type`                  |
+ * | 2      | 4    | time since the robot started, in ms       |
+ * | 6      |      | body, laid out as below for each type     |
+ *
+ * - `TELEMETRY_POSE`: x, y and heading as 4-byte floats, then the 2-byte
+ *   sequence number of the waypoint reached (20 bytes in all).
+ * - `TELEMETRY_OBSTACLE`: x and y of the node found blocked, and the range at
+ *   which it was detected, as 4-byte floats (18 bytes).
+ * - `TELEMETRY_PROGRESS`: a 1-byte `telemetry_progress`, then the 2-byte
+ *   number of waypoints in the plan (9 bytes).
+ * - `TELEMETRY_ERROR`: a 1-byte `telemetry_fault` (7 bytes).
+ * - `TELEMETRY_RANGE`: x, y and heading of the robot when the reading was
+ *   taken, and the range of the echo, as 4-byte floats, then the 2-byte index
+ *   of the node being driven to, or `#TELEMETRY_NO_NODE` (24 bytes).
+ *
+ * Later versions may only append fields to a body, so a message longer than
+ * its layout is decoded by ignoring the extra bytes. The Java counterpart is
+ * `Telemetry.java`; `encode_telemetry()` writes the same layout, for programs
+ * that play the part of the robot.
+ */
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+#include "error_codes.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*! \def TELEMETRY_VERSION
+ * The version of the message layout that is decoded.
+ */
+#define TELEMETRY_VERSION 1
+
+/*! \def TELEMETRY_NO_NODE
+ * The node of a `TELEMETRY_RANGE` message taken when the robot was not driving
+ * to a node.
+ */
+#define TELEMETRY_NO_NODE 0xffff
+
+/*! \brief The kinds of telemetry message.
+ */
+typedef enum telemetry_type {
+    TELEMETRY_POSE = 1, /*!< The robot reached a waypoint. */
+    TELEMETRY_OBSTACLE = 2, /*!< The robot detected an obstacle. */
+    TELEMETRY_PROGRESS = 3, /*!< The robot started or finished a plan. */
+    TELEMETRY_ERROR = 4, /*!< The robot could not continue its plan. */
+    TELEMETRY_RANGE = 5 /*!< The robot's sensor heard an echo, while sensing
+                         * continuously. */
+} telemetry_type;
+
+/*! \brief Stages in executing a plan, reported by `TELEMETRY_PROGRESS`.
+ */
+typedef enum telemetry_progress {
+    PROGRESS_STARTED = 1, /*!< The robot began following a plan. */
+    PROGRESS_REPLANNED = 2, /*!< A new plan was made around an obstacle. */
+    PROGRESS_COMPLETE = 3 /*!< The robot reached the end of its plan. */
+} telemetry_progress;
+
+/*! \brief Failures reported by `TELEMETRY_ERROR`.
+ */
+typedef enum telemetry_fault {
+    FAULT_NO_PATH = 1, /*!< No path to the target could be found. */
+    FAULT_LOCALISE = 2, /*!< The robot could not be placed on the grid. */
+    FAULT_MAPPING = 3, /*!< An obstacle could not be placed on the grid. */
+    FAULT_IO = 4 /*!< The robot failed to communicate. */
+} telemetry_fault;
+
+/*! \brief A decoded telemetry message.
+ */
+typedef struct telemetry_message {
+    uint8_t version; /*!< Version of the layout the message was sent with. */
+    telemetry_type type; /*!< Selects the member of the union that is set. */
+    uint32_t time; /*!< Time since the robot started, in ms. */
+    union {
+        /*! Set for `TELEMETRY_POSE`. */
+        struct {
+            float x;
+            float y;
+            float heading; /*!< In degrees. */
+            uint16_t waypoint; /*!< Sequence number of the waypoint. */
+        } pose;
+        /*! Set for `TELEMETRY_OBSTACLE`. */
+        struct {
+            float x;
+            float y;
+            float range; /*!< From the centre of the robot. */
+        } obstacle;
+        /*! Set for `TELEMETRY_PROGRESS`. */
+        struct {
+            telemetry_progress stage;
+            uint16_t waypoints; /*!< Number of waypoints in the plan. */
+        } progress;
+        /*! Set for `TELEMETRY_ERROR`. */
+        struct {
+            telemetry_fault fault;
+        } error;
+        /*! Set for `TELEMETRY_RANGE`. */
+        struct {
+            float x;
+            float y;
+            float heading; /*!< In degrees. */
+            float range; /*!< From the centre of the robot. */
+            uint16_t next; /*!< Index of the node being driven to. */
+        } range;
+    };
+} telemetry_message;
+
+/*! \brief Decode a telemetry message.
+ *
+ * Reads straight from the received data, such as a `message_view` lent out
+ * by `receive_view()`, without allocating memory.
+ * \param [in] data The message received from the robot.
+ * \param [in] length Size of the message in bytes.
+ * \param [out] message Output location for the decoded message.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS} (and populates `message`)
+ *
+ * \linkerror{LIBNXT_ILLEGAL_ARG} if the message is shorter than its layout, or
+ * of an unknown type
+ *
+ * \linkerror{LIBNXT_OTHER_ERROR} if the message was sent with an incompatible
+ * version of the layout.
+ * \endparblock
+ */
+libnxt_error decode_telemetry( const unsigned char * data, uint16_t length,
+                               telemetry_message * message );
+
+/*! \brief Encode a telemetry message, as `Telemetry.java` does on the robot.
+ *
+ * The message is encoded with version `#TELEMETRY_VERSION` of the layout,
+ * whatever its `version` field.
+ * \param [in] message The message to encode.
+ * \param [out] data Output location for the encoded message.
+ * \param [in] capacity Size of `data` in bytes.
+ * \return The size of the encoded message, or 0 if the type is unknown or the
+ * message does not fit in `capacity`.
+ */
+size_t encode_telemetry( const telemetry_message * message,
+                         unsigned char * data, size_t capacity );
+
+#endif
@@ -0,0 +1,265 @@
+/*
+ * Compares blocking reads with `bulk_read_nxt()` and asynchronous reads with
+ * `wait_async_nxt()` and `read_async_nxt()`, against a mock NXT that sends a
+ * packet every millisecond: for each way of reading, the latency from each
+ * packet being sent to it being read, and the CPU time the reading thread
+ * spends per packet, are printed. libusb's transfer functions are replaced by
+ * ones in this program that stand in for the NXT, so no NXT is needed.
+ *
+ * Usage: bench_async [packets], by default 2000.
+ */
+#include "check.h"
+#include "nxt_usb.h"
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_PACKETS 2000
+// Time between packets sent by the mock NXT.
+#define PERIOD_NS 1000000
+// Transfers kept in flight by asynchronous reads.
+#define DEPTH 4
+// Longest queue of transfers submitted and not yet completed.
+#define MAX_QUEUED 16
+
+/*
+ * Body of the thread of the mock NXT, which sends the packets.
+ */
+static void * send_packets( void * context );
+
+/*
+ * Take the next packet sent, waiting for up to the given time in ms, or
+ * forever if 0.
+ * return: Non-zero if a packet was taken.
+ */
+static int take_packet( unsigned char * data, unsigned int timeout );
+
+/*
+ * Time on the monotonic clock, and CPU time of the calling thread, in us.
+ */
+static long now_us( void );
+static long cpu_us( void );
+
+/*
+ * Read every packet, blocking or asynchronously, and print the latencies and
+ * the CPU time taken.
+ */
+static void run( int async );
+
+/*
+ * Order latencies for qsort().
+ */
+static int compare_long( const void * a, const void * b );
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+// Packets to send, sent so far and taken so far, and when each was sent.
+static size_t packets = DEFAULT_PACKETS;
+static size_t sent = 0;
+static size_t taken = 0;
+static long * sentAt;
+// Transfers submitted and not yet completed, oldest first.
+static struct libusb_transfer * queue[MAX_QUEUED];
+static size_t queueHead = 0;
+static size_t queueCount = 0;
+// Boolean flag: the transfers have been cancelled.
+static int cancelling = 0;
+
+struct libusb_transfer * LIBUSB_CALL libusb_alloc_transfer( int isoPackets ) {
+    (void) isoPackets;
+    return (struct libusb_transfer *) calloc(
+        1, sizeof ( struct libusb_transfer ) );
+}
+
+void LIBUSB_CALL libusb_free_transfer( struct libusb_transfer * transfer ) {
+    free( transfer );
+}
+
+int LIBUSB_CALL libusb_submit_transfer( struct libusb_transfer * transfer ) {
+    pthread_mutex_lock( &lock );
+    CHECK( queueCount < MAX_QUEUED );
+    queue[( queueHead + queueCount++ ) % MAX_QUEUED] = transfer;
+    pthread_mutex_unlock( &lock );
+    return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL libusb_cancel_transfer( struct libusb_transfer * transfer ) {
+    (void) transfer;
+    pthread_mutex_lock( &lock );
+    cancelling = 1;
+    pthread_mutex_unlock( &lock );
+    return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL libusb_handle_events_timeout( libusb_context * context,
+                                              struct timeval * tv ) {
+    (void) context;
+    struct libusb_transfer * transfer = NULL;
+    pthread_mutex_lock( &lock );
+    if ( cancelling && queueCount > 0 ) {
+        transfer = queue[queueHead];
+        transfer->status = LIBUSB_TRANSFER_CANCELLED;
+        transfer->actual_length = 0;
+        queueHead = ( queueHead + 1 ) % MAX_QUEUED;
+        queueCount--;
+    }
+    pthread_mutex_unlock( &lock );
+    if ( transfer == NULL && queueCount > 0 &&
+         take_packet( queue[queueHead]->buffer,
+                      (unsigned int) ( tv->tv_sec * 1000 +
+                                       tv->tv_usec / 1000 ) ) ) {
+        pthread_mutex_lock( &lock );
+        transfer = queue[queueHead];
+        transfer->status = LIBUSB_TRANSFER_COMPLETED;
+        transfer->actual_length = MAX_PKT_SIZE;
+        queueHead = ( queueHead + 1 ) % MAX_QUEUED;
+        queueCount--;
+        pthread_mutex_unlock( &lock );
+    }
+    if ( transfer != NULL )
+        transfer->callback( transfer );
+    return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL libusb_bulk_transfer( libusb_device_handle * handle,
+                                      unsigned char endpoint,
+                                      unsigned char * data, int length,
+                                      int * transferred,
+                                      unsigned int timeout ) {
+    (void) handle;
+    CHECK( endpoint == BULK_READ_EP && length >= MAX_PKT_SIZE );
+    *transferred = 0;
+    if ( ! take_packet( data, timeout ) )
+        return LIBUSB_ERROR_TIMEOUT;
+    *transferred = MAX_PKT_SIZE;
+    return LIBUSB_SUCCESS;
+}
+
+static void * send_packets( void * context ) {
+    (void) context;
+    struct timespec next;
+    clock_gettime( CLOCK_MONOTONIC, &next );
+    while ( sent < packets ) {
+        next.tv_nsec += PERIOD_NS;
+        if ( next.tv_nsec >= 1000000000L ) {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000L;
+        }
+        clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL );
+        pthread_mutex_lock( &lock );
+        sentAt[sent++] = now_us();
+        pthread_cond_broadcast( &changed );
+        pthread_mutex_unlock( &lock );
+    }
+    return NULL;
+}
+
+static int take_packet( unsigned char * data, unsigned int timeout ) {
+    struct timespec deadline;
+    clock_gettime( CLOCK_REALTIME, &deadline );
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_nsec += ( timeout % 1000 ) * 1000000L;
+    if ( deadline.tv_nsec >= 1000000000L ) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_mutex_lock( &lock );
+    while ( taken == sent && ! cancelling ) {
+        if ( timeout == 0 )
+            pthread_cond_wait( &changed, &lock );
+        else if ( pthread_cond_timedwait( &changed, &lock, &deadline ) )
+            break;
+    }
+    int found = ( taken < sent && ! cancelling );
+    if ( found ) {
+        // Each packet carries its number, for the reader to find when it
+        // was sent.
+        memset( data, 0, MAX_PKT_SIZE );
+        memcpy( data, &taken, sizeof ( taken ) );
+        taken++;
+    }
+    pthread_mutex_unlock( &lock );
+    return found;
+}
+
+static long now_us( void ) {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return now.tv_sec * 1000000L + now.tv_nsec / 1000L;
+}
+
+static long cpu_us( void ) {
+    struct timespec now;
+    clock_gettime( CLOCK_THREAD_CPUTIME_ID, &now );
+    return now.tv_sec * 1000000L + now.tv_nsec / 1000L;
+}
+
+static int compare_long( const void * a, const void * b ) {
+    long x = *(const long *) a, y = *(const long *) b;
+    return ( x > y ) - ( x < y );
+}
+
+static void run( int async ) {
+    long * latency = (long *) malloc( packets * sizeof ( long ) );
+    CHECK( latency != NULL );
+    sent = taken = 0;
+    cancelling = 0;
+    nxt_async * reads = NULL;
+    if ( async )
+        CHECK( start_async_reads( NULL, DEPTH, &reads ) == LIBUSB_SUCCESS );
+    pthread_t thread;
+    CHECK( pthread_create( &thread, NULL, send_packets, NULL ) == 0 );
+
+    long cpuStart = cpu_us();
+    size_t received;
+    for ( received = 0; received < packets; received++ ) {
+        unsigned char packet[MAX_PKT_SIZE];
+        int transferred;
+        if ( async ) {
+            CHECK( wait_async_nxt( reads, 0 ) == LIBUSB_SUCCESS );
+            CHECK( read_async_nxt( reads, packet, 0, MAX_PKT_SIZE,
+                                   &transferred ) == LIBUSB_SUCCESS );
+        } else {
+            CHECK( bulk_read_nxt( NULL, packet, 0, MAX_PKT_SIZE, 0,
+                                  &transferred ) == LIBUSB_SUCCESS );
+        }
+        CHECK( transferred == MAX_PKT_SIZE );
+        long arrived = now_us();
+        size_t number;
+        memcpy( &number, packet, sizeof ( number ) );
+        CHECK( number == received );
+        pthread_mutex_lock( &lock );
+        latency[received] = arrived - sentAt[number];
+        pthread_mutex_unlock( &lock );
+    }
+    long cpu = cpu_us() - cpuStart;
+    CHECK( pthread_join( thread, NULL ) == 0 );
+    if ( async )
+        stop_async_reads( reads );
+
+    long total = 0;
+    for ( received = 0; received < packets; received++ )
+        total += latency[received];
+    qsort( latency, packets, sizeof ( long ), compare_long );
+    printf( "%-12s %8.1f %8ld %8ld %8ld %12.2f\n",
+            async ? "asynchronous" : "blocking", (double) total / packets,
+            latency[packets / 2], latency[packets * 99 / 100],
+            latency[packets - 1], (double) cpu / packets );
+    free( latency );
+}
+
+int main( int argc, char ** argv ) {
+    if ( argc > 1 )
+        packets = (size_t) atoi( argv[1] );
+    CHECK( packets > 0 );
+    sentAt = (long *) malloc( packets * sizeof ( long ) );
+    CHECK( sentAt != NULL );
+    printf( "%zu packets, one every %d us; latencies in us\n", packets,
+            PERIOD_NS / 1000 );
+    printf( "%-12s %8s %8s %8s %8s %12s\n", "reads", "mean", "median", "p99",
+            "max", "CPU us/pkt" );
+    run( 0 );
+    run( 1 );
+    free( sentAt );
+    return 0;
+}
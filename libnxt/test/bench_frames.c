@@ -0,0 +1,138 @@
+/*
+ * Measures how fast messages of different lengths pass through a pair of
+ * connections over a loopback link: the NXT's end sends them with
+ * `conn_send()`, and the host receives them with `conn_receive_view()` or
+ * with `conn_receive()`. The rate of message bytes through the pair is
+ * printed for each length and way of receiving.
+ *
+ * Usage: bench_frames [MiB per run], by default 64.
+ */
+#include "check.h"
+#include "loopback.h"
+#include "messaging.h"
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_MIB 64
+// Bytes in transit in each direction of the loopback pair.
+#define CAPACITY 65536
+#define MAX_LENGTH 65535
+
+/*
+ * A run of messages of one length.
+ */
+typedef struct run {
+    uint16_t length;
+    size_t count;
+} run;
+
+/*
+ * Complete the handshake as the NXT, or close the connection, while the host
+ * does as well.
+ */
+static void * init_device( void * context );
+static void * exit_device( void * context );
+
+/*
+ * Send the messages of a run from the NXT.
+ * in: context - The run.
+ */
+static void * send_run( void * context );
+
+/*
+ * Receive the messages of a run on the host, by view or by copying them.
+ * return: The time taken in s, from the first send.
+ */
+static double time_run( nxt_conn * conn, run * messages, int copy );
+
+static nxt_comm * deviceLink;
+static nxt_conn * deviceConn;
+
+static void * init_device( void * context ) {
+    (void) context;
+    messaging_options options;
+    memset( &options, 0, sizeof ( options ) );
+    options.device = 1;
+    CHECK( conn_init_messaging_on( deviceLink, &options, &deviceConn ) ==
+           LIBNXT_SUCCESS );
+    return NULL;
+}
+
+static void * exit_device( void * context ) {
+    (void) context;
+    conn_exit_messaging( deviceConn );
+    return NULL;
+}
+
+static void * send_run( void * context ) {
+    run * messages = (run *) context;
+    static unsigned char message[MAX_LENGTH];
+    memset( message, 0xa5, sizeof ( message ) );
+    size_t i;
+    for ( i = 0; i < messages->count; i++ )
+        CHECK( conn_send( deviceConn, message, messages->length ) ==
+               LIBNXT_SUCCESS );
+    return NULL;
+}
+
+static double time_run( nxt_conn * conn, run * messages, int copy ) {
+    static unsigned char scratch[MAX_LENGTH];
+    struct timespec start, end;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    pthread_t thread;
+    CHECK( pthread_create( &thread, NULL, send_run, messages ) == 0 );
+    size_t i;
+    for ( i = 0; i < messages->count; i++ ) {
+        if ( copy ) {
+            unsigned char * message;
+            uint16_t length;
+            CHECK( conn_receive( conn, &message, &length ) == LIBNXT_SUCCESS );
+            CHECK( length == messages->length );
+            free_message( message );
+        } else {
+            message_view view;
+            CHECK( conn_receive_view( conn, scratch, sizeof ( scratch ),
+                                      &view ) == LIBNXT_SUCCESS );
+            CHECK( view.length == messages->length );
+            conn_release_view( conn );
+        }
+    }
+    CHECK( pthread_join( thread, NULL ) == 0 );
+    clock_gettime( CLOCK_MONOTONIC, &end );
+    return ( end.tv_sec - start.tv_sec ) +
+           ( end.tv_nsec - start.tv_nsec ) / 1e9;
+}
+
+int main( int argc, char ** argv ) {
+    size_t total = (size_t) ( argc > 1 ? atoi( argv[1] ) : DEFAULT_MIB ) <<
+                   20;
+    CHECK( total > 0 );
+    const uint16_t lengths[] = { 16, 64, 256, 1024, 4096, 16384, MAX_LENGTH };
+
+    nxt_comm * hostLink;
+    CHECK( open_loopback_pair( CAPACITY, &hostLink, &deviceLink ) ==
+           LIBNXT_SUCCESS );
+    pthread_t thread;
+    CHECK( pthread_create( &thread, NULL, init_device, NULL ) == 0 );
+    nxt_conn * conn;
+    CHECK( conn_init_messaging_on( hostLink, NULL, &conn ) == LIBNXT_SUCCESS );
+    CHECK( pthread_join( thread, NULL ) == 0 );
+
+    printf( "%8s %10s %12s %12s\n", "length", "messages", "view MB/s",
+            "copy MB/s" );
+    size_t i;
+    for ( i = 0; i < sizeof ( lengths ) / sizeof ( lengths[0] ); i++ ) {
+        run messages = { lengths[i], total / lengths[i] };
+        double bytes = (double) messages.length * messages.count;
+        double view = time_run( conn, &messages, 0 );
+        double copy = time_run( conn, &messages, 1 );
+        printf( "%8u %10zu %12.1f %12.1f\n", messages.length, messages.count,
+                bytes / view / 1e6, bytes / copy / 1e6 );
+    }
+
+    CHECK( pthread_create( &thread, NULL, exit_device, NULL ) == 0 );
+    conn_exit_messaging( conn );
+    CHECK( pthread_join( thread, NULL ) == 0 );
+    return 0;
+}
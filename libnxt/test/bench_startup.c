@@ -0,0 +1,243 @@
+/*
+ * Measures how long connections to an NXT over USB take to open and close:
+ * connections are opened with `conn_init_messaging()` and closed with
+ * `conn_exit_messaging()` in turn, to an NXT with nothing to send and to one
+ * with stale packets waiting, and the mean time of each phase of opening, and
+ * of closing, are printed. libusb's device and transfer functions are
+ * replaced by ones in this program that stand in for one NXT, which answers
+ * the handshake and EOF and, like a real device, keeps a read with no data
+ * waiting until its timeout.
+ *
+ * Usage: bench_startup [cycles], by default 20.
+ */
+#include "check.h"
+#include "messaging.h"
+#include "nxt_usb.h"
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_CYCLES 20
+// Packets the NXT has waiting when opened, in the second run.
+#define STALE_PACKETS 8
+// Longest reply the NXT queues.
+#define MAX_REPLY 16
+
+/*
+ * Open and close a connection the given number of times, and print the mean
+ * time of each phase.
+ * in: stale - The packets the NXT has waiting each time it is opened.
+ */
+static void run( size_t cycles, size_t stale );
+
+/*
+ * Time elapsed since the given time on the monotonic clock, in us.
+ */
+static long elapsed_us( const struct timespec * since );
+
+struct libusb_device {
+    int unused;
+};
+struct libusb_device_handle {
+    int unused;
+};
+static struct libusb_device nxt;
+static struct libusb_device_handle nxtHandle;
+// Stale packets waiting to be read, and the reply queued by the last request.
+static size_t stalePackets = 0;
+static unsigned char reply[MAX_REPLY];
+static size_t replyLength = 0;
+
+int LIBUSB_CALL libusb_init( libusb_context ** context ) {
+    (void) context;
+    return LIBUSB_SUCCESS;
+}
+
+void LIBUSB_CALL libusb_exit( libusb_context * context ) {
+    (void) context;
+}
+
+void LIBUSB_CALL libusb_set_debug( libusb_context * context, int level ) {
+    (void) context;
+    (void) level;
+}
+
+ssize_t LIBUSB_CALL libusb_get_device_list( libusb_context * context,
+                                            libusb_device *** list ) {
+    (void) context;
+    static libusb_device * devices[] = { &nxt, NULL };
+    *list = devices;
+    return 1;
+}
+
+void LIBUSB_CALL libusb_free_device_list( libusb_device ** list,
+                                          int unrefDevices ) {
+    (void) list;
+    (void) unrefDevices;
+}
+
+int LIBUSB_CALL libusb_get_device_descriptor(
+    libusb_device * device, struct libusb_device_descriptor * descriptor ) {
+    (void) device;
+    memset( descriptor, 0, sizeof ( *descriptor ) );
+    descriptor->idVendor = 0x0694;
+    descriptor->idProduct = 0x0002;
+    return LIBUSB_SUCCESS;
+}
+
+libusb_device * LIBUSB_CALL libusb_ref_device( libusb_device * device ) {
+    return device;
+}
+
+void LIBUSB_CALL libusb_unref_device( libusb_device * device ) {
+    (void) device;
+}
+
+uint8_t LIBUSB_CALL libusb_get_bus_number( libusb_device * device ) {
+    (void) device;
+    return 1;
+}
+
+uint8_t LIBUSB_CALL libusb_get_port_number( libusb_device * device ) {
+    (void) device;
+    return 1;
+}
+
+int LIBUSB_CALL libusb_open( libusb_device * device,
+                             libusb_device_handle ** handle ) {
+    (void) device;
+    *handle = &nxtHandle;
+    return LIBUSB_SUCCESS;
+}
+
+void LIBUSB_CALL libusb_close( libusb_device_handle * handle ) {
+    (void) handle;
+}
+
+libusb_device * LIBUSB_CALL libusb_get_device(
+    libusb_device_handle * handle ) {
+    (void) handle;
+    return &nxt;
+}
+
+int LIBUSB_CALL libusb_get_configuration( libusb_device_handle * handle,
+                                          int * configuration ) {
+    (void) handle;
+    *configuration = 1;
+    return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL libusb_set_configuration( libusb_device_handle * handle,
+                                          int configuration ) {
+    (void) handle;
+    (void) configuration;
+    return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL libusb_claim_interface( libusb_device_handle * handle,
+                                        int interface ) {
+    (void) handle;
+    (void) interface;
+    return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL libusb_release_interface( libusb_device_handle * handle,
+                                          int interface ) {
+    (void) handle;
+    (void) interface;
+    return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL libusb_bulk_transfer( libusb_device_handle * handle,
+                                      unsigned char endpoint,
+                                      unsigned char * data, int length,
+                                      int * transferred,
+                                      unsigned int timeout ) {
+    (void) handle;
+    *transferred = 0;
+    if ( endpoint == BULK_WRITE_EP ) {
+        // The NXT answers the handshake, and an EOF with its own.
+        const unsigned char handshake[] = { 0x01, 0xff };
+        const unsigned char confirm[] = { 0x02, 0xfe, 0xef };
+        const unsigned char eof[] = { 0x00, 0x00 };
+        if ( length == sizeof ( handshake ) &&
+             ! memcmp( data, handshake, sizeof ( handshake ) ) ) {
+            memcpy( reply, confirm, sizeof ( confirm ) );
+            replyLength = sizeof ( confirm );
+        } else if ( length == sizeof ( eof ) &&
+                    ! memcmp( data, eof, sizeof ( eof ) ) ) {
+            memcpy( reply, eof, sizeof ( eof ) );
+            replyLength = sizeof ( eof );
+        }
+        *transferred = length;
+        return LIBUSB_SUCCESS;
+    }
+
+    CHECK( endpoint == BULK_READ_EP && length >= MAX_PKT_SIZE );
+    if ( stalePackets > 0 ) {
+        stalePackets--;
+        memset( data, 0, MAX_PKT_SIZE );
+        *transferred = MAX_PKT_SIZE;
+        return LIBUSB_SUCCESS;
+    }
+    if ( replyLength > 0 ) {
+        memcpy( data, reply, replyLength );
+        *transferred = (int) replyLength;
+        replyLength = 0;
+        return LIBUSB_SUCCESS;
+    }
+    // Nothing will arrive while this thread waits, so waiting forever would
+    // never end.
+    CHECK( timeout > 0 );
+    struct timespec wait = { timeout / 1000, ( timeout % 1000 ) * 1000000L };
+    nanosleep( &wait, NULL );
+    return LIBUSB_ERROR_TIMEOUT;
+}
+
+static long elapsed_us( const struct timespec * since ) {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return ( now.tv_sec - since->tv_sec ) * 1000000L +
+           ( now.tv_nsec - since->tv_nsec ) / 1000L;
+}
+
+static void run( size_t cycles, size_t stale ) {
+    startup_timing sum;
+    memset( &sum, 0, sizeof ( sum ) );
+    long closing = 0;
+    size_t i;
+    for ( i = 0; i < cycles; i++ ) {
+        stalePackets = stale;
+        nxt_conn * conn;
+        CHECK( conn_init_messaging( 0, NULL, &conn ) == LIBNXT_SUCCESS );
+        CHECK( stalePackets == 0 );
+        startup_timing timing;
+        conn_get_startup_timing( conn, &timing );
+        sum.init += timing.init;
+        sum.enumerate += timing.enumerate;
+        sum.open += timing.open;
+        sum.configure += timing.configure;
+        sum.drain += timing.drain;
+        sum.handshake += timing.handshake;
+        sum.total += timing.total;
+
+        struct timespec start;
+        clock_gettime( CLOCK_MONOTONIC, &start );
+        conn_exit_messaging( conn );
+        closing += elapsed_us( &start );
+    }
+    long n = (long) cycles;
+    printf( "%6zu %8ld %8ld %8ld %8ld %8ld %8ld %8ld %8ld\n", stale,
+            sum.init / n, sum.enumerate / n, sum.open / n, sum.configure / n,
+            sum.drain / n, sum.handshake / n, sum.total / n, closing / n );
+}
+
+int main( int argc, char ** argv ) {
+    size_t cycles = (size_t) ( argc > 1 ? atoi( argv[1] ) : DEFAULT_CYCLES );
+    CHECK( cycles > 0 );
+    printf( "mean of %zu cycles, in us\n", cycles );
+    printf( "%6s %8s %8s %8s %8s %8s %8s %8s %8s\n", "stale", "init", "enum",
+            "open", "config", "drain", "shake", "total", "close" );
+    run( cycles, 0 );
+    run( cycles, STALE_PACKETS );
+    return 0;
+}
@@ -0,0 +1,181 @@
+/*
+ * Measures the cost of the statistics libnxt keeps on its I/O paths: the time
+ * per `stats_count()` and per `stats_record()` with its clock read, from one
+ * thread and from several at once on the same counter and histogram, then the
+ * time of a small message's round trip over a loopback pair, and the share of
+ * it spent keeping statistics, from the counts and histograms the round trips
+ * left.
+ *
+ * Usage: bench_stats [threads [round trips]], by default 4 and 100000.
+ */
+#include "check.h"
+#include "loopback.h"
+#include "messaging.h"
+#include "stats.h"
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_THREADS 4
+#define DEFAULT_ROUND_TRIPS 100000
+// Calls made by each thread of a run.
+#define CALLS 10000000
+#define MAX_THREADS 64
+#define MESSAGE_LENGTH 8
+
+/*
+ * Body of the threads of a run, counting or recording CALLS times.
+ * in: context - Non-zero to record latencies rather than count.
+ */
+static void * call_stats( void * context );
+
+/*
+ * Time a run of calls from the given number of threads.
+ * return: The mean time per call, in ns.
+ */
+static double time_calls( size_t threads, int record );
+
+/*
+ * Time elapsed since the given time on the monotonic clock, in ns.
+ */
+static double elapsed_ns( const struct timespec * since );
+
+/*
+ * Complete the handshake as the NXT while the host does as well.
+ */
+static void * init_device( void * context );
+
+/*
+ * Echo messages back to the host as the NXT, then close the connection once
+ * the host sends EOF.
+ */
+static void * echo_device( void * context );
+
+static nxt_comm * deviceLink;
+static nxt_conn * deviceConn;
+
+static double elapsed_ns( const struct timespec * since ) {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return ( now.tv_sec - since->tv_sec ) * 1e9 +
+           ( now.tv_nsec - since->tv_nsec );
+}
+
+static void * call_stats( void * context ) {
+    int record = ( context != NULL );
+    size_t i;
+    if ( record ) {
+        // As on the I/O paths, the latency is measured from a clock read.
+        struct timespec start;
+        clock_gettime( CLOCK_MONOTONIC, &start );
+        for ( i = 0; i < CALLS; i++ )
+            stats_record( STAT_RECEIVE_WAIT,
+                          (uint64_t) elapsed_ns( &start ) / 1000 );
+    } else {
+        for ( i = 0; i < CALLS; i++ )
+            stats_count( STAT_BYTES_RECEIVED, MESSAGE_LENGTH );
+    }
+    return NULL;
+}
+
+static double time_calls( size_t threads, int record ) {
+    pthread_t thread[MAX_THREADS];
+    struct timespec start;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    size_t i;
+    for ( i = 0; i < threads; i++ )
+        CHECK( pthread_create( &thread[i], NULL, call_stats,
+                               record ? &thread[i] : NULL ) == 0 );
+    for ( i = 0; i < threads; i++ )
+        CHECK( pthread_join( thread[i], NULL ) == 0 );
+    return elapsed_ns( &start ) / ( (double) CALLS * threads );
+}
+
+static void * init_device( void * context ) {
+    (void) context;
+    messaging_options options;
+    memset( &options, 0, sizeof ( options ) );
+    options.device = 1;
+    CHECK( conn_init_messaging_on( deviceLink, &options, &deviceConn ) ==
+           LIBNXT_SUCCESS );
+    return NULL;
+}
+
+static void * echo_device( void * context ) {
+    (void) context;
+    unsigned char * message;
+    uint16_t length;
+    while ( conn_receive( deviceConn, &message, &length ) == LIBNXT_SUCCESS &&
+            length > 0 ) {
+        CHECK( conn_send( deviceConn, message, length ) == LIBNXT_SUCCESS );
+        free_message( message );
+    }
+    conn_exit_messaging( deviceConn );
+    return NULL;
+}
+
+int main( int argc, char ** argv ) {
+    size_t threads = (size_t) ( argc > 1 ? atoi( argv[1] ) :
+                                DEFAULT_THREADS );
+    size_t roundTrips = (size_t) ( argc > 2 ? atoi( argv[2] ) :
+                                   DEFAULT_ROUND_TRIPS );
+    CHECK( threads > 0 && threads <= MAX_THREADS && roundTrips > 0 );
+
+    printf( "%8s %12s %12s\n", "threads", "count ns", "record ns" );
+    double count = time_calls( 1, 0 );
+    double record = time_calls( 1, 1 );
+    printf( "%8d %12.1f %12.1f\n", 1, count, record );
+    if ( threads > 1 )
+        printf( "%8zu %12.1f %12.1f\n", threads, time_calls( threads, 0 ),
+                time_calls( threads, 1 ) );
+
+    nxt_comm * hostLink;
+    CHECK( open_loopback_pair( 4096, &hostLink, &deviceLink ) ==
+           LIBNXT_SUCCESS );
+    pthread_t thread;
+    CHECK( pthread_create( &thread, NULL, init_device, NULL ) == 0 );
+    nxt_conn * conn;
+    CHECK( conn_init_messaging_on( hostLink, NULL, &conn ) == LIBNXT_SUCCESS );
+    CHECK( pthread_join( thread, NULL ) == 0 );
+    CHECK( pthread_create( &thread, NULL, echo_device, NULL ) == 0 );
+
+    libnxt_reset_stats();
+    unsigned char message[MESSAGE_LENGTH] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    struct timespec start;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    size_t i;
+    for ( i = 0; i < roundTrips; i++ ) {
+        CHECK( conn_send( conn, message, sizeof ( message ) ) ==
+               LIBNXT_SUCCESS );
+        unsigned char * reply;
+        uint16_t length;
+        CHECK( conn_receive( conn, &reply, &length ) == LIBNXT_SUCCESS );
+        CHECK( length == sizeof ( message ) );
+        free_message( reply );
+    }
+    double roundTrip = elapsed_ns( &start ) / roundTrips;
+    libnxt_stats stats;
+    libnxt_get_stats( &stats );
+
+    // Each fill and flush counts its bytes as well as itself.
+    const uint64_t * counters = stats.counters;
+    double counts = (double) ( counters[STAT_FRAMES_SENT] +
+                               counters[STAT_FRAMES_RECEIVED] +
+                               2 * counters[STAT_FILLS] +
+                               2 * counters[STAT_FLUSHES] +
+                               counters[STAT_SHORT_READS] +
+                               counters[STAT_SHORT_WRITES] ) / roundTrips;
+    double records = 0;
+    int histogram;
+    for ( histogram = 0; histogram < STAT_HISTOGRAMS; histogram++ )
+        records += (double) stats.histograms[histogram].count / roundTrips;
+    double overhead = counts * count + records * record;
+    printf( "%zu round trips of %d bytes: %.0f ns each, with %.1f counts and "
+            "%.1f records, about %.0f ns (%.1f%%)\n", roundTrips,
+            MESSAGE_LENGTH, roundTrip, counts, records, overhead,
+            100 * overhead / roundTrip );
+
+    conn_exit_messaging( conn );
+    CHECK( pthread_join( thread, NULL ) == 0 );
+    return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * Compares the binary telemetry messages with the string reports the robot
+ * used to send, such as "robot at ( 34, 68 )": a mix of pose and obstacle
+ * reports is encoded and decoded both ways, and the mean size of a report
+ * and the reports encoded and decoded per second are printed. Strings are
+ * written with snprintf() and read with sscanf(), as a host would have to.
+ *
+ * Usage: bench_telemetry [reports], by default 1000000.
+ */
+#include "check.h"
+#include "telemetry.h"
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_REPORTS 1000000
+// Longest encoded report of either kind.
+#define MAX_REPORT 64
+
+/*
+ * Time elapsed since the given time on the monotonic clock, in s.
+ */
+static double elapsed_s( const struct timespec * since );
+
+/*
+ * Fill in the report with the given number, of a pose every other report
+ * and an obstacle in between.
+ */
+static void make_report( size_t number, telemetry_message * message );
+
+/*
+ * Encode a report as the string the robot used to send.
+ * return: The length of the string.
+ */
+static size_t format_report( const telemetry_message * message, char * text );
+
+static double elapsed_s( const struct timespec * since ) {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return ( now.tv_sec - since->tv_sec ) +
+           ( now.tv_nsec - since->tv_nsec ) / 1e9;
+}
+
+static void make_report( size_t number, telemetry_message * message ) {
+    memset( message, 0, sizeof ( *message ) );
+    message->version = TELEMETRY_VERSION;
+    message->time = (uint32_t) ( number * 50 );
+    float x = (float) ( number % 97 ), y = (float) ( number % 89 );
+    if ( number % 2 == 0 ) {
+        message->type = TELEMETRY_POSE;
+        message->pose.x = x;
+        message->pose.y = y;
+        message->pose.heading = (float) ( number % 360 );
+        message->pose.waypoint = (uint16_t) number;
+    } else {
+        message->type = TELEMETRY_OBSTACLE;
+        message->obstacle.x = x;
+        message->obstacle.y = y;
+        message->obstacle.range = 25.5f;
+    }
+}
+
+static size_t format_report( const telemetry_message * message, char * text ) {
+    int length;
+    if ( message->type == TELEMETRY_POSE )
+        length = snprintf( text, MAX_REPORT, "robot at ( %d, %d )",
+                           (int) message->pose.x, (int) message->pose.y );
+    else
+        length = snprintf( text, MAX_REPORT, "Feature at ( %d, %d )",
+                           (int) message->obstacle.x,
+                           (int) message->obstacle.y );
+    CHECK( length > 0 && length < MAX_REPORT );
+    return (size_t) length;
+}
+
+int main( int argc, char ** argv ) {
+    size_t reports = (size_t) ( argc > 1 ? atoi( argv[1] ) : DEFAULT_REPORTS );
+    CHECK( reports > 0 );
+    // Every report, encoded each way, one after the other.
+    unsigned char * binary = (unsigned char *) malloc( reports * MAX_REPORT );
+    char * text = (char *) malloc( reports * MAX_REPORT );
+    uint8_t * binaryLength = (uint8_t *) malloc( reports );
+    CHECK( binary != NULL && text != NULL && binaryLength != NULL );
+
+    telemetry_message message;
+    size_t i, binaryBytes = 0, textBytes = 0;
+    struct timespec start;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    for ( i = 0; i < reports; i++ ) {
+        make_report( i, &message );
+        binaryLength[i] = (uint8_t) encode_telemetry(
+            &message, binary + i * MAX_REPORT, MAX_REPORT );
+        CHECK( binaryLength[i] > 0 );
+        binaryBytes += binaryLength[i];
+    }
+    double binaryEncode = elapsed_s( &start );
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    for ( i = 0; i < reports; i++ ) {
+        make_report( i, &message );
+        textBytes += format_report( &message, text + i * MAX_REPORT );
+    }
+    double textEncode = elapsed_s( &start );
+
+    // Sums of the decoded fields, checked so the decoding is not optimised
+    // away.
+    long binarySum = 0, textSum = 0;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    for ( i = 0; i < reports; i++ ) {
+        CHECK( decode_telemetry( binary + i * MAX_REPORT, binaryLength[i],
+                                 &message ) == LIBNXT_SUCCESS );
+        if ( message.type == TELEMETRY_POSE )
+            binarySum += (long) message.pose.x + (long) message.pose.y;
+        else
+            binarySum += (long) message.obstacle.x +
+                         (long) message.obstacle.y;
+    }
+    double binaryDecode = elapsed_s( &start );
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    for ( i = 0; i < reports; i++ ) {
+        const char * report = text + i * MAX_REPORT;
+        int x, y;
+        CHECK( sscanf( report, report[0] == 'r' ? "robot at ( %d, %d )" :
+                       "Feature at ( %d, %d )", &x, &y ) == 2 );
+        textSum += x + y;
+    }
+    double textDecode = elapsed_s( &start );
+    CHECK( binarySum == textSum );
+
+    printf( "%zu reports, half poses and half obstacles\n", reports );
+    printf( "%-8s %12s %16s %16s\n", "format", "bytes/report",
+            "encodes/s", "decodes/s" );
+    printf( "%-8s %12.1f %16.0f %16.0f\n", "binary",
+            (double) binaryBytes / reports, reports / binaryEncode,
+            reports / binaryDecode );
+    printf( "%-8s %12.1f %16.0f %16.0f\n", "string",
+            (double) textBytes / reports, reports / textEncode,
+            reports / textDecode );
+    free( binaryLength );
+    free( text );
+    free( binary );
+    return 0;
+}
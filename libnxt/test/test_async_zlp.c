@@ -0,0 +1,112 @@
+/*
+ * Checks that asynchronous reads return data in the order the NXT sent it
+ * when some transfers complete with no data, as a zero-length packet makes
+ * them: a stream is read through `wait_async_nxt()` and `read_async_nxt()`
+ * while zero-length packets are mixed in with the data, and must come out
+ * whole and in order. libusb's transfer functions are replaced by ones in this
+ * program that complete the transfers in the order they were submitted, as
+ * libusb does for one endpoint, so no NXT is needed.
+ */
+#include "check.h"
+#include "nxt_usb.h"
+#include <string.h>
+
+// Transfers kept in flight.
+#define DEPTH 3
+// Longest queue of transfers submitted and not yet completed.
+#define MAX_QUEUED 16
+
+/*
+ * The packets the NXT sends, in order; empty ones are zero-length packets.
+ * Several arrive back to back at the head of the transfers, and between
+ * transfers already holding data.
+ */
+static const char * const packets[] = {
+    "The ", "", "quick ", "brown ", "", "", "fox ", "jumps", "", " over",
+    " the", "", "", "", " lazy", " dog"
+};
+#define PACKET_COUNT ( sizeof ( packets ) / sizeof ( packets[0] ) )
+
+// Transfers submitted and not yet completed, oldest first.
+static struct libusb_transfer * queue[MAX_QUEUED];
+static size_t queueHead = 0;
+static size_t queueCount = 0;
+// The next packet to arrive.
+static size_t nextPacket = 0;
+// Boolean flag: the transfers have been cancelled.
+static int cancelling = 0;
+
+struct libusb_transfer * LIBUSB_CALL libusb_alloc_transfer( int isoPackets ) {
+    (void) isoPackets;
+    return (struct libusb_transfer *) calloc(
+        1, sizeof ( struct libusb_transfer ) );
+}
+
+void LIBUSB_CALL libusb_free_transfer( struct libusb_transfer * transfer ) {
+    free( transfer );
+}
+
+int LIBUSB_CALL libusb_submit_transfer( struct libusb_transfer * transfer ) {
+    CHECK( queueCount < MAX_QUEUED );
+    queue[( queueHead + queueCount++ ) % MAX_QUEUED] = transfer;
+    return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL libusb_cancel_transfer( struct libusb_transfer * transfer ) {
+    (void) transfer;
+    cancelling = 1;
+    return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL libusb_handle_events_timeout( libusb_context * context,
+                                              struct timeval * tv ) {
+    (void) context;
+    (void) tv;
+    // Complete the oldest transfer with the next packet, if one is due.
+    if ( queueCount == 0 || ( ! cancelling && nextPacket == PACKET_COUNT ) )
+        return LIBUSB_SUCCESS;
+    struct libusb_transfer * transfer = queue[queueHead];
+    queueHead = ( queueHead + 1 ) % MAX_QUEUED;
+    queueCount--;
+    if ( cancelling ) {
+        transfer->status = LIBUSB_TRANSFER_CANCELLED;
+        transfer->actual_length = 0;
+    } else {
+        size_t length = strlen( packets[nextPacket] );
+        CHECK( length <= (size_t) transfer->length );
+        memcpy( transfer->buffer, packets[nextPacket++], length );
+        transfer->status = LIBUSB_TRANSFER_COMPLETED;
+        transfer->actual_length = (int) length;
+    }
+    transfer->callback( transfer );
+    return LIBUSB_SUCCESS;
+}
+
+int main( void ) {
+    char expected[256] = "";
+    size_t i;
+    for ( i = 0; i < PACKET_COUNT; i++ )
+        strcat( expected, packets[i] );
+    size_t expectedLength = strlen( expected );
+
+    nxt_async * async;
+    CHECK( start_async_reads( NULL, DEPTH, &async ) == LIBUSB_SUCCESS );
+    unsigned char received[256];
+    size_t total = 0;
+    while ( total < expectedLength ) {
+        CHECK( wait_async_nxt( async, 100 ) == LIBUSB_SUCCESS );
+        int transferred;
+        // A few bytes at a time, so that transfers are left part collected.
+        CHECK( read_async_nxt( async, received, total, 3, &transferred ) ==
+               LIBUSB_SUCCESS );
+        CHECK( transferred > 0 );
+        total += (size_t) transferred;
+        CHECK( total <= expectedLength );
+    }
+    CHECK( memcmp( received, expected, expectedLength ) == 0 );
+    CHECK( nextPacket == PACKET_COUNT );
+    stop_async_reads( async );
+    CHECK( queueCount == 0 );
+    printf( "test_async_zlp: ok\n" );
+    return 0;
+}
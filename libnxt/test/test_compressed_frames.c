@@ -0,0 +1,136 @@
+/*
+ * Checks the handling of malformed compressed messages: a length wider than
+ * 32 bits is refused rather than wrapped to a small value, and on a compressed
+ * connection a frame that expands to an empty message is an error rather than
+ * the end of the connection, after which the next message is received as
+ * usual. An empty message sent on a compressed connection still ends it.
+ */
+#include "check.h"
+#include "compress.h"
+#include "loopback.h"
+#include "messaging.h"
+#include <pthread.h>
+#include <string.h>
+
+/*
+ * Complete the handshake as the NXT, offering compression, while the host
+ * does as well.
+ */
+static void * init_device( void * context );
+
+/*
+ * Check that lengths of up to 32 bits are decoded, and wider ones refused.
+ */
+static void check_lengths( void );
+
+/*
+ * Write frames to the host from the NXT's end of the link, bypassing its
+ * connection.
+ */
+static void write_raw( const unsigned char * data, size_t length );
+
+/*
+ * Receive a message, with a view or by copying it, and check it.
+ */
+static void check_receive( nxt_conn * conn, int copy, libnxt_error expected,
+                           const unsigned char * message, uint16_t length );
+
+static nxt_comm * deviceLink;
+static nxt_conn * deviceConn;
+
+static void * init_device( void * context ) {
+    (void) context;
+    messaging_options options;
+    memset( &options, 0, sizeof ( options ) );
+    options.device = 1;
+    options.compression = 1;
+    CHECK( conn_init_messaging_on( deviceLink, &options, &deviceConn ) ==
+           LIBNXT_SUCCESS );
+    return NULL;
+}
+
+static void check_lengths( void ) {
+    // Lengths of 2^32 and of 0xf0000000, behind an empty RLE run.
+    const unsigned char wide[] = { 0x80, 0x80, 0x80, 0x80, 0x10 };
+    const unsigned char widest[] = { 0x80, 0x80, 0x80, 0x80, 0x0f };
+    unsigned char dest[16];
+    size_t decoded;
+    CHECK( decompress_message( COMPRESS_RLE, wide, sizeof ( wide ), dest,
+                               sizeof ( dest ), &decoded ) ==
+           LIBNXT_OTHER_ERROR );
+    CHECK( decompress_message( COMPRESS_RLE, widest, sizeof ( widest ), dest,
+                               sizeof ( dest ), &decoded ) ==
+           LIBNXT_ILLEGAL_ARG );
+}
+
+static void write_raw( const unsigned char * data, size_t length ) {
+    int written = 0;
+    CHECK( comm_write( deviceLink, (unsigned char *) data, 0, length, 0,
+                       &written ) == LIBNXT_SUCCESS );
+    CHECK( written == (int) length );
+}
+
+static void check_receive( nxt_conn * conn, int copy, libnxt_error expected,
+                           const unsigned char * message, uint16_t length ) {
+    libnxt_error errorCode;
+    if ( copy ) {
+        unsigned char * received;
+        uint16_t receivedLength;
+        errorCode = conn_receive( conn, &received, &receivedLength );
+        CHECK( errorCode == expected );
+        if ( ! errorCode ) {
+            CHECK( receivedLength == length );
+            CHECK( length == 0 || memcmp( received, message, length ) == 0 );
+            free_message( received );
+        }
+        return;
+    }
+    message_view view;
+    errorCode = conn_receive_view( conn, NULL, 0, &view );
+    CHECK( errorCode == expected );
+    if ( ! errorCode ) {
+        CHECK( view.length == length );
+        CHECK( length == 0 || memcmp( view.data, message, length ) == 0 );
+        conn_release_view( conn );
+    }
+}
+
+int main( void ) {
+    check_lengths();
+
+    int copy;
+    for ( copy = 0; copy <= 1; copy++ ) {
+        nxt_comm * hostLink;
+        CHECK( open_loopback_pair( 4096, &hostLink, &deviceLink ) ==
+               LIBNXT_SUCCESS );
+        pthread_t thread;
+        CHECK( pthread_create( &thread, NULL, init_device, NULL ) == 0 );
+        messaging_options options;
+        memset( &options, 0, sizeof ( options ) );
+        options.compression = 1;
+        nxt_conn * conn;
+        CHECK( conn_init_messaging_on( hostLink, &options, &conn ) ==
+               LIBNXT_SUCCESS );
+        CHECK( pthread_join( thread, NULL ) == 0 );
+
+        // Frames of a message sent without compression but empty, of one
+        // that RLE expands to nothing, and of the message "hi".
+        const unsigned char empty[] = { 0x01, 0x00, COMPRESS_NONE };
+        const unsigned char expandsEmpty[] = { 0x02, 0x00, COMPRESS_RLE, 0x00 };
+        const unsigned char hi[] = { 0x03, 0x00, COMPRESS_NONE, 'h', 'i' };
+        write_raw( empty, sizeof ( empty ) );
+        write_raw( expandsEmpty, sizeof ( expandsEmpty ) );
+        write_raw( hi, sizeof ( hi ) );
+        check_receive( conn, copy, LIBNXT_OTHER_ERROR, NULL, 0 );
+        check_receive( conn, copy, LIBNXT_OTHER_ERROR, NULL, 0 );
+        check_receive( conn, copy, LIBNXT_SUCCESS,
+                       (const unsigned char *) "hi", 2 );
+
+        CHECK( conn_send( deviceConn, NULL, 0 ) == LIBNXT_SUCCESS );
+        check_receive( conn, copy, LIBNXT_SUCCESS, NULL, 0 );
+        conn_exit_messaging( conn );
+        conn_exit_messaging( deviceConn );
+    }
+    printf( "test_compressed_frames: ok\n" );
+    return 0;
+}
@@ -0,0 +1,172 @@
+/*
+ * Checks that connections opened side by side keep their traffic apart: two
+ * connections over loopback pairs exchange interleaved messages with
+ * simulated NXTs, each message tagged with its connection and sequence
+ * number, and each end checks that it only sees its own messages, in order.
+ * One connection is then closed while the other carries on.
+ */
+#include "check.h"
+#include "loopback.h"
+#include "messaging.h"
+#include <pthread.h>
+#include <string.h>
+
+#define CONNECTIONS 2
+// Messages sent on each connection before it is closed.
+#define MESSAGES 400
+// Messages sent on each connection before waiting for their echoes.
+#define WINDOW 4
+// Longest message, longer than the rings, so that long messages are copied.
+#define MAX_LENGTH 700
+// Bytes in transit in each direction of a loopback pair.
+#define CAPACITY 65536
+
+// A simulated NXT, which checks and echoes each message it receives.
+typedef struct device {
+    nxt_comm * comm;
+    unsigned char id;
+    int received;
+    pthread_t thread;
+} device;
+
+/*
+ * Fill a message with its connection, sequence number and a pattern.
+ * return: The length of the message.
+ */
+static uint16_t make_message( unsigned char id, int sequence,
+                              unsigned char * message );
+
+/*
+ * Check that a message is the given one of a connection.
+ */
+static void check_message( unsigned char id, int sequence,
+                           const unsigned char * message, uint16_t length );
+
+/*
+ * Play the part of an NXT until the host closes the connection.
+ */
+static void * run_device( void * context );
+
+/*
+ * Send messages on each connection in turn, a window at a time, and check
+ * their echoes.
+ * in: first, last - Sequence numbers of the first message and one past the
+ *     last.
+ */
+static void exchange( nxt_conn ** conns, size_t count,
+                      const unsigned char * ids, int first, int last );
+
+static uint16_t make_message( unsigned char id, int sequence,
+                              unsigned char * message ) {
+    uint16_t length = (uint16_t) ( 3 + ( sequence * 37 + id * 11 ) %
+                                   ( MAX_LENGTH - 2 ) );
+    uint16_t i;
+    message[0] = id;
+    message[1] = (unsigned char) ( sequence >> 8 );
+    message[2] = (unsigned char) sequence;
+    for ( i = 3; i < length; i++ )
+        message[i] = (unsigned char) ( id * 31 + sequence + i );
+    return length;
+}
+
+static void check_message( unsigned char id, int sequence,
+                           const unsigned char * message, uint16_t length ) {
+    unsigned char expected[MAX_LENGTH];
+    uint16_t expectedLength = make_message( id, sequence, expected );
+    CHECK( length == expectedLength );
+    CHECK( message[0] == id );
+    CHECK( ( message[1] << 8 | message[2] ) == sequence );
+    CHECK( memcmp( message, expected, length ) == 0 );
+}
+
+static void * run_device( void * context ) {
+    device * nxt = (device *) context;
+    messaging_options options;
+    memset( &options, 0, sizeof ( options ) );
+    options.device = 1;
+    options.bufferSize = 64;
+    nxt_conn * conn;
+    CHECK( conn_init_messaging_on( nxt->comm, &options, &conn ) ==
+           LIBNXT_SUCCESS );
+    for ( ;; ) {
+        unsigned char * message;
+        uint16_t length;
+        CHECK( conn_receive( conn, &message, &length ) == LIBNXT_SUCCESS );
+        if ( length == 0 )
+            break;
+        check_message( nxt->id, nxt->received++, message, length );
+        CHECK( conn_send( conn, message, length ) == LIBNXT_SUCCESS );
+        free_message( message );
+    }
+    conn_exit_messaging( conn );
+    return NULL;
+}
+
+static void exchange( nxt_conn ** conns, size_t count,
+                      const unsigned char * ids, int first, int last ) {
+    unsigned char message[MAX_LENGTH];
+    int sequence, window, i;
+    size_t c;
+    for ( sequence = first; sequence < last; sequence += window ) {
+        window = ( last - sequence < WINDOW ? last - sequence : WINDOW );
+        for ( i = 0; i < window; i++ ) {
+            for ( c = 0; c < count; c++ ) {
+                uint16_t length = make_message( ids[c], sequence + i,
+                                                message );
+                CHECK( conn_send( conns[c], message, length ) ==
+                       LIBNXT_SUCCESS );
+            }
+        }
+        for ( i = 0; i < window; i++ ) {
+            for ( c = 0; c < count; c++ ) {
+                unsigned char * echo;
+                uint16_t length;
+                CHECK( conn_receive( conns[c], &echo, &length ) ==
+                       LIBNXT_SUCCESS );
+                check_message( ids[c], sequence + i, echo, length );
+                free_message( echo );
+            }
+        }
+    }
+}
+
+int main( void ) {
+    device nxts[CONNECTIONS];
+    nxt_conn * conns[CONNECTIONS];
+    unsigned char ids[CONNECTIONS];
+    size_t c;
+    for ( c = 0; c < CONNECTIONS; c++ ) {
+        nxt_comm * host;
+        memset( &nxts[c], 0, sizeof ( device ) );
+        nxts[c].id = ids[c] = (unsigned char) ( 'A' + c );
+        CHECK( open_loopback_pair( CAPACITY, &host, &nxts[c].comm ) ==
+               LIBNXT_SUCCESS );
+        CHECK( pthread_create( &nxts[c].thread, NULL, run_device,
+                               &nxts[c] ) == 0 );
+
+        // One connection reads with a pump thread, the other without.
+        messaging_options options;
+        memset( &options, 0, sizeof ( options ) );
+        options.bufferSize = 64;
+        options.pump = ( c == 1 );
+        options.readTimeout = 10000;
+        CHECK( conn_init_messaging_on( host, &options, &conns[c] ) ==
+               LIBNXT_SUCCESS );
+    }
+
+    exchange( conns, CONNECTIONS, ids, 0, MESSAGES / 2 );
+
+    // Closing the first connection leaves the second working.
+    conn_exit_messaging( conns[0] );
+    CHECK( pthread_join( nxts[0].thread, NULL ) == 0 );
+    CHECK( nxts[0].received == MESSAGES / 2 );
+    exchange( conns + 1, CONNECTIONS - 1, ids + 1, MESSAGES / 2, MESSAGES );
+
+    for ( c = 1; c < CONNECTIONS; c++ ) {
+        conn_exit_messaging( conns[c] );
+        CHECK( pthread_join( nxts[c].thread, NULL ) == 0 );
+        CHECK( nxts[c].received == MESSAGES );
+    }
+    printf( "test_connections: ok\n" );
+    return 0;
+}
@@ -0,0 +1,132 @@
+/*
+ * Checks that a message too long for the receive ring, which arrives in parts
+ * with a pause longer than the read timeout between them, is resumed by the
+ * next receive rather than losing its header: the message and the one after
+ * it are both received whole, with and without a pump thread, through
+ * `conn_receive_view()` and `conn_receive()`.
+ */
+#include "check.h"
+#include "loopback.h"
+#include "messaging.h"
+#include <string.h>
+
+// Length of the long message, and of the part sent before the pause.
+#define LONG_LENGTH 1500
+#define FIRST_PART 700
+// Length of the message that follows it.
+#define SHORT_LENGTH 5
+
+/*
+ * Write bytes to the host from the NXT's end of the link.
+ */
+static void write_raw( nxt_comm * device, const unsigned char * data,
+                       size_t length );
+
+/*
+ * Receive a message, with a view or by copying it.
+ * out: message - Holds the message, of at least LONG_LENGTH bytes.
+ */
+static libnxt_error receive_into( nxt_conn * conn, int copy,
+                                  unsigned char * scratch,
+                                  unsigned char * message, uint16_t * length );
+
+/*
+ * Send the long message in two parts, then the short one, and check that both
+ * are received.
+ */
+static void check_resumed( int pump, int copy );
+
+static void write_raw( nxt_comm * device, const unsigned char * data,
+                       size_t length ) {
+    int written = 0;
+    CHECK( comm_write( device, (unsigned char *) data, 0, length, 0,
+                       &written ) == LIBNXT_SUCCESS );
+    CHECK( written == (int) length );
+}
+
+static libnxt_error receive_into( nxt_conn * conn, int copy,
+                                  unsigned char * scratch,
+                                  unsigned char * message, uint16_t * length ) {
+    libnxt_error errorCode;
+    if ( copy ) {
+        unsigned char * copied;
+        errorCode = conn_receive( conn, &copied, length );
+        if ( ! errorCode ) {
+            memcpy( message, copied, *length );
+            free_message( copied );
+        }
+        return errorCode;
+    }
+    message_view view;
+    errorCode = conn_receive_view( conn, scratch, LONG_LENGTH, &view );
+    if ( ! errorCode ) {
+        *length = view.length;
+        memcpy( message, view.data, view.length );
+        conn_release_view( conn );
+    }
+    return errorCode;
+}
+
+static void check_resumed( int pump, int copy ) {
+    nxt_comm * host, * device;
+    CHECK( open_loopback_pair( 4096, &host, &device ) == LIBNXT_SUCCESS );
+    // The handshake reply is waiting before the host asks for it.
+    const unsigned char reply[] = { 0x02, 0xfe, 0xef };
+    write_raw( device, reply, sizeof ( reply ) );
+
+    messaging_options options;
+    memset( &options, 0, sizeof ( options ) );
+    options.bufferSize = 64;
+    options.pump = pump;
+    options.readTimeout = 50;
+    nxt_conn * conn;
+    CHECK( conn_init_messaging_on( host, &options, &conn ) == LIBNXT_SUCCESS );
+    unsigned char request[2];
+    int read = 0;
+    CHECK( comm_read( device, request, 0, sizeof ( request ), 0, &read ) ==
+           LIBNXT_SUCCESS && read == 2 );
+
+    unsigned char frame[2 + LONG_LENGTH + 2 + SHORT_LENGTH];
+    size_t i;
+    frame[0] = (unsigned char) LONG_LENGTH;
+    frame[1] = (unsigned char) ( LONG_LENGTH >> 8 );
+    for ( i = 0; i < LONG_LENGTH; i++ )
+        frame[2 + i] = (unsigned char) ( i * 7 + 1 );
+    frame[2 + LONG_LENGTH] = SHORT_LENGTH;
+    frame[3 + LONG_LENGTH] = 0;
+    for ( i = 0; i < SHORT_LENGTH; i++ )
+        frame[4 + LONG_LENGTH + i] = (unsigned char) ( 0xa0 + i );
+
+    static unsigned char scratch[LONG_LENGTH];
+    static unsigned char message[LONG_LENGTH];
+    uint16_t length = 0;
+    write_raw( device, frame, 2 + FIRST_PART );
+    CHECK( receive_into( conn, copy, scratch, message, &length ) ==
+           LIBNXT_TIMEOUT );
+    write_raw( device, frame + 2 + FIRST_PART, sizeof ( frame ) - 2 -
+                                               FIRST_PART );
+    CHECK( receive_into( conn, copy, scratch, message, &length ) ==
+           LIBNXT_SUCCESS );
+    CHECK( length == LONG_LENGTH );
+    CHECK( memcmp( message, frame + 2, LONG_LENGTH ) == 0 );
+    CHECK( receive_into( conn, copy, scratch, message, &length ) ==
+           LIBNXT_SUCCESS );
+    CHECK( length == SHORT_LENGTH );
+    CHECK( memcmp( message, frame + 4 + LONG_LENGTH, SHORT_LENGTH ) == 0 );
+
+    // Answer the host's EOF, so that closing does not wait.
+    const unsigned char eof[] = { 0x00, 0x00 };
+    write_raw( device, eof, sizeof ( eof ) );
+    conn_exit_messaging( conn );
+    close_comm_at( device );
+}
+
+int main( void ) {
+    int pump, copy;
+    for ( pump = 0; pump <= 1; pump++ ) {
+        for ( copy = 0; copy <= 1; copy++ )
+            check_resumed( pump, copy );
+    }
+    printf( "test_long_frames: ok\n" );
+    return 0;
+}
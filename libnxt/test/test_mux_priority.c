@@ -0,0 +1,313 @@
+/*
+ * Checks that a control message queued behind bulk data on a channel of lower
+ * priority is delivered first: whether queued before the bulk data starts to
+ * go out or partway through it, the control message is the next chunk sent and
+ * the first message received, and the bulk data still arrives whole after it.
+ *
+ * Then measures, while a thread pumps bulk data from two channels of the same
+ * priority over a slow link, how many bytes of bulk data are taken from the
+ * queues after a control message is queued and before it: there must be none,
+ * so the control message waits for at most the chunk already on its way. The
+ * two bulk channels must meanwhile share the link by their weights, neither
+ * getting more than one round of deficit round robin ahead of the other.
+ */
+#include "check.h"
+#include "loopback.h"
+#include "mux.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+// Channels of the control messages and of the bulk data. The bulk channel
+// comes first and has the larger weight, so only its priority puts the control
+// message ahead.
+#define CONTROL 2
+#define BULK 1
+// Length of the bulk message, many chunks long.
+#define BULK_LENGTH 16000
+#define CHUNK_SIZE 256
+// Bytes in transit in each direction of the loopback pair, room for all.
+#define CAPACITY 65536
+
+// The second bulk channel, of the same priority as the first, and the weights
+// of the two while they share the link.
+#define BULK2 3
+#define BULK_WEIGHT 8
+#define BULK2_WEIGHT 2
+// Bulk messages queued on each channel, each a whole number of chunks, so that
+// every chunk of bulk data is full.
+#define SLOW_MESSAGES 4
+#define SLOW_LENGTH ( 64 * CHUNK_SIZE )
+#define SLOW_TOTAL ( 2 * SLOW_MESSAGES * SLOW_LENGTH )
+// Bytes in transit on the slow link, only a few chunks, and the time the NXT
+// takes over each chunk, so that the bulk data takes a while to send.
+#define SLOW_CAPACITY 1024
+#define CHUNK_DELAY_NS 20000
+// Control messages queued while the bulk data goes out, the time between
+// them, and how many must be measured exactly for the check to count.
+#define CONTROLS 40
+#define CONTROL_GAP_NS 200000
+#define MIN_MEASURED 10
+
+// What was found out about each control message of the slow link: the bulk
+// bytes left queued when it was queued, whether no chunk was taken while it
+// was being queued, so that this is exact, and the bulk bytes taken from the
+// queues after it was queued and before it.
+static uint32_t controlQueued[CONTROLS];
+static int controlExact[CONTROLS];
+static long controlAhead[CONTROLS];
+
+/*
+ * Complete the handshake as the NXT, or close the connection, while the host
+ * does as well.
+ */
+static void * init_device( void * context );
+static void * exit_device( void * context );
+
+/*
+ * Open a loopback pair and a connection on each end of it.
+ * out: hostConn - The host's connection; the NXT's is deviceConn.
+ */
+static void open_pair( size_t capacity, nxt_conn ** hostConn );
+
+/*
+ * Queue the bulk message, send the given number of its chunks, then queue a
+ * control message and check that it is sent and received first.
+ */
+static void check_control_first( mux_link * host, mux_link * device,
+                                 size_t chunksBefore );
+
+/*
+ * Pump every chunk queued on the host's channels until told to stop.
+ * in: context - The host's mux_link.
+ */
+static void * pump_host( void * context );
+
+/*
+ * Play the part of an NXT that reads the chunks on the slow link as they
+ * come, measuring the bulk data sent ahead of each control message and the
+ * shares of the bulk channels, until the host closes the connection.
+ */
+static void * read_chunks( void * context );
+
+/*
+ * Queue control messages while the bulk data goes out over a slow link, and
+ * check how long each of them waited.
+ */
+static void check_bytes_ahead( void );
+
+static nxt_comm * deviceLink;
+static nxt_conn * deviceConn;
+// Boolean flag telling pump_host() to stop.
+static atomic_int pumpStop;
+
+static void * init_device( void * context ) {
+    (void) context;
+    messaging_options options;
+    memset( &options, 0, sizeof ( options ) );
+    options.device = 1;
+    CHECK( conn_init_messaging_on( deviceLink, &options, &deviceConn ) ==
+           LIBNXT_SUCCESS );
+    return NULL;
+}
+
+static void * exit_device( void * context ) {
+    (void) context;
+    conn_exit_messaging( deviceConn );
+    return NULL;
+}
+
+static void open_pair( size_t capacity, nxt_conn ** hostConn ) {
+    nxt_comm * hostLink;
+    CHECK( open_loopback_pair( capacity, &hostLink, &deviceLink ) ==
+           LIBNXT_SUCCESS );
+    pthread_t thread;
+    CHECK( pthread_create( &thread, NULL, init_device, NULL ) == 0 );
+    CHECK( conn_init_messaging_on( hostLink, NULL, hostConn ) ==
+           LIBNXT_SUCCESS );
+    CHECK( pthread_join( thread, NULL ) == 0 );
+}
+
+static void check_control_first( mux_link * host, mux_link * device,
+                                 size_t chunksBefore ) {
+    static unsigned char bulk[BULK_LENGTH];
+    const unsigned char control[] = { 'S', 'T', 'O', 'P' };
+    size_t i;
+    for ( i = 0; i < BULK_LENGTH; i++ )
+        bulk[i] = (unsigned char) ( i * 7 + chunksBefore );
+
+    CHECK( mux_send( host, BULK, bulk, BULK_LENGTH ) == LIBNXT_SUCCESS );
+    if ( chunksBefore > 0 )
+        CHECK( mux_pump( host, chunksBefore ) == LIBNXT_SUCCESS );
+    CHECK( mux_send( host, CONTROL, control, sizeof ( control ) ) ==
+           LIBNXT_SUCCESS );
+    size_t bulkQueued = mux_queued( host, BULK );
+    CHECK( mux_pump( host, 1 ) == LIBNXT_SUCCESS );
+    CHECK( mux_queued( host, CONTROL ) == 0 );
+    CHECK( mux_queued( host, BULK ) == bulkQueued );
+    CHECK( mux_pump( host, 0 ) == LIBNXT_SUCCESS );
+    CHECK( mux_queued( host, BULK ) == 0 );
+
+    int channel;
+    unsigned char * message;
+    uint16_t length;
+    CHECK( mux_receive( device, &channel, &message, &length ) ==
+           LIBNXT_SUCCESS );
+    CHECK( channel == CONTROL );
+    CHECK( length == sizeof ( control ) );
+    CHECK( memcmp( message, control, length ) == 0 );
+    free_message( message );
+    CHECK( mux_receive( device, &channel, &message, &length ) ==
+           LIBNXT_SUCCESS );
+    CHECK( channel == BULK );
+    CHECK( length == BULK_LENGTH );
+    CHECK( memcmp( message, bulk, length ) == 0 );
+    free_message( message );
+}
+
+static void * pump_host( void * context ) {
+    mux_link * host = (mux_link *) context;
+    const struct timespec idle = { 0, CHUNK_DELAY_NS };
+    while ( ! atomic_load( &pumpStop ) ) {
+        libnxt_error errorCode = mux_pump( host, 0 );
+        CHECK( errorCode == LIBNXT_SUCCESS || errorCode == LIBNXT_NO_EFFECT );
+        if ( errorCode == LIBNXT_NO_EFFECT )
+            nanosleep( &idle, NULL );
+    }
+    return NULL;
+}
+
+static void * read_chunks( void * context ) {
+    (void) context;
+    const struct timespec delay = { 0, CHUNK_DELAY_NS };
+    long received[2] = { 0, 0 };
+    size_t controls = 0;
+    for ( ;; ) {
+        message_view view;
+        CHECK( conn_receive_view( deviceConn, NULL, 0, &view ) ==
+               LIBNXT_SUCCESS );
+        if ( view.length == 0 )
+            break;
+        CHECK( view.length > MUX_HEADER_SIZE );
+        int channel = view.data[0] & ~MUX_MORE;
+        const unsigned char * data = view.data + MUX_HEADER_SIZE;
+        long length = (long) view.length - MUX_HEADER_SIZE;
+        if ( channel == CONTROL ) {
+            CHECK( controls < CONTROLS );
+            uint32_t queued = ( (uint32_t) data[0] << 24 ) |
+                              ( (uint32_t) data[1] << 16 ) |
+                              ( (uint32_t) data[2] << 8 ) | data[3];
+            controlAhead[controls++] = (long) queued + received[0] +
+                                       received[1] - SLOW_TOTAL;
+        } else {
+            CHECK( channel == BULK || channel == BULK2 );
+            received[channel == BULK2] += length;
+            // While both have data queued, each round gives the channels
+            // their weights in chunks.
+            if ( received[0] < SLOW_TOTAL / 2 &&
+                 received[1] < SLOW_TOTAL / 2 ) {
+                long lead = received[0] * BULK2_WEIGHT -
+                            received[1] * BULK_WEIGHT;
+                if ( lead < 0 )
+                    lead = -lead;
+                CHECK( lead <= (long) BULK_WEIGHT * BULK2_WEIGHT * CHUNK_SIZE );
+            }
+        }
+        conn_release_view( deviceConn );
+        nanosleep( &delay, NULL );
+    }
+    CHECK( controls == CONTROLS );
+    CHECK( received[0] == SLOW_TOTAL / 2 && received[1] == SLOW_TOTAL / 2 );
+    conn_exit_messaging( deviceConn );
+    return NULL;
+}
+
+static void check_bytes_ahead( void ) {
+    nxt_conn * hostConn;
+    open_pair( SLOW_CAPACITY, &hostConn );
+    mux_options options;
+    memset( &options, 0, sizeof ( options ) );
+    options.chunkSize = CHUNK_SIZE;
+    mux_link * host;
+    CHECK( open_mux( hostConn, &options, &host ) == LIBNXT_SUCCESS );
+    CHECK( mux_configure( host, CONTROL, 0, 1 ) == LIBNXT_SUCCESS );
+    CHECK( mux_configure( host, BULK, 1, BULK_WEIGHT ) == LIBNXT_SUCCESS );
+    CHECK( mux_configure( host, BULK2, 1, BULK2_WEIGHT ) == LIBNXT_SUCCESS );
+
+    static unsigned char bulk[SLOW_LENGTH];
+    memset( bulk, 0xb5, sizeof ( bulk ) );
+    size_t i;
+    for ( i = 0; i < SLOW_MESSAGES; i++ ) {
+        CHECK( mux_send( host, BULK, bulk, SLOW_LENGTH ) == LIBNXT_SUCCESS );
+        CHECK( mux_send( host, BULK2, bulk, SLOW_LENGTH ) == LIBNXT_SUCCESS );
+    }
+    pthread_t reader, pumper;
+    CHECK( pthread_create( &reader, NULL, read_chunks, NULL ) == 0 );
+    atomic_store( &pumpStop, 0 );
+    CHECK( pthread_create( &pumper, NULL, pump_host, host ) == 0 );
+
+    const struct timespec gap = { 0, CONTROL_GAP_NS };
+    for ( i = 0; i < CONTROLS; i++ ) {
+        nanosleep( &gap, NULL );
+        // The pump thread may take a chunk between these calls, in which case
+        // the bulk data queued when the control message was is not known.
+        uint32_t queued = (uint32_t) ( mux_queued( host, BULK ) +
+                                       mux_queued( host, BULK2 ) );
+        unsigned char control[4] = {
+            (unsigned char) ( queued >> 24 ), (unsigned char) ( queued >> 16 ),
+            (unsigned char) ( queued >> 8 ), (unsigned char) queued
+        };
+        CHECK( mux_send( host, CONTROL, control, sizeof ( control ) ) ==
+               LIBNXT_SUCCESS );
+        controlQueued[i] = queued;
+        controlExact[i] = ( mux_queued( host, BULK ) +
+                            mux_queued( host, BULK2 ) == queued );
+    }
+    while ( mux_queued( host, CONTROL ) + mux_queued( host, BULK ) +
+            mux_queued( host, BULK2 ) > 0 )
+        nanosleep( &gap, NULL );
+    atomic_store( &pumpStop, 1 );
+    CHECK( pthread_join( pumper, NULL ) == 0 );
+    close_mux( host );
+    conn_exit_messaging( hostConn );
+    CHECK( pthread_join( reader, NULL ) == 0 );
+
+    size_t measured = 0;
+    for ( i = 0; i < CONTROLS; i++ ) {
+        if ( controlExact[i] && controlQueued[i] > 0 ) {
+            CHECK( controlAhead[i] == 0 );
+            measured++;
+        }
+    }
+    CHECK( measured >= MIN_MEASURED );
+}
+
+int main( void ) {
+    nxt_conn * hostConn;
+    open_pair( CAPACITY, &hostConn );
+
+    mux_options options;
+    memset( &options, 0, sizeof ( options ) );
+    options.chunkSize = CHUNK_SIZE;
+    mux_link * host, * device;
+    CHECK( open_mux( hostConn, &options, &host ) == LIBNXT_SUCCESS );
+    CHECK( open_mux( deviceConn, &options, &device ) == LIBNXT_SUCCESS );
+    CHECK( mux_configure( host, CONTROL, 0, 1 ) == LIBNXT_SUCCESS );
+    CHECK( mux_configure( host, BULK, 1, 8 ) == LIBNXT_SUCCESS );
+
+    check_control_first( host, device, 0 );
+    check_control_first( host, device, 5 );
+    CHECK( mux_pump( host, 0 ) == LIBNXT_NO_EFFECT );
+
+    close_mux( host );
+    close_mux( device );
+    pthread_t thread;
+    CHECK( pthread_create( &thread, NULL, exit_device, NULL ) == 0 );
+    conn_exit_messaging( hostConn );
+    CHECK( pthread_join( thread, NULL ) == 0 );
+
+    check_bytes_ahead();
+    printf( "test_mux_priority: ok\n" );
+    return 0;
+}
@@ -0,0 +1,282 @@
+/*
+ * Checks that a session over reliable channels survives the link dropping
+ * mid-transfer: both connections resume after each drop, as when an NXT's
+ * cable is unplugged and plugged back in, and every message is still echoed
+ * once and in order. Each drop loses the data in transit and resets the state
+ * of both connections, so the reliable channels, which keep their own state
+ * across the drop, must send again what was lost and discard what arrives
+ * twice.
+ */
+#include "check.h"
+#include "loopback.h"
+#include "reliable.h"
+#include "stats.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+// Times the link is dropped, and messages echoed in all.
+#define DROPS 10
+#define MESSAGES 3000
+// Messages sent ahead of their echoes, fewer than the window.
+#define AHEAD 6
+#define MAX_LENGTH 200
+// Bytes in transit in each direction of a loopback pair, room for all the
+// messages in flight, so that neither end waits to write while the other does.
+#define CAPACITY 65536
+
+// The ends of a link, which may be plugged into a new loopback pair.
+enum { HOST, DEVICE };
+
+// The cable between the ends, which hands out a new loopback pair each time
+// an end finds the last one gone.
+typedef struct cable {
+    pthread_mutex_t lock;
+    // The latest pair, counting from 1, and its ends not yet taken.
+    unsigned int pair;
+    nxt_comm * ends[2];
+    // Drops still to come.
+    int drops;
+    // State of the generator of drop points.
+    uint32_t random;
+} cable;
+
+// One end of the cable, as seen by a connection.
+typedef struct plug {
+    cable * cable;
+    int side;
+    // The pair plugged into, and the end of it.
+    unsigned int pair;
+    nxt_comm * inner;
+    // Bytes the end may read before the link drops, and has read.
+    size_t limit;
+    size_t read;
+} plug;
+
+/*
+ * The transport of an end of the cable.
+ */
+static libnxt_error plug_read( void * state, unsigned char * buf,
+                               size_t offset, size_t maxLength, int timeout,
+                               int * transferred );
+static libnxt_error plug_write( void * state, unsigned char * buf,
+                                size_t offset, size_t length, int timeout,
+                                int * transferred );
+static void plug_close( void * state );
+static libnxt_error plug_reopen( void * state, int timeout );
+
+/*
+ * Plug an end into the latest pair, opening a new pair if the end has already
+ * been plugged into it.
+ */
+static void plug_in( plug * end );
+
+/*
+ * Open a connection over an end of the cable.
+ */
+static nxt_conn * open_end( cable * wire, int side,
+                            const messaging_options * options );
+
+/*
+ * Fill a message with its sequence number and a pattern.
+ * return: The length of the message.
+ */
+static uint16_t make_message( uint32_t sequence, unsigned char * message );
+
+/*
+ * Check that a message is the given one.
+ */
+static void check_message( uint32_t sequence, const unsigned char * message,
+                           uint16_t length );
+
+/*
+ * Play the part of an NXT, echoing each message over a reliable channel until
+ * the host closes the connection.
+ */
+static void * run_device( void * context );
+
+static const nxt_transport plugTransport = {
+    plug_read, plug_write, NULL, plug_close, plug_reopen
+};
+
+static libnxt_error plug_read( void * state, unsigned char * buf,
+                               size_t offset, size_t maxLength, int timeout,
+                               int * transferred ) {
+    plug * end = (plug *) state;
+    *transferred = 0;
+    // The link drops once the limit is reached, cutting a frame short.
+    if ( end->read == end->limit )
+        return LIBNXT_DISCONNECTED;
+    if ( maxLength > end->limit - end->read )
+        maxLength = end->limit - end->read;
+    libnxt_error errorCode = comm_read( end->inner, buf, offset, maxLength,
+                                        timeout, transferred );
+    end->read += (size_t) *transferred;
+    return errorCode;
+}
+
+static libnxt_error plug_write( void * state, unsigned char * buf,
+                                size_t offset, size_t length, int timeout,
+                                int * transferred ) {
+    plug * end = (plug *) state;
+    *transferred = 0;
+    if ( end->read == end->limit )
+        return LIBNXT_DISCONNECTED;
+    return comm_write( end->inner, buf, offset, length, timeout, transferred );
+}
+
+static void plug_close( void * state ) {
+    plug * end = (plug *) state;
+    close_comm_at( end->inner );
+    free( end );
+}
+
+static libnxt_error plug_reopen( void * state, int timeout ) {
+    (void) timeout;
+    plug * end = (plug *) state;
+    // Closing this end tells the other end that the link has dropped.
+    close_comm_at( end->inner );
+    plug_in( end );
+    return LIBNXT_SUCCESS;
+}
+
+static void plug_in( plug * end ) {
+    cable * wire = end->cable;
+    pthread_mutex_lock( &wire->lock );
+    if ( end->pair == wire->pair ) {
+        nxt_comm * host, * device;
+        CHECK( open_loopback_pair( CAPACITY, &host, &device ) ==
+               LIBNXT_SUCCESS );
+        // An end the other side never took belongs to a pair now dead.
+        if ( wire->ends[1 - end->side] != NULL )
+            close_comm_at( wire->ends[1 - end->side] );
+        wire->ends[HOST] = host;
+        wire->ends[DEVICE] = device;
+        wire->pair++;
+    }
+    end->pair = wire->pair;
+    end->inner = wire->ends[end->side];
+    wire->ends[end->side] = NULL;
+    end->read = 0;
+    end->limit = SIZE_MAX;
+    // The device drops the link after reading a few frames' worth.
+    if ( end->side == DEVICE && wire->drops > 0 ) {
+        wire->drops--;
+        wire->random = wire->random * 1103515245 + 12345;
+        end->limit = 2000 + ( wire->random >> 8 ) % 6000;
+    }
+    pthread_mutex_unlock( &wire->lock );
+}
+
+static nxt_conn * open_end( cable * wire, int side,
+                            const messaging_options * options ) {
+    plug * end = (plug *) calloc( 1, sizeof ( plug ) );
+    CHECK( end != NULL );
+    end->cable = wire;
+    end->side = side;
+    plug_in( end );
+    nxt_comm * comm;
+    CHECK( open_comm_with( &plugTransport, end, &comm ) == LIBNXT_SUCCESS );
+    nxt_conn * conn;
+    CHECK( conn_init_messaging_on( comm, options, &conn ) == LIBNXT_SUCCESS );
+    return conn;
+}
+
+static uint16_t make_message( uint32_t sequence, unsigned char * message ) {
+    uint16_t length = (uint16_t) ( 4 + sequence * 37 % ( MAX_LENGTH - 3 ) );
+    uint16_t i;
+    message[0] = (unsigned char) ( sequence >> 24 );
+    message[1] = (unsigned char) ( sequence >> 16 );
+    message[2] = (unsigned char) ( sequence >> 8 );
+    message[3] = (unsigned char) sequence;
+    for ( i = 4; i < length; i++ )
+        message[i] = (unsigned char) ( sequence * 13 + i );
+    return length;
+}
+
+static void check_message( uint32_t sequence, const unsigned char * message,
+                           uint16_t length ) {
+    unsigned char expected[MAX_LENGTH];
+    uint16_t expectedLength = make_message( sequence, expected );
+    CHECK( length == expectedLength );
+    CHECK( memcmp( message, expected, length ) == 0 );
+}
+
+static void * run_device( void * context ) {
+    cable * wire = (cable *) context;
+    messaging_options options;
+    memset( &options, 0, sizeof ( options ) );
+    options.device = 1;
+    options.reconnect = 1;
+    nxt_conn * conn = open_end( wire, DEVICE, &options );
+    reliable_channel * channel;
+    CHECK( open_reliable( conn, NULL, &channel ) == LIBNXT_SUCCESS );
+
+    uint32_t received = 0;
+    for ( ;; ) {
+        unsigned char message[MAX_LENGTH];
+        uint16_t length;
+        CHECK( reliable_receive( channel, message, sizeof ( message ),
+                                 &length ) == LIBNXT_SUCCESS );
+        if ( length == 0 )
+            break;
+        check_message( received++, message, length );
+        CHECK( reliable_send( channel, message, length ) == LIBNXT_SUCCESS );
+    }
+    CHECK( received == MESSAGES );
+    close_reliable( channel );
+    conn_exit_messaging( conn );
+    return NULL;
+}
+
+int main( void ) {
+    cable wire;
+    memset( &wire, 0, sizeof ( wire ) );
+    CHECK( pthread_mutex_init( &wire.lock, NULL ) == 0 );
+    wire.drops = DROPS;
+    wire.random = 1;
+    pthread_t thread;
+    CHECK( pthread_create( &thread, NULL, run_device, &wire ) == 0 );
+
+    messaging_options options;
+    memset( &options, 0, sizeof ( options ) );
+    options.reconnect = 1;
+    nxt_conn * conn = open_end( &wire, HOST, &options );
+    reliable_options reliableOptions;
+    memset( &reliableOptions, 0, sizeof ( reliableOptions ) );
+    reliableOptions.timeout = 10000;
+    reliable_channel * channel;
+    CHECK( open_reliable( conn, &reliableOptions, &channel ) ==
+           LIBNXT_SUCCESS );
+
+    unsigned char message[MAX_LENGTH];
+    uint32_t sent = 0, echoed = 0;
+    while ( echoed < MESSAGES ) {
+        while ( sent < MESSAGES && sent - echoed < AHEAD ) {
+            uint16_t length = make_message( sent++, message );
+            CHECK( reliable_send( channel, message, length ) ==
+                   LIBNXT_SUCCESS );
+        }
+        uint16_t length;
+        CHECK( reliable_receive( channel, message, sizeof ( message ),
+                                 &length ) == LIBNXT_SUCCESS );
+        check_message( echoed++, message, length );
+    }
+    reliable_flush( channel );
+    CHECK( reliable_in_flight( channel ) == 0 );
+    close_reliable( channel );
+
+    // Every drop was recovered from by both ends, and cost messages that had
+    // to be sent again.
+    libnxt_stats stats;
+    libnxt_get_stats( &stats );
+    CHECK( wire.drops == 0 );
+    CHECK( stats.counters[STAT_RECONNECTS] >= 2 * DROPS );
+    CHECK( stats.counters[STAT_RETRANSMITS] > 0 );
+
+    conn_exit_messaging( conn );
+    CHECK( pthread_join( thread, NULL ) == 0 );
+    pthread_mutex_destroy( &wire.lock );
+    printf( "test_reconnect: ok\n" );
+    return 0;
+}
@@ -0,0 +1,94 @@
+/*
+ * Checks that a packet too long for a reliable channel is dropped rather than
+ * left blocking the channel: packets longer than the channel takes, one of
+ * them longer than the receive ring too, are each reported as an error, and
+ * the message sent after them is still received.
+ */
+#include "check.h"
+#include "loopback.h"
+#include "reliable.h"
+#include <pthread.h>
+#include <string.h>
+
+// Longest message the host's channel takes, and lengths of packets too long
+// for it, which do and do not fit in the default 512 byte receive ring.
+#define MAX_MESSAGE 64
+#define SHORT_OVERSIZE 300
+#define LONG_OVERSIZE 1000
+
+/*
+ * Complete the handshake as the NXT, or close the connection, while the host
+ * does as well.
+ */
+static void * init_device( void * context );
+static void * exit_device( void * context );
+
+static nxt_comm * deviceLink;
+static nxt_conn * deviceConn;
+
+static void * init_device( void * context ) {
+    (void) context;
+    messaging_options options;
+    memset( &options, 0, sizeof ( options ) );
+    options.device = 1;
+    CHECK( conn_init_messaging_on( deviceLink, &options, &deviceConn ) ==
+           LIBNXT_SUCCESS );
+    return NULL;
+}
+
+static void * exit_device( void * context ) {
+    (void) context;
+    conn_exit_messaging( deviceConn );
+    return NULL;
+}
+
+int main( void ) {
+    nxt_comm * hostLink;
+    CHECK( open_loopback_pair( 4096, &hostLink, &deviceLink ) ==
+           LIBNXT_SUCCESS );
+    pthread_t thread;
+    CHECK( pthread_create( &thread, NULL, init_device, NULL ) == 0 );
+    nxt_conn * hostConn;
+    CHECK( conn_init_messaging_on( hostLink, NULL, &hostConn ) ==
+           LIBNXT_SUCCESS );
+    CHECK( pthread_join( thread, NULL ) == 0 );
+
+    reliable_options options;
+    memset( &options, 0, sizeof ( options ) );
+    options.maxMessage = MAX_MESSAGE;
+    options.timeout = 10000;
+    reliable_channel * host, * device;
+    CHECK( open_reliable( hostConn, &options, &host ) == LIBNXT_SUCCESS );
+    CHECK( open_reliable( deviceConn, NULL, &device ) == LIBNXT_SUCCESS );
+
+    // The oversize packets are sent around the NXT's channel, as if its
+    // channel had been opened for longer messages than the host's.
+    static unsigned char oversize[LONG_OVERSIZE];
+    memset( oversize, 0x5a, sizeof ( oversize ) );
+    CHECK( conn_send( deviceConn, oversize, LONG_OVERSIZE ) ==
+           LIBNXT_SUCCESS );
+    CHECK( conn_send( deviceConn, oversize, SHORT_OVERSIZE ) ==
+           LIBNXT_SUCCESS );
+    const unsigned char hello[] = { 'h', 'e', 'l', 'l', 'o' };
+    CHECK( reliable_send( device, hello, sizeof ( hello ) ) ==
+           LIBNXT_SUCCESS );
+
+    unsigned char message[MAX_MESSAGE];
+    uint16_t length;
+    CHECK( reliable_receive( host, message, sizeof ( message ), &length ) ==
+           LIBNXT_OTHER_ERROR );
+    CHECK( reliable_receive( host, message, sizeof ( message ), &length ) ==
+           LIBNXT_OTHER_ERROR );
+    CHECK( reliable_receive( host, message, sizeof ( message ), &length ) ==
+           LIBNXT_SUCCESS );
+    CHECK( length == sizeof ( hello ) );
+    CHECK( memcmp( message, hello, length ) == 0 );
+
+    close_reliable( host );
+    close_reliable( device );
+    CHECK( pthread_create( &thread, NULL, exit_device, NULL ) == 0 );
+    conn_exit_messaging( hostConn );
+    CHECK( pthread_join( thread, NULL ) == 0 );
+    printf( "test_reliable_oversize: ok\n" );
+    return 0;
+}
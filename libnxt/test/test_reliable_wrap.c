@@ -0,0 +1,147 @@
+/*
+ * Checks that a reliable channel keeps messages in order, without loss or
+ * repetition, while its 16-bit sequence numbers wrap from 65535 to 0 on a link
+ * that drops, repeats and reorders packets: messages are echoed by a simulated
+ * NXT, and faults are enabled on both ends a little before the wrap. Also
+ * checks that a window that is not a power of two, whose slots would fall out
+ * of step across the wrap, is refused.
+ */
+#include "check.h"
+#include "fault_transport.h"
+#include "loopback.h"
+#include "reliable.h"
+#include "stats.h"
+#include <pthread.h>
+#include <string.h>
+
+// Messages sent before faults are enabled, and in all.
+#define FAULTS_FROM 65000
+#define MESSAGES 67000
+// Messages sent ahead of their echoes, fewer than the window.
+#define AHEAD 6
+#define MAX_LENGTH 64
+// Bytes in transit in each direction of the loopback pair.
+#define CAPACITY 4096
+
+static const fault_options faults = { 0.05, 0.05, 0.05 };
+
+/*
+ * Fill a message with its sequence number and a pattern.
+ * return: The length of the message.
+ */
+static uint16_t make_message( uint32_t sequence, unsigned char * message );
+
+/*
+ * Check that a message is the given one.
+ */
+static void check_message( uint32_t sequence, const unsigned char * message,
+                           uint16_t length );
+
+/*
+ * Play the part of an NXT, echoing each message over a reliable channel until
+ * the host closes the connection.
+ */
+static void * run_device( void * context );
+
+static uint16_t make_message( uint32_t sequence, unsigned char * message ) {
+    uint16_t length = (uint16_t) ( 4 + sequence % ( MAX_LENGTH - 3 ) );
+    uint16_t i;
+    message[0] = (unsigned char) ( sequence >> 24 );
+    message[1] = (unsigned char) ( sequence >> 16 );
+    message[2] = (unsigned char) ( sequence >> 8 );
+    message[3] = (unsigned char) sequence;
+    for ( i = 4; i < length; i++ )
+        message[i] = (unsigned char) ( sequence * 13 + i );
+    return length;
+}
+
+static void check_message( uint32_t sequence, const unsigned char * message,
+                           uint16_t length ) {
+    unsigned char expected[MAX_LENGTH];
+    uint16_t expectedLength = make_message( sequence, expected );
+    CHECK( length == expectedLength );
+    CHECK( memcmp( message, expected, length ) == 0 );
+}
+
+static void * run_device( void * context ) {
+    nxt_comm * comm = (nxt_comm *) context;
+    messaging_options options;
+    memset( &options, 0, sizeof ( options ) );
+    options.device = 1;
+    nxt_conn * conn;
+    CHECK( conn_init_messaging_on( comm, &options, &conn ) == LIBNXT_SUCCESS );
+    reliable_channel * channel;
+    CHECK( open_reliable( conn, NULL, &channel ) == LIBNXT_SUCCESS );
+
+    uint32_t received = 0;
+    for ( ;; ) {
+        unsigned char message[MAX_LENGTH];
+        uint16_t length;
+        CHECK( reliable_receive( channel, message, sizeof ( message ),
+                                 &length ) == LIBNXT_SUCCESS );
+        if ( length == 0 )
+            break;
+        check_message( received, message, length );
+        // Only this thread writes to the link, so faults change between
+        // packets.
+        if ( ++received == FAULTS_FROM )
+            CHECK( set_comm_faults( comm, &faults ) == LIBNXT_SUCCESS );
+        CHECK( reliable_send( channel, message, length ) == LIBNXT_SUCCESS );
+    }
+    CHECK( received == MESSAGES );
+    close_reliable( channel );
+    conn_exit_messaging( conn );
+    return NULL;
+}
+
+int main( void ) {
+    nxt_comm * hostLink, * deviceLink, * host, * device;
+    CHECK( open_loopback_pair( CAPACITY, &hostLink, &deviceLink ) ==
+           LIBNXT_SUCCESS );
+    CHECK( open_fault_comm( hostLink, 7, &host ) == LIBNXT_SUCCESS );
+    CHECK( open_fault_comm( deviceLink, 11, &device ) == LIBNXT_SUCCESS );
+    pthread_t thread;
+    CHECK( pthread_create( &thread, NULL, run_device, device ) == 0 );
+
+    nxt_conn * conn;
+    CHECK( conn_init_messaging_on( host, NULL, &conn ) == LIBNXT_SUCCESS );
+    reliable_options options;
+    memset( &options, 0, sizeof ( options ) );
+    options.window = 6;
+    reliable_channel * channel;
+    CHECK( open_reliable( conn, &options, &channel ) == LIBNXT_ILLEGAL_ARG );
+    CHECK( channel == NULL );
+    options.window = 8;
+    options.timeout = 10000;
+    CHECK( open_reliable( conn, &options, &channel ) == LIBNXT_SUCCESS );
+
+    unsigned char message[MAX_LENGTH];
+    uint32_t sent = 0, echoed = 0;
+    while ( echoed < MESSAGES ) {
+        while ( sent < MESSAGES && sent - echoed < AHEAD ) {
+            if ( sent == FAULTS_FROM )
+                CHECK( set_comm_faults( host, &faults ) == LIBNXT_SUCCESS );
+            uint16_t length = make_message( sent++, message );
+            CHECK( reliable_send( channel, message, length ) ==
+                   LIBNXT_SUCCESS );
+        }
+        uint16_t length;
+        CHECK( reliable_receive( channel, message, sizeof ( message ),
+                                 &length ) == LIBNXT_SUCCESS );
+        check_message( echoed++, message, length );
+    }
+    reliable_flush( channel );
+    close_reliable( channel );
+
+    // Faults must have been injected for the wrap to be tested under them.
+    libnxt_stats stats;
+    libnxt_get_stats( &stats );
+    CHECK( stats.counters[STAT_RETRANSMITS] > 0 );
+    CHECK( stats.counters[STAT_DUPLICATES] > 0 );
+
+    CHECK( set_comm_faults( host, NULL ) == LIBNXT_SUCCESS );
+    conn_exit_messaging( conn );
+    CHECK( pthread_join( thread, NULL ) == 0 );
+    printf( "test_reliable_wrap: ok\n" );
+    return 0;
+}
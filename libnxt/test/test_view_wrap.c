@@ -0,0 +1,99 @@
+/*
+ * Checks that messages viewed with no scratch buffer are received whole even
+ * when they wrap around the end of the receive ring: a stream of short
+ * telemetry messages, whose frames do not divide the ring evenly, is received
+ * through `conn_receive_view()` with a NULL scratch buffer, with and without
+ * a pump thread.
+ */
+#include "check.h"
+#include "loopback.h"
+#include "messaging.h"
+#include <pthread.h>
+#include <string.h>
+
+// Messages sent, and the length of each, so that frames straddle the end of
+// the default 512 byte ring every few messages.
+#define MESSAGES 100
+#define MESSAGE_LENGTH 24
+
+/*
+ * Complete the handshake as the NXT, or close the connection, while the host
+ * does as well.
+ */
+static void * init_device( void * context );
+static void * exit_device( void * context );
+
+/*
+ * Fill a message with its sequence number and a pattern.
+ */
+static void make_message( unsigned int sequence, unsigned char * message );
+
+/*
+ * Send the messages from the NXT, and check that the host views each of them
+ * whole with no scratch buffer.
+ */
+static void check_wrapped( int pump );
+
+static nxt_comm * deviceLink;
+static nxt_conn * deviceConn;
+
+static void * init_device( void * context ) {
+    (void) context;
+    messaging_options options;
+    memset( &options, 0, sizeof ( options ) );
+    options.device = 1;
+    CHECK( conn_init_messaging_on( deviceLink, &options, &deviceConn ) ==
+           LIBNXT_SUCCESS );
+    return NULL;
+}
+
+static void * exit_device( void * context ) {
+    (void) context;
+    conn_exit_messaging( deviceConn );
+    return NULL;
+}
+
+static void make_message( unsigned int sequence, unsigned char * message ) {
+    unsigned int i;
+    for ( i = 0; i < MESSAGE_LENGTH; i++ )
+        message[i] = (unsigned char) ( sequence * 31 + i );
+}
+
+static void check_wrapped( int pump ) {
+    nxt_comm * hostLink;
+    CHECK( open_loopback_pair( 4096, &hostLink, &deviceLink ) ==
+           LIBNXT_SUCCESS );
+    pthread_t thread;
+    CHECK( pthread_create( &thread, NULL, init_device, NULL ) == 0 );
+    messaging_options options;
+    memset( &options, 0, sizeof ( options ) );
+    options.pump = pump;
+    nxt_conn * conn;
+    CHECK( conn_init_messaging_on( hostLink, &options, &conn ) ==
+           LIBNXT_SUCCESS );
+    CHECK( pthread_join( thread, NULL ) == 0 );
+
+    unsigned int i;
+    unsigned char message[MESSAGE_LENGTH];
+    for ( i = 0; i < MESSAGES; i++ ) {
+        make_message( i, message );
+        CHECK( conn_send( deviceConn, message, MESSAGE_LENGTH ) ==
+               LIBNXT_SUCCESS );
+        message_view view;
+        CHECK( conn_receive_view( conn, NULL, 0, &view ) == LIBNXT_SUCCESS );
+        CHECK( view.length == MESSAGE_LENGTH );
+        CHECK( memcmp( view.data, message, MESSAGE_LENGTH ) == 0 );
+        conn_release_view( conn );
+    }
+
+    CHECK( pthread_create( &thread, NULL, exit_device, NULL ) == 0 );
+    conn_exit_messaging( conn );
+    CHECK( pthread_join( thread, NULL ) == 0 );
+}
+
+int main( void ) {
+    check_wrapped( 0 );
+    check_wrapped( 1 );
+    printf( "test_view_wrap: ok\n" );
+    return 0;
+}
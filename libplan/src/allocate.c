@@ -0,0 +1,506 @@
+#include "allocate.h"
+#include <string.h>
+
+/*
+ * Find the number of steps from a node to every node, by breadth-first search
+ * around blocked nodes, into allocator->distance.
+ */
+static void search_from( repair_allocator * allocator, grid_node from );
+
+/*
+ * Take a site off the list of sites waiting for allocation.
+ */
+static void unlink_waiting( repair_allocator * allocator, repair_site site );
+
+/*
+ * Insert a site into a robot's queue.
+ * in: after - The site to insert it after, or ALLOCATE_NONE for the head.
+ * in: leg - Cost of the path to the site from the node before it.
+ */
+static void enqueue( repair_allocator * allocator, uint32_t robot,
+                     repair_site site, repair_site after, uint32_t leg );
+
+/*
+ * Find where a site finishes soonest in any robot's queue, never ahead of a
+ * job on its way, from the steps to the site in allocator->distance.
+ * in: skip - A robot not to consider, or ALLOCATE_NONE.
+ * out: after - The site to insert it after, or ALLOCATE_NONE for the head.
+ * out: leg - Cost of the path to the site from the node before it.
+ * return: The robot, or ALLOCATE_NONE if no robot can reach the site.
+ */
+static uint32_t best_insertion( const repair_allocator * allocator,
+                                uint32_t skip, uint64_t * bid,
+                                repair_site * after, uint32_t * leg );
+
+/*
+ * Insert a site where best_insertion() found, and update the costs.
+ */
+static void insert_site( repair_allocator * allocator, uint32_t robot,
+                         repair_site site, repair_site after, uint32_t leg,
+                         uint64_t finish );
+
+/*
+ * return: Non-zero if a site is in use and waits for allocation.
+ */
+static int is_waiting( const repair_allocator * allocator, repair_site site );
+
+static void search_from( repair_allocator * allocator, grid_node from ) {
+    const grid_map * map = allocator->map;
+    size_t nodes = grid_node_count( map );
+    memset( allocator->distance, 0xff, nodes * sizeof ( uint32_t ) );
+    allocator->searches++;
+    if ( grid_is_blocked( map, from ) )
+        return;
+
+    allocator->distance[from] = 0;
+    allocator->frontier[0] = from;
+    size_t first = 0;
+    size_t last = 1;
+    grid_node neighbours[4];
+    while ( first < last ) {
+        grid_node node = allocator->frontier[first++];
+        uint32_t distance = allocator->distance[node] + 1;
+        size_t n = grid_neighbours( map, node, neighbours );
+        size_t i;
+        for ( i = 0; i < n; i++ ) {
+            if ( allocator->distance[neighbours[i]] == ALLOCATE_UNREACHABLE ) {
+                allocator->distance[neighbours[i]] = distance;
+                allocator->frontier[last++] = neighbours[i];
+            }
+        }
+    }
+}
+
+static void unlink_waiting( repair_allocator * allocator, repair_site site ) {
+    repair_site * link = &allocator->waiting;
+    while ( *link != site )
+        link = &allocator->siteNext[*link];
+    *link = allocator->siteNext[site];
+}
+
+static void enqueue( repair_allocator * allocator, uint32_t robot,
+                     repair_site site, repair_site after, uint32_t leg ) {
+    repair_site * link = ( after == ALLOCATE_NONE ? &allocator->head[robot] :
+                           &allocator->siteNext[after] );
+    allocator->siteNext[site] = *link;
+    *link = site;
+    if ( allocator->siteNext[site] == ALLOCATE_NONE )
+        allocator->tail[robot] = site;
+    allocator->siteRobot[site] = robot;
+    allocator->siteLeg[site] = leg;
+}
+
+static uint32_t best_insertion( const repair_allocator * allocator,
+                                uint32_t skip, uint64_t * bid,
+                                repair_site * after, uint32_t * leg ) {
+    const uint32_t * distance = allocator->distance;
+    uint64_t bestBid = UINT64_MAX;
+    uint64_t bestAdded = UINT64_MAX;
+    uint32_t winner = ALLOCATE_NONE;
+    uint32_t r;
+    for ( r = 0; r < allocator->robotCount; r++ ) {
+        if ( r == skip )
+            continue;
+        grid_node previous = allocator->position[r];
+        repair_site before = ALLOCATE_NONE;
+        repair_site next = allocator->head[r];
+        if ( allocator->dispatched[r] && next != ALLOCATE_NONE ) {
+            // The job on its way cannot be put off.
+            previous = allocator->siteNode[next];
+            before = next;
+            next = allocator->siteNext[next];
+        }
+        for ( ;; ) {
+            uint32_t in = distance[previous];
+            if ( in == ALLOCATE_UNREACHABLE )
+                break;
+            uint64_t added = (uint64_t) in + allocator->repairCost;
+            if ( next != ALLOCATE_NONE )
+                added = added + distance[allocator->siteNode[next]] -
+                        allocator->siteLeg[next];
+            uint64_t finish = allocator->finish[r] + added;
+            if ( finish < bestBid ||
+                 ( finish == bestBid && added < bestAdded ) ) {
+                bestBid = finish;
+                bestAdded = added;
+                winner = r;
+                *after = before;
+                *leg = in;
+            }
+            if ( next == ALLOCATE_NONE )
+                break;
+            previous = allocator->siteNode[next];
+            before = next;
+            next = allocator->siteNext[next];
+        }
+    }
+    *bid = bestBid;
+    return winner;
+}
+
+static void insert_site( repair_allocator * allocator, uint32_t robot,
+                         repair_site site, repair_site after, uint32_t leg,
+                         uint64_t finish ) {
+    enqueue( allocator, robot, site, after, leg );
+    repair_site following = allocator->siteNext[site];
+    if ( following != ALLOCATE_NONE )
+        allocator->siteLeg[following] =
+            allocator->distance[allocator->siteNode[following]];
+    allocator->finish[robot] = finish;
+}
+
+static int is_waiting( const repair_allocator * allocator, repair_site site ) {
+    return ( site < allocator->siteCapacity &&
+             allocator->siteNode[site] != GRID_NO_NODE &&
+             allocator->siteRobot[site] == ALLOCATE_NONE );
+}
+
+plan_error init_allocator( repair_allocator * allocator, const grid_map * map,
+                           uint32_t robotCount, uint32_t siteCapacity ) {
+    memset( allocator, 0, sizeof ( repair_allocator ) );
+    if ( robotCount == 0 || siteCapacity == 0 ||
+         robotCount >= ALLOCATE_NONE || siteCapacity >= ALLOCATE_NONE )
+        return PLAN_ILLEGAL_ARG;
+
+    size_t robots = robotCount;
+    size_t sites = siteCapacity;
+    size_t nodes = grid_node_count( map );
+    allocator->position = (grid_node *) calloc( robots, sizeof ( grid_node ) );
+    allocator->head = (repair_site *) malloc( robots * sizeof ( repair_site ) );
+    allocator->tail = (repair_site *) malloc( robots * sizeof ( repair_site ) );
+    allocator->finish = (uint64_t *) calloc( robots, sizeof ( uint64_t ) );
+    allocator->dispatched = (unsigned char *) calloc( robots, 1 );
+    allocator->siteNode = (grid_node *) malloc( sites * sizeof ( grid_node ) );
+    allocator->siteRobot = (uint32_t *) malloc( sites * sizeof ( uint32_t ) );
+    allocator->siteNext = (repair_site *) malloc( sites *
+                                                  sizeof ( repair_site ) );
+    allocator->siteLeg = (uint32_t *) malloc( sites * sizeof ( uint32_t ) );
+    allocator->distance = (uint32_t *) malloc( nodes * sizeof ( uint32_t ) );
+    allocator->frontier = (grid_node *) malloc( nodes * sizeof ( grid_node ) );
+    allocator->pending = (repair_site *) malloc( sites *
+                                                 sizeof ( repair_site ) );
+    allocator->cost = (uint32_t *) malloc( robots * sites *
+                                           sizeof ( uint32_t ) );
+    allocator->bidders = (uint32_t *) malloc( robots * sizeof ( uint32_t ) );
+    allocator->assignment = (size_t *) malloc(
+        ( robots < sites ? robots : sites ) * sizeof ( size_t ) );
+    if ( allocator->position == NULL || allocator->head == NULL ||
+         allocator->tail == NULL || allocator->finish == NULL ||
+         allocator->dispatched == NULL || allocator->siteNode == NULL ||
+         allocator->siteRobot == NULL || allocator->siteNext == NULL ||
+         allocator->siteLeg == NULL || allocator->distance == NULL ||
+         allocator->frontier == NULL || allocator->pending == NULL ||
+         allocator->cost == NULL || allocator->assignment == NULL ||
+         allocator->bidders == NULL ||
+         init_hungarian( &allocator->solver,
+                         robots > sites ? robots : sites ) ) {
+        free_allocator( allocator );
+        return PLAN_OTHER_ERROR;
+    }
+
+    allocator->map = map;
+    allocator->robotCount = robotCount;
+    allocator->siteCapacity = siteCapacity;
+    uint32_t i;
+    for ( i = 0; i < robotCount; i++ )
+        allocator->head[i] = allocator->tail[i] = ALLOCATE_NONE;
+    for ( i = 0; i < siteCapacity; i++ ) {
+        allocator->siteNode[i] = GRID_NO_NODE;
+        allocator->siteNext[i] = ( i + 1 < siteCapacity ? i + 1 :
+                                   ALLOCATE_NONE );
+    }
+    allocator->waiting = ALLOCATE_NONE;
+    allocator->freeSites = 0;
+    return PLAN_SUCCESS;
+}
+
+void free_allocator( repair_allocator * allocator ) {
+    free( allocator->position );
+    free( allocator->head );
+    free( allocator->tail );
+    free( allocator->finish );
+    free( allocator->dispatched );
+    free( allocator->siteNode );
+    free( allocator->siteRobot );
+    free( allocator->siteNext );
+    free( allocator->siteLeg );
+    free( allocator->distance );
+    free( allocator->frontier );
+    free( allocator->pending );
+    free( allocator->cost );
+    free( allocator->assignment );
+    free( allocator->bidders );
+    free_hungarian( &allocator->solver );
+    memset( allocator, 0, sizeof ( repair_allocator ) );
+}
+
+plan_error allocator_set_robot( repair_allocator * allocator, uint32_t robot,
+                                grid_node node ) {
+    if ( robot >= allocator->robotCount ||
+         allocator->head[robot] != ALLOCATE_NONE ||
+         grid_is_blocked( allocator->map, node ) )
+        return PLAN_ILLEGAL_ARG;
+    allocator->position[robot] = node;
+    allocator->finish[robot] = 0;
+    return PLAN_SUCCESS;
+}
+
+plan_error allocator_add_site( repair_allocator * allocator, grid_node node,
+                               repair_site * site ) {
+    if ( grid_is_blocked( allocator->map, node ) )
+        return PLAN_ILLEGAL_ARG;
+    if ( allocator->freeSites == ALLOCATE_NONE )
+        return PLAN_OTHER_ERROR;
+
+    repair_site added = allocator->freeSites;
+    allocator->freeSites = allocator->siteNext[added];
+    allocator->siteNode[added] = node;
+    allocator->siteRobot[added] = ALLOCATE_NONE;
+    allocator->siteNext[added] = allocator->waiting;
+    allocator->waiting = added;
+    allocator->siteCount++;
+    *site = added;
+    return PLAN_SUCCESS;
+}
+
+plan_error allocator_assign( repair_allocator * allocator ) {
+    allocator->searches = 0;
+    size_t pendingCount = 0;
+    repair_site site;
+    for ( site = allocator->waiting; site != ALLOCATE_NONE;
+          site = allocator->siteNext[site] )
+        allocator->pending[pendingCount++] = site;
+    if ( pendingCount == 0 )
+        return PLAN_NO_EFFECT;
+
+    // Boolean flag: offer the sites to every robot this round.
+    int everyone = 0;
+    while ( pendingCount > 0 ) {
+        // Offer every site to the robots due to finish in the earlier half of
+        // the spread of finish times, after the sites already queued for them,
+        // so that robots with long queues are not made to take more.
+        uint64_t earliest = UINT64_MAX, latest = 0;
+        size_t r, j;
+        for ( r = 0; r < allocator->robotCount; r++ ) {
+            if ( allocator->finish[r] < earliest )
+                earliest = allocator->finish[r];
+            if ( allocator->finish[r] > latest )
+                latest = allocator->finish[r];
+        }
+        uint64_t cutoff = earliest + ( latest - earliest ) / 2;
+        size_t robots = 0;
+        for ( r = 0; r < allocator->robotCount; r++ )
+            if ( everyone || allocator->finish[r] <= cutoff )
+                allocator->bidders[robots++] = (uint32_t) r;
+        // The matrix has a row for each robot, unless there are fewer sites
+        // than robots, when it has a row for each site.
+        int byRobot = ( robots <= pendingCount );
+        size_t k;
+        for ( k = 0; k < robots; k++ ) {
+            r = allocator->bidders[k];
+            repair_site last = allocator->tail[r];
+            search_from( allocator, last == ALLOCATE_NONE ?
+                                    allocator->position[r] :
+                                    allocator->siteNode[last] );
+            for ( j = 0; j < pendingCount; j++ ) {
+                uint32_t steps = allocator->distance[
+                    allocator->siteNode[allocator->pending[j]]];
+                uint64_t finish = allocator->finish[r] + steps +
+                                  allocator->repairCost;
+                uint32_t entry = ( steps == ALLOCATE_UNREACHABLE ?
+                                   HUNGARIAN_FORBIDDEN :
+                                   finish < HUNGARIAN_FORBIDDEN ?
+                                   (uint32_t) finish :
+                                   HUNGARIAN_FORBIDDEN - 1 );
+                allocator->cost[byRobot ? k * pendingCount + j :
+                                          j * robots + k] = entry;
+            }
+        }
+        size_t rows = ( byRobot ? robots : pendingCount );
+        size_t columns = ( byRobot ? pendingCount : robots );
+        hungarian_solve( &allocator->solver, allocator->cost, rows, columns,
+                         allocator->assignment );
+
+        size_t assigned = 0;
+        size_t row;
+        for ( row = 0; row < rows; row++ ) {
+            size_t column = allocator->assignment[row];
+            uint32_t entry = allocator->cost[row * columns + column];
+            if ( entry == HUNGARIAN_FORBIDDEN )
+                continue;
+            r = allocator->bidders[byRobot ? row : column];
+            j = ( byRobot ? column : row );
+            uint64_t leg = entry - allocator->finish[r] -
+                           allocator->repairCost;
+            enqueue( allocator, (uint32_t) r, allocator->pending[j],
+                     allocator->tail[r], (uint32_t) leg );
+            allocator->finish[r] = entry;
+            allocator->pending[j] = ALLOCATE_NONE;
+            assigned++;
+        }
+        if ( assigned == 0 ) {
+            // The sites left may only be reachable by robots that were not
+            // offered them, so offer them to every robot before giving up.
+            if ( robots == allocator->robotCount )
+                break;
+            everyone = 1;
+            continue;
+        }
+        everyone = 0;
+        size_t kept = 0;
+        for ( j = 0; j < pendingCount; j++ ) {
+            if ( allocator->pending[j] != ALLOCATE_NONE )
+                allocator->pending[kept++] = allocator->pending[j];
+        }
+        pendingCount = kept;
+    }
+
+    // Rounds share out sites more evenly by number than by time, so move the
+    // last site of the robot due to finish last to wherever it finishes
+    // soonest, for as long as that finishes sooner.
+    for ( ;; ) {
+        uint32_t latest = 0;
+        uint32_t r;
+        for ( r = 1; r < allocator->robotCount; r++ ) {
+            if ( allocator->finish[r] > allocator->finish[latest] )
+                latest = r;
+        }
+        site = allocator->tail[latest];
+        if ( site == ALLOCATE_NONE || ( allocator->dispatched[latest] &&
+                                        site == allocator->head[latest] ) )
+            break;
+        search_from( allocator, allocator->siteNode[site] );
+        uint64_t bid;
+        repair_site after = ALLOCATE_NONE;
+        uint32_t leg = 0;
+        uint32_t winner = best_insertion( allocator, latest, &bid, &after,
+                                          &leg );
+        if ( winner == ALLOCATE_NONE || bid >= allocator->finish[latest] )
+            break;
+
+        repair_site previous = ALLOCATE_NONE;
+        repair_site * link = &allocator->head[latest];
+        while ( *link != site ) {
+            previous = *link;
+            link = &allocator->siteNext[*link];
+        }
+        *link = ALLOCATE_NONE;
+        allocator->tail[latest] = previous;
+        allocator->finish[latest] -= allocator->siteLeg[site] +
+                                     allocator->repairCost;
+        insert_site( allocator, winner, site, after, leg, bid );
+    }
+
+    // Any sites left could not be reached, and wait again.
+    allocator->waiting = ALLOCATE_NONE;
+    size_t j;
+    for ( j = pendingCount; j > 0; j-- ) {
+        allocator->siteNext[allocator->pending[j - 1]] = allocator->waiting;
+        allocator->waiting = allocator->pending[j - 1];
+    }
+    return ( pendingCount > 0 ? PLAN_NO_PATH : PLAN_SUCCESS );
+}
+
+plan_error allocator_auction( repair_allocator * allocator, repair_site site,
+                              uint32_t * robot ) {
+    if ( ! is_waiting( allocator, site ) )
+        return PLAN_ILLEGAL_ARG;
+    allocator->searches = 0;
+    // The grid is undirected, so one search from the site gives the steps to
+    // it from every node.
+    search_from( allocator, allocator->siteNode[site] );
+    uint64_t bid;
+    repair_site after = ALLOCATE_NONE;
+    uint32_t leg = 0;
+    uint32_t winner = best_insertion( allocator, ALLOCATE_NONE, &bid, &after,
+                                      &leg );
+    if ( robot != NULL )
+        *robot = winner;
+    if ( winner == ALLOCATE_NONE )
+        return PLAN_NO_PATH;
+
+    unlink_waiting( allocator, site );
+    insert_site( allocator, winner, site, after, leg, bid );
+    return PLAN_SUCCESS;
+}
+
+plan_error allocator_complete( repair_allocator * allocator, uint32_t robot ) {
+    if ( robot >= allocator->robotCount )
+        return PLAN_ILLEGAL_ARG;
+    repair_site done = allocator->head[robot];
+    if ( done == ALLOCATE_NONE )
+        return PLAN_NO_EFFECT;
+
+    allocator->finish[robot] -= allocator->siteLeg[done] +
+                                allocator->repairCost;
+    allocator->position[robot] = allocator->siteNode[done];
+    allocator->head[robot] = allocator->siteNext[done];
+    if ( allocator->head[robot] == ALLOCATE_NONE )
+        allocator->tail[robot] = ALLOCATE_NONE;
+    allocator->dispatched[robot] = 0;
+
+    allocator->siteNode[done] = GRID_NO_NODE;
+    allocator->siteNext[done] = allocator->freeSites;
+    allocator->freeSites = done;
+    allocator->siteCount--;
+    return PLAN_SUCCESS;
+}
+
+repair_site allocator_next_site( const repair_allocator * allocator,
+                                 uint32_t robot ) {
+    if ( robot >= allocator->robotCount )
+        return ALLOCATE_NONE;
+    return allocator->head[robot];
+}
+
+uint64_t allocator_finish( const repair_allocator * allocator,
+                           uint32_t robot ) {
+    if ( robot >= allocator->robotCount )
+        return 0;
+    return allocator->finish[robot];
+}
+
+uint64_t allocator_makespan( const repair_allocator * allocator ) {
+    uint64_t makespan = 0;
+    uint32_t r;
+    for ( r = 0; r < allocator->robotCount; r++ ) {
+        if ( allocator->finish[r] > makespan )
+            makespan = allocator->finish[r];
+    }
+    return makespan;
+}
+
+uint16_t allocator_job_message( grid_node from, grid_node to,
+                                unsigned char * message ) {
+    if ( from < 256 && to < 256 ) {
+        message[0] = (unsigned char) from;
+        message[1] = (unsigned char) to;
+        return 2;
+    }
+    int i;
+    for ( i = 0; i < 4; i++ ) {
+        message[i] = (unsigned char) ( from >> ( 24 - 8 * i ) );
+        message[4 + i] = (unsigned char) ( to >> ( 24 - 8 * i ) );
+    }
+    return JOB_MESSAGE_SIZE;
+}
+
+plan_error allocator_dispatch( repair_allocator * allocator,
+                               allocator_send_fn send, void * context ) {
+    plan_error result = PLAN_NO_EFFECT;
+    uint32_t r;
+    for ( r = 0; r < allocator->robotCount; r++ ) {
+        repair_site site = allocator->head[r];
+        if ( site == ALLOCATE_NONE || allocator->dispatched[r] )
+            continue;
+        unsigned char message[JOB_MESSAGE_SIZE];
+        uint16_t length = allocator_job_message( allocator->position[r],
+                                                 allocator->siteNode[site],
+                                                 message );
+        if ( send( context, r, message, length ) )
+            return PLAN_OTHER_ERROR;
+        allocator->dispatched[r] = 1;
+        result = PLAN_SUCCESS;
+    }
+    return result;
+}
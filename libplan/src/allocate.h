@@ -0,0 +1,273 @@
+/*! \file
+ * \brief Allocation of repair sites, such as failed sensor nodes, to robots,
+ * aiming to finish every repair as early as possible (least makespan).
+ *
+ * Each robot has a queue of sites to visit in order, and its finish time is
+ * the cost of the path along its queue: the number of steps between
+ * neighbouring nodes of the grid, found by breadth-first search around
+ * blocked nodes, plus a fixed cost to repair each site. The makespan is the
+ * latest finish time of any robot.
+ *
+ * Allocating sites to minimise makespan is NP-hard, so two heuristics are
+ * offered:
+ *
+ * - `allocator_assign()` allocates every site waiting at once, in rounds. In
+ *   each round, every robot not far behind the others is offered one more
+ *   site, and the Hungarian algorithm of `hungarian.h` pairs robots with
+ *   sites at least total finish time, so the work is spread across the
+ *   robots. The last sites of the robot due to finish last are then moved to
+ *   other robots while that finishes them sooner.
+ * - `allocator_auction()` allocates one site that arrived after the others,
+ *   as when a node fails mid-mission. Every robot bids the finish time it
+ *   would have with the site inserted at the best place in its queue, and the
+ *   lowest bid wins. A single search from the site prices every bid.
+ *
+ * Jobs are sent to the robots as the messages `Controller.java` reads: the
+ * indices of the node to start from and of the node to go to.
+ *
+ * Usage
+ * =====
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~{.c}
+ * repair_allocator allocator;
+ * init_allocator( &allocator, &map, robotCount, maxSites );
+ * allocator_set_robot( &allocator, 0, robotNode );
+ * allocator_add_site( &allocator, failedNode, &site );
+ * allocator_assign( &allocator );
+ * allocator_dispatch( &allocator, send_job, context );
+ *
+ * // When a robot reports PROGRESS_COMPLETE:
+ * allocator_complete( &allocator, robot );
+ * // When another node fails:
+ * allocator_add_site( &allocator, failedNode, &site );
+ * allocator_auction( &allocator, site, &robot );
+ * allocator_dispatch( &allocator, send_job, context );
+ *
+ * free_allocator( &allocator );
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+#ifndef ALLOCATE_H
+#define ALLOCATE_H
+#include "plan_error.h"
+#include "grid_map.h"
+#include "hungarian.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+/*! \brief Index of a site in a `repair_allocator`.
+ */
+typedef uint32_t repair_site;
+
+/*! \def ALLOCATE_NONE
+ * A `repair_site` or robot that refers to none.
+ */
+#define ALLOCATE_NONE UINT32_MAX
+
+/*! \def ALLOCATE_UNREACHABLE
+ * The cost of a path that does not exist.
+ */
+#define ALLOCATE_UNREACHABLE UINT32_MAX
+
+/*! \def JOB_MESSAGE_SIZE
+ * Size of the longest message made by `allocator_job_message()`.
+ */
+#define JOB_MESSAGE_SIZE 8
+
+/*! \brief Sends a job to a robot, such as with `conn_send()`.
+ *
+ * \param [in] context As passed to `allocator_dispatch()`.
+ * \param [in] robot The robot to send to.
+ * \param [in] message The job, made by `allocator_job_message()`.
+ * \param [in] length Size of the job in bytes.
+ * \return 0 if the job was sent.
+ */
+typedef int ( * allocator_send_fn )( void * context, uint32_t robot,
+                                     unsigned char * message,
+                                     uint16_t length );
+
+/*! \brief Robots, the sites they are to repair, and reusable state for
+ * allocating the sites. Initialise with `init_allocator()`.
+ */
+typedef struct repair_allocator {
+    const grid_map * map; /*!< The grid the robots drive on. */
+    uint32_t robotCount; /*!< Number of robots. */
+    uint32_t siteCapacity; /*!< Largest number of sites at once. */
+    uint32_t repairCost; /*!< Cost added for repairing each site. */
+    grid_node * position; /*!< Node each robot starts its queue from. */
+    repair_site * head; /*!< First site in each robot's queue. */
+    repair_site * tail; /*!< Last site in each robot's queue. */
+    uint64_t * finish; /*!< Cost of each robot's queue. */
+    unsigned char * dispatched; /*!< Flag of each robot sent its head. */
+    grid_node * siteNode; /*!< Node of each site. */
+    uint32_t * siteRobot; /*!< Robot each site is queued for, or
+                           * `ALLOCATE_NONE` while it waits. */
+    repair_site * siteNext; /*!< Next site in the same queue or list. */
+    uint32_t * siteLeg; /*!< Cost of the path to each queued site from the
+                         * node before it in its queue. */
+    repair_site waiting; /*!< First site waiting to be allocated. */
+    repair_site freeSites; /*!< First unused site. */
+    uint32_t siteCount; /*!< Number of sites in use. */
+    uint32_t * distance; /*!< Steps to each node from the last search. */
+    grid_node * frontier; /*!< Queue of the breadth-first search. */
+    repair_site * pending; /*!< Sites offered in a round. */
+    uint32_t * cost; /*!< Cost matrix of a round. */
+    size_t * assignment; /*!< Solution of a round. */
+    uint32_t * bidders; /*!< Robots offered sites in a round. */
+    hungarian_solver solver; /*!< Solves each round. */
+    size_t searches; /*!< Breadth-first searches made by the last call. */
+} repair_allocator;
+
+/*! \brief Allocate the state of an allocator, with every robot at node 0 and
+ * no sites.
+ *
+ * \param [out] allocator The allocator to initialise.
+ * \param [in] map The grid the robots drive on, which must outlive the
+ * allocator. Changes to which nodes are blocked take effect in later
+ * allocations.
+ * \param [in] robotCount Number of robots.
+ * \param [in] siteCapacity Largest number of sites to hold at once.
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS}
+ *
+ * \linkerror{PLAN_ILLEGAL_ARG} if `robotCount` or `siteCapacity` is 0, or
+ * `ALLOCATE_NONE` or more
+ *
+ * \linkerror{PLAN_OTHER_ERROR} if memory could not be allocated.
+ * \endparblock
+ */
+plan_error init_allocator( repair_allocator * allocator, const grid_map * map,
+                           uint32_t robotCount, uint32_t siteCapacity );
+
+/*! \brief Free the state of an allocator initialised with `init_allocator()`.
+ */
+void free_allocator( repair_allocator * allocator );
+
+/*! \brief Place a robot, which must have an empty queue.
+ *
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS}
+ *
+ * \linkerror{PLAN_ILLEGAL_ARG} if the robot does not exist, has sites queued,
+ * or `node` is not an unblocked node of the grid.
+ * \endparblock
+ */
+plan_error allocator_set_robot( repair_allocator * allocator, uint32_t robot,
+                                grid_node node );
+
+/*! \brief Add a site to repair, to wait for allocation.
+ *
+ * \param [in] node The node of the site.
+ * \param [out] site Output location for the index of the site.
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS}
+ *
+ * \linkerror{PLAN_ILLEGAL_ARG} if `node` is not an unblocked node of the grid
+ *
+ * \linkerror{PLAN_OTHER_ERROR} if the allocator holds `siteCapacity` sites
+ * already.
+ * \endparblock
+ */
+plan_error allocator_add_site( repair_allocator * allocator, grid_node node,
+                               repair_site * site );
+
+/*! \brief Allocate every site waiting, in rounds solved with the Hungarian
+ * algorithm, appending them to the robots' queues.
+ *
+ * A round offers sites to the robots due to finish no later than halfway
+ * between the earliest and latest finish times, or to every robot if none of
+ * those can reach a site that is left. After the rounds, sites may
+ * be moved from the end of the latest robot's queue into other queues.
+ *
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS}
+ *
+ * \linkerror{PLAN_NO_EFFECT} if no site was waiting
+ *
+ * \linkerror{PLAN_NO_PATH} if some sites could not be reached by any robot,
+ * and still wait.
+ * \endparblock
+ */
+plan_error allocator_assign( repair_allocator * allocator );
+
+/*! \brief Allocate one waiting site by auction, inserting it into the queue
+ * of the robot that would finish earliest with it.
+ *
+ * A site can be inserted anywhere in a queue but ahead of a job already
+ * dispatched.
+ * \param [in] site A site waiting for allocation.
+ * \param [out] robot Output location for the robot that won the site, or NULL.
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS}
+ *
+ * \linkerror{PLAN_ILLEGAL_ARG} if `site` is not waiting
+ *
+ * \linkerror{PLAN_NO_PATH} if no robot can reach the site, which still waits.
+ * \endparblock
+ */
+plan_error allocator_auction( repair_allocator * allocator, repair_site site,
+                              uint32_t * robot );
+
+/*! \brief Mark the first site in a robot's queue repaired: the robot is then
+ * at that site, and its next site can be dispatched.
+ *
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS}
+ *
+ * \linkerror{PLAN_NO_EFFECT} if the robot's queue is empty
+ *
+ * \linkerror{PLAN_ILLEGAL_ARG} if the robot does not exist.
+ * \endparblock
+ */
+plan_error allocator_complete( repair_allocator * allocator, uint32_t robot );
+
+/*! \return The first site in a robot's queue, or `ALLOCATE_NONE` if it is
+ * empty or the robot does not exist.
+ */
+repair_site allocator_next_site( const repair_allocator * allocator,
+                                 uint32_t robot );
+
+/*! \return The cost of a robot's queue, or 0 if the robot does not exist.
+ */
+uint64_t allocator_finish( const repair_allocator * allocator,
+                           uint32_t robot );
+
+/*! \return The latest finish time of any robot.
+ */
+uint64_t allocator_makespan( const repair_allocator * allocator );
+
+/*! \brief Make the message that sends a robot from one node to another.
+ *
+ * If both nodes are below 256, the message is their indices as 2 bytes.
+ * Otherwise it is their indices as 4-byte big-endian integers, for robots on
+ * larger grids. `Controller.java` tells the two apart by their length.
+ * \param [out] message Output location for the message, of at least
+ * `#JOB_MESSAGE_SIZE` bytes.
+ * \return The size of the message.
+ */
+uint16_t allocator_job_message( grid_node from, grid_node to,
+                                unsigned char * message );
+
+/*! \brief Send each robot whose first site has not been sent yet the job of
+ * going to it.
+ *
+ * \param [in] send Sends each job.
+ * \param [in] context Passed to `send`.
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS}
+ *
+ * \linkerror{PLAN_NO_EFFECT} if no job was to be sent
+ *
+ * \linkerror{PLAN_OTHER_ERROR} if `send` failed; the job is sent again by the
+ * next call.
+ * \endparblock
+ */
+plan_error allocator_dispatch( repair_allocator * allocator,
+                               allocator_send_fn send, void * context );
+
+#endif
@@ -0,0 +1,196 @@
+#include "astar.h"
+#include <string.h>
+
+// heapIndex of a node that has been expanded.
+#define CLOSED UINT32_MAX
+
+/*
+ * Start a new search, making the entries of every node stale.
+ */
+static void begin_search( astar_planner * planner );
+
+/*
+ * Order open nodes by estimate, breaking ties in favour of the node furthest
+ * from the start, which is likely to be nearer the goal.
+ * return: Non-zero if node a should be expanded before node b.
+ */
+static int heap_before( astar_planner * planner, grid_node a, grid_node b );
+
+/*
+ * Move the node at the given position of the heap towards the root until the
+ * heap is ordered.
+ */
+static void sift_up( astar_planner * planner, size_t position );
+
+/*
+ * Move the node at the given position of the heap towards the leaves until the
+ * heap is ordered.
+ */
+static void sift_down( astar_planner * planner, size_t position );
+
+/*
+ * Remove and return the root of the heap, marking it closed.
+ */
+static grid_node pop_heap( astar_planner * planner );
+
+static void begin_search( astar_planner * planner ) {
+    planner->heapCount = 0;
+    planner->expanded = 0;
+    planner->searchCount++;
+    if ( planner->searchCount == 0 ) {
+        // The counter wrapped, so old numbers could be mistaken for current.
+        memset( planner->search, 0, planner->capacity * sizeof ( uint32_t ) );
+        planner->searchCount = 1;
+    }
+}
+
+static int heap_before( astar_planner * planner, grid_node a, grid_node b ) {
+    if ( planner->estimate[a] != planner->estimate[b] )
+        return planner->estimate[a] < planner->estimate[b];
+    return planner->cost[a] > planner->cost[b];
+}
+
+static void sift_up( astar_planner * planner, size_t position ) {
+    grid_node node = planner->heap[position];
+    while ( position > 0 ) {
+        size_t up = ( position - 1 ) / 2;
+        grid_node above = planner->heap[up];
+        if ( ! heap_before( planner, node, above ) )
+            break;
+        planner->heap[position] = above;
+        planner->heapIndex[above] = position;
+        position = up;
+    }
+    planner->heap[position] = node;
+    planner->heapIndex[node] = position;
+}
+
+static void sift_down( astar_planner * planner, size_t position ) {
+    grid_node node = planner->heap[position];
+    for ( ;; ) {
+        size_t down = 2 * position + 1;
+        if ( down >= planner->heapCount )
+            break;
+        if ( down + 1 < planner->heapCount &&
+             heap_before( planner, planner->heap[down + 1],
+                          planner->heap[down] ) )
+            down++;
+        grid_node below = planner->heap[down];
+        if ( ! heap_before( planner, below, node ) )
+            break;
+        planner->heap[position] = below;
+        planner->heapIndex[below] = position;
+        position = down;
+    }
+    planner->heap[position] = node;
+    planner->heapIndex[node] = position;
+}
+
+static grid_node pop_heap( astar_planner * planner ) {
+    grid_node root = planner->heap[0];
+    planner->heapCount--;
+    if ( planner->heapCount > 0 ) {
+        planner->heap[0] = planner->heap[planner->heapCount];
+        sift_down( planner, 0 );
+    }
+    planner->heapIndex[root] = CLOSED;
+    return root;
+}
+
+plan_error init_astar( astar_planner * planner, size_t capacity ) {
+    memset( planner, 0, sizeof ( astar_planner ) );
+    if ( capacity == 0 )
+        return PLAN_ILLEGAL_ARG;
+
+    planner->cost = (uint32_t *) malloc( capacity * sizeof ( uint32_t ) );
+    planner->estimate = (uint32_t *) malloc( capacity * sizeof ( uint32_t ) );
+    planner->parent = (grid_node *) malloc( capacity * sizeof ( grid_node ) );
+    planner->search = (uint32_t *) calloc( capacity, sizeof ( uint32_t ) );
+    planner->heapIndex = (uint32_t *) malloc( capacity * sizeof ( uint32_t ) );
+    planner->heap = (grid_node *) malloc( capacity * sizeof ( grid_node ) );
+    if ( planner->cost == NULL || planner->estimate == NULL ||
+         planner->parent == NULL || planner->search == NULL ||
+         planner->heapIndex == NULL || planner->heap == NULL ) {
+        free_astar( planner );
+        return PLAN_OTHER_ERROR;
+    }
+    planner->capacity = capacity;
+    return PLAN_SUCCESS;
+}
+
+void free_astar( astar_planner * planner ) {
+    free( planner->cost );
+    free( planner->estimate );
+    free( planner->parent );
+    free( planner->search );
+    free( planner->heapIndex );
+    free( planner->heap );
+    memset( planner, 0, sizeof ( astar_planner ) );
+}
+
+plan_error astar_find_path( astar_planner * planner, const grid_map * map,
+                            grid_node start, grid_node goal, grid_node * path,
+                            size_t maxCount, size_t * count ) {
+    *count = 0;
+    if ( grid_node_count( map ) > planner->capacity )
+        return PLAN_ILLEGAL_ARG;
+    if ( grid_is_blocked( map, start ) || grid_is_blocked( map, goal ) )
+        return PLAN_ILLEGAL_ARG;
+
+    begin_search( planner );
+    uint32_t current = planner->searchCount;
+    planner->search[start] = current;
+    planner->cost[start] = 0;
+    planner->estimate[start] = grid_distance( map, start, goal );
+    planner->parent[start] = GRID_NO_NODE;
+    planner->heap[0] = start;
+    planner->heapIndex[start] = 0;
+    planner->heapCount = 1;
+
+    grid_node neighbours[4];
+    while ( planner->heapCount > 0 ) {
+        grid_node node = pop_heap( planner );
+        if ( node == goal )
+            break;
+        planner->expanded++;
+
+        uint32_t cost = planner->cost[node] + 1;
+        size_t n = grid_neighbours( map, node, neighbours );
+        size_t i;
+        for ( i = 0; i < n; i++ ) {
+            grid_node next = neighbours[i];
+            if ( planner->search[next] != current ) {
+                planner->search[next] = current;
+                planner->cost[next] = cost;
+                planner->estimate[next] = cost +
+                                          grid_distance( map, next, goal );
+                planner->parent[next] = node;
+                planner->heap[planner->heapCount] = next;
+                sift_up( planner, planner->heapCount++ );
+            } else if ( planner->heapIndex[next] != CLOSED &&
+                        cost < planner->cost[next] ) {
+                // The heuristic is consistent, so closed nodes never improve.
+                planner->estimate[next] -= planner->cost[next] - cost;
+                planner->cost[next] = cost;
+                planner->parent[next] = node;
+                sift_up( planner, planner->heapIndex[next] );
+            }
+        }
+    }
+
+    if ( planner->search[goal] != current ||
+         planner->heapIndex[goal] != CLOSED )
+        return PLAN_NO_PATH;
+
+    *count = (size_t) planner->cost[goal] + 1;
+    if ( *count > maxCount )
+        return PLAN_ILLEGAL_ARG;
+
+    grid_node node = goal;
+    size_t i = *count;
+    while ( i > 0 ) {
+        path[--i] = node;
+        node = planner->parent[node];
+    }
+    return PLAN_SUCCESS;
+}
@@ -0,0 +1,83 @@
+/*! \file
+ * \brief A* search over a `grid_map`, for planning the paths of the robot on
+ * the Galileo instead of on the NXT.
+ *
+ * An `astar_planner` owns flat arrays with one entry per node, and an indexed
+ * binary heap of open nodes. They are allocated once, when the planner is
+ * initialised, and reused by every search: entries left over from earlier
+ * searches are recognised as stale by a search number stored with each node,
+ * so nothing is cleared or allocated between searches.
+ *
+ * Each step between neighbouring nodes costs 1, and the Manhattan distance is
+ * used as the heuristic, so paths found are shortest paths.
+ */
+#ifndef ASTAR_H
+#define ASTAR_H
+#include "plan_error.h"
+#include "grid_map.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+/*! \brief Reusable state for A* searches. Initialise with `init_astar()`.
+ */
+typedef struct astar_planner {
+    size_t capacity; /*!< Number of nodes the arrays can hold. */
+    uint32_t * cost; /*!< Cost of the best path found to each node. */
+    uint32_t * estimate; /*!< `cost` plus the heuristic of each node. */
+    grid_node * parent; /*!< Previous node on the best path found. */
+    uint32_t * search; /*!< Search in which each entry was last written. */
+    uint32_t * heapIndex; /*!< Position of each node in `heap`. */
+    grid_node * heap; /*!< Binary heap of open nodes, by `estimate`. */
+    size_t heapCount; /*!< Number of nodes in `heap`. */
+    uint32_t searchCount; /*!< Number of the current search. */
+    size_t expanded; /*!< Nodes expanded by the last search. */
+} astar_planner;
+
+/*! \brief Allocate the arrays of a planner.
+ *
+ * \param [out] planner The planner to initialise.
+ * \param [in] capacity The largest number of nodes of the grids to search.
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS}
+ *
+ * \linkerror{PLAN_ILLEGAL_ARG} if `capacity` is 0
+ *
+ * \linkerror{PLAN_OTHER_ERROR} if memory could not be allocated.
+ * \endparblock
+ */
+plan_error init_astar( astar_planner * planner, size_t capacity );
+
+/*! \brief Free the arrays of a planner initialised with `init_astar()`.
+ */
+void free_astar( astar_planner * planner );
+
+/*! \brief Find a shortest path between two nodes of a grid.
+ *
+ * Does not allocate memory.
+ * \param [in] planner A planner with a capacity of at least the number of
+ * nodes in `map`.
+ * \param [in] map The grid to search.
+ * \param [in] start The node to start from.
+ * \param [in] goal The node to reach.
+ * \param [out] path A buffer to store the nodes of the path, from `start` to
+ * `goal` inclusive. Convert them to waypoints with `grid_node_point()`.
+ * \param [in] maxCount Size of `path`.
+ * \param [out] count The number of nodes in the path, which may exceed
+ * `maxCount`.
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS} (and populates `path` and `count`)
+ *
+ * \linkerror{PLAN_ILLEGAL_ARG} if `start` or `goal` is blocked or not in the
+ * grid, or the grid is too large for the planner, or `maxCount` is less than
+ * the length of the path (and populates `count`)
+ *
+ * \linkerror{PLAN_NO_PATH} if `goal` cannot be reached from `start`.
+ * \endparblock
+ */
+plan_error astar_find_path( astar_planner * planner, const grid_map * map,
+                            grid_node start, grid_node goal, grid_node * path,
+                            size_t maxCount, size_t * count );
+
+#endif
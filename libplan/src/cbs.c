@@ -0,0 +1,1035 @@
+#include "cbs.h"
+#include <string.h>
+
+// Number of entries the arrays that grow start with.
+#define INITIAL_CAPACITY 256
+
+// Steps to a node from which a goal cannot be reached.
+#define UNREACHABLE UINT32_MAX
+
+/*
+ * A conflict between two robots: each robot is at node[i] at time, having
+ * moved from from[i], or GRID_NO_NODE if only the node matters.
+ */
+typedef struct conflict {
+    uint32_t agent[2];
+    grid_node node[2];
+    grid_node from[2];
+    uint32_t time;
+} conflict;
+
+/*
+ * return: The least capacity, from doubling `capacity`, of at least `needed`.
+ */
+static size_t grown( size_t capacity, size_t needed );
+
+/*
+ * Reallocate an array of 32-bit entries to a new number of entries.
+ * return: Non-zero if memory could not be allocated; the array is unchanged.
+ */
+static int resize( uint32_t ** array, size_t count );
+
+/*
+ * Empty a queue, and set the ratio of its bound to its least lower bound.
+ */
+static void queue_reset( cbs_queue * queue, double weight );
+
+/*
+ * Free the arrays of a queue.
+ */
+static void queue_free( cbs_queue * queue );
+
+/*
+ * Order items in the heap by key, then the latest added first.
+ * return: Non-zero if item a should be taken before item b.
+ */
+static int queue_before( const cbs_queue * queue, uint32_t a, uint32_t b );
+
+/*
+ * Add an item to the heap of a queue.
+ */
+static void queue_heap_push( cbs_queue * queue, uint32_t item );
+
+/*
+ * Raise the bound of a queue, moving the items waiting within it to the heap.
+ */
+static void queue_raise( cbs_queue * queue, uint32_t bound );
+
+/*
+ * Lower the bound of a queue, moving the items beyond it from the heap to
+ * wait.
+ */
+static void queue_lower( cbs_queue * queue, uint32_t bound );
+
+/*
+ * Add an item to a queue. The index must not be queued already.
+ * return: Non-zero if memory could not be allocated.
+ */
+static int queue_push( cbs_queue * queue, uint32_t item, uint32_t cost,
+                       uint32_t lower, uint64_t key );
+
+/*
+ * Remove the first item of a queue.
+ * return: The item, or CBS_NONE if the queue is empty.
+ */
+static uint32_t queue_pop( cbs_queue * queue );
+
+/*
+ * Free the arrays of a table.
+ */
+static void table_free( cbs_table * table );
+
+/*
+ * Make every entry of a table stale.
+ */
+static void table_clear( cbs_table * table );
+
+/*
+ * return: The slot holding a key, or the empty slot where it would be added.
+ */
+static size_t table_slot( const cbs_table * table, uint64_t key );
+
+/*
+ * Make room for a number of entries more than are in use.
+ * return: Non-zero if memory could not be allocated.
+ */
+static int table_reserve( cbs_table * table, size_t more );
+
+/*
+ * return: The key of a node at a step.
+ */
+static uint64_t table_key( const cbs_planner * planner, grid_node node,
+                           uint32_t time );
+
+/*
+ * Find the steps from every node to a robot's goal, by breadth-first search.
+ */
+static void search_distances( cbs_planner * planner, uint32_t agent );
+
+/*
+ * Make each robot's path that of a tree node.
+ */
+static void load_paths( cbs_planner * planner, uint32_t treeNode );
+
+/*
+ * return: The node of a robot at a step of its loaded path.
+ */
+static grid_node position( const cbs_planner * planner, uint32_t agent,
+                           uint32_t time );
+
+/*
+ * Count the conflicts between the loaded paths.
+ * out: first - The earliest conflict, if any.
+ */
+static uint32_t find_conflicts( cbs_planner * planner, conflict * first );
+
+/*
+ * return: The number of conflicts with other robots' loaded paths of a move
+ * from one node to another between a step and the next.
+ */
+static uint32_t move_conflicts( const cbs_planner * planner, grid_node from,
+                                grid_node to, uint32_t time );
+
+/*
+ * return: Non-zero if the constraints of the robot being planned forbid a
+ * move from one node to another arriving at a step.
+ */
+static int forbidden( const cbs_planner * planner, grid_node from,
+                      grid_node to, uint32_t time );
+
+/*
+ * Find a path for a robot under the constraints of a tree node and its
+ * ancestors, avoiding the other robots' loaded paths where possible, and
+ * store it at the end of planner->paths.
+ * in: lower - Lower bound of the cost of the robot's path in the parent node.
+ * return: PLAN_SUCCESS (and sets the path and lower bound of the tree node),
+ * PLAN_NO_PATH, or PLAN_OTHER_ERROR if memory could not be allocated.
+ */
+static plan_error plan_agent( cbs_planner * planner, uint32_t agent,
+                              uint32_t treeNode, uint32_t lower );
+
+/*
+ * Add a node to the constraint tree.
+ * return: The node, or CBS_NONE if memory could not be allocated.
+ */
+static uint32_t add_tree_node( cbs_planner * planner, uint32_t parent,
+                               uint32_t agent );
+
+static size_t grown( size_t capacity, size_t needed ) {
+    if ( capacity < INITIAL_CAPACITY )
+        capacity = INITIAL_CAPACITY;
+    while ( capacity < needed )
+        capacity *= 2;
+    return capacity;
+}
+
+static int resize( uint32_t ** array, size_t count ) {
+    uint32_t * resized = (uint32_t *) realloc( *array,
+                                               count * sizeof ( uint32_t ) );
+    if ( resized == NULL )
+        return 1;
+    *array = resized;
+    return 0;
+}
+
+static void queue_reset( cbs_queue * queue, double weight ) {
+    size_t i;
+    for ( i = 0; i < queue->costCapacity && i <= queue->maxCost; i++ ) {
+        queue->waiting[i] = CBS_NONE;
+        queue->lowerCount[i] = 0;
+    }
+    queue->heapCount = 0;
+    queue->count = 0;
+    queue->minLower = 0;
+    queue->bound = 0;
+    queue->maxCost = 0;
+    queue->weight = weight;
+}
+
+static void queue_free( cbs_queue * queue ) {
+    free( queue->cost );
+    free( queue->lower );
+    free( queue->key );
+    free( queue->next );
+    free( queue->heap );
+    free( queue->waiting );
+    free( queue->lowerCount );
+    memset( queue, 0, sizeof ( cbs_queue ) );
+}
+
+static int queue_before( const cbs_queue * queue, uint32_t a, uint32_t b ) {
+    if ( queue->key[a] != queue->key[b] )
+        return queue->key[a] < queue->key[b];
+    return a > b;
+}
+
+static void queue_heap_push( cbs_queue * queue, uint32_t item ) {
+    size_t position = queue->heapCount++;
+    while ( position > 0 ) {
+        size_t up = ( position - 1 ) / 2;
+        if ( ! queue_before( queue, item, queue->heap[up] ) )
+            break;
+        queue->heap[position] = queue->heap[up];
+        position = up;
+    }
+    queue->heap[position] = item;
+}
+
+static void queue_raise( cbs_queue * queue, uint32_t bound ) {
+    uint32_t cost;
+    for ( cost = queue->bound + 1; cost <= bound && cost <= queue->maxCost;
+          cost++ ) {
+        uint32_t item = queue->waiting[cost];
+        while ( item != CBS_NONE ) {
+            uint32_t next = queue->next[item];
+            queue_heap_push( queue, item );
+            item = next;
+        }
+        queue->waiting[cost] = CBS_NONE;
+    }
+    queue->bound = bound;
+}
+
+static void queue_lower( cbs_queue * queue, uint32_t bound ) {
+    size_t count = queue->heapCount;
+    queue->heapCount = 0;
+    size_t i;
+    for ( i = 0; i < count; i++ ) {
+        uint32_t item = queue->heap[i];
+        uint32_t cost = queue->cost[item];
+        if ( cost <= bound ) {
+            queue_heap_push( queue, item );
+        } else {
+            queue->next[item] = queue->waiting[cost];
+            queue->waiting[cost] = item;
+        }
+    }
+    queue->bound = bound;
+}
+
+static int queue_push( cbs_queue * queue, uint32_t item, uint32_t cost,
+                       uint32_t lower, uint64_t key ) {
+    if ( item >= queue->capacity ) {
+        size_t capacity = grown( queue->capacity, (size_t) item + 1 );
+        if ( resize( &queue->cost, capacity ) ||
+             resize( &queue->lower, capacity ) ||
+             resize( &queue->next, capacity ) )
+            return 1;
+        uint64_t * keys = (uint64_t *) realloc( queue->key,
+                                                capacity *
+                                                sizeof ( uint64_t ) );
+        if ( keys == NULL )
+            return 1;
+        queue->key = keys;
+        queue->capacity = capacity;
+    }
+    if ( queue->count >= queue->heapCapacity ) {
+        size_t capacity = grown( queue->heapCapacity, queue->count + 1 );
+        if ( resize( &queue->heap, capacity ) )
+            return 1;
+        queue->heapCapacity = capacity;
+    }
+    uint32_t largest = ( cost > lower ? cost : lower );
+    if ( largest >= queue->costCapacity ) {
+        size_t capacity = grown( queue->costCapacity, (size_t) largest + 1 );
+        if ( resize( &queue->waiting, capacity ) ||
+             resize( &queue->lowerCount, capacity ) )
+            return 1;
+        size_t i;
+        for ( i = queue->costCapacity; i < capacity; i++ ) {
+            queue->waiting[i] = CBS_NONE;
+            queue->lowerCount[i] = 0;
+        }
+        queue->costCapacity = capacity;
+    }
+    if ( largest > queue->maxCost )
+        queue->maxCost = largest;
+
+    queue->cost[item] = cost;
+    queue->lower[item] = lower;
+    queue->key[item] = key;
+    if ( queue->count == 0 || lower < queue->minLower ) {
+        queue->minLower = lower;
+        uint32_t bound = (uint32_t) ( queue->weight * lower + 1e-9 );
+        if ( queue->count == 0 )
+            queue->bound = bound;
+        else if ( bound < queue->bound )
+            queue_lower( queue, bound );
+    }
+    queue->lowerCount[lower]++;
+    queue->count++;
+    if ( cost <= queue->bound ) {
+        queue_heap_push( queue, item );
+    } else {
+        queue->next[item] = queue->waiting[cost];
+        queue->waiting[cost] = item;
+    }
+    return 0;
+}
+
+static uint32_t queue_pop( cbs_queue * queue ) {
+    if ( queue->count == 0 )
+        return CBS_NONE;
+    if ( queue->heapCount == 0 ) {
+        // Every item queued costs more than the bound, so raise it to the
+        // least cost.
+        uint32_t cost = queue->bound + 1;
+        while ( queue->waiting[cost] == CBS_NONE )
+            cost++;
+        queue_raise( queue, cost );
+    }
+
+    uint32_t item = queue->heap[0];
+    uint32_t last = queue->heap[--queue->heapCount];
+    size_t position = 0;
+    for ( ;; ) {
+        size_t down = 2 * position + 1;
+        if ( down >= queue->heapCount )
+            break;
+        if ( down + 1 < queue->heapCount &&
+             queue_before( queue, queue->heap[down + 1], queue->heap[down] ) )
+            down++;
+        if ( ! queue_before( queue, queue->heap[down], last ) )
+            break;
+        queue->heap[position] = queue->heap[down];
+        position = down;
+    }
+    if ( queue->heapCount > 0 )
+        queue->heap[position] = last;
+
+    queue->lowerCount[queue->lower[item]]--;
+    queue->count--;
+    if ( queue->count > 0 ) {
+        while ( queue->lowerCount[queue->minLower] == 0 )
+            queue->minLower++;
+        uint32_t bound = (uint32_t) ( queue->weight * queue->minLower + 1e-9 );
+        if ( bound > queue->bound )
+            queue_raise( queue, bound );
+    }
+    return item;
+}
+
+static void table_free( cbs_table * table ) {
+    free( table->key );
+    free( table->value );
+    free( table->count );
+    free( table->use );
+    memset( table, 0, sizeof ( cbs_table ) );
+}
+
+static void table_clear( cbs_table * table ) {
+    table->used = 0;
+    table->current++;
+    if ( table->current == 0 ) {
+        // The counter wrapped, so old numbers could be mistaken for current.
+        memset( table->use, 0, table->size * sizeof ( uint32_t ) );
+        table->current = 1;
+    }
+}
+
+static size_t table_slot( const cbs_table * table, uint64_t key ) {
+    size_t mask = table->size - 1;
+    size_t slot = (size_t) ( ( key * 0x9e3779b97f4a7c15ULL ) >> 32 ) & mask;
+    while ( table->use[slot] == table->current && table->key[slot] != key )
+        slot = ( slot + 1 ) & mask;
+    return slot;
+}
+
+static int table_reserve( cbs_table * table, size_t more ) {
+    // Keep the table at most half full, so that probes stay short.
+    if ( 2 * ( table->used + more ) <= table->size )
+        return 0;
+
+    size_t size = grown( table->size, 2 * ( table->used + more ) );
+    cbs_table larger;
+    larger.size = size;
+    larger.key = (uint64_t *) malloc( size * sizeof ( uint64_t ) );
+    larger.value = (uint32_t *) malloc( size * sizeof ( uint32_t ) );
+    larger.count = (uint32_t *) malloc( size * sizeof ( uint32_t ) );
+    larger.use = (uint32_t *) calloc( size, sizeof ( uint32_t ) );
+    larger.current = 1;
+    larger.used = table->used;
+    if ( larger.key == NULL || larger.value == NULL || larger.count == NULL ||
+         larger.use == NULL ) {
+        table_free( &larger );
+        return 1;
+    }
+    size_t i;
+    for ( i = 0; i < table->size; i++ ) {
+        if ( table->use[i] != table->current )
+            continue;
+        size_t slot = table_slot( &larger, table->key[i] );
+        larger.key[slot] = table->key[i];
+        larger.value[slot] = table->value[i];
+        larger.count[slot] = table->count[i];
+        larger.use[slot] = larger.current;
+    }
+    table_free( table );
+    *table = larger;
+    return 0;
+}
+
+static uint64_t table_key( const cbs_planner * planner, grid_node node,
+                           uint32_t time ) {
+    return (uint64_t) time * planner->nodeCount + node;
+}
+
+static void search_distances( cbs_planner * planner, uint32_t agent ) {
+    const grid_map * map = planner->map;
+    uint32_t * distance = planner->distance + agent * planner->nodeCount;
+    memset( distance, 0xff, planner->nodeCount * sizeof ( uint32_t ) );
+    grid_node goal = planner->goals[agent];
+    distance[goal] = 0;
+    planner->frontier[0] = goal;
+    size_t first = 0;
+    size_t last = 1;
+    grid_node neighbours[4];
+    while ( first < last ) {
+        grid_node node = planner->frontier[first++];
+        size_t n = grid_neighbours( map, node, neighbours );
+        size_t i;
+        for ( i = 0; i < n; i++ ) {
+            if ( distance[neighbours[i]] == UNREACHABLE ) {
+                distance[neighbours[i]] = distance[node] + 1;
+                planner->frontier[last++] = neighbours[i];
+            }
+        }
+    }
+}
+
+static void load_paths( cbs_planner * planner, uint32_t treeNode ) {
+    planner->loadCount++;
+    if ( planner->loadCount == 0 ) {
+        // The counter wrapped, so old numbers could be mistaken for current.
+        memset( planner->loaded, 0,
+                planner->agentCapacity * sizeof ( uint32_t ) );
+        planner->loadCount = 1;
+    }
+    // The newest path of each robot is the nearest on the way to the root.
+    uint32_t left = planner->agentCount;
+    uint32_t n;
+    for ( n = treeNode; n != CBS_NONE && left > 0;
+          n = planner->tree[n].parent ) {
+        const cbs_tree_node * node = &planner->tree[n];
+        if ( planner->loaded[node->agent] == planner->loadCount )
+            continue;
+        planner->loaded[node->agent] = planner->loadCount;
+        planner->pathStart[node->agent] = node->pathStart;
+        planner->pathLength[node->agent] = node->pathLength;
+        planner->lower[node->agent] = node->lower;
+        left--;
+    }
+}
+
+static grid_node position( const cbs_planner * planner, uint32_t agent,
+                           uint32_t time ) {
+    uint32_t length = planner->pathLength[agent];
+    return planner->paths[planner->pathStart[agent] +
+                          ( time < length ? time : length - 1 )];
+}
+
+static uint32_t find_conflicts( cbs_planner * planner, conflict * first ) {
+    uint32_t agents = planner->agentCount;
+    uint32_t steps = 0;
+    uint32_t a;
+    for ( a = 0; a < agents; a++ ) {
+        if ( planner->pathLength[a] > steps )
+            steps = planner->pathLength[a];
+    }
+
+    // After the longest path every robot stays at its own goal, so only the
+    // steps before need checking.
+    uint32_t count = 0;
+    first->time = CBS_NONE;
+    uint32_t time;
+    for ( time = 0; time < steps; time++ ) {
+        planner->occupiedCount++;
+        if ( planner->occupiedCount == 0 ) {
+            memset( planner->occupied, 0,
+                    planner->nodeCount * sizeof ( uint32_t ) );
+            planner->occupiedCount = 1;
+        }
+        uint32_t current = planner->occupiedCount;
+        for ( a = 0; a < agents; a++ ) {
+            grid_node node = position( planner, a, time );
+            if ( planner->occupied[node] != current ) {
+                planner->occupied[node] = current;
+                planner->occupant[node] = a;
+                continue;
+            }
+            if ( count++ == 0 ) {
+                first->agent[0] = planner->occupant[node];
+                first->agent[1] = a;
+                first->node[0] = first->node[1] = node;
+                first->from[0] = first->from[1] = GRID_NO_NODE;
+                first->time = time;
+            }
+        }
+        if ( time == 0 )
+            continue;
+        // Robots that swapped nodes since the step before.
+        for ( a = 0; a < agents; a++ ) {
+            grid_node from = position( planner, a, time - 1 );
+            grid_node to = position( planner, a, time );
+            if ( from == to || planner->occupied[from] != current )
+                continue;
+            uint32_t b = planner->occupant[from];
+            if ( b <= a || position( planner, b, time - 1 ) != to )
+                continue;
+            if ( count++ == 0 ) {
+                first->agent[0] = a;
+                first->agent[1] = b;
+                first->node[0] = to;
+                first->node[1] = from;
+                first->from[0] = from;
+                first->from[1] = to;
+                first->time = time;
+            }
+        }
+    }
+    return count;
+}
+
+static uint32_t move_conflicts( const cbs_planner * planner, grid_node from,
+                                grid_node to, uint32_t time ) {
+    const cbs_table * reserved = &planner->reserved;
+    uint32_t count = 0;
+    size_t slot = table_slot( reserved, table_key( planner, to, time + 1 ) );
+    if ( reserved->use[slot] == reserved->current )
+        count += reserved->count[slot];
+    if ( planner->parkTime[to] <= time + 1 )
+        count++;
+    if ( from != to ) {
+        slot = table_slot( reserved, table_key( planner, to, time ) );
+        if ( reserved->use[slot] == reserved->current &&
+             position( planner, reserved->value[slot], time + 1 ) == from )
+            count++;
+    }
+    return count;
+}
+
+static int forbidden( const cbs_planner * planner, grid_node from,
+                      grid_node to, uint32_t time ) {
+    size_t i;
+    for ( i = 0; i < planner->constraintCount; i++ ) {
+        const cbs_tree_node * node = &planner->tree[planner->constraints[i]];
+        if ( node->time == time && node->node == to &&
+             ( node->from == GRID_NO_NODE || node->from == from ) )
+            return 1;
+    }
+    return 0;
+}
+
+static plan_error plan_agent( cbs_planner * planner, uint32_t agent,
+                              uint32_t treeNode, uint32_t lower ) {
+    grid_node goal = planner->goals[agent];
+    const uint32_t * distance = planner->distance +
+                                agent * planner->nodeCount;
+    planner->searches++;
+
+    // The robot may not arrive at its goal to stay before a step it is kept
+    // out of it.
+    planner->constraintCount = 0;
+    uint32_t arrival = 0;
+    uint32_t latest = 0;
+    uint32_t n;
+    for ( n = treeNode; n != CBS_NONE; n = planner->tree[n].parent ) {
+        const cbs_tree_node * node = &planner->tree[n];
+        if ( node->agent != agent || node->node == GRID_NO_NODE )
+            continue;
+        if ( planner->constraintCount >= planner->constraintCapacity ) {
+            size_t capacity = grown( planner->constraintCapacity,
+                                     planner->constraintCount + 1 );
+            if ( resize( &planner->constraints, capacity ) )
+                return PLAN_OTHER_ERROR;
+            planner->constraintCapacity = capacity;
+        }
+        planner->constraints[planner->constraintCount++] = n;
+    }
+    size_t i;
+    for ( i = 0; i < planner->constraintCount; i++ ) {
+        const cbs_tree_node * node = &planner->tree[planner->constraints[i]];
+        if ( node->time > latest )
+            latest = node->time;
+        if ( node->from == GRID_NO_NODE && node->node == goal &&
+             node->time >= arrival )
+            arrival = node->time + 1;
+    }
+    // After its last constraint, the robot can reach its goal in fewer steps
+    // than there are nodes, so no later state need be searched.
+    uint64_t horizon = (uint64_t) latest + planner->nodeCount;
+    if ( horizon >= UINT32_MAX )
+        horizon = UINT32_MAX - 1;
+
+    // Reserve the nodes of the other robots' paths.
+    cbs_table * reserved = &planner->reserved;
+    table_clear( reserved );
+    uint32_t b;
+    for ( b = 0; b < planner->agentCount; b++ ) {
+        uint32_t length = planner->pathLength[b];
+        if ( b == agent || length == 0 )
+            continue;
+        if ( table_reserve( reserved, length ) )
+            return PLAN_OTHER_ERROR;
+        uint32_t time;
+        for ( time = 0; time + 1 < length; time++ ) {
+            grid_node node = planner->paths[planner->pathStart[b] + time];
+            size_t slot = table_slot( reserved,
+                                      table_key( planner, node, time ) );
+            if ( reserved->use[slot] == reserved->current ) {
+                reserved->count[slot]++;
+                continue;
+            }
+            reserved->use[slot] = reserved->current;
+            reserved->key[slot] = table_key( planner, node, time );
+            reserved->value[slot] = b;
+            reserved->count[slot] = 1;
+            reserved->used++;
+        }
+        planner->parkTime[position( planner, b, length )] = length - 1;
+    }
+
+    cbs_table * visited = &planner->visited;
+    cbs_queue * open = &planner->open;
+    table_clear( visited );
+    queue_reset( open, planner->treeOpen.weight );
+    planner->stateCount = 0;
+    plan_error result = PLAN_NO_PATH;
+    grid_node start = position( planner, agent, 0 );
+    uint32_t found = CBS_NONE;
+    uint32_t bound = 0;
+
+    if ( planner->stateCapacity == 0 ) {
+        planner->states = (cbs_state *) malloc( INITIAL_CAPACITY *
+                                                sizeof ( cbs_state ) );
+        if ( planner->states == NULL ) {
+            result = PLAN_OTHER_ERROR;
+            goto done;
+        }
+        planner->stateCapacity = INITIAL_CAPACITY;
+    }
+    if ( table_reserve( visited, 1 ) ||
+         queue_push( open, 0, distance[start], distance[start], 0 ) ) {
+        result = PLAN_OTHER_ERROR;
+        goto done;
+    }
+    planner->states[0].node = start;
+    planner->states[0].time = 0;
+    planner->states[0].parent = CBS_NONE;
+    planner->states[0].conflicts = 0;
+    planner->stateCount = 1;
+    size_t slot = table_slot( visited, table_key( planner, start, 0 ) );
+    visited->use[slot] = visited->current;
+    visited->key[slot] = table_key( planner, start, 0 );
+    visited->value[slot] = 0;
+    visited->used++;
+
+    grid_node neighbours[5];
+    for ( ;; ) {
+        uint32_t least = open->minLower;
+        uint32_t s = queue_pop( open );
+        if ( s == CBS_NONE )
+            break;
+        cbs_state state = planner->states[s];
+        if ( state.node == goal && state.time >= arrival ) {
+            found = s;
+            bound = least;
+            break;
+        }
+        if ( state.time >= horizon )
+            continue;
+
+        size_t count = grid_neighbours( planner->map, state.node,
+                                        neighbours );
+        neighbours[count++] = state.node;
+        uint32_t time = state.time + 1;
+        size_t k;
+        for ( k = 0; k < count; k++ ) {
+            grid_node next = neighbours[k];
+            if ( forbidden( planner, state.node, next, time ) )
+                continue;
+            uint64_t key = table_key( planner, next, time );
+            if ( table_reserve( visited, 1 ) ) {
+                result = PLAN_OTHER_ERROR;
+                goto done;
+            }
+            slot = table_slot( visited, key );
+            if ( visited->use[slot] == visited->current )
+                continue;
+
+            if ( planner->stateCount >= planner->stateCapacity ) {
+                size_t capacity = grown( planner->stateCapacity,
+                                         planner->stateCount + 1 );
+                cbs_state * states = (cbs_state *) realloc(
+                    planner->states, capacity * sizeof ( cbs_state ) );
+                if ( states == NULL ) {
+                    result = PLAN_OTHER_ERROR;
+                    goto done;
+                }
+                planner->states = states;
+                planner->stateCapacity = capacity;
+            }
+            uint32_t index = (uint32_t) planner->stateCount++;
+            cbs_state * added = &planner->states[index];
+            added->node = next;
+            added->time = time;
+            added->parent = s;
+            added->conflicts = state.conflicts +
+                               move_conflicts( planner, state.node, next,
+                                               state.time );
+            visited->use[slot] = visited->current;
+            visited->key[slot] = key;
+            visited->value[slot] = index;
+            visited->used++;
+
+            // Among states within the bound, take those with the fewest
+            // conflicts, then the least cost.
+            uint32_t cost = time + distance[next];
+            if ( queue_push( open, index, cost, cost,
+                             (uint64_t) added->conflicts << 32 | cost ) ) {
+                result = PLAN_OTHER_ERROR;
+                goto done;
+            }
+        }
+    }
+    if ( found == CBS_NONE )
+        goto done;
+
+    uint32_t length = planner->states[found].time + 1;
+    if ( planner->pathCount + length > planner->pathCapacity ) {
+        size_t capacity = grown( planner->pathCapacity,
+                                 planner->pathCount + length );
+        grid_node * paths = (grid_node *) realloc(
+            planner->paths, capacity * sizeof ( grid_node ) );
+        if ( paths == NULL ) {
+            result = PLAN_OTHER_ERROR;
+            goto done;
+        }
+        planner->paths = paths;
+        planner->pathCapacity = capacity;
+    }
+    cbs_tree_node * node = &planner->tree[treeNode];
+    node->pathStart = (uint32_t) planner->pathCount;
+    node->pathLength = length;
+    node->lower = ( bound > lower ? bound : lower );
+    planner->pathCount += length;
+    uint32_t s;
+    for ( s = found; s != CBS_NONE; s = planner->states[s].parent )
+        planner->paths[node->pathStart + planner->states[s].time] =
+            planner->states[s].node;
+    result = PLAN_SUCCESS;
+
+done:
+    for ( b = 0; b < planner->agentCount; b++ ) {
+        if ( b != agent && planner->pathLength[b] > 0 )
+            planner->parkTime[position( planner, b,
+                                        planner->pathLength[b] )] =
+                UINT32_MAX;
+    }
+    return result;
+}
+
+static uint32_t add_tree_node( cbs_planner * planner, uint32_t parent,
+                               uint32_t agent ) {
+    if ( planner->treeCount >= planner->treeCapacity ) {
+        size_t capacity = grown( planner->treeCapacity,
+                                 planner->treeCount + 1 );
+        cbs_tree_node * tree = (cbs_tree_node *) realloc(
+            planner->tree, capacity * sizeof ( cbs_tree_node ) );
+        if ( tree == NULL )
+            return CBS_NONE;
+        planner->tree = tree;
+        planner->treeCapacity = capacity;
+    }
+    uint32_t index = (uint32_t) planner->treeCount++;
+    cbs_tree_node * node = &planner->tree[index];
+    node->parent = parent;
+    node->agent = agent;
+    node->node = GRID_NO_NODE;
+    node->from = GRID_NO_NODE;
+    node->time = 0;
+    node->pathStart = 0;
+    node->pathLength = 0;
+    node->lower = 0;
+    node->cost = 0;
+    node->lowerBound = 0;
+    node->conflicts = 0;
+    return index;
+}
+
+plan_error init_cbs( cbs_planner * planner, const grid_map * map,
+                     uint32_t agentCapacity ) {
+    memset( planner, 0, sizeof ( cbs_planner ) );
+    size_t nodes = grid_node_count( map );
+    if ( agentCapacity == 0 || agentCapacity >= CBS_NONE ||
+         nodes >= UINT32_MAX / 2 )
+        return PLAN_ILLEGAL_ARG;
+
+    size_t agents = agentCapacity;
+    planner->distance = (uint32_t *) malloc( agents * nodes *
+                                             sizeof ( uint32_t ) );
+    planner->frontier = (grid_node *) malloc( nodes * sizeof ( grid_node ) );
+    planner->pathStart = (uint32_t *) malloc( agents * sizeof ( uint32_t ) );
+    planner->pathLength = (uint32_t *) malloc( agents * sizeof ( uint32_t ) );
+    planner->lower = (uint32_t *) malloc( agents * sizeof ( uint32_t ) );
+    planner->loaded = (uint32_t *) calloc( agents, sizeof ( uint32_t ) );
+    planner->occupant = (uint32_t *) malloc( nodes * sizeof ( uint32_t ) );
+    planner->occupied = (uint32_t *) calloc( nodes, sizeof ( uint32_t ) );
+    planner->parkTime = (uint32_t *) malloc( nodes * sizeof ( uint32_t ) );
+    if ( planner->distance == NULL || planner->frontier == NULL ||
+         planner->pathStart == NULL || planner->pathLength == NULL ||
+         planner->lower == NULL || planner->loaded == NULL ||
+         planner->occupant == NULL || planner->occupied == NULL ||
+         planner->parkTime == NULL ||
+         table_reserve( &planner->visited, INITIAL_CAPACITY ) ||
+         table_reserve( &planner->reserved, INITIAL_CAPACITY ) ) {
+        free_cbs( planner );
+        return PLAN_OTHER_ERROR;
+    }
+    memset( planner->parkTime, 0xff, nodes * sizeof ( uint32_t ) );
+    planner->map = map;
+    planner->nodeCount = nodes;
+    planner->agentCapacity = agentCapacity;
+    return PLAN_SUCCESS;
+}
+
+void free_cbs( cbs_planner * planner ) {
+    free( planner->distance );
+    free( planner->frontier );
+    free( planner->pathStart );
+    free( planner->pathLength );
+    free( planner->lower );
+    free( planner->loaded );
+    free( planner->occupant );
+    free( planner->occupied );
+    free( planner->parkTime );
+    free( planner->constraints );
+    free( planner->states );
+    table_free( &planner->visited );
+    table_free( &planner->reserved );
+    queue_free( &planner->open );
+    free( planner->tree );
+    queue_free( &planner->treeOpen );
+    free( planner->paths );
+    memset( planner, 0, sizeof ( cbs_planner ) );
+}
+
+plan_error cbs_find_paths( cbs_planner * planner, const grid_node * starts,
+                           const grid_node * goals, uint32_t agentCount,
+                           float weight, size_t maxExpansions ) {
+    planner->agentCount = 0;
+    planner->expanded = 0;
+    planner->searches = 0;
+    if ( agentCount == 0 || agentCount > planner->agentCapacity ||
+         ! ( weight >= 1.0f ) ||
+         grid_node_count( planner->map ) != planner->nodeCount )
+        return PLAN_ILLEGAL_ARG;
+
+    // Check that no two robots start or finish at the same node.
+    uint32_t a;
+    int pass;
+    for ( pass = 0; pass < 2; pass++ ) {
+        const grid_node * nodes = ( pass == 0 ? starts : goals );
+        planner->occupiedCount++;
+        if ( planner->occupiedCount == 0 ) {
+            memset( planner->occupied, 0,
+                    planner->nodeCount * sizeof ( uint32_t ) );
+            planner->occupiedCount = 1;
+        }
+        for ( a = 0; a < agentCount; a++ ) {
+            if ( grid_is_blocked( planner->map, nodes[a] ) ||
+                 planner->occupied[nodes[a]] == planner->occupiedCount )
+                return PLAN_ILLEGAL_ARG;
+            planner->occupied[nodes[a]] = planner->occupiedCount;
+        }
+    }
+
+    planner->goals = goals;
+    for ( a = 0; a < agentCount; a++ ) {
+        search_distances( planner, a );
+        if ( planner->distance[a * planner->nodeCount + starts[a]] ==
+             UNREACHABLE )
+            return PLAN_NO_PATH;
+    }
+
+    // The root is a chain of tree nodes, each planning one more robot, so
+    // that later robots avoid the paths of earlier ones.
+    planner->treeCount = 0;
+    planner->pathCount = 0;
+    queue_reset( &planner->treeOpen, weight );
+    planner->agentCount = agentCount;
+    uint32_t root = CBS_NONE;
+    uint32_t cost = 0;
+    uint32_t lowerBound = 0;
+    for ( a = 0; a < agentCount; a++ ) {
+        planner->pathStart[a] = (uint32_t) planner->pathCount;
+        planner->pathLength[a] = 0;
+    }
+    plan_error result = PLAN_SUCCESS;
+    for ( a = 0; a < agentCount && result == PLAN_SUCCESS; a++ ) {
+        root = add_tree_node( planner, root, a );
+        if ( root == CBS_NONE ) {
+            result = PLAN_OTHER_ERROR;
+            break;
+        }
+        // The path of a robot not yet planned is its start.
+        if ( planner->pathCount + 1 > planner->pathCapacity ) {
+            size_t capacity = grown( planner->pathCapacity,
+                                     planner->pathCount + 1 );
+            grid_node * paths = (grid_node *) realloc(
+                planner->paths, capacity * sizeof ( grid_node ) );
+            if ( paths == NULL ) {
+                result = PLAN_OTHER_ERROR;
+                break;
+            }
+            planner->paths = paths;
+            planner->pathCapacity = capacity;
+        }
+        planner->paths[planner->pathCount] = starts[a];
+        planner->pathStart[a] = (uint32_t) planner->pathCount++;
+        planner->pathLength[a] = 1;
+        result = plan_agent( planner, a, root, 0 );
+        if ( result == PLAN_SUCCESS ) {
+            const cbs_tree_node * node = &planner->tree[root];
+            planner->pathStart[a] = node->pathStart;
+            planner->pathLength[a] = node->pathLength;
+            planner->lower[a] = node->lower;
+            cost += node->pathLength - 1;
+            lowerBound += node->lower;
+        }
+    }
+    if ( result != PLAN_SUCCESS ) {
+        planner->agentCount = 0;
+        return result;
+    }
+    conflict first;
+    cbs_tree_node * node = &planner->tree[root];
+    node->cost = cost;
+    node->lowerBound = lowerBound;
+    node->conflicts = find_conflicts( planner, &first );
+    if ( queue_push( &planner->treeOpen, root, cost, lowerBound,
+                     (uint64_t) node->conflicts << 32 | cost ) ) {
+        planner->agentCount = 0;
+        return PLAN_OTHER_ERROR;
+    }
+
+    result = PLAN_NO_PATH;
+    while ( planner->expanded < maxExpansions ) {
+        uint32_t least = planner->treeOpen.minLower;
+        uint32_t parent = queue_pop( &planner->treeOpen );
+        if ( parent == CBS_NONE )
+            break;
+        load_paths( planner, parent );
+        if ( planner->tree[parent].conflicts == 0 ) {
+            planner->sumOfCosts = planner->tree[parent].cost;
+            planner->lowerBound = least;
+            return PLAN_SUCCESS;
+        }
+        planner->expanded++;
+        find_conflicts( planner, &first );
+
+        // Branch on which robot is kept out of the conflict.
+        int i;
+        for ( i = 0; i < 2; i++ ) {
+            a = first.agent[i];
+            size_t pathCount = planner->pathCount;
+            uint32_t child = add_tree_node( planner, parent, a );
+            if ( child == CBS_NONE ) {
+                result = PLAN_OTHER_ERROR;
+                break;
+            }
+            node = &planner->tree[child];
+            node->node = first.node[i];
+            node->from = first.from[i];
+            node->time = first.time;
+            plan_error planned = plan_agent( planner, a, child,
+                                             planner->lower[a] );
+            if ( planned == PLAN_NO_PATH ) {
+                planner->treeCount--;
+                planner->pathCount = pathCount;
+                continue;
+            } else if ( planned != PLAN_SUCCESS ) {
+                result = planned;
+                break;
+            }
+
+            uint32_t pathStart = planner->pathStart[a];
+            uint32_t pathLength = planner->pathLength[a];
+            uint32_t lower = planner->lower[a];
+            node = &planner->tree[child];
+            const cbs_tree_node * above = &planner->tree[parent];
+            node->cost = above->cost - ( pathLength - 1 ) +
+                         ( node->pathLength - 1 );
+            node->lowerBound = above->lowerBound - lower + node->lower;
+            planner->pathStart[a] = node->pathStart;
+            planner->pathLength[a] = node->pathLength;
+            planner->lower[a] = node->lower;
+            conflict ignored;
+            node->conflicts = find_conflicts( planner, &ignored );
+            planner->pathStart[a] = pathStart;
+            planner->pathLength[a] = pathLength;
+            planner->lower[a] = lower;
+            if ( queue_push( &planner->treeOpen, child, node->cost,
+                             node->lowerBound,
+                             (uint64_t) node->conflicts << 32 |
+                             node->cost ) ) {
+                result = PLAN_OTHER_ERROR;
+                break;
+            }
+        }
+        if ( result == PLAN_OTHER_ERROR )
+            break;
+    }
+    planner->agentCount = 0;
+    return result;
+}
+
+const grid_node * cbs_path( const cbs_planner * planner, uint32_t agent,
+                            size_t * count ) {
+    if ( agent >= planner->agentCount ) {
+        *count = 0;
+        return NULL;
+    }
+    *count = planner->pathLength[agent];
+    return planner->paths + planner->pathStart[agent];
+}
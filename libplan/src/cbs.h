@@ -0,0 +1,231 @@
+/*! \file
+ * \brief Conflict-Based Search over a `grid_map`, for planning the paths of a
+ * team of robots that share one grid, so that no two are ever at the same
+ * node, or swap nodes, at the same time.
+ *
+ * Time advances in steps: at each step a robot moves to a neighbouring node,
+ * or waits where it is. A robot stays at its goal once it has arrived, and
+ * the cost of its path is the step at which it arrives. The paths found are
+ * schedules indexed by time: the node of a robot at step `t` is entry `t` of
+ * its path, or the goal after the end of its path.
+ *
+ * Each robot is planned alone by A* over nodes and times, and the paths are
+ * then checked for conflicts. When two robots conflict, the search branches
+ * on which of them is kept out of the conflicting node at that time, and
+ * replans only that robot. The branches form a constraint tree, searched
+ * best first. A* prefers, among paths of equal cost, those with the fewest
+ * conflicts with the other robots' paths.
+ *
+ * With a `weight` of 1 the sum of the costs of the paths found is least
+ * (CBS). Larger teams conflict too often for that to finish quickly, and a
+ * weight above 1 trades optimality for speed (Enhanced CBS): both searches
+ * then pick, among the choices within `weight` times the best lower bound,
+ * the one with the fewest conflicts, and the sum of costs is at most `weight`
+ * times the least.
+ *
+ * The arrays of the planner grow as needed, and are kept between searches.
+ *
+ * Usage
+ * =====
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~{.c}
+ * cbs_planner planner;
+ * init_cbs( &planner, &map, robotCount );
+ * // Optimal paths if they are found quickly, else bounded-suboptimal ones.
+ * if ( cbs_find_paths( &planner, starts, goals, robotCount, 1.0f, 1000 ) )
+ *     cbs_find_paths( &planner, starts, goals, robotCount, 1.5f, 100000 );
+ * for ( robot = 0; robot < robotCount; robot++ ) {
+ *     path = cbs_path( &planner, robot, &count );
+ *     // At step t, robot is at path[t < count ? t : count - 1].
+ * }
+ * free_cbs( &planner );
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+#ifndef CBS_H
+#define CBS_H
+#include "plan_error.h"
+#include "grid_map.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+/*! \def CBS_NONE
+ * Index of no state, tree node or robot.
+ */
+#define CBS_NONE UINT32_MAX
+
+/*! \brief A state of the search for one robot's path: a node at a step.
+ */
+typedef struct cbs_state {
+    grid_node node; /*!< The node the robot is at. */
+    uint32_t time; /*!< The step, which is also the cost of reaching it. */
+    uint32_t parent; /*!< The state before, or `#CBS_NONE` at the start. */
+    uint32_t conflicts; /*!< Conflicts with other robots on the way to it. */
+} cbs_state;
+
+/*! \brief A node of the constraint tree: its parent's paths, with one robot
+ * replanned under one more constraint.
+ */
+typedef struct cbs_tree_node {
+    uint32_t parent; /*!< The node it branched from, or `#CBS_NONE`. */
+    uint32_t agent; /*!< The robot replanned. */
+    grid_node node; /*!< The robot may not be at this node at `time`, or
+                     * `GRID_NO_NODE` for the nodes at the root, which plan
+                     * each robot in turn without constraints. */
+    grid_node from; /*!< If not `GRID_NO_NODE`, the robot may instead not
+                     * move from this node to `node` arriving at `time`. */
+    uint32_t time; /*!< The step the constraint applies to. */
+    uint32_t pathStart; /*!< Offset of the new path in `paths`. */
+    uint32_t pathLength; /*!< Number of nodes in the new path. */
+    uint32_t lower; /*!< Lower bound of the cost of the robot's path. */
+    uint32_t cost; /*!< Sum of the costs of all the paths. */
+    uint32_t lowerBound; /*!< Sum of the lower bounds of all the paths. */
+    uint32_t conflicts; /*!< Number of conflicts between the paths. */
+} cbs_tree_node;
+
+/*! \brief Items of a search ordered best first, within a bound of the least
+ * lower bound (a focal list).
+ *
+ * Items with a cost of at most `weight` times the least lower bound of any
+ * item queued are in `heap`, ordered by key. The others wait in a list for
+ * their cost until the bound reaches it.
+ */
+typedef struct cbs_queue {
+    size_t capacity; /*!< Number of items the item arrays can hold. */
+    uint32_t * cost; /*!< Cost of each item. */
+    uint32_t * lower; /*!< Lower bound of each item. */
+    uint64_t * key; /*!< Order of each item in `heap`, least first. */
+    uint32_t * next; /*!< Next item waiting with the same cost. */
+    size_t heapCapacity; /*!< Number of items `heap` can hold. */
+    uint32_t * heap; /*!< Binary heap of the items within the bound. */
+    size_t heapCount; /*!< Number of items in `heap`. */
+    size_t costCapacity; /*!< Number of costs the cost arrays can hold. */
+    uint32_t * waiting; /*!< First item waiting with each cost. */
+    uint32_t * lowerCount; /*!< Number of items queued with each lower
+                            * bound. */
+    size_t count; /*!< Number of items queued. */
+    uint32_t minLower; /*!< Least lower bound of any item queued. */
+    uint32_t bound; /*!< Largest cost of the items in `heap`. */
+    uint32_t maxCost; /*!< Largest cost of any item waiting. */
+    double weight; /*!< Ratio of `bound` to `minLower`. */
+} cbs_queue;
+
+/*! \brief Table of the entries of a search keyed by node and step.
+ *
+ * Entries are recognised as stale by a number stored with each slot, so the
+ * table is cleared without writing to it.
+ */
+typedef struct cbs_table {
+    size_t size; /*!< Number of slots, a power of 2. */
+    uint64_t * key; /*!< Node and step of each slot. */
+    uint32_t * value; /*!< Value of each slot. */
+    uint32_t * count; /*!< Number of times each slot has been added to. */
+    uint32_t * use; /*!< `current` when each slot was last written. */
+    uint32_t current; /*!< Number of the current use of the table. */
+    size_t used; /*!< Number of slots in use. */
+} cbs_table;
+
+/*! \brief Reusable state for searches. Initialise with `init_cbs()`.
+ */
+typedef struct cbs_planner {
+    const grid_map * map; /*!< The grid being searched. */
+    size_t nodeCount; /*!< Number of nodes of the grid. */
+    uint32_t agentCapacity; /*!< Largest number of robots. */
+    uint32_t agentCount; /*!< Number of robots in the last search. */
+    const grid_node * goals; /*!< Goal of each robot in the current search. */
+    uint32_t * distance; /*!< Steps from each node to each robot's goal,
+                          * `nodeCount` entries per robot. */
+    grid_node * frontier; /*!< Queue of the breadth-first searches. */
+    uint32_t * pathStart; /*!< Offset in `paths` of each robot's path in the
+                           * tree node being expanded, or of its solution. */
+    uint32_t * pathLength; /*!< Number of nodes in each robot's path. */
+    uint32_t * lower; /*!< Lower bound of each robot's path cost. */
+    uint32_t * loaded; /*!< `loadCount` when each robot's path was loaded. */
+    uint32_t loadCount; /*!< Number of the current load of paths. */
+    uint32_t * occupant; /*!< Robot at each node at the step being checked. */
+    uint32_t * occupied; /*!< `occupiedCount` when `occupant` was written. */
+    uint32_t occupiedCount; /*!< Number of the step being checked. */
+    uint32_t * parkTime; /*!< Step from which a robot stays at each node. */
+    size_t constraintCapacity; /*!< Number of entries `constraints` holds. */
+    uint32_t * constraints; /*!< Tree nodes constraining the robot being
+                             * planned. */
+    size_t constraintCount; /*!< Number of entries in `constraints`. */
+    size_t stateCapacity; /*!< Number of states `states` can hold. */
+    cbs_state * states; /*!< States of the search for one robot's path. */
+    size_t stateCount; /*!< Number of states in `states`. */
+    cbs_table visited; /*!< State at each node and step. */
+    cbs_table reserved; /*!< Robot at each node and step, other than the one
+                         * being planned. */
+    cbs_queue open; /*!< States to expand. */
+    size_t treeCapacity; /*!< Number of nodes `tree` can hold. */
+    cbs_tree_node * tree; /*!< The constraint tree. */
+    size_t treeCount; /*!< Number of nodes in `tree`. */
+    cbs_queue treeOpen; /*!< Tree nodes to expand. */
+    size_t pathCapacity; /*!< Number of nodes `paths` can hold. */
+    grid_node * paths; /*!< Nodes of the paths of the tree nodes. */
+    size_t pathCount; /*!< Number of nodes in `paths`. */
+    uint32_t sumOfCosts; /*!< Sum of the costs of the paths last found. */
+    uint32_t lowerBound; /*!< Lower bound of the least sum of costs. */
+    size_t expanded; /*!< Tree nodes expanded by the last search. */
+    size_t searches; /*!< Paths planned by the last search. */
+} cbs_planner;
+
+/*! \brief Allocate the arrays of a planner for a grid.
+ *
+ * \param [out] planner The planner to initialise.
+ * \param [in] map The grid to search, which must outlive the planner. Changes
+ * to which nodes are blocked take effect in later searches.
+ * \param [in] agentCapacity The largest number of robots to plan for.
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS}
+ *
+ * \linkerror{PLAN_ILLEGAL_ARG} if `agentCapacity` is 0, or too large
+ *
+ * \linkerror{PLAN_OTHER_ERROR} if memory could not be allocated.
+ * \endparblock
+ */
+plan_error init_cbs( cbs_planner * planner, const grid_map * map,
+                     uint32_t agentCapacity );
+
+/*! \brief Free the arrays of a planner initialised with `init_cbs()`.
+ */
+void free_cbs( cbs_planner * planner );
+
+/*! \brief Find paths for a team of robots that do not conflict.
+ *
+ * \param [in] starts The node each robot starts at.
+ * \param [in] goals The node each robot is to reach.
+ * \param [in] agentCount The number of robots.
+ * \param [in] weight At least 1: the sum of costs found is at most `weight`
+ * times the least.
+ * \param [in] maxExpansions The largest number of tree nodes to expand before
+ * giving up.
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS} (and the paths can be read with `cbs_path()`)
+ *
+ * \linkerror{PLAN_ILLEGAL_ARG} if `agentCount` is 0 or more than the capacity
+ * of the planner, or `weight` is less than 1, or a start or goal is blocked
+ * or not in the grid, or two robots have the same start or the same goal
+ *
+ * \linkerror{PLAN_NO_PATH} if a robot cannot reach its goal, or no paths were
+ * found within `maxExpansions`
+ *
+ * \linkerror{PLAN_OTHER_ERROR} if memory could not be allocated.
+ * \endparblock
+ */
+plan_error cbs_find_paths( cbs_planner * planner, const grid_node * starts,
+                           const grid_node * goals, uint32_t agentCount,
+                           float weight, size_t maxExpansions );
+
+/*! \brief Get the path found for a robot by the last successful search.
+ *
+ * \param [in] agent The index of the robot.
+ * \param [out] count The number of nodes in the path, one more than its cost.
+ * \return The node of the robot at each step, from its start to its goal
+ * inclusive, valid until the next search. Convert them to waypoints with
+ * `grid_node_point()`.
+ */
+const grid_node * cbs_path( const cbs_planner * planner, uint32_t agent,
+                            size_t * count );
+
+#endif
@@ -0,0 +1,316 @@
+#include "dstar.h"
+#include <string.h>
+
+// Cost of a node from which the goal cannot be reached.
+#define UNREACHABLE UINT32_MAX
+// heapIndex of a node that is not in the heap.
+#define NOT_QUEUED UINT32_MAX
+
+/*
+ * Add a step to a cost, keeping UNREACHABLE costs unreachable.
+ */
+static uint32_t step_cost( uint32_t cost );
+
+/*
+ * The lesser of the cost and lookahead of a node: its secondary key.
+ */
+static uint32_t min_cost( dstar_planner * planner, grid_node node );
+
+/*
+ * Calculate the primary key a node should be queued with.
+ */
+static uint32_t calculate_key( dstar_planner * planner, grid_node node );
+
+/*
+ * Compare the keys of two queued nodes.
+ * return: Non-zero if node a should be expanded before node b.
+ */
+static int heap_before( dstar_planner * planner, grid_node a, grid_node b );
+
+/*
+ * Move the node at the given position of the heap until the heap is ordered.
+ */
+static void sift_up( dstar_planner * planner, size_t position );
+static void sift_down( dstar_planner * planner, size_t position );
+
+/*
+ * Remove the node at the given position of the heap.
+ */
+static void heap_remove( dstar_planner * planner, size_t position );
+
+/*
+ * Recalculate the lookahead of a node from its neighbours, and queue the node
+ * if it has become inconsistent, or dequeue it if it has become consistent.
+ */
+static void update_node( dstar_planner * planner, grid_node node );
+
+/*
+ * Update a node and each of its unblocked neighbours.
+ */
+static void update_around( dstar_planner * planner, grid_node node );
+
+/*
+ * Expand inconsistent nodes until the cost of the start is correct.
+ */
+static void compute_costs( dstar_planner * planner );
+
+static uint32_t step_cost( uint32_t cost ) {
+    return ( cost == UNREACHABLE ? UNREACHABLE : cost + 1 );
+}
+
+static uint32_t min_cost( dstar_planner * planner, grid_node node ) {
+    uint32_t cost = planner->cost[node];
+    uint32_t lookahead = planner->lookahead[node];
+    return ( cost < lookahead ? cost : lookahead );
+}
+
+static uint32_t calculate_key( dstar_planner * planner, grid_node node ) {
+    uint32_t cost = min_cost( planner, node );
+    if ( cost == UNREACHABLE )
+        return UNREACHABLE;
+    return cost + grid_distance( planner->map, planner->start, node ) +
+           planner->keyOffset;
+}
+
+static int heap_before( dstar_planner * planner, grid_node a, grid_node b ) {
+    if ( planner->key[a] != planner->key[b] )
+        return planner->key[a] < planner->key[b];
+    return min_cost( planner, a ) < min_cost( planner, b );
+}
+
+static void sift_up( dstar_planner * planner, size_t position ) {
+    grid_node node = planner->heap[position];
+    while ( position > 0 ) {
+        size_t up = ( position - 1 ) / 2;
+        grid_node above = planner->heap[up];
+        if ( ! heap_before( planner, node, above ) )
+            break;
+        planner->heap[position] = above;
+        planner->heapIndex[above] = position;
+        position = up;
+    }
+    planner->heap[position] = node;
+    planner->heapIndex[node] = position;
+}
+
+static void sift_down( dstar_planner * planner, size_t position ) {
+    grid_node node = planner->heap[position];
+    for ( ;; ) {
+        size_t down = 2 * position + 1;
+        if ( down >= planner->heapCount )
+            break;
+        if ( down + 1 < planner->heapCount &&
+             heap_before( planner, planner->heap[down + 1],
+                          planner->heap[down] ) )
+            down++;
+        grid_node below = planner->heap[down];
+        if ( ! heap_before( planner, below, node ) )
+            break;
+        planner->heap[position] = below;
+        planner->heapIndex[below] = position;
+        position = down;
+    }
+    planner->heap[position] = node;
+    planner->heapIndex[node] = position;
+}
+
+static void heap_remove( dstar_planner * planner, size_t position ) {
+    planner->heapIndex[planner->heap[position]] = NOT_QUEUED;
+    planner->heapCount--;
+    if ( position < planner->heapCount ) {
+        grid_node moved = planner->heap[planner->heapCount];
+        planner->heap[position] = moved;
+        sift_up( planner, position );
+        sift_down( planner, planner->heapIndex[moved] );
+    }
+}
+
+static void update_node( dstar_planner * planner, grid_node node ) {
+    if ( node != planner->goal ) {
+        uint32_t lookahead = UNREACHABLE;
+        if ( ! grid_is_blocked( planner->map, node ) ) {
+            grid_node neighbours[4];
+            size_t n = grid_neighbours( planner->map, node, neighbours );
+            size_t i;
+            for ( i = 0; i < n; i++ ) {
+                uint32_t cost = step_cost( planner->cost[neighbours[i]] );
+                if ( cost < lookahead )
+                    lookahead = cost;
+            }
+        }
+        planner->lookahead[node] = lookahead;
+    }
+
+    size_t position = planner->heapIndex[node];
+    if ( planner->cost[node] != planner->lookahead[node] ) {
+        planner->key[node] = calculate_key( planner, node );
+        if ( position == NOT_QUEUED ) {
+            position = planner->heapCount++;
+            planner->heap[position] = node;
+        }
+        sift_up( planner, position );
+        sift_down( planner, planner->heapIndex[node] );
+    } else if ( position != NOT_QUEUED ) {
+        heap_remove( planner, position );
+    }
+}
+
+static void update_around( dstar_planner * planner, grid_node node ) {
+    grid_node neighbours[4];
+    size_t n = grid_neighbours( planner->map, node, neighbours );
+    size_t i;
+    update_node( planner, node );
+    for ( i = 0; i < n; i++ )
+        update_node( planner, neighbours[i] );
+}
+
+static void compute_costs( dstar_planner * planner ) {
+    grid_node start = planner->start;
+    while ( planner->heapCount > 0 ) {
+        grid_node top = planner->heap[0];
+        uint32_t startKey = calculate_key( planner, start );
+        int beforeStart = planner->key[top] < startKey ||
+                          ( planner->key[top] == startKey &&
+                            min_cost( planner, top ) <
+                            min_cost( planner, start ) );
+        if ( ! beforeStart &&
+             planner->cost[start] == planner->lookahead[start] )
+            break;
+
+        uint32_t key = calculate_key( planner, top );
+        if ( planner->key[top] < key ) {
+            // Queued before the robot moved; requeue with the current key.
+            planner->key[top] = key;
+            sift_down( planner, 0 );
+            continue;
+        }
+
+        planner->expanded++;
+        if ( planner->cost[top] > planner->lookahead[top] ) {
+            planner->cost[top] = planner->lookahead[top];
+            heap_remove( planner, 0 );
+            grid_node neighbours[4];
+            size_t n = grid_neighbours( planner->map, top, neighbours );
+            size_t i;
+            for ( i = 0; i < n; i++ )
+                update_node( planner, neighbours[i] );
+        } else {
+            planner->cost[top] = UNREACHABLE;
+            update_around( planner, top );
+        }
+    }
+}
+
+plan_error init_dstar( dstar_planner * planner, grid_map * map ) {
+    memset( planner, 0, sizeof ( dstar_planner ) );
+    size_t capacity = grid_node_count( map );
+
+    planner->cost = (uint32_t *) malloc( capacity * sizeof ( uint32_t ) );
+    planner->lookahead = (uint32_t *) malloc( capacity * sizeof ( uint32_t ) );
+    planner->key = (uint32_t *) malloc( capacity * sizeof ( uint32_t ) );
+    planner->heapIndex = (uint32_t *) malloc( capacity * sizeof ( uint32_t ) );
+    planner->heap = (grid_node *) malloc( capacity * sizeof ( grid_node ) );
+    if ( planner->cost == NULL || planner->lookahead == NULL ||
+         planner->key == NULL || planner->heapIndex == NULL ||
+         planner->heap == NULL ) {
+        free_dstar( planner );
+        return PLAN_OTHER_ERROR;
+    }
+    planner->map = map;
+    planner->capacity = capacity;
+    planner->start = GRID_NO_NODE;
+    planner->goal = GRID_NO_NODE;
+    return PLAN_SUCCESS;
+}
+
+void free_dstar( dstar_planner * planner ) {
+    free( planner->cost );
+    free( planner->lookahead );
+    free( planner->key );
+    free( planner->heapIndex );
+    free( planner->heap );
+    memset( planner, 0, sizeof ( dstar_planner ) );
+}
+
+plan_error dstar_reset( dstar_planner * planner, grid_node start,
+                        grid_node goal ) {
+    if ( start >= planner->capacity || goal >= planner->capacity )
+        return PLAN_ILLEGAL_ARG;
+
+    size_t i;
+    for ( i = 0; i < planner->capacity; i++ ) {
+        planner->cost[i] = UNREACHABLE;
+        planner->lookahead[i] = UNREACHABLE;
+        planner->heapIndex[i] = NOT_QUEUED;
+    }
+    planner->heapCount = 0;
+    planner->start = start;
+    planner->lastStart = start;
+    planner->goal = goal;
+    planner->keyOffset = 0;
+    planner->expanded = 0;
+
+    planner->lookahead[goal] = 0;
+    update_node( planner, goal );
+    return PLAN_SUCCESS;
+}
+
+plan_error dstar_set_start( dstar_planner * planner, grid_node start ) {
+    if ( start >= planner->capacity )
+        return PLAN_ILLEGAL_ARG;
+    if ( start == planner->start )
+        return PLAN_NO_EFFECT;
+
+    // Queued keys now overestimate by at most this much, so are lower bounds.
+    planner->keyOffset += grid_distance( planner->map, planner->lastStart,
+                                         start );
+    planner->lastStart = start;
+    planner->start = start;
+    return PLAN_SUCCESS;
+}
+
+plan_error dstar_set_blocked( dstar_planner * planner, grid_node node,
+                              int blocked ) {
+    plan_error errorCode = grid_set_blocked( planner->map, node, blocked );
+    if ( errorCode == PLAN_SUCCESS && planner->goal != GRID_NO_NODE )
+        update_around( planner, node );
+    return errorCode;
+}
+
+plan_error dstar_find_path( dstar_planner * planner, grid_node * path,
+                            size_t maxCount, size_t * count ) {
+    *count = 0;
+    if ( planner->goal == GRID_NO_NODE ||
+         grid_is_blocked( planner->map, planner->start ) ||
+         grid_is_blocked( planner->map, planner->goal ) )
+        return PLAN_ILLEGAL_ARG;
+
+    planner->expanded = 0;
+    compute_costs( planner );
+    if ( planner->cost[planner->start] == UNREACHABLE )
+        return PLAN_NO_PATH;
+
+    *count = (size_t) planner->cost[planner->start] + 1;
+    if ( *count > maxCount )
+        return PLAN_ILLEGAL_ARG;
+
+    // Descend the costs from the start to the goal.
+    grid_node node = planner->start;
+    size_t i;
+    for ( i = 0; i < *count; i++ ) {
+        path[i] = node;
+        grid_node neighbours[4];
+        size_t n = grid_neighbours( planner->map, node, neighbours );
+        grid_node next = GRID_NO_NODE;
+        uint32_t best = UNREACHABLE;
+        size_t j;
+        for ( j = 0; j < n; j++ ) {
+            if ( planner->cost[neighbours[j]] < best ) {
+                best = planner->cost[neighbours[j]];
+                next = neighbours[j];
+            }
+        }
+        node = next;
+    }
+    return PLAN_SUCCESS;
+}
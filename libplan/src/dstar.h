@@ -0,0 +1,147 @@
+/*! \file
+ * \brief D* Lite search over a `grid_map`, for replanning incrementally as the
+ * robot discovers obstacles.
+ *
+ * A `dstar_planner` searches backwards from the goal, and keeps the costs it
+ * has found to the goal between searches. When a node is blocked or unblocked,
+ * only the costs that depend on it are repaired, and when the robot moves, the
+ * search is reused from its new position. After each obstacle detected by the
+ * robot this expands far fewer nodes than searching again from scratch with
+ * `astar_find_path()`.
+ *
+ * As with A*, each step between neighbouring nodes costs 1, the Manhattan
+ * distance is used as the heuristic, and the arrays of the planner are
+ * allocated once and reused.
+ *
+ * Usage
+ * =====
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~{.c}
+ * dstar_planner planner;
+ * init_dstar( &planner, &map );
+ * dstar_reset( &planner, start, goal );
+ * dstar_find_path( &planner, path, maxCount, &count );
+ *
+ * // When an obstacle is detected, as in Controller.featureDetected():
+ * dstar_set_start( &planner, robotLoc );
+ * dstar_set_blocked( &planner, obstacleLoc, 1 );
+ * dstar_find_path( &planner, path, maxCount, &count );
+ *
+ * free_dstar( &planner );
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+#ifndef DSTAR_H
+#define DSTAR_H
+#include "plan_error.h"
+#include "grid_map.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+/*! \brief Search state kept between replans. Initialise with `init_dstar()`.
+ */
+typedef struct dstar_planner {
+    grid_map * map; /*!< The grid being searched. */
+    size_t capacity; /*!< Number of nodes the arrays can hold. */
+    uint32_t * cost; /*!< Cost to the goal of each node, as last expanded. */
+    uint32_t * lookahead; /*!< One-step lookahead of `cost` (rhs). */
+    uint32_t * key; /*!< Primary key of each node in `heap`; the secondary
+                     * key is the lesser of `cost` and `lookahead`. */
+    uint32_t * heapIndex; /*!< Position of each node in `heap`. */
+    grid_node * heap; /*!< Binary heap of inconsistent nodes, by key. */
+    size_t heapCount; /*!< Number of nodes in `heap`. */
+    grid_node start; /*!< The node the robot is at. */
+    grid_node goal; /*!< The node the robot is heading to. */
+    grid_node lastStart; /*!< `start` when the keys were last adjusted. */
+    uint32_t keyOffset; /*!< Added to keys as the robot moves (km). */
+    size_t expanded; /*!< Nodes expanded by the last `dstar_find_path()`. */
+} dstar_planner;
+
+/*! \brief Allocate the arrays of a planner for a grid.
+ *
+ * Call `dstar_reset()` before searching.
+ * \param [out] planner The planner to initialise.
+ * \param [in] map The grid to search. Must remain valid until the planner is
+ * freed, and must only be changed through `dstar_set_blocked()`.
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS}
+ *
+ * \linkerror{PLAN_OTHER_ERROR} if memory could not be allocated.
+ * \endparblock
+ */
+plan_error init_dstar( dstar_planner * planner, grid_map * map );
+
+/*! \brief Free the arrays of a planner initialised with `init_dstar()`.
+ */
+void free_dstar( dstar_planner * planner );
+
+/*! \brief Discard all search state, and start planning between new nodes.
+ *
+ * Required whenever the goal changes, such as when the robot turns back to
+ * follow its plan in reverse.
+ * \param [in] start The node the robot is at.
+ * \param [in] goal The node to reach.
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS}
+ *
+ * \linkerror{PLAN_ILLEGAL_ARG} if `start` or `goal` is not in the grid.
+ * \endparblock
+ */
+plan_error dstar_reset( dstar_planner * planner, grid_node start,
+                        grid_node goal );
+
+/*! \brief Record that the robot has moved, keeping the search state.
+ *
+ * \param [in] start The node the robot is now at.
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS}
+ *
+ * \linkerror{PLAN_NO_EFFECT} if the robot is still at the same node
+ *
+ * \linkerror{PLAN_ILLEGAL_ARG} if `start` is not in the grid.
+ * \endparblock
+ */
+plan_error dstar_set_start( dstar_planner * planner, grid_node start );
+
+/*! \brief Block or unblock a node of the grid, and mark the costs that depend
+ * on it for repair.
+ *
+ * The repair itself is done by the next call to `dstar_find_path()`.
+ * \param [in] node A node of the grid.
+ * \param [in] blocked Boolean flag: non-zero to block the node.
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS}
+ *
+ * \linkerror{PLAN_NO_EFFECT} if the node was already in the requested state
+ *
+ * \linkerror{PLAN_ILLEGAL_ARG} if `node` is not in the grid.
+ * \endparblock
+ */
+plan_error dstar_set_blocked( dstar_planner * planner, grid_node node,
+                              int blocked );
+
+/*! \brief Repair the search state and get a shortest path from the start to
+ * the goal.
+ *
+ * Does not allocate memory.
+ * \param [out] path A buffer to store the nodes of the path, from the start to
+ * the goal inclusive.
+ * \param [in] maxCount Size of `path`.
+ * \param [out] count The number of nodes in the path, which may exceed
+ * `maxCount`.
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS} (and populates `path` and `count`)
+ *
+ * \linkerror{PLAN_ILLEGAL_ARG} if the start or goal is blocked, or `maxCount`
+ * is less than the length of the path (and populates `count`)
+ *
+ * \linkerror{PLAN_NO_PATH} if the goal cannot be reached from the start.
+ * \endparblock
+ */
+plan_error dstar_find_path( dstar_planner * planner, grid_node * path,
+                            size_t maxCount, size_t * count );
+
+#endif
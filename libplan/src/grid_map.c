@@ -0,0 +1,168 @@
+#include "grid_map.h"
+#include <math.h>
+
+// Number of node bits held by each word of the blocked array.
+#define WORD_BITS 64
+
+/*
+ * Round a position along an axis, in grid units, to the nearest node index.
+ * in: position - Distance from node 0, in multiples of the spacing.
+ * in: count - Number of nodes along the axis.
+ */
+static uint32_t nearest_index( float position, uint32_t count );
+
+static uint32_t nearest_index( float position, uint32_t count ) {
+    if ( ! ( position > 0.0f ) )
+        return 0;
+    if ( position >= (float) ( count - 1 ) )
+        return count - 1;
+    return (uint32_t) ( position + 0.5f );
+}
+
+plan_error init_grid_map( grid_map * map, uint32_t width, uint32_t height,
+                          float originX, float originY, float spacing ) {
+    map->blocked = NULL;
+    if ( width == 0 || height == 0 || ! ( spacing > 0.0f ) )
+        return PLAN_ILLEGAL_ARG;
+    if ( (uint64_t) width * height >= GRID_NO_NODE )
+        return PLAN_ILLEGAL_ARG;
+
+    size_t words = ( (size_t) width * height + WORD_BITS - 1 ) / WORD_BITS;
+    map->blocked = (uint64_t *) calloc( words, sizeof ( uint64_t ) );
+    if ( map->blocked == NULL )
+        return PLAN_OTHER_ERROR;
+
+    map->width = width;
+    map->height = height;
+    map->originX = originX;
+    map->originY = originY;
+    map->spacing = spacing;
+    return PLAN_SUCCESS;
+}
+
+plan_error square_grid_map( grid_map * map, uint32_t gridSize,
+                            float gridSquareSide ) {
+    return init_grid_map( map, gridSize, gridSize, gridSquareSide,
+                          gridSquareSide, gridSquareSide );
+}
+
+void free_grid_map( grid_map * map ) {
+    free( map->blocked );
+    map->blocked = NULL;
+}
+
+size_t grid_node_count( const grid_map * map ) {
+    return (size_t) map->width * map->height;
+}
+
+grid_node grid_node_at( const grid_map * map, uint32_t x, uint32_t y ) {
+    if ( x >= map->width || y >= map->height )
+        return GRID_NO_NODE;
+    return y * map->width + x;
+}
+
+void grid_node_point( const grid_map * map, grid_node node, float * x,
+                      float * y ) {
+    *x = map->originX + map->spacing * (float) ( node % map->width );
+    *y = map->originY + map->spacing * (float) ( node / map->width );
+}
+
+grid_node grid_cell_at( const grid_map * map, float x, float y ) {
+    float column = floorf( ( x - map->originX ) / map->spacing + 0.5f );
+    float row = floorf( ( y - map->originY ) / map->spacing + 0.5f );
+    if ( ! ( column >= 0.0f && column < (float) map->width &&
+             row >= 0.0f && row < (float) map->height ) )
+        return GRID_NO_NODE;
+    return (uint32_t) row * map->width + (uint32_t) column;
+}
+
+grid_node grid_nearest_node( const grid_map * map, float x, float y ) {
+    float fx = ( x - map->originX ) / map->spacing;
+    float fy = ( y - map->originY ) / map->spacing;
+    int64_t cx = nearest_index( fx, map->width );
+    int64_t cy = nearest_index( fy, map->height );
+    if ( ! grid_is_blocked( map, cy * map->width + cx ) )
+        return cy * map->width + cx;
+
+    // How far the point is from the centre of the search, in grid units.
+    float offset = fabsf( fx - (float) cx );
+    if ( fabsf( fy - (float) cy ) > offset )
+        offset = fabsf( fy - (float) cy );
+
+    grid_node nearest = GRID_NO_NODE;
+    float best = INFINITY;
+    int64_t limit = ( map->width > map->height ? map->width : map->height );
+    int64_t r;
+    for ( r = 1; r <= limit; r++ ) {
+        // Every node of this ring is at least this far from the point.
+        float bound = (float) r - offset;
+        if ( bound > 0.0f && bound * bound > best )
+            break;
+
+        int64_t dy;
+        for ( dy = -r; dy <= r; dy++ ) {
+            int64_t j = cy + dy;
+            if ( j < 0 || j >= map->height )
+                continue;
+            // Inside the ring, only its left and right edges are searched.
+            int64_t step = ( dy == -r || dy == r ? 1 : 2 * r );
+            int64_t dx;
+            for ( dx = -r; dx <= r; dx += step ) {
+                int64_t i = cx + dx;
+                if ( i < 0 || i >= map->width )
+                    continue;
+                grid_node node = j * map->width + i;
+                if ( grid_is_blocked( map, node ) )
+                    continue;
+                float ex = (float) i - fx;
+                float ey = (float) j - fy;
+                if ( ex * ex + ey * ey < best ) {
+                    best = ex * ex + ey * ey;
+                    nearest = node;
+                }
+            }
+        }
+    }
+    return nearest;
+}
+
+plan_error grid_set_blocked( grid_map * map, grid_node node, int blocked ) {
+    if ( node >= grid_node_count( map ) )
+        return PLAN_ILLEGAL_ARG;
+
+    uint64_t bit = (uint64_t) 1 << ( node % WORD_BITS );
+    uint64_t * word = map->blocked + node / WORD_BITS;
+    if ( ( ( *word & bit ) != 0 ) == ( blocked != 0 ) )
+        return PLAN_NO_EFFECT;
+    *word ^= bit;
+    return PLAN_SUCCESS;
+}
+
+int grid_is_blocked( const grid_map * map, grid_node node ) {
+    if ( node >= grid_node_count( map ) )
+        return 1;
+    return ( map->blocked[node / WORD_BITS] >> ( node % WORD_BITS ) ) & 1;
+}
+
+uint32_t grid_distance( const grid_map * map, grid_node from, grid_node to ) {
+    uint32_t fromX = from % map->width, fromY = from / map->width;
+    uint32_t toX = to % map->width, toY = to / map->width;
+    return ( fromX > toX ? fromX - toX : toX - fromX ) +
+           ( fromY > toY ? fromY - toY : toY - fromY );
+}
+
+size_t grid_neighbours( const grid_map * map, grid_node node,
+                        grid_node neighbours[4] ) {
+    size_t count = 0;
+    uint32_t x = node % map->width;
+    uint32_t y = node / map->width;
+    if ( x > 0 && ! grid_is_blocked( map, node - 1 ) )
+        neighbours[count++] = node - 1;
+    if ( x + 1 < map->width && ! grid_is_blocked( map, node + 1 ) )
+        neighbours[count++] = node + 1;
+    if ( y > 0 && ! grid_is_blocked( map, node - map->width ) )
+        neighbours[count++] = node - map->width;
+    if ( y + 1 < map->height && ! grid_is_blocked( map, node + map->width ) )
+        neighbours[count++] = node + map->width;
+    return count;
+}
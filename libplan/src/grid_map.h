@@ -0,0 +1,153 @@
+/*! \file
+ * \brief A dense, bit-packed occupancy grid equivalent to the lejos
+ * `FourWayGridMesh` used by the robot.
+ *
+ * Nodes lie at the centres of the squares of a regular grid, and each node is
+ * connected to the nodes above, below, left and right of it. Rather than
+ * removing a node from the mesh when an obstacle is found on it, as the robot
+ * does with `FourWayGridMesh.removeNode()`, the node is marked as blocked. One
+ * bit is stored per node, so that a grid of a million nodes takes 125 kB.
+ *
+ * Nodes are identified by a `grid_node` index in row-major order, which can
+ * be sent to the NXT in place of coordinates.
+ */
+#ifndef GRID_MAP_H
+#define GRID_MAP_H
+#include "plan_error.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+/*! \brief Index of a node in a `grid_map`: `y * width + x`.
+ */
+typedef uint32_t grid_node;
+
+/*! \def GRID_NO_NODE
+ * A `grid_node` that refers to no node.
+ */
+#define GRID_NO_NODE UINT32_MAX
+
+/*! \brief An occupancy grid. Initialise with `init_grid_map()`.
+ */
+typedef struct grid_map {
+    uint32_t width; /*!< Number of nodes along the x axis. */
+    uint32_t height; /*!< Number of nodes along the y axis. */
+    float originX; /*!< x coordinate of node (0, 0). */
+    float originY; /*!< y coordinate of node (0, 0). */
+    float spacing; /*!< Distance between neighbouring nodes. */
+    uint64_t * blocked; /*!< One bit per node, set if the node is blocked. */
+} grid_map;
+
+/*! \brief Allocate a grid with every node unblocked.
+ *
+ * \param [out] map The grid to initialise.
+ * \param [in] width Number of nodes along the x axis.
+ * \param [in] height Number of nodes along the y axis.
+ * \param [in] originX x coordinate of node (0, 0).
+ * \param [in] originY y coordinate of node (0, 0).
+ * \param [in] spacing Distance between neighbouring nodes; must be positive.
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS}
+ *
+ * \linkerror{PLAN_ILLEGAL_ARG} if the grid is empty, has `GRID_NO_NODE` or
+ * more nodes, or `spacing` is not positive
+ *
+ * \linkerror{PLAN_OTHER_ERROR} if memory could not be allocated.
+ * \endparblock
+ */
+plan_error init_grid_map( grid_map * map, uint32_t width, uint32_t height,
+                          float originX, float originY, float spacing );
+
+/*! \brief Allocate the grid made by `FourWayGridMeshFactory.squareGridMesh()`.
+ *
+ * The grid has `gridSize` nodes along each side, with node (0, 0) one grid
+ * square from the origin, as on the robot.
+ * \param [out] map The grid to initialise.
+ * \param [in] gridSize Number of nodes along each side.
+ * \param [in] gridSquareSide Side length of each grid square.
+ * \see init_grid_map()
+ */
+plan_error square_grid_map( grid_map * map, uint32_t gridSize,
+                            float gridSquareSide );
+
+/*! \brief Free the storage of a grid initialised with `init_grid_map()`.
+ */
+void free_grid_map( grid_map * map );
+
+/*! \return The number of nodes in the grid.
+ */
+size_t grid_node_count( const grid_map * map );
+
+/*! \brief Get the node at the given grid position.
+ *
+ * \return The node, or `GRID_NO_NODE` if the position is outside the grid.
+ */
+grid_node grid_node_at( const grid_map * map, uint32_t x, uint32_t y );
+
+/*! \brief Get the coordinates of a node, as used by the robot.
+ *
+ * \param [in] node A node of the grid.
+ * \param [out] x Output location for the x coordinate.
+ * \param [out] y Output location for the y coordinate.
+ */
+void grid_node_point( const grid_map * map, grid_node node, float * x,
+                      float * y );
+
+/*! \brief Get the node whose grid square contains a point.
+ *
+ * Replaces testing the point against a rectangle for each node, as
+ * `Controller.mapObstacle()` does on the robot. Takes constant time.
+ * \param [in] x x coordinate of the point.
+ * \param [in] y y coordinate of the point.
+ * \return The node, which may be blocked, or `GRID_NO_NODE` if the point is
+ * outside every grid square.
+ */
+grid_node grid_cell_at( const grid_map * map, float x, float y );
+
+/*! \brief Get the unblocked node nearest to a point.
+ *
+ * Replaces measuring the distance to every node, as
+ * `Controller.localiseRobot()` does on the robot. The nearest node is
+ * computed directly from the coordinates; only if it is blocked are the
+ * surrounding nodes searched, ring by ring, until no nearer node can remain.
+ * \param [in] x x coordinate of the point.
+ * \param [in] y y coordinate of the point.
+ * \return The node, or `GRID_NO_NODE` if every node is blocked.
+ */
+grid_node grid_nearest_node( const grid_map * map, float x, float y );
+
+/*! \brief Block or unblock a node.
+ *
+ * \param [in] node A node of the grid.
+ * \param [in] blocked Boolean flag: non-zero to block the node.
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS}
+ *
+ * \linkerror{PLAN_NO_EFFECT} if the node was already in the requested state
+ *
+ * \linkerror{PLAN_ILLEGAL_ARG} if `node` is not in the grid.
+ * \endparblock
+ */
+plan_error grid_set_blocked( grid_map * map, grid_node node, int blocked );
+
+/*! \return A non-zero integer if `node` is blocked or outside the grid,
+ * otherwise 0.
+ */
+int grid_is_blocked( const grid_map * map, grid_node node );
+
+/*! \return The number of steps between two nodes, ignoring blocked nodes
+ * (the Manhattan distance).
+ */
+uint32_t grid_distance( const grid_map * map, grid_node from, grid_node to );
+
+/*! \brief Get the unblocked neighbours of a node.
+ *
+ * \param [in] node A node of the grid.
+ * \param [out] neighbours Output location for up to four neighbours.
+ * \return The number of neighbours stored.
+ */
+size_t grid_neighbours( const grid_map * map, grid_node node,
+                        grid_node neighbours[4] );
+
+#endif
@@ -0,0 +1,113 @@
+#include "hungarian.h"
+#include <string.h>
+
+// Cost used in place of HUNGARIAN_FORBIDDEN: greater than the total of any
+// assignment of allowed pairs, yet far from overflowing the potentials.
+#define FORBIDDEN_COST ( (int64_t) 1 << 48 )
+// Greater than any reduced cost.
+#define INFINITE_COST INT64_MAX
+
+plan_error init_hungarian( hungarian_solver * solver, size_t capacity ) {
+    memset( solver, 0, sizeof ( hungarian_solver ) );
+    if ( capacity == 0 )
+        return PLAN_ILLEGAL_ARG;
+
+    // Row and column 0 are used by the search as a virtual start.
+    size_t size = capacity + 1;
+    solver->rowPotential = (int64_t *) malloc( size * sizeof ( int64_t ) );
+    solver->columnPotential = (int64_t *) malloc( size * sizeof ( int64_t ) );
+    solver->slack = (int64_t *) malloc( size * sizeof ( int64_t ) );
+    solver->match = (size_t *) malloc( size * sizeof ( size_t ) );
+    solver->way = (size_t *) malloc( size * sizeof ( size_t ) );
+    solver->visited = (unsigned char *) malloc( size );
+    if ( solver->rowPotential == NULL || solver->columnPotential == NULL ||
+         solver->slack == NULL || solver->match == NULL ||
+         solver->way == NULL || solver->visited == NULL ) {
+        free_hungarian( solver );
+        return PLAN_OTHER_ERROR;
+    }
+    solver->capacity = capacity;
+    return PLAN_SUCCESS;
+}
+
+void free_hungarian( hungarian_solver * solver ) {
+    free( solver->rowPotential );
+    free( solver->columnPotential );
+    free( solver->slack );
+    free( solver->match );
+    free( solver->way );
+    free( solver->visited );
+    memset( solver, 0, sizeof ( hungarian_solver ) );
+}
+
+plan_error hungarian_solve( hungarian_solver * solver, const uint32_t * cost,
+                            size_t rows, size_t columns, size_t * assignment ) {
+    if ( rows > columns || columns > solver->capacity )
+        return PLAN_ILLEGAL_ARG;
+
+    int64_t * u = solver->rowPotential;
+    int64_t * v = solver->columnPotential;
+    int64_t * slack = solver->slack;
+    size_t * match = solver->match;
+    size_t * way = solver->way;
+    memset( u, 0, ( rows + 1 ) * sizeof ( int64_t ) );
+    memset( v, 0, ( columns + 1 ) * sizeof ( int64_t ) );
+    memset( match, 0, ( columns + 1 ) * sizeof ( size_t ) );
+
+    size_t row;
+    for ( row = 1; row <= rows; row++ ) {
+        // Grow a tree of tight edges from the row, through column 0, until it
+        // reaches a free column.
+        match[0] = row;
+        size_t column = 0;
+        size_t j;
+        for ( j = 0; j <= columns; j++ )
+            slack[j] = INFINITE_COST;
+        memset( solver->visited, 0, columns + 1 );
+        do {
+            solver->visited[column] = 1;
+            size_t from = match[column];
+            const uint32_t * costs = cost + ( from - 1 ) * columns;
+            int64_t delta = INFINITE_COST;
+            size_t next = 0;
+            for ( j = 1; j <= columns; j++ ) {
+                if ( solver->visited[j] )
+                    continue;
+                int64_t entry = ( costs[j - 1] == HUNGARIAN_FORBIDDEN ?
+                                  FORBIDDEN_COST : costs[j - 1] );
+                int64_t reduced = entry - u[from] - v[j];
+                if ( reduced < slack[j] ) {
+                    slack[j] = reduced;
+                    way[j] = column;
+                }
+                if ( slack[j] < delta ) {
+                    delta = slack[j];
+                    next = j;
+                }
+            }
+            for ( j = 0; j <= columns; j++ ) {
+                if ( solver->visited[j] ) {
+                    u[match[j]] += delta;
+                    v[j] -= delta;
+                } else {
+                    slack[j] -= delta;
+                }
+            }
+            column = next;
+        } while ( match[column] != 0 );
+
+        // Flip the matching along the path back to the row.
+        do {
+            size_t previous = way[column];
+            match[column] = match[previous];
+            column = previous;
+        } while ( column != 0 );
+    }
+
+    size_t j;
+    for ( j = 1; j <= columns; j++ ) {
+        if ( match[j] != 0 )
+            assignment[match[j] - 1] = j - 1;
+    }
+    return PLAN_SUCCESS;
+}
@@ -0,0 +1,78 @@
+/*! \file
+ * \brief The Hungarian algorithm, for assigning jobs to workers at least total
+ * cost.
+ *
+ * Solves the rectangular assignment problem, with no more rows (workers) than
+ * columns (jobs), by finding a shortest augmenting path for each row in turn
+ * and keeping dual potentials on the rows and columns. This takes
+ * O(rows² × columns) time, O(n³) for a square problem. As with the planners,
+ * a `hungarian_solver` owns arrays that are allocated once and reused by every
+ * solve.
+ */
+#ifndef HUNGARIAN_H
+#define HUNGARIAN_H
+#include "plan_error.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+/*! \def HUNGARIAN_FORBIDDEN
+ * The cost of a row and column that must not be paired, such as a robot and a
+ * site it cannot reach. It is paired only when a row has no other column
+ * left.
+ */
+#define HUNGARIAN_FORBIDDEN UINT32_MAX
+
+/*! \brief Reusable state for assignments. Initialise with `init_hungarian()`.
+ */
+typedef struct hungarian_solver {
+    size_t capacity; /*!< Largest number of columns the arrays can hold. */
+    int64_t * rowPotential; /*!< Dual potential of each row, from 1. */
+    int64_t * columnPotential; /*!< Dual potential of each column, from 1. */
+    int64_t * slack; /*!< Least reduced cost to each column in a search. */
+    size_t * match; /*!< Row matched to each column, from 1; 0 if none. */
+    size_t * way; /*!< Previous column on the path to each column. */
+    unsigned char * visited; /*!< Flag of each column reached in a search. */
+} hungarian_solver;
+
+/*! \brief Allocate the arrays of a solver.
+ *
+ * \param [out] solver The solver to initialise.
+ * \param [in] capacity The largest number of columns of the problems to
+ * solve.
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS}
+ *
+ * \linkerror{PLAN_ILLEGAL_ARG} if `capacity` is 0
+ *
+ * \linkerror{PLAN_OTHER_ERROR} if memory could not be allocated.
+ * \endparblock
+ */
+plan_error init_hungarian( hungarian_solver * solver, size_t capacity );
+
+/*! \brief Free the arrays of a solver initialised with `init_hungarian()`.
+ */
+void free_hungarian( hungarian_solver * solver );
+
+/*! \brief Pair each row with a different column, at least total cost.
+ *
+ * Does not allocate memory.
+ * \param [in] solver A solver with a capacity of at least `columns`.
+ * \param [in] cost The cost of pairing each row with each column, in row-major
+ * order: `cost[row * columns + column]`.
+ * \param [in] rows Number of rows, at most `columns`.
+ * \param [in] columns Number of columns.
+ * \param [out] assignment Output location for the column paired with each
+ * row.
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS} (and populates `assignment`)
+ *
+ * \linkerror{PLAN_ILLEGAL_ARG} if there are more rows than columns, or more
+ * columns than the capacity of the solver.
+ * \endparblock
+ */
+plan_error hungarian_solve( hungarian_solver * solver, const uint32_t * cost,
+                            size_t rows, size_t columns, size_t * assignment );
+
+#endif
@@ -0,0 +1,259 @@
+#include "occupancy.h"
+#include <math.h>
+#include <string.h>
+
+// Units of log odds per nat.
+#define SCALE 16.0f
+
+// Least and greatest log odds of a cell: probabilities of 0.12 and 0.97.
+#define MIN_LOG_ODDS -32
+#define MAX_LOG_ODDS 56
+
+// Default probabilities of an echo's cell and a beam's cells.
+#define DEFAULT_HIT 0.7f
+#define DEFAULT_MISS 0.4f
+
+/*
+ * return: The log odds of a probability, in units, rounded away from 0.
+ */
+static int log_odds( float probability );
+
+/*
+ * Add to the log odds of consecutive cells of a row, clamping them.
+ * in: firstX, lastX - Ends of the run, in either order, either of which may
+ *     be outside the grid.
+ */
+static void update_run( occupancy_grid * grid, int64_t y, int64_t firstX,
+                        int64_t lastX, int delta );
+
+/*
+ * Trace the beam of one reading through the cells.
+ */
+static void integrate_reading( occupancy_grid * grid,
+                               const occupancy_reading * reading );
+
+/*
+ * return: Non-zero if any cell of a node has at least the given log odds.
+ */
+static int node_occupied( const occupancy_grid * grid, grid_node node,
+                          int threshold );
+
+static int log_odds( float probability ) {
+    return (int) lroundf( logf( probability / ( 1.0f - probability ) ) *
+                          SCALE );
+}
+
+static void update_run( occupancy_grid * grid, int64_t y, int64_t firstX,
+                        int64_t lastX, int delta ) {
+    if ( firstX > lastX ) {
+        int64_t swapped = firstX;
+        firstX = lastX;
+        lastX = swapped;
+    }
+    if ( y < 0 || y >= grid->height || lastX < 0 || firstX >= grid->width )
+        return;
+    if ( firstX < 0 )
+        firstX = 0;
+    if ( lastX >= grid->width )
+        lastX = grid->width - 1;
+
+    // Without branches or aliasing, this loop is vectorised at -O3.
+    int8_t * restrict cells = grid->logOdds + (size_t) y * grid->width;
+    int64_t x;
+    for ( x = firstX; x <= lastX; x++ ) {
+        int value = cells[x] + delta;
+        value = ( value < MIN_LOG_ODDS ? MIN_LOG_ODDS : value );
+        value = ( value > MAX_LOG_ODDS ? MAX_LOG_ODDS : value );
+        cells[x] = (int8_t) value;
+    }
+    grid->cellUpdates += (uint64_t) ( lastX - firstX + 1 );
+
+    uint32_t k = grid->cellsPerNode;
+    uint32_t mapWidth = grid->map->width;
+    grid_node node = (grid_node) ( y / k ) * mapWidth;
+    uint32_t column;
+    for ( column = firstX / k; column <= lastX / k; column++ ) {
+        if ( ! grid->dirty[node + column] ) {
+            grid->dirty[node + column] = 1;
+            grid->dirtyNodes[grid->dirtyCount++] = node + column;
+        }
+    }
+}
+
+static void integrate_reading( occupancy_grid * grid,
+                               const occupancy_reading * reading ) {
+    float range = reading->range;
+    int echo = ( range < grid->maxRange );
+    if ( ! echo )
+        range = grid->maxRange;
+    if ( ! ( range >= 0.0f ) )
+        return;
+
+    // Positions in cells from the corner of the grid.
+    float angle = reading->heading * (float) ( M_PI / 180.0 );
+    float directionX = cosf( angle );
+    float directionY = sinf( angle );
+    float startX = ( reading->x - grid->cornerX ) / grid->cellSize;
+    float startY = ( reading->y - grid->cornerY ) / grid->cellSize;
+    float length = range / grid->cellSize;
+    float endX = startX + directionX * length;
+    float endY = startY + directionY * length;
+    if ( ! ( fabsf( startX ) < 1e9f && fabsf( startY ) < 1e9f &&
+             fabsf( endX ) < 1e9f && fabsf( endY ) < 1e9f ) )
+        return;
+
+    // Step cell by cell along the beam (Amanatides and Woo), collecting the
+    // cells crossed in each row into one run.
+    int64_t x = (int64_t) floorf( startX );
+    int64_t y = (int64_t) floorf( startY );
+    int64_t lastX = (int64_t) floorf( endX );
+    int64_t lastY = (int64_t) floorf( endY );
+    int64_t stepX = ( directionX > 0.0f ? 1 : -1 );
+    int64_t stepY = ( directionY > 0.0f ? 1 : -1 );
+    float deltaX = INFINITY, deltaY = INFINITY;
+    float nextX = INFINITY, nextY = INFINITY;
+    if ( directionX != 0.0f ) {
+        deltaX = fabsf( 1.0f / directionX );
+        nextX = ( stepX > 0 ? (float) ( x + 1 ) - startX :
+                  startX - (float) x ) * deltaX;
+    }
+    if ( directionY != 0.0f ) {
+        deltaY = fabsf( 1.0f / directionY );
+        nextY = ( stepY > 0 ? (float) ( y + 1 ) - startY :
+                  startY - (float) y ) * deltaY;
+    }
+    int64_t steps = ( lastX > x ? lastX - x : x - lastX ) +
+                    ( lastY > y ? lastY - y : y - lastY );
+    int64_t runStart = x;
+    int64_t i;
+    for ( i = 0; i < steps; i++ ) {
+        if ( nextX < nextY ) {
+            x += stepX;
+            nextX += deltaX;
+        } else {
+            update_run( grid, y, runStart, x, grid->miss );
+            y += stepY;
+            nextY += deltaY;
+            runStart = x;
+        }
+    }
+    // The beam ends in the cell at (x, y).
+    if ( x != runStart )
+        update_run( grid, y, runStart, x - stepX, grid->miss );
+    update_run( grid, y, x, x, echo ? grid->hit : grid->miss );
+}
+
+static int node_occupied( const occupancy_grid * grid, grid_node node,
+                          int threshold ) {
+    uint32_t k = grid->cellsPerNode;
+    uint32_t firstX = node % grid->map->width * k;
+    uint32_t firstY = node / grid->map->width * k;
+    uint32_t x, y;
+    for ( y = firstY; y < firstY + k; y++ ) {
+        const int8_t * cells = grid->logOdds + (size_t) y * grid->width;
+        for ( x = firstX; x < firstX + k; x++ ) {
+            if ( cells[x] >= threshold )
+                return 1;
+        }
+    }
+    return 0;
+}
+
+plan_error init_occupancy( occupancy_grid * grid, const grid_map * map,
+                           uint32_t cellsPerNode, float maxRange ) {
+    memset( grid, 0, sizeof ( occupancy_grid ) );
+    if ( cellsPerNode == 0 || ! ( maxRange > 0.0f ) )
+        return PLAN_ILLEGAL_ARG;
+    if ( (uint64_t) map->width * cellsPerNode > UINT32_MAX / 2 ||
+         (uint64_t) map->height * cellsPerNode > UINT32_MAX / 2 ||
+         (uint64_t) map->width * map->height * cellsPerNode * cellsPerNode >
+         SIZE_MAX / 2 )
+        return PLAN_ILLEGAL_ARG;
+
+    size_t nodes = grid_node_count( map );
+    grid->width = map->width * cellsPerNode;
+    grid->height = map->height * cellsPerNode;
+    grid->logOdds = (int8_t *) calloc( (size_t) grid->width * grid->height,
+                                       sizeof ( int8_t ) );
+    grid->dirty = (unsigned char *) calloc( nodes, 1 );
+    grid->dirtyNodes = (grid_node *) malloc( nodes * sizeof ( grid_node ) );
+    if ( grid->logOdds == NULL || grid->dirty == NULL ||
+         grid->dirtyNodes == NULL ) {
+        free_occupancy( grid );
+        return PLAN_OTHER_ERROR;
+    }
+
+    // Each node lies at the centre of its square of cells.
+    grid->map = map;
+    grid->cellsPerNode = cellsPerNode;
+    grid->cornerX = map->originX - map->spacing / 2.0f;
+    grid->cornerY = map->originY - map->spacing / 2.0f;
+    grid->cellSize = map->spacing / (float) cellsPerNode;
+    grid->maxRange = maxRange;
+    occupancy_set_model( grid, DEFAULT_HIT, DEFAULT_MISS );
+    return PLAN_SUCCESS;
+}
+
+void free_occupancy( occupancy_grid * grid ) {
+    free( grid->logOdds );
+    free( grid->dirty );
+    free( grid->dirtyNodes );
+    memset( grid, 0, sizeof ( occupancy_grid ) );
+}
+
+plan_error occupancy_set_model( occupancy_grid * grid, float hit,
+                                float miss ) {
+    if ( ! ( hit > 0.5f && hit < 0.97f && miss > 0.12f && miss < 0.5f ) )
+        return PLAN_ILLEGAL_ARG;
+    int hitUnits = log_odds( hit );
+    int missUnits = log_odds( miss );
+    grid->hit = (int8_t) ( hitUnits > 1 ? hitUnits : 1 );
+    grid->miss = (int8_t) ( missUnits < -1 ? missUnits : -1 );
+    return PLAN_SUCCESS;
+}
+
+void occupancy_integrate( occupancy_grid * grid,
+                          const occupancy_reading * readings, size_t count ) {
+    size_t i;
+    for ( i = 0; i < count; i++ )
+        integrate_reading( grid, &readings[i] );
+}
+
+float occupancy_probability( const occupancy_grid * grid, uint32_t x,
+                             uint32_t y ) {
+    if ( x >= grid->width || y >= grid->height )
+        return 0.5f;
+    float odds = expf( grid->logOdds[(size_t) y * grid->width + x] / SCALE );
+    return odds / ( 1.0f + odds );
+}
+
+int occupancy_node_occupied( const occupancy_grid * grid, grid_node node,
+                             float threshold ) {
+    return node_occupied( grid, node, log_odds( threshold ) );
+}
+
+plan_error occupancy_changes( occupancy_grid * grid, float threshold,
+                              grid_node * nodes, int * blocked,
+                              size_t maxCount, size_t * count ) {
+    *count = 0;
+    if ( ! ( threshold > 0.0f && threshold < 1.0f ) )
+        return PLAN_ILLEGAL_ARG;
+    int units = log_odds( threshold );
+
+    // Check the nodes from the end of the list, so that those left over stay
+    // in it.
+    while ( grid->dirtyCount > 0 ) {
+        grid_node node = grid->dirtyNodes[grid->dirtyCount - 1];
+        int occupied = node_occupied( grid, node, units );
+        if ( occupied != grid_is_blocked( grid->map, node ) ) {
+            if ( *count == maxCount )
+                break;
+            nodes[*count] = node;
+            blocked[*count] = occupied;
+            ( *count )++;
+        }
+        grid->dirty[node] = 0;
+        grid->dirtyCount--;
+    }
+    return ( *count > 0 ? PLAN_SUCCESS : PLAN_NO_EFFECT );
+}
@@ -0,0 +1,190 @@
+/*! \file
+ * \brief A probabilistic occupancy grid built from ultrasonic range readings,
+ * for blocking the nodes of a `grid_map` only once the evidence for an
+ * obstacle outweighs the evidence against it.
+ *
+ * On the robot, `Controller.featureDetected()` removes a node from the mesh
+ * the first time a single echo lands in its square, so one noisy reading
+ * blocks it for good. Here each reading is traced as a ray through a grid of
+ * cells finer than the nodes: the cells the beam passed through become more
+ * likely to be free, and the cell it ended in more likely to be occupied.
+ * A cell's belief is stored as its log odds, `log( p / ( 1 - p ) )`, so that
+ * each reading simply adds to it. The log odds are kept in 1/16ths, in one
+ * byte per cell, and clamped between the probabilities 0.12 and 0.97 so that
+ * a cell can change its state again after a few readings.
+ *
+ * The cells a ray crosses in each row are updated as one contiguous run, in a
+ * loop simple enough for the compiler to vectorise. Rays along the rows of
+ * the grid, as the robot's are when it faces along the x axis, update all of
+ * their cells this way.
+ *
+ * A node is occupied when any of its cells has a probability of at least the
+ * threshold given to `occupancy_changes()`, which lists the nodes touched by
+ * readings whose state differs from the `grid_map`, for the planner to block
+ * or unblock. With the default model and a threshold of 0.8, two echoes from a
+ * cell block its node, and two beams passing through the cell afterwards
+ * unblock it again.
+ *
+ * Usage
+ * =====
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~{.c}
+ * occupancy_grid grid;
+ * init_occupancy( &grid, &map, 4, 255.0f );
+ *
+ * // For each range reading of each robot:
+ * reading.x = poseX;
+ * reading.y = poseY;
+ * reading.heading = poseHeading;
+ * reading.range = range;
+ * occupancy_integrate( &grid, &reading, 1 );
+ *
+ * // Before replanning:
+ * occupancy_changes( &grid, 0.8f, nodes, blocked, maxCount, &count );
+ * for ( i = 0; i < count; i++ )
+ *     dstar_set_blocked( &planner, nodes[i], blocked[i] );
+ *
+ * free_occupancy( &grid );
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+#ifndef OCCUPANCY_H
+#define OCCUPANCY_H
+#include "plan_error.h"
+#include "grid_map.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+/*! \brief A range reading of an ultrasonic sensor.
+ */
+typedef struct occupancy_reading {
+    float x; /*!< x coordinate of the robot when the reading was taken. */
+    float y; /*!< y coordinate of the robot when the reading was taken. */
+    float heading; /*!< Direction of the beam, in degrees anticlockwise from
+                    * the x axis, as in the robot's `Pose`. */
+    float range; /*!< Distance from (`x`, `y`) to the echo, as reported by
+                  * `TELEMETRY_OBSTACLE`. */
+} occupancy_reading;
+
+/*! \brief Log odds of occupancy of the cells covering a `grid_map`.
+ * Initialise with `init_occupancy()`.
+ */
+typedef struct occupancy_grid {
+    const grid_map * map; /*!< The grid of nodes the cells cover. */
+    uint32_t cellsPerNode; /*!< Number of cells along each side of a node's
+                            * square. */
+    uint32_t width; /*!< Number of cells along the x axis. */
+    uint32_t height; /*!< Number of cells along the y axis. */
+    float cornerX; /*!< x coordinate of the outer corner of cell (0, 0). */
+    float cornerY; /*!< y coordinate of the outer corner of cell (0, 0). */
+    float cellSize; /*!< Side length of each cell. */
+    float maxRange; /*!< Readings of at least this range found no echo. */
+    int8_t * logOdds; /*!< Log odds of each cell, in 1/16ths, by row. */
+    int8_t hit; /*!< Added to the cell an echo came from. */
+    int8_t miss; /*!< Added to the cells a beam passed through. */
+    unsigned char * dirty; /*!< Whether each node is in `dirtyNodes`. */
+    grid_node * dirtyNodes; /*!< Nodes with cells updated since they were
+                             * last checked by `occupancy_changes()`. */
+    size_t dirtyCount; /*!< Number of nodes in `dirtyNodes`. */
+    uint64_t cellUpdates; /*!< Number of cell updates made. */
+} occupancy_grid;
+
+/*! \brief Allocate the cells covering a grid, all with a probability of 0.5.
+ *
+ * The probabilities of a cell in the square of an obstacle after an echo, and
+ * of a cell the beam passes through, are 0.7 and 0.4; change them with
+ * `occupancy_set_model()`.
+ * \param [out] grid The occupancy grid to initialise.
+ * \param [in] map The grid of nodes to cover, which must outlive `grid`.
+ * \param [in] cellsPerNode The number of cells along each side of a node's
+ * square.
+ * \param [in] maxRange The range the sensor reports when it hears no echo.
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS}
+ *
+ * \linkerror{PLAN_ILLEGAL_ARG} if `cellsPerNode` is 0, or there would be too
+ * many cells, or `maxRange` is not positive
+ *
+ * \linkerror{PLAN_OTHER_ERROR} if memory could not be allocated.
+ * \endparblock
+ */
+plan_error init_occupancy( occupancy_grid * grid, const grid_map * map,
+                           uint32_t cellsPerNode, float maxRange );
+
+/*! \brief Free the storage of a grid initialised with `init_occupancy()`.
+ */
+void free_occupancy( occupancy_grid * grid );
+
+/*! \brief Set how much each reading changes the cells.
+ *
+ * \param [in] hit The probability that a cell an echo came from is occupied,
+ * given only that reading.
+ * \param [in] miss The probability that a cell a beam passed through is
+ * occupied, given only that reading.
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS}
+ *
+ * \linkerror{PLAN_ILLEGAL_ARG} if `hit` is not between 0.5 and 0.97, or `miss`
+ * is not between 0.12 and 0.5, exclusive.
+ * \endparblock
+ */
+plan_error occupancy_set_model( occupancy_grid * grid, float hit,
+                                float miss );
+
+/*! \brief Update the cells along the beams of some readings.
+ *
+ * Cells from the robot up to the echo are made more likely to be free, and the
+ * cell of the echo more likely to be occupied. A reading of at least the
+ * maximum range clears the cells up to that range. Cells outside the grid are
+ * ignored. Takes time linear in the number of cells crossed.
+ * \param [in] readings The readings, in the order they were taken.
+ * \param [in] count The number of readings.
+ */
+void occupancy_integrate( occupancy_grid * grid,
+                          const occupancy_reading * readings, size_t count );
+
+/*! \return The probability that a cell is occupied, or 0.5 if the cell is not
+ * in the grid.
+ */
+float occupancy_probability( const occupancy_grid * grid, uint32_t x,
+                             uint32_t y );
+
+/*! \brief Check whether any cell of a node is occupied.
+ *
+ * \param [in] node A node of the grid.
+ * \param [in] threshold The probability at which a cell is occupied, between
+ * 0 and 1 exclusive.
+ * \return A non-zero integer if any cell of the node has a probability of at
+ * least `threshold`, otherwise 0.
+ */
+int occupancy_node_occupied( const occupancy_grid * grid, grid_node node,
+                             float threshold );
+
+/*! \brief List the nodes whose occupancy has changed since they were last
+ * listed.
+ *
+ * Of the nodes whose cells readings have updated, lists those that are
+ * blocked in the `grid_map` but have no cell with a probability of at least
+ * `threshold`, or are unblocked but have such a cell. The `grid_map` is not
+ * changed: pass the nodes to `grid_set_blocked()` or `dstar_set_blocked()`.
+ * \param [in] threshold The probability at which a cell is occupied, between
+ * 0 and 1 exclusive.
+ * \param [out] nodes Output location for the nodes that changed.
+ * \param [out] blocked Output location for whether each node is now blocked.
+ * \param [in] maxCount The size of `nodes` and `blocked`. Nodes that do not
+ * fit are listed by the next call.
+ * \param [out] count The number of nodes listed.
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS}
+ *
+ * \linkerror{PLAN_NO_EFFECT} if no node changed
+ *
+ * \linkerror{PLAN_ILLEGAL_ARG} if `threshold` is not between 0 and 1.
+ * \endparblock
+ */
+plan_error occupancy_changes( occupancy_grid * grid, float threshold,
+                              grid_node * nodes, int * blocked,
+                              size_t maxCount, size_t * count );
+
+#endif
@@ -0,0 +1,24 @@
+#include "plan_error.h"
+
+/* Error Messages */
+static const char * NO_EFFECT_MSG = "An operation had no effect";
+static const char * SUCCESS_MSG = "No errors occurred";
+static const char * ILLEGAL_ARG_MSG = "Illegal argument supplied to a function";
+static const char * NO_PATH_MSG = "No path exists between the given nodes";
+static const char * OTHER_ERROR_MSG = "An error occurred";
+/* ************** */
+
+const char * plan_error_message( plan_error errorCode ) {
+    switch ( errorCode ) {
+        case PLAN_NO_EFFECT:
+            return NO_EFFECT_MSG;
+        case PLAN_SUCCESS:
+            return SUCCESS_MSG;
+        case PLAN_ILLEGAL_ARG:
+            return ILLEGAL_ARG_MSG;
+        case PLAN_NO_PATH:
+            return NO_PATH_MSG;
+        default:
+            return OTHER_ERROR_MSG;
+    }
+}
@@ -0,0 +1,35 @@
+/*! \file
+ * \brief Defines codes to be returned from the functions of libplan to
+ * indicate the status of their completion.
+ */
+#ifndef PLAN_ERROR_H
+#define PLAN_ERROR_H
+
+/*! \brief Error codes.
+ *
+ * As with `libnxt_error`, functions return 0 on success, +1 to indicate no
+ * effect, or another negative code on failure. You can call
+ * `plan_error_message()` to retrieve a basic description of an error code.
+ */
+typedef enum plan_error {
+    PLAN_NO_EFFECT = 1, /*!< A function call had no effect.
+                             \showinitializer */
+    PLAN_SUCCESS = 0, /*!< A function call completed successfully.
+                           \showinitializer */
+    PLAN_ILLEGAL_ARG = -1, /*!< Illegal argument(s) passed to a function.
+                                \showinitializer */
+    PLAN_NO_PATH = -2, /*!< No path exists between the given nodes.
+                            \showinitializer */
+    PLAN_OTHER_ERROR = -3 /*!< Other error, such as failure to allocate memory.
+                               \showinitializer */
+} plan_error;
+
+/*! \brief Get a basic description of an error code.
+ *
+ * The caller must not `free()` the returned string.
+ * \return A constant NULL-terminated string with an ASCII message related to
+ * the given error code.
+ */
+const char * plan_error_message( plan_error errorCode );
+
+#endif
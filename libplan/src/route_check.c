@@ -0,0 +1,55 @@
+#include "route_check.h"
+#include <string.h>
+
+// Largest node sent in a 2-byte field; 0xffff means no node.
+#define MAX_MESSAGE_NODE 0xfffe
+
+plan_error init_route_checker( route_checker * checker, const grid_map * map,
+                               uint32_t cellsPerNode, float threshold ) {
+    memset( checker, 0, sizeof ( route_checker ) );
+    if ( ! ( threshold > 0.0f && threshold < 1.0f ) )
+        return PLAN_ILLEGAL_ARG;
+    checker->threshold = threshold;
+    return init_occupancy( &checker->grid, map, cellsPerNode,
+                           ROUTE_MAX_RANGE );
+}
+
+void free_route_checker( route_checker * checker ) {
+    free_occupancy( &checker->grid );
+    memset( checker, 0, sizeof ( route_checker ) );
+}
+
+plan_error route_check_reading( route_checker * checker,
+                                const occupancy_reading * reading,
+                                grid_node next ) {
+    if ( next != GRID_NO_NODE &&
+         next >= grid_node_count( checker->grid.map ) )
+        return PLAN_ILLEGAL_ARG;
+    occupancy_integrate( &checker->grid, reading, 1 );
+    checker->readings++;
+    if ( next == GRID_NO_NODE ||
+         ! occupancy_node_occupied( &checker->grid, next,
+                                    checker->threshold ) )
+        return PLAN_NO_EFFECT;
+    checker->stops++;
+    return PLAN_SUCCESS;
+}
+
+uint16_t route_check_job_message( grid_node from, grid_node to,
+                                  unsigned char * message ) {
+    if ( from > 255 || to > 255 )
+        return 0;
+    message[0] = (unsigned char) from;
+    message[1] = (unsigned char) to;
+    message[2] = ROUTE_CONTINUOUS;
+    return ROUTE_MESSAGE_SIZE;
+}
+
+uint16_t route_check_stop_message( grid_node node, unsigned char * message ) {
+    if ( node > MAX_MESSAGE_NODE )
+        return 0;
+    message[0] = ROUTE_BLOCKED;
+    message[1] = (unsigned char) ( node >> 8 );
+    message[2] = (unsigned char) node;
+    return ROUTE_MESSAGE_SIZE;
+}
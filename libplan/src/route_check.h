@@ -0,0 +1,146 @@
+/*! \file
+ * \brief The host's side of continuous sensing: decides from the range
+ * readings a robot streams while it drives whether the node it is driving to
+ * is blocked, so that the robot need only stop when it is.
+ *
+ * By default `Controller.java` stops at every waypoint, turns to face the
+ * next, and listens for two pulses of its sensor before driving on: half a
+ * second per node of its route. A job made by `route_check_job_message()`
+ * instead asks the robot to keep its sensor on while it drives, and to send
+ * each echo it hears, with its pose and the node it is driving to, as a
+ * `TELEMETRY_RANGE` message. The host passes each reading to
+ * `route_check_reading()`, which adds it to an `occupancy_grid`; when the
+ * node being driven to becomes occupied, the host sends the message made by
+ * `route_check_stop_message()`, and the robot stops, removes the node from
+ * its map and plans around it, as it does for an obstacle it detects itself.
+ * Until then, the robot does not stop.
+ *
+ * Usage
+ * =====
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~{.c}
+ * route_checker checker;
+ * init_route_checker( &checker, &map, 4, 0.8f );
+ * length = route_check_job_message( start, target, message );
+ * conn_send( conn, message, length );
+ *
+ * // For each TELEMETRY_RANGE report:
+ * reading.x = report.range.x;
+ * reading.y = report.range.y;
+ * reading.heading = report.range.heading;
+ * reading.range = report.range.range;
+ * next = ( report.range.next == TELEMETRY_NO_NODE ? GRID_NO_NODE :
+ *          report.range.next );
+ * if ( route_check_reading( &checker, &reading, next ) == PLAN_SUCCESS ) {
+ *     length = route_check_stop_message( next, message );
+ *     conn_send( conn, message, length );
+ * }
+ *
+ * free_route_checker( &checker );
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+#ifndef ROUTE_CHECK_H
+#define ROUTE_CHECK_H
+#include "plan_error.h"
+#include "grid_map.h"
+#include "occupancy.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+/*! \def ROUTE_CONTINUOUS
+ * Flag, in the third byte of a job, asking the robot to sense continuously.
+ */
+#define ROUTE_CONTINUOUS 1
+
+/*! \def ROUTE_BLOCKED
+ * First byte of the message telling a robot that a node is blocked.
+ */
+#define ROUTE_BLOCKED 1
+
+/*! \def ROUTE_MESSAGE_SIZE
+ * Size of the messages made by `route_check_job_message()` and
+ * `route_check_stop_message()`.
+ */
+#define ROUTE_MESSAGE_SIZE 3
+
+/*! \def ROUTE_MAX_RANGE
+ * The range of an echo reported by a robot, from its centre, beyond which it
+ * is taken as no echo: the largest reading of the sensor, plus its offset from
+ * the centre of the robot.
+ */
+#define ROUTE_MAX_RANGE 263.0f
+
+/*! \brief The evidence from one robot's readings. Initialise with
+ * `init_route_checker()`.
+ */
+typedef struct route_checker {
+    occupancy_grid grid; /*!< Occupancy of the cells the readings crossed. */
+    float threshold; /*!< Probability at which a cell is occupied. */
+    uint64_t readings; /*!< Readings checked. */
+    uint64_t stops; /*!< Readings after which the robot was to stop. */
+} route_checker;
+
+/*! \brief Allocate a checker, knowing nothing of the grid.
+ *
+ * \param [out] checker The checker to initialise.
+ * \param [in] map The grid the robot plans on, which must outlive the checker.
+ * \param [in] cellsPerNode The number of cells along each side of a node's
+ * square, as for `init_occupancy()`.
+ * \param [in] threshold The probability at which a cell is occupied, between
+ * 0 and 1 exclusive. With the default model of `occupancy_grid`, 0.8 needs two
+ * echoes from a cell.
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS}
+ *
+ * \linkerror{PLAN_ILLEGAL_ARG} if `threshold` is not between 0 and 1, or as for
+ * `init_occupancy()`
+ *
+ * \linkerror{PLAN_OTHER_ERROR} if memory could not be allocated.
+ * \endparblock
+ */
+plan_error init_route_checker( route_checker * checker, const grid_map * map,
+                               uint32_t cellsPerNode, float threshold );
+
+/*! \brief Free the storage of a checker initialised with
+ * `init_route_checker()`.
+ */
+void free_route_checker( route_checker * checker );
+
+/*! \brief Add a reading to the evidence, and decide whether the robot is to
+ * stop.
+ *
+ * \param [in] reading The robot's pose and the range of the echo it heard.
+ * \param [in] next The node the robot was driving to, or `GRID_NO_NODE`.
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS} if `next` is now occupied, so the robot is to stop
+ *
+ * \linkerror{PLAN_NO_EFFECT} if it is not
+ *
+ * \linkerror{PLAN_ILLEGAL_ARG} if `next` is not `GRID_NO_NODE` or in the grid.
+ * \endparblock
+ */
+plan_error route_check_reading( route_checker * checker,
+                                const occupancy_reading * reading,
+                                grid_node next );
+
+/*! \brief Make a job asking a robot to drive between two nodes, sensing
+ * continuously. `Controller.java` reads the nodes as bytes.
+ *
+ * \param [out] message Output location for the job, of `#ROUTE_MESSAGE_SIZE`
+ * bytes.
+ * \return The length of the job, or 0 if a node is 256 or more.
+ */
+uint16_t route_check_job_message( grid_node from, grid_node to,
+                                  unsigned char * message );
+
+/*! \brief Make the message telling a robot that a node is blocked.
+ *
+ * \param [out] message Output location for the message, of
+ * `#ROUTE_MESSAGE_SIZE` bytes.
+ * \return The length of the message, or 0 if `node` does not fit in the 2
+ * bytes of a `TELEMETRY_RANGE` message.
+ */
+uint16_t route_check_stop_message( grid_node node, unsigned char * message );
+
+#endif
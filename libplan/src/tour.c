@@ -0,0 +1,758 @@
+#include "tour.h"
+#include <string.h>
+#include <time.h>
+
+// Steps to a node that cannot be reached.
+#define UNREACHABLE UINT32_MAX
+
+// Longest stretch of the tour moved by a perturbation.
+#define KICK_SPAN 50
+
+// Longest run of sites moved by Or-opt.
+#define MAX_SEGMENT 3
+
+/*
+ * return: The time from a fixed point, in ns.
+ */
+static uint64_t now_ns( void );
+
+/*
+ * return: A pseudo-random number (SplitMix64).
+ */
+static uint64_t next_random( uint64_t * state );
+
+/*
+ * return: The steps between two sites.
+ */
+static uint32_t site_distance( const tour_planner * planner, uint32_t a,
+                               uint32_t b );
+
+/*
+ * Run a function in every worker, each on its own thread.
+ * return: Non-zero if a thread could not be started; the others are joined.
+ */
+static int run_workers( tour_planner * planner,
+                        void * ( * work )( void * worker ) );
+
+/*
+ * Fill the rows of the distance matrix, and the nearest sites, of the sites
+ * numbered by the worker's index plus multiples of the number of workers.
+ */
+static void * search_sites( void * worker );
+
+/*
+ * return: The site after the one at an index of the tour, or TOUR_NONE at the
+ * end of an open tour.
+ */
+static uint32_t next_site( const tour_worker * worker, size_t index );
+
+/*
+ * return: The site before the one at an index of the tour, or TOUR_NONE at
+ * the start of an open tour.
+ */
+static uint32_t previous_site( const tour_worker * worker, size_t index );
+
+/*
+ * Record that the sites between two indices of the tour, inclusive, moved.
+ */
+static void mark_changed( tour_worker * worker, size_t start, size_t end );
+
+/*
+ * Add a site, if not TOUR_NONE, to the sites to search moves from.
+ */
+static void enqueue( tour_worker * worker, uint32_t site );
+
+/*
+ * Reverse the sites between two indices of the tour, inclusive.
+ */
+static void reverse( tour_worker * worker, size_t start, size_t end );
+
+/*
+ * Move the sites between two indices of the tour, inclusive, to follow a site
+ * not among them.
+ * in: reversed - Non-zero to reverse their order.
+ */
+static void move_segment( tour_worker * worker, size_t start, size_t end,
+                          uint32_t after, int reversed );
+
+/*
+ * Make the first 2-opt move found that shortens the tour by joining a site to
+ * one of its nearest sites.
+ * return: Non-zero if a move was made.
+ */
+static int two_opt( tour_worker * worker, uint32_t site );
+
+/*
+ * Make the first Or-opt move found that shortens the tour by moving a segment
+ * that ends with a site next to one of the site's nearest sites.
+ * return: Non-zero if a move was made.
+ */
+static int or_opt( tour_worker * worker, uint32_t site );
+
+/*
+ * Make moves from the queued sites until none shortens the tour.
+ */
+static void local_search( tour_worker * worker );
+
+/*
+ * Swap two adjacent stretches of the tour near a random index (a double
+ * bridge move), and queue the sites at their ends.
+ */
+static void kick( tour_worker * worker );
+
+/*
+ * Improve the planner's tour into the worker's best tour, until the deadline.
+ */
+static void * improve( void * worker );
+
+static uint64_t now_ns( void ) {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+static uint64_t next_random( uint64_t * state ) {
+    uint64_t z = ( *state += 0x9e3779b97f4a7c15ULL );
+    z = ( z ^ ( z >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+    z = ( z ^ ( z >> 27 ) ) * 0x94d049bb133111ebULL;
+    return z ^ ( z >> 31 );
+}
+
+static uint32_t site_distance( const tour_planner * planner, uint32_t a,
+                               uint32_t b ) {
+    return planner->distance[(size_t) a * planner->siteCount + b];
+}
+
+static int run_workers( tour_planner * planner,
+                        void * ( * work )( void * worker ) ) {
+    if ( planner->workerCount == 1 ) {
+        work( &planner->workers[0] );
+        return 0;
+    }
+    unsigned started;
+    for ( started = 0; started < planner->workerCount; started++ ) {
+        tour_worker * worker = &planner->workers[started];
+        if ( pthread_create( &worker->thread, NULL, work, worker ) )
+            break;
+    }
+    unsigned i;
+    for ( i = 0; i < started; i++ )
+        pthread_join( planner->workers[i].thread, NULL );
+    return ( started < planner->workerCount );
+}
+
+static void * search_sites( void * argument ) {
+    tour_worker * worker = (tour_worker *) argument;
+    tour_planner * planner = worker->planner;
+    const grid_map * map = planner->map;
+    size_t nodes = grid_node_count( map );
+    uint32_t count = planner->siteCount;
+    uint32_t site;
+    for ( site = worker->index; site < count;
+          site += planner->workerCount ) {
+        uint32_t * steps = worker->steps;
+        memset( steps, 0xff, nodes * sizeof ( uint32_t ) );
+        grid_node from = planner->siteNode[site];
+        steps[from] = 0;
+        worker->frontier[0] = from;
+        size_t first = 0;
+        size_t last = 1;
+        grid_node neighbours[4];
+        while ( first < last ) {
+            grid_node node = worker->frontier[first++];
+            size_t n = grid_neighbours( map, node, neighbours );
+            size_t i;
+            for ( i = 0; i < n; i++ ) {
+                if ( steps[neighbours[i]] == UNREACHABLE ) {
+                    steps[neighbours[i]] = steps[node] + 1;
+                    worker->frontier[last++] = neighbours[i];
+                }
+            }
+        }
+
+        // Keep the nearest sites in order by insertion.
+        uint32_t * row = planner->distance + (size_t) site * count;
+        uint32_t * nearest = planner->neighbours +
+                             (size_t) site * TOUR_NEIGHBOURS;
+        uint32_t kept = 0;
+        uint32_t other;
+        for ( other = 0; other < count; other++ ) {
+            uint32_t distance = steps[planner->siteNode[other]];
+            row[other] = distance;
+            if ( other == site || distance == UNREACHABLE )
+                continue;
+            if ( kept == TOUR_NEIGHBOURS &&
+                 distance >= row[nearest[kept - 1]] )
+                continue;
+            uint32_t k = ( kept < TOUR_NEIGHBOURS ? kept++ : kept - 1 );
+            while ( k > 0 && row[nearest[k - 1]] > distance ) {
+                nearest[k] = nearest[k - 1];
+                k--;
+            }
+            nearest[k] = other;
+        }
+    }
+    return NULL;
+}
+
+static uint32_t next_site( const tour_worker * worker, size_t index ) {
+    const tour_planner * planner = worker->planner;
+    if ( index + 1 < planner->siteCount )
+        return worker->order[index + 1];
+    return ( planner->closed ? worker->order[0] : TOUR_NONE );
+}
+
+static uint32_t previous_site( const tour_worker * worker, size_t index ) {
+    const tour_planner * planner = worker->planner;
+    if ( index > 0 )
+        return worker->order[index - 1];
+    return ( planner->closed ? worker->order[planner->siteCount - 1] :
+             TOUR_NONE );
+}
+
+static void mark_changed( tour_worker * worker, size_t start, size_t end ) {
+    if ( start < worker->changedStart )
+        worker->changedStart = start;
+    if ( end + 1 > worker->changedEnd )
+        worker->changedEnd = end + 1;
+}
+
+static void enqueue( tour_worker * worker, uint32_t site ) {
+    if ( site == TOUR_NONE || worker->queued[site] )
+        return;
+    uint32_t count = worker->planner->siteCount;
+    worker->queued[site] = 1;
+    worker->queue[( worker->queueStart + worker->queueCount++ ) % count] =
+        site;
+}
+
+static void reverse( tour_worker * worker, size_t start, size_t end ) {
+    mark_changed( worker, start, end );
+    while ( start < end ) {
+        uint32_t swapped = worker->order[start];
+        worker->order[start] = worker->order[end];
+        worker->order[end] = swapped;
+        worker->position[worker->order[start]] = (uint32_t) start;
+        worker->position[worker->order[end]] = (uint32_t) end;
+        start++;
+        end--;
+    }
+}
+
+static void move_segment( tour_worker * worker, size_t start, size_t end,
+                          uint32_t after, int reversed ) {
+    uint32_t segment[MAX_SEGMENT];
+    size_t length = end - start + 1;
+    size_t i;
+    for ( i = 0; i < length; i++ )
+        segment[i] = worker->order[reversed ? end - i : start + i];
+
+    size_t target = worker->position[after];
+    size_t first;
+    if ( target < start ) {
+        // Shift the sites between right, and put the segment after `after`.
+        memmove( worker->order + target + 1 + length,
+                 worker->order + target + 1,
+                 ( start - target - 1 ) * sizeof ( uint32_t ) );
+        first = target + 1;
+        mark_changed( worker, first, end );
+    } else {
+        // Shift the sites between left, and put the segment before the site
+        // after `after`.
+        memmove( worker->order + start, worker->order + end + 1,
+                 ( target - end ) * sizeof ( uint32_t ) );
+        first = target + 1 - length;
+        mark_changed( worker, start, target );
+    }
+    memcpy( worker->order + first, segment, length * sizeof ( uint32_t ) );
+    size_t from = ( first < start ? first : start );
+    size_t to = ( target > end ? target : end );
+    for ( i = from; i <= to; i++ )
+        worker->position[worker->order[i]] = (uint32_t) i;
+}
+
+static int two_opt( tour_worker * worker, uint32_t site ) {
+    const tour_planner * planner = worker->planner;
+    const uint32_t * nearest = planner->neighbours +
+                               (size_t) site * TOUR_NEIGHBOURS;
+    size_t i = worker->position[site];
+    uint32_t k;
+
+    // Replace the edge after the site with one to a nearer site c, and the
+    // edge after c with one between the sites that followed them.
+    uint32_t after = next_site( worker, i );
+    if ( after != TOUR_NONE ) {
+        uint32_t removed = site_distance( planner, site, after );
+        for ( k = 0; k < planner->neighbourCount; k++ ) {
+            uint32_t c = nearest[k];
+            uint32_t added = site_distance( planner, site, c );
+            if ( added >= removed )
+                break;
+            size_t j = worker->position[c];
+            uint32_t d = next_site( worker, j );
+            if ( c == after || d == site )
+                continue;
+            int64_t delta = (int64_t) added - removed;
+            if ( d != TOUR_NONE )
+                delta += (int64_t) site_distance( planner, after, d ) -
+                         site_distance( planner, c, d );
+            if ( delta >= 0 )
+                continue;
+            if ( j > i )
+                reverse( worker, i + 1, j );
+            else
+                reverse( worker, j + 1, i );
+            worker->length += delta;
+            worker->moves++;
+            enqueue( worker, site );
+            enqueue( worker, after );
+            enqueue( worker, c );
+            enqueue( worker, d );
+            return 1;
+        }
+    }
+
+    // Likewise with the edges before the site and before c.
+    uint32_t before = previous_site( worker, i );
+    if ( before != TOUR_NONE ) {
+        uint32_t removed = site_distance( planner, before, site );
+        for ( k = 0; k < planner->neighbourCount; k++ ) {
+            uint32_t c = nearest[k];
+            uint32_t added = site_distance( planner, site, c );
+            if ( added >= removed )
+                break;
+            size_t j = worker->position[c];
+            uint32_t f = previous_site( worker, j );
+            if ( c == before || f == site || f == TOUR_NONE )
+                continue;
+            // Site 0 stays first.
+            if ( ( j > i && i == 0 ) || ( j < i && j == 0 ) )
+                continue;
+            int64_t delta = (int64_t) added - removed +
+                            site_distance( planner, before, f ) -
+                            site_distance( planner, f, c );
+            if ( delta >= 0 )
+                continue;
+            if ( j > i )
+                reverse( worker, i, j - 1 );
+            else
+                reverse( worker, j, i - 1 );
+            worker->length += delta;
+            worker->moves++;
+            enqueue( worker, site );
+            enqueue( worker, before );
+            enqueue( worker, c );
+            enqueue( worker, f );
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int or_opt( tour_worker * worker, uint32_t site ) {
+    const tour_planner * planner = worker->planner;
+    const uint32_t * nearest = planner->neighbours +
+                               (size_t) site * TOUR_NEIGHBOURS;
+    size_t n = planner->siteCount;
+    size_t i = worker->position[site];
+    size_t length;
+    int forwards;
+    for ( length = 1; length <= MAX_SEGMENT; length++ ) {
+        for ( forwards = 1; forwards >= ( length > 1 ? 0 : 1 ); forwards-- ) {
+            // The segment runs from the site forwards or backwards, and never
+            // includes site 0.
+            if ( ! forwards && i + 1 < length )
+                continue;
+            size_t start = ( forwards ? i : i + 1 - length );
+            size_t end = start + length - 1;
+            if ( start == 0 || end >= n )
+                continue;
+            uint32_t first = worker->order[start];
+            uint32_t last = worker->order[end];
+            uint32_t other = ( site == first ? last : first );
+            uint32_t before = worker->order[start - 1];
+            uint32_t after = next_site( worker, end );
+            if ( after == before )
+                continue;
+            int64_t gain = site_distance( planner, before, first );
+            if ( after != TOUR_NONE )
+                gain += (int64_t) site_distance( planner, last, after ) -
+                        site_distance( planner, before, after );
+            if ( gain <= 0 )
+                continue;
+
+            uint32_t k;
+            for ( k = 0; k < planner->neighbourCount; k++ ) {
+                uint32_t c = nearest[k];
+                uint32_t joined = site_distance( planner, site, c );
+                if ( joined >= gain )
+                    break;
+                size_t j = worker->position[c];
+                if ( j >= start && j <= end )
+                    continue;
+                // Between c and the site after it, with the site next to c.
+                uint32_t cNext = next_site( worker, j );
+                if ( c != before ) {
+                    int64_t cost = joined;
+                    if ( cNext != TOUR_NONE )
+                        cost += (int64_t) site_distance( planner, other,
+                                                         cNext ) -
+                                site_distance( planner, c, cNext );
+                    if ( cost < gain ) {
+                        move_segment( worker, start, end, c, site != first );
+                        worker->length -= gain - cost;
+                        goto moved;
+                    }
+                }
+                // Between the site before c and c, with the site next to c.
+                uint32_t cPrevious = previous_site( worker, j );
+                if ( cPrevious != TOUR_NONE && c != after ) {
+                    int64_t cost = (int64_t) joined +
+                                   site_distance( planner, cPrevious, other ) -
+                                   site_distance( planner, cPrevious, c );
+                    if ( cost < gain ) {
+                        move_segment( worker, start, end, cPrevious,
+                                      site == first );
+                        worker->length -= gain - cost;
+                        goto moved;
+                    }
+                }
+                continue;
+moved:
+                worker->moves++;
+                enqueue( worker, site );
+                enqueue( worker, other );
+                enqueue( worker, before );
+                enqueue( worker, after );
+                enqueue( worker, c );
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void local_search( tour_worker * worker ) {
+    uint32_t count = worker->planner->siteCount;
+    while ( worker->queueCount > 0 ) {
+        uint32_t site = worker->queue[worker->queueStart];
+        worker->queueStart = ( worker->queueStart + 1 ) % count;
+        worker->queueCount--;
+        worker->queued[site] = 0;
+        if ( two_opt( worker, site ) || or_opt( worker, site ) )
+            enqueue( worker, site );
+    }
+}
+
+static void kick( tour_worker * worker ) {
+    const tour_planner * planner = worker->planner;
+    size_t n = planner->siteCount;
+    // Stretches [a, b) and [b, c) swap places, where 1 <= a < b < c <= n.
+    size_t a = 1 + (size_t) ( next_random( &worker->random ) % ( n - 2 ) );
+    size_t span = n - a;
+    if ( span > KICK_SPAN )
+        span = KICK_SPAN;
+    size_t b = a + 1 + (size_t) ( next_random( &worker->random ) %
+                                  ( span - 1 ) );
+    size_t c = b + 1 + (size_t) ( next_random( &worker->random ) %
+                                  ( a + span - b ) );
+    uint32_t * order = worker->order;
+    uint32_t beforeA = order[a - 1];
+    uint32_t firstA = order[a];
+    uint32_t lastA = order[b - 1];
+    uint32_t firstB = order[b];
+    uint32_t lastB = order[c - 1];
+    uint32_t after = next_site( worker, c - 1 );
+    int64_t delta = (int64_t) site_distance( planner, beforeA, firstB ) +
+                    site_distance( planner, lastB, firstA ) -
+                    site_distance( planner, beforeA, firstA ) -
+                    site_distance( planner, lastA, firstB );
+    if ( after != TOUR_NONE )
+        delta += (int64_t) site_distance( planner, lastA, after ) -
+                 site_distance( planner, lastB, after );
+
+    // Reversing both stretches, then the whole, swaps them.
+    reverse( worker, a, b - 1 );
+    reverse( worker, b, c - 1 );
+    reverse( worker, a, c - 1 );
+    worker->length += delta;
+    worker->kicks++;
+    enqueue( worker, beforeA );
+    enqueue( worker, firstA );
+    enqueue( worker, lastA );
+    enqueue( worker, firstB );
+    enqueue( worker, lastB );
+    enqueue( worker, after );
+}
+
+static void * improve( void * argument ) {
+    tour_worker * worker = (tour_worker *) argument;
+    const tour_planner * planner = worker->planner;
+    uint32_t n = planner->siteCount;
+    uint32_t i;
+    memcpy( worker->order, planner->order, n * sizeof ( uint32_t ) );
+    for ( i = 0; i < n; i++ )
+        worker->position[worker->order[i]] = i;
+    memset( worker->queued, 0, n );
+    worker->queueStart = 0;
+    worker->queueCount = 0;
+    worker->length = planner->length;
+    worker->random = planner->length * 31 + worker->index;
+    worker->moves = 0;
+    worker->kicks = 0;
+    for ( i = 1; i < n; i++ )
+        enqueue( worker, worker->order[i] );
+    local_search( worker );
+    memcpy( worker->best, worker->order, n * sizeof ( uint32_t ) );
+    worker->bestLength = worker->length;
+    if ( n < 4 )
+        return NULL;
+
+    // Perturb the best tour found and search again, keeping the result if it
+    // is no longer, and otherwise undoing the changes.
+    while ( now_ns() < planner->deadline ) {
+        worker->changedStart = n;
+        worker->changedEnd = 0;
+        kick( worker );
+        local_search( worker );
+        size_t start = worker->changedStart;
+        size_t count = worker->changedEnd - start;
+        if ( worker->length <= worker->bestLength ) {
+            memcpy( worker->best + start, worker->order + start,
+                    count * sizeof ( uint32_t ) );
+            worker->bestLength = worker->length;
+        } else {
+            memcpy( worker->order + start, worker->best + start,
+                    count * sizeof ( uint32_t ) );
+            for ( i = (uint32_t) start; i < worker->changedEnd; i++ )
+                worker->position[worker->order[i]] = i;
+            worker->length = worker->bestLength;
+        }
+    }
+    return NULL;
+}
+
+plan_error init_tour( tour_planner * planner, const grid_map * map,
+                      uint32_t siteCapacity, unsigned threadCount ) {
+    memset( planner, 0, sizeof ( tour_planner ) );
+    if ( siteCapacity == 0 || threadCount == 0 ||
+         siteCapacity >= TOUR_NONE ||
+         siteCapacity > SIZE_MAX / sizeof ( uint32_t ) / siteCapacity )
+        return PLAN_ILLEGAL_ARG;
+
+    size_t sites = siteCapacity;
+    size_t nodes = grid_node_count( map );
+    planner->siteNode = (grid_node *) malloc( sites * sizeof ( grid_node ) );
+    planner->distance = (uint32_t *) malloc( sites * sites *
+                                             sizeof ( uint32_t ) );
+    planner->neighbours = (uint32_t *) malloc( sites * TOUR_NEIGHBOURS *
+                                               sizeof ( uint32_t ) );
+    planner->order = (uint32_t *) malloc( sites * sizeof ( uint32_t ) );
+    planner->workers = (tour_worker *) calloc( threadCount,
+                                               sizeof ( tour_worker ) );
+    planner->workerCount = threadCount;
+    if ( planner->siteNode == NULL || planner->distance == NULL ||
+         planner->neighbours == NULL || planner->order == NULL ||
+         planner->workers == NULL ) {
+        free_tour( planner );
+        return PLAN_OTHER_ERROR;
+    }
+    unsigned i;
+    for ( i = 0; i < threadCount; i++ ) {
+        tour_worker * worker = &planner->workers[i];
+        worker->planner = planner;
+        worker->index = i;
+        worker->steps = (uint32_t *) malloc( nodes * sizeof ( uint32_t ) );
+        worker->frontier = (grid_node *) malloc( nodes *
+                                                 sizeof ( grid_node ) );
+        worker->order = (uint32_t *) malloc( sites * sizeof ( uint32_t ) );
+        worker->position = (uint32_t *) malloc( sites * sizeof ( uint32_t ) );
+        worker->best = (uint32_t *) malloc( sites * sizeof ( uint32_t ) );
+        worker->queue = (uint32_t *) malloc( sites * sizeof ( uint32_t ) );
+        worker->queued = (unsigned char *) malloc( sites );
+        if ( worker->steps == NULL || worker->frontier == NULL ||
+             worker->order == NULL || worker->position == NULL ||
+             worker->best == NULL || worker->queue == NULL ||
+             worker->queued == NULL ) {
+            free_tour( planner );
+            return PLAN_OTHER_ERROR;
+        }
+    }
+    planner->map = map;
+    planner->siteCapacity = siteCapacity;
+    return PLAN_SUCCESS;
+}
+
+void free_tour( tour_planner * planner ) {
+    unsigned i;
+    for ( i = 0; planner->workers != NULL && i < planner->workerCount; i++ ) {
+        tour_worker * worker = &planner->workers[i];
+        free( worker->steps );
+        free( worker->frontier );
+        free( worker->order );
+        free( worker->position );
+        free( worker->best );
+        free( worker->queue );
+        free( worker->queued );
+    }
+    free( planner->workers );
+    free( planner->siteNode );
+    free( planner->distance );
+    free( planner->neighbours );
+    free( planner->order );
+    memset( planner, 0, sizeof ( tour_planner ) );
+}
+
+plan_error tour_set_sites( tour_planner * planner, const grid_node * sites,
+                           uint32_t count ) {
+    planner->siteCount = 0;
+    planner->built = 0;
+    if ( count == 0 || count > planner->siteCapacity )
+        return PLAN_ILLEGAL_ARG;
+    uint32_t i;
+    for ( i = 0; i < count; i++ ) {
+        if ( grid_is_blocked( planner->map, sites[i] ) )
+            return PLAN_ILLEGAL_ARG;
+        planner->siteNode[i] = sites[i];
+    }
+
+    planner->siteCount = count;
+    planner->neighbourCount = ( count - 1 < TOUR_NEIGHBOURS ? count - 1 :
+                                TOUR_NEIGHBOURS );
+    if ( run_workers( planner, search_sites ) ) {
+        planner->siteCount = 0;
+        return PLAN_OTHER_ERROR;
+    }
+    // The grid is undirected, so every site can reach every other if site 0
+    // can reach them all.
+    for ( i = 0; i < count; i++ ) {
+        if ( planner->distance[i] == UNREACHABLE ) {
+            planner->siteCount = 0;
+            return PLAN_NO_PATH;
+        }
+    }
+    return PLAN_SUCCESS;
+}
+
+plan_error tour_build( tour_planner * planner, int closed ) {
+    uint32_t n = planner->siteCount;
+    if ( n == 0 )
+        return PLAN_ILLEGAL_ARG;
+
+    // The distance from the tour of each site not in it yet, or UNREACHABLE
+    // once it is in the tour, and the length of the edge after each index of
+    // the tour, or 0 after the end of an open tour.
+    uint32_t * nearest = planner->workers[0].best;
+    uint32_t * edge = planner->workers[0].position;
+    uint32_t * order = planner->order;
+    uint32_t site;
+    order[0] = 0;
+    edge[0] = 0;
+    nearest[0] = UNREACHABLE;
+    for ( site = 1; site < n; site++ )
+        nearest[site] = site_distance( planner, 0, site );
+
+    uint32_t size;
+    for ( size = 1; size < n; size++ ) {
+        uint32_t added = 0;
+        uint32_t least = UNREACHABLE;
+        for ( site = 1; site < n; site++ ) {
+            if ( nearest[site] < least ) {
+                least = nearest[site];
+                added = site;
+            }
+        }
+
+        // The distances are symmetric, so those to the site are read along
+        // its row.
+        const uint32_t * row = planner->distance + (size_t) added * n;
+        uint32_t k;
+        uint32_t at = 0;
+        int64_t cheapest = INT64_MAX;
+        for ( k = 0; k < size; k++ ) {
+            int64_t cost = row[order[k]];
+            if ( k + 1 < size || closed )
+                cost += (int64_t) row[order[( k + 1 ) % size]] - edge[k];
+            if ( cost < cheapest ) {
+                cheapest = cost;
+                at = k + 1;
+            }
+        }
+        memmove( order + at + 1, order + at,
+                 ( size - at ) * sizeof ( uint32_t ) );
+        memmove( edge + at + 1, edge + at,
+                 ( size - at ) * sizeof ( uint32_t ) );
+        order[at] = added;
+        edge[at - 1] = row[order[at - 1]];
+        if ( at < size || closed )
+            edge[at] = row[order[( at + 1 ) % ( size + 1 )]];
+        else
+            edge[at] = 0;
+
+        nearest[added] = UNREACHABLE;
+        for ( site = 1; site < n; site++ ) {
+            if ( nearest[site] != UNREACHABLE && row[site] < nearest[site] )
+                nearest[site] = row[site];
+        }
+    }
+
+    planner->closed = closed;
+    planner->length = 0;
+    for ( site = 0; site + 1 < n; site++ )
+        planner->length += site_distance( planner, order[site],
+                                          order[site + 1] );
+    if ( closed )
+        planner->length += site_distance( planner, order[n - 1], order[0] );
+    planner->dispatched = 0;
+    planner->built = 1;
+    return PLAN_SUCCESS;
+}
+
+plan_error tour_improve( tour_planner * planner, uint32_t timeLimit ) {
+    if ( ! planner->built )
+        return PLAN_ILLEGAL_ARG;
+    uint32_t n = planner->siteCount;
+    if ( n < 3 )
+        return PLAN_NO_EFFECT;
+
+    planner->deadline = now_ns() + (uint64_t) timeLimit * 1000000u;
+    if ( run_workers( planner, improve ) )
+        return PLAN_OTHER_ERROR;
+
+    const tour_worker * best = &planner->workers[0];
+    unsigned i;
+    for ( i = 1; i < planner->workerCount; i++ ) {
+        if ( planner->workers[i].bestLength < best->bestLength )
+            best = &planner->workers[i];
+    }
+    if ( best->bestLength >= planner->length )
+        return PLAN_NO_EFFECT;
+    memcpy( planner->order, best->best, n * sizeof ( uint32_t ) );
+    planner->length = best->bestLength;
+    planner->dispatched = 0;
+    return PLAN_SUCCESS;
+}
+
+const uint32_t * tour_order( const tour_planner * planner, size_t * count ) {
+    *count = ( planner->built ? planner->siteCount : 0 );
+    return planner->order;
+}
+
+plan_error tour_dispatch( tour_planner * planner, allocator_send_fn send,
+                          void * context ) {
+    uint32_t n = ( planner->built ? planner->siteCount : 0 );
+    uint32_t legs = ( n < 2 ? 0 : planner->closed ? n : n - 1 );
+    if ( planner->dispatched >= legs )
+        return PLAN_NO_EFFECT;
+    while ( planner->dispatched < legs ) {
+        uint32_t k = planner->dispatched;
+        grid_node from = planner->siteNode[planner->order[k]];
+        grid_node to = planner->siteNode[planner->order[( k + 1 ) % n]];
+        unsigned char message[JOB_MESSAGE_SIZE];
+        uint16_t length = allocator_job_message( from, to, message );
+        if ( send( context, 0, message, length ) )
+            return PLAN_OTHER_ERROR;
+        planner->dispatched++;
+    }
+    return PLAN_SUCCESS;
+}
@@ -0,0 +1,209 @@
+/*! \file
+ * \brief Ordering of the sites one robot visits, such as failed sensor nodes
+ * to repair, so that the robot's route through them is short (a travelling
+ * salesman tour).
+ *
+ * Site 0 is where the robot starts. The tour either ends at the last site
+ * (open), or returns to site 0 (closed). Its length is the number of steps
+ * between neighbouring nodes of the grid along it, found by breadth-first
+ * search around blocked nodes.
+ *
+ * Planning a tour takes three calls:
+ *
+ * - `tour_set_sites()` finds the steps between every pair of sites, with a
+ *   breadth-first search from each site. The searches are shared between
+ *   threads, as each fills its own rows of the distance matrix.
+ * - `tour_build()` builds a tour by nearest insertion: it repeatedly inserts
+ *   the site nearest the tour where it lengthens the tour least.
+ * - `tour_improve()` improves the tour by local search until a time limit:
+ *   2-opt, which reverses a stretch of the tour, and Or-opt, which moves one
+ *   to three consecutive sites elsewhere. Moves are only tried that join a
+ *   site to one of its nearest sites. Each thread searches from a different
+ *   random perturbation of the best tour it has found, and the best of the
+ *   threads is kept.
+ *
+ * The distance matrix takes 4 bytes for each pair of sites: 100 MB for 5000.
+ *
+ * Usage
+ * =====
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~{.c}
+ * tour_planner planner;
+ * init_tour( &planner, &map, maxSites, threadCount );
+ * sites[0] = robotNode;
+ * tour_set_sites( &planner, sites, siteCount );
+ * tour_build( &planner, 0 );
+ * tour_improve( &planner, 200 );
+ * tour_dispatch( &planner, send_job, context );
+ * free_tour( &planner );
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+#ifndef TOUR_H
+#define TOUR_H
+#include "plan_error.h"
+#include "grid_map.h"
+#include "allocate.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/*! \def TOUR_NEIGHBOURS
+ * Number of nearest sites of each site that moves may join it to.
+ */
+#define TOUR_NEIGHBOURS 10
+
+/*! \def TOUR_NONE
+ * Index of no site.
+ */
+#define TOUR_NONE UINT32_MAX
+
+struct tour_planner;
+
+/*! \brief State of one thread of a planner.
+ */
+typedef struct tour_worker {
+    struct tour_planner * planner; /*!< The planner it works for. */
+    unsigned index; /*!< Index of the worker, from 0. */
+    pthread_t thread; /*!< The thread, while it runs. */
+    uint32_t * steps; /*!< Steps from the site searched from to each node. */
+    grid_node * frontier; /*!< Queue of the breadth-first search. */
+    uint32_t * order; /*!< The tour being improved, as sites. */
+    uint32_t * position; /*!< Index of each site in `order`. */
+    uint32_t * best; /*!< The shortest tour found. */
+    uint32_t * queue; /*!< Sites to search moves from. */
+    unsigned char * queued; /*!< Whether each site is in `queue`. */
+    size_t queueStart; /*!< Index in `queue` of the next site. */
+    size_t queueCount; /*!< Number of sites in `queue`. */
+    size_t changedStart; /*!< First index of `order` that may differ from
+                          * `best`. */
+    size_t changedEnd; /*!< One past the last index of `order` that may
+                        * differ from `best`. */
+    uint64_t length; /*!< Length of `order`. */
+    uint64_t bestLength; /*!< Length of `best`. */
+    uint64_t random; /*!< State of the random number generator. */
+    size_t moves; /*!< Moves made. */
+    size_t kicks; /*!< Perturbations made. */
+} tour_worker;
+
+/*! \brief Distances between sites, and the tour through them. Initialise with
+ * `init_tour()`.
+ */
+typedef struct tour_planner {
+    const grid_map * map; /*!< The grid the sites are on. */
+    uint32_t siteCapacity; /*!< Largest number of sites. */
+    uint32_t siteCount; /*!< Number of sites. */
+    grid_node * siteNode; /*!< Node of each site. */
+    uint32_t * distance; /*!< Steps between each pair of sites, by row. */
+    uint32_t * neighbours; /*!< The nearest sites of each site, nearest
+                            * first, `TOUR_NEIGHBOURS` per site. */
+    uint32_t neighbourCount; /*!< Number of nearest sites of each site. */
+    int built; /*!< Non-zero once a tour of the sites has been built. */
+    int closed; /*!< Non-zero if the tour returns to site 0. */
+    uint32_t * order; /*!< The tour, as sites, starting with site 0. */
+    uint64_t length; /*!< Length of the tour. */
+    uint32_t dispatched; /*!< Number of legs of the tour sent. */
+    unsigned workerCount; /*!< Number of threads. */
+    tour_worker * workers; /*!< State of each thread. */
+    uint64_t deadline; /*!< When `tour_improve()` stops, in ns. */
+} tour_planner;
+
+/*! \brief Allocate the arrays of a planner.
+ *
+ * \param [out] planner The planner to initialise.
+ * \param [in] map The grid the sites are on, which must outlive the planner.
+ * Changes to which nodes are blocked take effect in the next
+ * `tour_set_sites()`.
+ * \param [in] siteCapacity The largest number of sites, including the start.
+ * \param [in] threadCount The number of threads to search with.
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS}
+ *
+ * \linkerror{PLAN_ILLEGAL_ARG} if `siteCapacity` or `threadCount` is 0, or
+ * `siteCapacity` is too large
+ *
+ * \linkerror{PLAN_OTHER_ERROR} if memory could not be allocated.
+ * \endparblock
+ */
+plan_error init_tour( tour_planner * planner, const grid_map * map,
+                      uint32_t siteCapacity, unsigned threadCount );
+
+/*! \brief Free the arrays of a planner initialised with `init_tour()`.
+ */
+void free_tour( tour_planner * planner );
+
+/*! \brief Set the sites to visit, and find the steps between them.
+ *
+ * \param [in] sites The node of each site, starting with the robot's.
+ * \param [in] count The number of sites.
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS}
+ *
+ * \linkerror{PLAN_ILLEGAL_ARG} if `count` is 0 or more than the capacity of
+ * the planner, or a site is blocked or not in the grid
+ *
+ * \linkerror{PLAN_NO_PATH} if a site cannot be reached from site 0
+ *
+ * \linkerror{PLAN_OTHER_ERROR} if a thread could not be started.
+ * \endparblock
+ */
+plan_error tour_set_sites( tour_planner * planner, const grid_node * sites,
+                           uint32_t count );
+
+/*! \brief Build a tour of the sites by nearest insertion.
+ *
+ * \param [in] closed Non-zero if the tour is to return to site 0.
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS}
+ *
+ * \linkerror{PLAN_ILLEGAL_ARG} if the sites have not been set.
+ * \endparblock
+ */
+plan_error tour_build( tour_planner * planner, int closed );
+
+/*! \brief Shorten the tour by local search.
+ *
+ * Each thread first improves the tour until no move shortens it, however
+ * long that takes, then perturbs and improves it until the time limit.
+ * \param [in] timeLimit The time in ms to search for.
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS}
+ *
+ * \linkerror{PLAN_NO_EFFECT} if the tour was not shortened
+ *
+ * \linkerror{PLAN_ILLEGAL_ARG} if no tour has been built
+ *
+ * \linkerror{PLAN_OTHER_ERROR} if a thread could not be started.
+ * \endparblock
+ */
+plan_error tour_improve( tour_planner * planner, uint32_t timeLimit );
+
+/*! \brief Get the tour.
+ *
+ * \param [out] count The number of sites in the tour.
+ * \return The sites in the order to visit them, starting with site 0, valid
+ * until the tour is next built or improved.
+ */
+const uint32_t * tour_order( const tour_planner * planner, size_t * count );
+
+/*! \brief Send the legs of the tour not sent yet to the robot, as the jobs
+ * made by `allocator_job_message()`, in order.
+ *
+ * \param [in] send Sends each job, with a robot of 0.
+ * \param [in] context Passed to `send`.
+ * \return
+ * \parblock
+ * \linkerror{PLAN_SUCCESS}
+ *
+ * \linkerror{PLAN_NO_EFFECT} if every leg had been sent
+ *
+ * \linkerror{PLAN_OTHER_ERROR} if `send` failed; the leg is sent again by the
+ * next call.
+ * \endparblock
+ */
+plan_error tour_dispatch( tour_planner * planner, allocator_send_fn send,
+                          void * context );
+
+#endif
@@ -0,0 +1,98 @@
+/*
+ * Measures A* on square grids from the robot's 3x3 grid up to 1000x1000, open
+ * and with some nodes blocked: paths are planned between random pairs of open
+ * nodes, and the mean nodes expanded and wall time per search are printed for
+ * each grid.
+ *
+ * Usage: bench_astar [percent blocked], by default 20.
+ */
+#include "check.h"
+#include "astar.h"
+#include <time.h>
+
+#define DEFAULT_PERCENT 20
+// Grid nodes times searches on each grid, to keep the runs of similar
+// length, with at least 1000 searches on the largest grids.
+#define NODE_BUDGET 20000000
+
+/*
+ * Time the searches on one grid and print the results.
+ */
+static void run( uint32_t size, uint32_t percent );
+
+/*
+ * Draw a random open node of the grid.
+ */
+static grid_node random_open_node( const grid_map * map, uint32_t * random );
+
+static grid_node random_open_node( const grid_map * map, uint32_t * random ) {
+    grid_node node;
+    do {
+        *random = *random * 1103515245 + 12345;
+        node = (grid_node) ( ( *random >> 4 ) % grid_node_count( map ) );
+    } while ( grid_is_blocked( map, node ) );
+    return node;
+}
+
+static void run( uint32_t size, uint32_t percent ) {
+    grid_map map;
+    CHECK( square_grid_map( &map, size, 1 ) == PLAN_SUCCESS );
+    size_t nodes = grid_node_count( &map );
+    uint32_t random = 1;
+    grid_node node;
+    for ( node = 0; node < nodes; node++ ) {
+        random = random * 1103515245 + 12345;
+        // Node 0 is left open, so that even the smallest grid has one.
+        if ( node > 0 && ( random >> 8 ) % 100 < percent )
+            CHECK( grid_set_blocked( &map, node, 1 ) == PLAN_SUCCESS );
+    }
+
+    astar_planner planner;
+    CHECK( init_astar( &planner, nodes ) == PLAN_SUCCESS );
+    grid_node * path = (grid_node *) malloc( nodes * sizeof ( grid_node ) );
+    CHECK( path != NULL );
+    size_t searches = NODE_BUDGET / nodes;
+    if ( searches < 1000 )
+        searches = 1000;
+    size_t i, found = 0, expanded = 0;
+    struct timespec start, end;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    for ( i = 0; i < searches; i++ ) {
+        grid_node from = random_open_node( &map, &random );
+        grid_node to = random_open_node( &map, &random );
+        size_t count;
+        plan_error errorCode = astar_find_path( &planner, &map, from, to, path,
+                                                nodes, &count );
+        CHECK( errorCode == PLAN_SUCCESS || errorCode == PLAN_NO_PATH );
+        found += ( errorCode == PLAN_SUCCESS );
+        expanded += planner.expanded;
+    }
+    clock_gettime( CLOCK_MONOTONIC, &end );
+    double us = ( ( end.tv_sec - start.tv_sec ) * 1e6 +
+                  ( end.tv_nsec - start.tv_nsec ) / 1e3 ) / searches;
+    char grid[24];
+    snprintf( grid, sizeof ( grid ), "%ux%u", size, size );
+    printf( "%10s %8zu %8zu %12.1f %12.2f\n", grid, searches, found,
+            (double) expanded / searches, us );
+
+    free( path );
+    free_astar( &planner );
+    free_grid_map( &map );
+}
+
+int main( int argc, char ** argv ) {
+    uint32_t percent = ( argc > 1 ? (uint32_t) atoi( argv[1] ) :
+                         DEFAULT_PERCENT );
+    CHECK( percent < 100 );
+    const uint32_t sizes[] = { 3, 10, 30, 100, 300, 1000 };
+    const uint32_t percents[] = { 0, percent };
+    size_t i, j;
+    for ( j = 0; j < 2; j++ ) {
+        printf( "%u%% blocked\n", percents[j] );
+        printf( "%10s %8s %8s %12s %12s\n", "grid", "searches", "paths",
+                "expanded", "us/search" );
+        for ( i = 0; i < sizeof ( sizes ) / sizeof ( sizes[0] ); i++ )
+            run( sizes[i], percents[j] );
+    }
+    return 0;
+}
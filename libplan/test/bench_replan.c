@@ -0,0 +1,113 @@
+/*
+ * Compares replanning with D* Lite and with A* from scratch as a robot
+ * discovers obstacles: the robot crosses a square grid, from one corner to
+ * the other, whose obstacles it only finds as its sonar sees the next node of
+ * its path. Each obstacle found is blocked and the path planned again by both
+ * planners, which must agree on its length. The nodes expanded and the wall
+ * time of the first plan and of each replan are printed, then the totals of
+ * the replans.
+ *
+ * Usage: bench_replan [size [percent blocked]], by default 200 and 20.
+ */
+#include "check.h"
+#include "astar.h"
+#include "dstar.h"
+#include <time.h>
+
+#define DEFAULT_SIZE 200
+#define DEFAULT_PERCENT 20
+
+/*
+ * Time elapsed since the given time on the monotonic clock, in us.
+ */
+static long elapsed_us( const struct timespec * since );
+
+static long elapsed_us( const struct timespec * since ) {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return ( now.tv_sec - since->tv_sec ) * 1000000L +
+           ( now.tv_nsec - since->tv_nsec ) / 1000L;
+}
+
+int main( int argc, char ** argv ) {
+    uint32_t size = ( argc > 1 ? (uint32_t) atoi( argv[1] ) : DEFAULT_SIZE );
+    uint32_t percent = ( argc > 2 ? (uint32_t) atoi( argv[2] ) :
+                         DEFAULT_PERCENT );
+    CHECK( size >= 2 && percent < 100 );
+
+    // The obstacles the robot finds, and the grid it knows of.
+    grid_map world, map;
+    CHECK( init_grid_map( &world, size, size, 0, 0, 1 ) == PLAN_SUCCESS );
+    CHECK( init_grid_map( &map, size, size, 0, 0, 1 ) == PLAN_SUCCESS );
+    size_t nodes = grid_node_count( &map );
+    grid_node start = grid_node_at( &map, 0, 0 );
+    grid_node goal = grid_node_at( &map, size - 1, size - 1 );
+    uint32_t random = 1;
+    grid_node node;
+    for ( node = 0; node < nodes; node++ ) {
+        random = random * 1103515245 + 12345;
+        if ( node != start && node != goal && ( random >> 8 ) % 100 < percent )
+            CHECK( grid_set_blocked( &world, node, 1 ) == PLAN_SUCCESS );
+    }
+
+    dstar_planner dstar;
+    astar_planner astar;
+    CHECK( init_dstar( &dstar, &map ) == PLAN_SUCCESS );
+    CHECK( init_astar( &astar, nodes ) == PLAN_SUCCESS );
+    grid_node * path = (grid_node *) malloc( nodes * sizeof ( grid_node ) );
+    CHECK( path != NULL );
+    CHECK( dstar_reset( &dstar, start, goal ) == PLAN_SUCCESS );
+
+    printf( "%ux%u grid, %u%% blocked\n", size, size, percent );
+    printf( "%6s %8s %10s %8s %10s %8s\n", "replan", "at", "D* nodes",
+            "D* us", "A* nodes", "A* us" );
+    size_t replans = 0, dstarExpanded = 0, astarExpanded = 0;
+    long dstarTime = 0, astarTime = 0;
+    grid_node robot = start;
+    plan_error errorCode = PLAN_SUCCESS;
+    for ( ;; ) {
+        struct timespec begin;
+        size_t count, astarCount;
+        clock_gettime( CLOCK_MONOTONIC, &begin );
+        dstar_set_start( &dstar, robot );
+        errorCode = dstar_find_path( &dstar, path, nodes, &count );
+        long dstarUs = elapsed_us( &begin );
+        clock_gettime( CLOCK_MONOTONIC, &begin );
+        plan_error astarError = astar_find_path( &astar, &map, robot, goal,
+                                                 path, nodes, &astarCount );
+        long astarUs = elapsed_us( &begin );
+        CHECK( astarError == errorCode );
+        if ( errorCode )
+            break;
+        CHECK( astarCount == count );
+
+        printf( "%6zu %8u %10zu %8ld %10zu %8ld\n", replans, robot,
+                dstar.expanded, dstarUs, astar.expanded, astarUs );
+        // The first plan is a full search for both planners.
+        if ( replans++ > 0 ) {
+            dstarExpanded += dstar.expanded;
+            astarExpanded += astar.expanded;
+            dstarTime += dstarUs;
+            astarTime += astarUs;
+        }
+
+        // Follow the path until the sonar sees an obstacle on the next node.
+        size_t step = 1;
+        while ( step < count && ! grid_is_blocked( &world, path[step] ) )
+            robot = path[step++];
+        if ( robot == goal )
+            break;
+        CHECK( dstar_set_blocked( &dstar, path[step], 1 ) == PLAN_SUCCESS );
+    }
+
+    printf( "%s; %zu replans: D* %zu nodes, %ld us; A* %zu nodes, %ld us\n",
+            robot == goal ? "goal reached" : "no path",
+            ( replans > 0 ? replans - 1 : 0 ), dstarExpanded, dstarTime,
+            astarExpanded, astarTime );
+    free( path );
+    free_astar( &astar );
+    free_dstar( &dstar );
+    free_grid_map( &map );
+    free_grid_map( &world );
+    return 0;
+}
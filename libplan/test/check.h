@@ -0,0 +1,24 @@
+/*! \file
+ * \brief A check for the tests of libplan, each of which is a program that
+ * exits with a non-zero status when a check fails.
+ */
+#ifndef CHECK_H
+#define CHECK_H
+#include <stdio.h>
+#include <stdlib.h>
+
+/*! \def CHECK
+ * Print the condition and exit with status 1 if it is false. Unlike
+ * `assert()`, the condition is evaluated even when `NDEBUG` is defined, so it
+ * may have side effects.
+ */
+#define CHECK( condition ) \
+    do { \
+        if ( ! ( condition ) ) { \
+            fprintf( stderr, "%s:%d: check failed: %s\n", __FILE__, \
+                     __LINE__, #condition ); \
+            exit( 1 ); \
+        } \
+    } while ( 0 )
+
+#endif
@@ -0,0 +1,87 @@
+/*
+ * Checks that allocator_assign() leaves a site waiting only if no robot at all
+ * can reach it: on a 5x1 grid split by a blocked node, a site that only the
+ * robot due to finish last can reach is still allocated to it, while a site
+ * that no robot can reach waits and is reported as PLAN_NO_PATH.
+ */
+#include "check.h"
+#include "allocate.h"
+
+// Nodes of the 5x1 grid: robots start at either end of it, and the middle is
+// blocked.
+#define LEFT 0
+#define MIDDLE 2
+#define RIGHT 4
+
+/*
+ * Add a site at a node.
+ */
+static repair_site add_site( repair_allocator * allocator, grid_node node );
+
+/*
+ * Count the sites waiting to be allocated.
+ */
+static size_t count_waiting( const repair_allocator * allocator );
+
+static repair_site add_site( repair_allocator * allocator, grid_node node ) {
+    repair_site site;
+    CHECK( allocator_add_site( allocator, node, &site ) == PLAN_SUCCESS );
+    return site;
+}
+
+static size_t count_waiting( const repair_allocator * allocator ) {
+    size_t count = 0;
+    repair_site site;
+    for ( site = allocator->waiting; site != ALLOCATE_NONE;
+          site = allocator->siteNext[site] )
+        count++;
+    return count;
+}
+
+int main( void ) {
+    grid_map map;
+    CHECK( init_grid_map( &map, 5, 1, 0, 0, 1 ) == PLAN_SUCCESS );
+    CHECK( grid_set_blocked( &map, MIDDLE, 1 ) == PLAN_SUCCESS );
+    repair_allocator allocator;
+    CHECK( init_allocator( &allocator, &map, 2, 8 ) == PLAN_SUCCESS );
+    allocator.repairCost = 2;
+    CHECK( allocator_set_robot( &allocator, 0, LEFT ) == PLAN_SUCCESS );
+    CHECK( allocator_set_robot( &allocator, 1, RIGHT ) == PLAN_SUCCESS );
+
+    // Sites on both sides, two of them on the left, so that the left robot is
+    // due to finish last.
+    repair_site first[3];
+    first[0] = add_site( &allocator, LEFT + 1 );
+    first[1] = add_site( &allocator, LEFT );
+    first[2] = add_site( &allocator, RIGHT - 1 );
+    CHECK( allocator_assign( &allocator ) == PLAN_SUCCESS );
+    CHECK( allocator.siteRobot[first[0]] == 0 );
+    CHECK( allocator.siteRobot[first[1]] == 0 );
+    CHECK( allocator.siteRobot[first[2]] == 1 );
+    CHECK( allocator.finish[0] > allocator.finish[1] );
+
+    // Only the left robot can reach the next site, though it is not among the
+    // robots due to finish earliest.
+    repair_site left = add_site( &allocator, LEFT + 1 );
+    CHECK( allocator_assign( &allocator ) == PLAN_SUCCESS );
+    CHECK( allocator.siteRobot[left] == 0 );
+    CHECK( count_waiting( &allocator ) == 0 );
+
+    // With both robots on the right, no robot can reach the left.
+    free_allocator( &allocator );
+    CHECK( init_allocator( &allocator, &map, 2, 8 ) == PLAN_SUCCESS );
+    CHECK( allocator_set_robot( &allocator, 0, RIGHT - 1 ) == PLAN_SUCCESS );
+    CHECK( allocator_set_robot( &allocator, 1, RIGHT ) == PLAN_SUCCESS );
+    repair_site unreachable = add_site( &allocator, LEFT );
+    repair_site reachable = add_site( &allocator, RIGHT );
+    CHECK( allocator_assign( &allocator ) == PLAN_NO_PATH );
+    CHECK( allocator.siteRobot[unreachable] == ALLOCATE_NONE );
+    CHECK( allocator.siteRobot[reachable] != ALLOCATE_NONE );
+    CHECK( count_waiting( &allocator ) == 1 );
+    CHECK( allocator.waiting == unreachable );
+
+    free_allocator( &allocator );
+    free_grid_map( &map );
+    printf( "test_allocate: ok\n" );
+    return 0;
+}
@@ -0,0 +1,555 @@
+/*
+ * A headless simulator of a fleet of NXTs running Controller.java, for
+ * benchmarking the host without robots.
+ *
+ * Each robot listens on its own Unix domain socket, DIR/nxtN.sock, for the
+ * host to connect with open_socket_comm(), or, with -p, on its own pty, whose
+ * slave the host opens and passes to open_fd_comm(). The robots are shared
+ * between worker threads, each serving its robots' links with poll() and
+ * stepping them through simulated time in ticks. At speed 0, time runs as
+ * fast as the robots can be stepped, and stands still while every robot waits
+ * for the host.
+ *
+ * With -c, the robots sense while they drive, and the range readings each
+ * sends are also checked here, as demo.c checks them, so that the robot is
+ * told to stop a fixed latency after the reading that blocked its route,
+ * whatever the host does.
+ */
+// For the pty functions, and cfmakeraw().
+#define _GNU_SOURCE
+#include "sim_field.h"
+#include "sim_link.h"
+#include "sim_robot.h"
+#include "telemetry.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+// Bytes waiting to be written to the host at which a robot stops, as the NXT
+// blocks in a write until USB takes its data.
+#define BACKLOG_LIMIT 4096
+// Longest time in ms to wait in poll(), so that a signal to stop is noticed.
+#define POLL_LIMIT 100
+
+// Settings from the command line.
+typedef struct sim_settings {
+    size_t robots;
+    size_t threads;
+    const char * socketDir;
+    int pty;
+    double speed;
+    uint32_t tick;
+    double duration;
+    uint32_t gridSize;
+    float gridSquareSide;
+    float obstacleSide;
+    size_t obstacles;
+    uint64_t seed;
+    int checking;
+    uint32_t latency;
+    sim_robot_options robot;
+} sim_settings;
+
+// A robot and its link to the host.
+typedef struct sim_slot {
+    sim_robot robot;
+    sim_link link;
+    // Listening socket, or -1 for a pty.
+    int listener;
+    // The slave of the pty, kept open so that the master does not report a
+    // hang-up whenever the host closes it, or -1.
+    int ptySlave;
+    // Path the listening socket is bound to.
+    char path[sizeof ( ( (struct sockaddr_un *) 0 )->sun_path )];
+    // With -c: the host's checks of the robot's readings, and the stop due
+    // to be delivered at stopDue in the robot's time, if stopPending.
+    const sim_settings * settings;
+    route_checker checker;
+    int stopPending;
+    grid_node stopNode;
+    double stopDue;
+} sim_slot;
+
+// A thread serving some of the robots.
+typedef struct sim_worker {
+    const sim_settings * settings;
+    sim_slot * slots;
+    size_t count;
+    struct pollfd * fds;
+    // Simulated time stepped through, in ms.
+    double time;
+    pthread_t thread;
+} sim_worker;
+
+static volatile sig_atomic_t stopping = 0;
+
+/*
+ * Ask the workers to stop, on SIGINT or SIGTERM.
+ */
+static void stop( int sig );
+
+/*
+ * Print how to use the program.
+ */
+static void usage( const char * program );
+
+/*
+ * Read the command line.
+ * return: 0 if it was valid.
+ */
+static int parse_settings( int argc, char ** argv, sim_settings * settings );
+
+/*
+ * return: The time of a monotonic clock, in ms.
+ */
+static double now_ms( void );
+
+/*
+ * Open the listening socket or pty of a robot, and print where the host should
+ * connect.
+ * return: 0 on success, or -1 with errno set.
+ */
+static int open_endpoint( sim_slot * slot, const sim_settings * settings,
+                          size_t index );
+
+/*
+ * Handlers of the events of a link, which pass them on to the robot.
+ */
+static void session_started( void * context );
+static void message_received( void * context, const unsigned char * message,
+                              uint16_t length );
+static void session_ended( void * context );
+
+/*
+ * Send a message from a robot on its link, checking it first if it is a range
+ * reading and -c was given.
+ */
+static int send_to_host( void * context, const unsigned char * message,
+                         uint16_t length );
+
+/*
+ * Step a robot through a tick, delivering any stop that falls due in it.
+ */
+static void step_slot( sim_slot * slot, uint32_t tick );
+
+/*
+ * Stop serving a session whose link failed: close a socket, so that the
+ * robot accepts another connection, or wait for the handshake again on a pty.
+ */
+static void drop_session( sim_slot * slot );
+
+/*
+ * Serve the links of a worker's robots and step them until told to stop, or
+ * until the duration is simulated.
+ */
+static void * run_worker( void * context );
+
+static void stop( int sig ) {
+    (void) sig;
+    stopping = 1;
+}
+
+static void usage( const char * program ) {
+    fprintf( stderr,
+        "Usage: %s [options]\n"
+        "  -n ROBOTS   number of robots (1)\n"
+        "  -j THREADS  number of worker threads (1)\n"
+        "  -s DIR      directory for the robots' sockets (.)\n"
+        "  -p          serve each robot on a pty instead of a socket\n"
+        "  -x SPEED    times faster than real time to run, 0 for as fast as\n"
+        "              possible (1)\n"
+        "  -d MS       length of a tick of simulated time (10)\n"
+        "  -t SECONDS  simulated time to run for, 0 for ever (0)\n"
+        "  -g SIZE     nodes along each side of the grid (3)\n"
+        "  -q CM       side of each grid square (34)\n"
+        "  -o COUNT    obstacles placed at random (0)\n"
+        "  -b CM       side of each obstacle (10)\n"
+        "  -r SEED     seed of the obstacles and of every robot's noise (1)\n"
+        "  -w DEG/S    wheel speed (640)\n"
+        "  -l SLIP     standard deviation of wheel slip, as a fraction (0)\n"
+        "  -u CM       standard deviation of sonar noise (0)\n"
+        "  -e          send back every message after the first\n"
+        "  -c MS       sense while driving, and tell the robot to stop MS ms\n"
+        "              after a reading that blocks its route\n",
+        program );
+}
+
+static int parse_settings( int argc, char ** argv, sim_settings * settings ) {
+    memset( settings, 0, sizeof ( *settings ) );
+    settings->robots = 1;
+    settings->threads = 1;
+    settings->socketDir = ".";
+    settings->speed = 1.0;
+    settings->tick = 10;
+    settings->gridSize = 3;
+    settings->gridSquareSide = 34.0f;
+    settings->obstacleSide = 10.0f;
+    settings->seed = 1;
+
+    int option;
+    while ( ( option = getopt( argc, argv, "n:j:s:px:d:t:g:q:o:b:r:w:l:u:ec:" ) )
+            != -1 ) {
+        switch ( option ) {
+            case 'n': settings->robots = strtoul( optarg, NULL, 10 ); break;
+            case 'j': settings->threads = strtoul( optarg, NULL, 10 ); break;
+            case 's': settings->socketDir = optarg; break;
+            case 'p': settings->pty = 1; break;
+            case 'x': settings->speed = atof( optarg ); break;
+            case 'd': settings->tick = strtoul( optarg, NULL, 10 ); break;
+            case 't': settings->duration = atof( optarg ) * 1000.0; break;
+            case 'g': settings->gridSize = strtoul( optarg, NULL, 10 ); break;
+            case 'q': settings->gridSquareSide = atof( optarg ); break;
+            case 'o': settings->obstacles = strtoul( optarg, NULL, 10 ); break;
+            case 'b': settings->obstacleSide = atof( optarg ); break;
+            case 'r': settings->seed = strtoull( optarg, NULL, 10 ); break;
+            case 'w': settings->robot.wheelSpeed = atof( optarg ); break;
+            case 'l': settings->robot.slip = atof( optarg ); break;
+            case 'u': settings->robot.sonarNoise = atof( optarg ); break;
+            case 'e': settings->robot.echo = 1; break;
+            case 'c':
+                settings->checking = settings->robot.continuous = 1;
+                settings->latency = strtoul( optarg, NULL, 10 );
+                break;
+            default: return -1;
+        }
+    }
+    if ( optind < argc || settings->robots == 0 || settings->threads == 0 ||
+         settings->speed < 0.0 || settings->tick == 0 ||
+         settings->duration < 0.0 )
+        return -1;
+    if ( settings->threads > settings->robots )
+        settings->threads = settings->robots;
+    return 0;
+}
+
+static double now_ms( void ) {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+static int open_endpoint( sim_slot * slot, const sim_settings * settings,
+                          size_t index ) {
+    slot->listener = -1;
+    slot->ptySlave = -1;
+    if ( settings->pty ) {
+        int master = posix_openpt( O_RDWR | O_NOCTTY );
+        if ( master < 0 )
+            return -1;
+        const char * name = NULL;
+        if ( grantpt( master ) || unlockpt( master ) ||
+             ( name = ptsname( master ) ) == NULL ||
+             ( slot->ptySlave = open( name, O_RDWR | O_NOCTTY ) ) < 0 ) {
+            close( master );
+            return -1;
+        }
+        // Pass every byte through unchanged, as USB does.
+        struct termios raw;
+        tcgetattr( slot->ptySlave, &raw );
+        cfmakeraw( &raw );
+        tcsetattr( slot->ptySlave, TCSANOW, &raw );
+        printf( "robot %zu: %s\n", index, name );
+        sim_link_open( &slot->link, master );
+        return 0;
+    }
+
+    struct sockaddr_un address;
+    memset( &address, 0, sizeof ( address ) );
+    address.sun_family = AF_UNIX;
+    int length = snprintf( slot->path, sizeof ( slot->path ), "%s/nxt%zu.sock",
+                           settings->socketDir, index );
+    if ( length < 0 || (size_t) length >= sizeof ( slot->path ) ) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memcpy( address.sun_path, slot->path, sizeof ( slot->path ) );
+    slot->listener = socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0 );
+    if ( slot->listener < 0 )
+        return -1;
+    unlink( slot->path );
+    if ( bind( slot->listener, (struct sockaddr *) &address,
+               sizeof ( address ) ) || listen( slot->listener, 1 ) ) {
+        close( slot->listener );
+        slot->listener = -1;
+        return -1;
+    }
+    printf( "robot %zu: %s\n", index, slot->path );
+    return 0;
+}
+
+static void session_started( void * context ) {
+    ( (sim_slot *) context )->stopPending = 0;
+    sim_robot_reset( &( (sim_slot *) context )->robot );
+}
+
+static void message_received( void * context, const unsigned char * message,
+                              uint16_t length ) {
+    sim_robot_receive( &( (sim_slot *) context )->robot, message, length );
+}
+
+static void session_ended( void * context ) {
+    ( (sim_slot *) context )->stopPending = 0;
+    sim_robot_reset( &( (sim_slot *) context )->robot );
+}
+
+static int send_to_host( void * context, const unsigned char * message,
+                         uint16_t length ) {
+    sim_slot * slot = (sim_slot *) context;
+    telemetry_message report;
+    if ( slot->settings->checking &&
+         decode_telemetry( message, length, &report ) == LIBNXT_SUCCESS &&
+         report.type == TELEMETRY_RANGE ) {
+        occupancy_reading reading;
+        reading.x = report.range.x;
+        reading.y = report.range.y;
+        reading.heading = report.range.heading;
+        reading.range = report.range.range;
+        grid_node next = ( report.range.next == TELEMETRY_NO_NODE ?
+                           GRID_NO_NODE : report.range.next );
+        if ( route_check_reading( &slot->checker, &reading, next ) ==
+             PLAN_SUCCESS && ! slot->stopPending ) {
+            slot->stopPending = 1;
+            slot->stopNode = next;
+            slot->stopDue = slot->robot.time + slot->settings->latency;
+        }
+    }
+    return sim_link_send( &slot->link, message, length );
+}
+
+static void step_slot( sim_slot * slot, uint32_t tick ) {
+    sim_robot * robot = &slot->robot;
+    double end = robot->time + tick;
+    while ( slot->stopPending && slot->stopDue < end ) {
+        if ( slot->stopDue > robot->time )
+            sim_robot_step( robot, (uint32_t) ( slot->stopDue - robot->time ) );
+        slot->stopPending = 0;
+        unsigned char message[ROUTE_MESSAGE_SIZE];
+        uint16_t length = route_check_stop_message( slot->stopNode, message );
+        if ( length > 0 )
+            sim_robot_receive( robot, message, length );
+    }
+    if ( end > robot->time )
+        sim_robot_step( robot, (uint32_t) ( end - robot->time ) );
+}
+
+static void drop_session( sim_slot * slot ) {
+    slot->stopPending = 0;
+    sim_robot_reset( &slot->robot );
+    if ( slot->listener >= 0 ) {
+        sim_link_close( &slot->link );
+    } else {
+        int fd = slot->link.fd;
+        slot->link.fd = -1;
+        sim_link_close( &slot->link );
+        sim_link_open( &slot->link, fd );
+    }
+}
+
+static void * run_worker( void * context ) {
+    sim_worker * worker = (sim_worker *) context;
+    const sim_settings * settings = worker->settings;
+    double start = now_ms();
+    size_t i;
+    while ( ! stopping && ( settings->duration == 0.0 ||
+                            worker->time < settings->duration ) ) {
+        int active = 0;
+        for ( i = 0; i < worker->count; i++ ) {
+            sim_slot * slot = &worker->slots[i];
+            struct pollfd * fd = &worker->fds[i];
+            if ( slot->link.state == LINK_CLOSED ) {
+                fd->fd = slot->listener;
+                fd->events = POLLIN;
+            } else {
+                fd->fd = slot->link.fd;
+                fd->events = sim_link_events( &slot->link );
+            }
+            fd->revents = 0;
+            if ( slot->link.state == LINK_PACKET &&
+                 ! sim_robot_waiting( &slot->robot ) &&
+                 slot->link.outCount < BACKLOG_LIMIT )
+                active = 1;
+        }
+
+        // Real time paces simulated time, unless the speed is 0.
+        int timeout;
+        double due = 0.0;
+        if ( settings->speed > 0.0 ) {
+            due = start + worker->time / settings->speed;
+            double wait = ceil( due - now_ms() );
+            timeout = ( wait > 0.0 ? (int) fmin( wait, POLL_LIMIT ) : 0 );
+        } else {
+            timeout = ( active ? 0 : POLL_LIMIT );
+        }
+        if ( poll( worker->fds, worker->count, timeout ) < 0 &&
+             errno != EINTR )
+            break;
+
+        for ( i = 0; i < worker->count; i++ ) {
+            sim_slot * slot = &worker->slots[i];
+            short events = worker->fds[i].revents;
+            if ( events == 0 )
+                continue;
+            if ( slot->link.state == LINK_CLOSED ) {
+                int fd = accept( slot->listener, NULL, NULL );
+                if ( fd >= 0 )
+                    sim_link_open( &slot->link, fd );
+                continue;
+            }
+            sim_link_handler handler = { session_started, message_received,
+                                         session_ended, slot };
+            if ( ( events & ( POLLIN | POLLHUP | POLLERR ) ) &&
+                 sim_link_read( &slot->link, &handler ) ) {
+                drop_session( slot );
+                continue;
+            }
+            if ( ( events & POLLOUT ) &&
+                 sim_link_flush( &slot->link ) < LIBNXT_SUCCESS )
+                drop_session( slot );
+        }
+
+        if ( settings->speed > 0.0 ? now_ms() < due : ! active )
+            continue;
+        for ( i = 0; i < worker->count; i++ ) {
+            sim_slot * slot = &worker->slots[i];
+            if ( slot->link.state != LINK_PACKET ||
+                 slot->link.outCount >= BACKLOG_LIMIT )
+                continue;
+            step_slot( slot, settings->tick );
+            if ( sim_link_flush( &slot->link ) < LIBNXT_SUCCESS )
+                drop_session( slot );
+        }
+        worker->time += settings->tick;
+    }
+    return NULL;
+}
+
+int main( int argc, char ** argv ) {
+    sim_settings settings;
+    if ( parse_settings( argc, argv, &settings ) ) {
+        usage( argv[0] );
+        return 2;
+    }
+
+    sim_field field;
+    libnxt_error error = init_sim_field( &field, settings.gridSize,
+                                         settings.gridSquareSide,
+                                         settings.obstacleSide );
+    if ( ! error )
+        error = sim_field_scatter_obstacles( &field, settings.obstacles,
+                                             settings.seed );
+    if ( error ) {
+        fprintf( stderr, "Error creating field: %s\n",
+                 libnxt_error_message( error ) );
+        return 1;
+    }
+
+    sim_slot * slots = (sim_slot *) calloc( settings.robots,
+                                            sizeof ( sim_slot ) );
+    sim_worker * workers = (sim_worker *) calloc( settings.threads,
+                                                  sizeof ( sim_worker ) );
+    struct pollfd * fds = (struct pollfd *) calloc( settings.robots,
+                                                    sizeof ( struct pollfd ) );
+    if ( slots == NULL || workers == NULL || fds == NULL ) {
+        fprintf( stderr, "Out of memory\n" );
+        return 1;
+    }
+    size_t i;
+    for ( i = 0; i < settings.robots; i++ ) {
+        sim_slot * slot = &slots[i];
+        uint64_t seed = settings.seed + i;
+        slot->settings = &settings;
+        error = init_sim_link( &slot->link );
+        if ( ! error )
+            error = init_sim_robot( &slot->robot, &field, &settings.robot,
+                                    sim_random( &seed ), send_to_host, slot );
+        if ( ! error && settings.checking &&
+             init_route_checker( &slot->checker, &field.grid, 4, 0.8f ) )
+            error = LIBNXT_OTHER_ERROR;
+        if ( error ) {
+            fprintf( stderr, "Error creating robot: %s\n",
+                     libnxt_error_message( error ) );
+            return 1;
+        }
+        if ( open_endpoint( slot, &settings, i ) ) {
+            perror( "Error opening robot" );
+            return 1;
+        }
+    }
+    fflush( stdout );
+
+    signal( SIGPIPE, SIG_IGN );
+    signal( SIGINT, stop );
+    signal( SIGTERM, stop );
+    double start = now_ms();
+    size_t first = 0;
+    for ( i = 0; i < settings.threads; i++ ) {
+        sim_worker * worker = &workers[i];
+        worker->settings = &settings;
+        worker->slots = slots + first;
+        worker->fds = fds + first;
+        worker->count = ( settings.robots - first ) / ( settings.threads - i );
+        first += worker->count;
+        pthread_create( &worker->thread, NULL, run_worker, worker );
+    }
+    double simulated = 0.0;
+    for ( i = 0; i < settings.threads; i++ ) {
+        pthread_join( workers[i].thread, NULL );
+        if ( workers[i].time > simulated )
+            simulated = workers[i].time;
+    }
+    double elapsed = now_ms() - start;
+
+    uint64_t messagesIn = 0, messagesOut = 0, bytesIn = 0, bytesOut = 0;
+    uint64_t obstacles = 0, plans = 0, faults = 0, readings = 0, stops = 0;
+    double missionTime = 0.0;
+    for ( i = 0; i < settings.robots; i++ ) {
+        sim_slot * slot = &slots[i];
+        messagesIn += slot->link.messagesIn;
+        messagesOut += slot->link.messagesOut;
+        bytesIn += slot->link.bytesIn;
+        bytesOut += slot->link.bytesOut;
+        obstacles += slot->robot.obstaclesFound;
+        plans += slot->robot.plansComplete;
+        faults += slot->robot.faults;
+        readings += slot->robot.readingsSent;
+        stops += slot->robot.stops;
+        missionTime += slot->robot.missionTime;
+        free_sim_link( &slot->link );
+        free_sim_robot( &slot->robot );
+        free_route_checker( &slot->checker );
+        if ( slot->listener >= 0 ) {
+            close( slot->listener );
+            unlink( slot->path );
+        }
+        if ( slot->ptySlave >= 0 )
+            close( slot->ptySlave );
+    }
+    printf( "simulated %.1f s in %.1f s (%.1fx), %zu robots\n",
+            simulated / 1000.0, elapsed / 1000.0,
+            elapsed > 0.0 ? simulated / elapsed : 0.0, settings.robots );
+    printf( "messages in %llu out %llu, bytes in %llu out %llu\n",
+            (unsigned long long) messagesIn, (unsigned long long) messagesOut,
+            (unsigned long long) bytesIn, (unsigned long long) bytesOut );
+    printf( "obstacles found %llu, plans complete %llu, faults %llu\n",
+            (unsigned long long) obstacles, (unsigned long long) plans,
+            (unsigned long long) faults );
+    printf( "mean time per plan %.2f s, range readings %llu, stops %llu\n",
+            plans > 0 ? missionTime / plans / 1000.0 : 0.0,
+            (unsigned long long) readings, (unsigned long long) stops );
+    free( slots );
+    free( workers );
+    free( fds );
+    free_sim_field( &field );
+    return 0;
+}
@@ -0,0 +1,178 @@
+#include "sim_field.h"
+#include <math.h>
+
+#define PI 3.14159265358979323846
+// Number of values of the 53-bit numbers that fill a double exactly.
+#define DOUBLE_VALUES 9007199254740992.0
+
+/*
+ * Intersect a ray with a box whose sides are parallel to the axes.
+ * in: x, y - Start of the ray.
+ * in: dx, dy - Unit vector along the ray.
+ * in: cx, cy - Centre of the box.
+ * in: half - Half the side length of the box.
+ * return: Distance along the ray to the box, 0 if the ray starts inside it,
+ *         or a negative number if the ray misses it.
+ */
+static float ray_box( float x, float y, float dx, float dy, float cx,
+                      float cy, float half );
+
+/*
+ * Clip the range of distances along a ray at which it lies between two
+ * parallel lines.
+ * in: origin - Coordinate of the start of the ray across the lines.
+ * in: direction - Component of the ray across the lines.
+ * in: low, high - Coordinates of the lines.
+ * in/out: near, far - The range, narrowed to the part between the lines.
+ * return: 0 if the range became empty.
+ */
+static int clip_slab( float origin, float direction, float low, float high,
+                      float * near, float * far );
+
+/*
+ * Convert a coordinate to the index of the grid square containing it, clamped
+ * to the grid.
+ * in: position - Distance from node 0 in multiples of the spacing.
+ * in: count - Number of nodes along the axis.
+ */
+static uint32_t clamp_index( float position, uint32_t count );
+
+static int clip_slab( float origin, float direction, float low, float high,
+                      float * near, float * far ) {
+    if ( direction == 0.0f )
+        return ( origin >= low && origin <= high );
+    float t1 = ( low - origin ) / direction;
+    float t2 = ( high - origin ) / direction;
+    if ( t1 > t2 ) {
+        float swap = t1;
+        t1 = t2;
+        t2 = swap;
+    }
+    if ( t1 > *near )
+        *near = t1;
+    if ( t2 < *far )
+        *far = t2;
+    return ( *near <= *far );
+}
+
+static float ray_box( float x, float y, float dx, float dy, float cx,
+                      float cy, float half ) {
+    float near = 0.0f;
+    float far = INFINITY;
+    if ( ! clip_slab( x, dx, cx - half, cx + half, &near, &far ) ||
+         ! clip_slab( y, dy, cy - half, cy + half, &near, &far ) )
+        return -1.0f;
+    return near;
+}
+
+static uint32_t clamp_index( float position, uint32_t count ) {
+    float index = floorf( position + 0.5f );
+    if ( ! ( index > 0.0f ) )
+        return 0;
+    if ( index >= (float) ( count - 1 ) )
+        return count - 1;
+    return (uint32_t) index;
+}
+
+libnxt_error init_sim_field( sim_field * field, uint32_t gridSize,
+                             float gridSquareSide, float obstacleSide ) {
+    field->grid.blocked = NULL;
+    if ( gridSize == 0 || ! ( gridSquareSide > 0.0f ) ||
+         ! ( obstacleSide > 0.0f ) || obstacleSide > gridSquareSide )
+        return LIBNXT_ILLEGAL_ARG;
+    plan_error error = square_grid_map( &field->grid, gridSize,
+                                        gridSquareSide );
+    if ( error == PLAN_ILLEGAL_ARG )
+        return LIBNXT_ILLEGAL_ARG;
+    if ( error )
+        return LIBNXT_OTHER_ERROR;
+    field->obstacleSide = obstacleSide;
+    field->obstacleCount = 0;
+    return LIBNXT_SUCCESS;
+}
+
+void free_sim_field( sim_field * field ) {
+    free_grid_map( &field->grid );
+}
+
+libnxt_error sim_field_add_obstacle( sim_field * field, grid_node node ) {
+    plan_error error = grid_set_blocked( &field->grid, node, 1 );
+    if ( error == PLAN_NO_EFFECT )
+        return LIBNXT_NO_EFFECT;
+    if ( error )
+        return LIBNXT_ILLEGAL_ARG;
+    field->obstacleCount++;
+    return LIBNXT_SUCCESS;
+}
+
+libnxt_error sim_field_scatter_obstacles( sim_field * field, size_t count,
+                                          uint64_t seed ) {
+    size_t nodes = grid_node_count( &field->grid );
+    if ( count > nodes - field->obstacleCount )
+        return LIBNXT_ILLEGAL_ARG;
+    uint64_t state = seed;
+    while ( count > 0 ) {
+        grid_node node = (grid_node) ( sim_random( &state ) % nodes );
+        if ( sim_field_add_obstacle( field, node ) == LIBNXT_SUCCESS )
+            count--;
+    }
+    return LIBNXT_SUCCESS;
+}
+
+float sim_field_range( const sim_field * field, float x, float y,
+                       float heading, float maxRange ) {
+    const grid_map * grid = &field->grid;
+    float radians = heading * (float) ( PI / 180.0 );
+    float dx = cosf( radians );
+    float dy = sinf( radians );
+    float endX = x + dx * maxRange;
+    float endY = y + dy * maxRange;
+
+    // Every obstacle the ray can reach stands in a square the ray's bounding
+    // box overlaps, since each obstacle fits in its square.
+    float spacing = grid->spacing;
+    uint32_t left = clamp_index(
+        ( fminf( x, endX ) - grid->originX ) / spacing, grid->width );
+    uint32_t right = clamp_index(
+        ( fmaxf( x, endX ) - grid->originX ) / spacing, grid->width );
+    uint32_t bottom = clamp_index(
+        ( fminf( y, endY ) - grid->originY ) / spacing, grid->height );
+    uint32_t top = clamp_index(
+        ( fmaxf( y, endY ) - grid->originY ) / spacing, grid->height );
+
+    float half = field->obstacleSide / 2.0f;
+    float nearest = -1.0f;
+    uint32_t i, j;
+    for ( j = bottom; j <= top; j++ ) {
+        for ( i = left; i <= right; i++ ) {
+            grid_node node = j * grid->width + i;
+            if ( ! grid_is_blocked( grid, node ) )
+                continue;
+            float cx, cy;
+            grid_node_point( grid, node, &cx, &cy );
+            float range = ray_box( x, y, dx, dy, cx, cy, half );
+            if ( range >= 0.0f && range <= maxRange &&
+                 ( nearest < 0.0f || range < nearest ) )
+                nearest = range;
+        }
+    }
+    return nearest;
+}
+
+uint64_t sim_random( uint64_t * state ) {
+    uint64_t z = ( *state += 0x9e3779b97f4a7c15ULL );
+    z = ( z ^ ( z >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+    z = ( z ^ ( z >> 27 ) ) * 0x94d049bb133111ebULL;
+    return z ^ ( z >> 31 );
+}
+
+float sim_gaussian( uint64_t * state, float deviation ) {
+    if ( deviation == 0.0f )
+        return 0.0f;
+    // Box-Muller transform, from two uniform numbers in (0, 1].
+    double u1 = ( (double) ( sim_random( state ) >> 11 ) + 1.0 ) /
+                DOUBLE_VALUES;
+    double u2 = (double) ( sim_random( state ) >> 11 ) / DOUBLE_VALUES;
+    return deviation * (float) ( sqrt( -2.0 * log( u1 ) ) *
+                                 cos( 2.0 * PI * u2 ) );
+}
@@ -0,0 +1,112 @@
+/*! \file
+ * \brief The field the simulated robots drive on: the grid made by
+ * `FourWayGridMeshFactory.squareGridMesh()`, with obstacles for the robots to
+ * find with their range sensors.
+ *
+ * Each obstacle is a square box standing on a node of the grid, with its sides
+ * parallel to the axes. The robots share one field, but neither see nor
+ * collide with each other, nor with the obstacles: each behaves as if it
+ * drove on its own copy of the field, as in the demonstration.
+ */
+#ifndef SIM_FIELD_H
+#define SIM_FIELD_H
+#include "error_codes.h"
+#include "grid_map.h"
+
+/*! \brief A field. Initialise with `init_sim_field()`.
+ */
+typedef struct sim_field {
+    grid_map grid; /*!< The grid, with the node of each obstacle blocked. */
+    float obstacleSide; /*!< Side length of each obstacle box. */
+    size_t obstacleCount; /*!< Number of obstacles on the field. */
+} sim_field;
+
+/*! \brief Allocate a field with no obstacles.
+ *
+ * \param [out] field The field to initialise.
+ * \param [in] gridSize Number of nodes along each side of the grid.
+ * \param [in] gridSquareSide Side length of each grid square (cm).
+ * \param [in] obstacleSide Side length of each obstacle box (cm), no longer
+ * than `gridSquareSide`.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_ILLEGAL_ARG} if a size is not positive, or an obstacle
+ * would not fit in a grid square
+ *
+ * \linkerror{LIBNXT_OTHER_ERROR} if memory could not be allocated.
+ * \endparblock
+ */
+libnxt_error init_sim_field( sim_field * field, uint32_t gridSize,
+                             float gridSquareSide, float obstacleSide );
+
+/*! \brief Free the storage of a field initialised with `init_sim_field()`.
+ */
+void free_sim_field( sim_field * field );
+
+/*! \brief Stand an obstacle on a node.
+ *
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_NO_EFFECT} if there is already an obstacle on the node
+ *
+ * \linkerror{LIBNXT_ILLEGAL_ARG} if `node` is not in the grid.
+ * \endparblock
+ */
+libnxt_error sim_field_add_obstacle( sim_field * field, grid_node node );
+
+/*! \brief Stand obstacles on nodes chosen at random.
+ *
+ * The same `seed` always chooses the same nodes.
+ * \param [in] count Number of obstacles to add, at most the number of nodes
+ * without one.
+ * \param [in] seed Seed of the choice.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_ILLEGAL_ARG} if there are fewer than `count` nodes without
+ * an obstacle.
+ * \endparblock
+ */
+libnxt_error sim_field_scatter_obstacles( sim_field * field, size_t count,
+                                          uint64_t seed );
+
+/*! \brief Measure the distance along a ray to the nearest obstacle.
+ *
+ * Only the obstacles on nodes whose grid squares the ray passes near are
+ * tested, so a short ray takes constant time however large the field.
+ * \param [in] x x coordinate of the start of the ray.
+ * \param [in] y y coordinate of the start of the ray.
+ * \param [in] heading Direction of the ray in degrees, anticlockwise from the
+ * x axis.
+ * \param [in] maxRange Length of the ray.
+ * \return The distance, or a negative number if no obstacle lies within
+ * `maxRange`. The distance is 0 if the ray starts inside an obstacle.
+ */
+float sim_field_range( const sim_field * field, float x, float y,
+                       float heading, float maxRange );
+
+/*! \brief Draw the next number from a generator of pseudo-random numbers.
+ *
+ * The generator is SplitMix64, so every seed, including 0, gives a long
+ * sequence; the simulator draws from one generator per robot so that each
+ * robot's run depends only on its own seed.
+ * \param [in,out] state The state of the generator, which may start at any
+ * value.
+ * \return A number uniformly distributed over 64 bits.
+ */
+uint64_t sim_random( uint64_t * state );
+
+/*! \brief Draw a number from a normal distribution, using `sim_random()`.
+ *
+ * \param [in,out] state The state of the generator.
+ * \param [in] deviation Standard deviation of the distribution, whose mean is
+ * 0.
+ */
+float sim_gaussian( uint64_t * state, float deviation );
+
+#endif
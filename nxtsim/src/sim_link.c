@@ -0,0 +1,245 @@
+#include "sim_link.h"
+#include "compress.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Size of the length that starts each frame.
+#define HEADER_SIZE 2
+// Size of the longest frame.
+#define MAX_FRAME ( HEADER_SIZE + UINT16_MAX )
+// Initial size of the buffer of data to write.
+#define INITIAL_OUT_SIZE 1024
+
+// The handshake requesting packet mode, and the reply to it.
+static const unsigned char PACKET_MODE_REQUEST[] = { 0x01, 0xff };
+static const unsigned char PACKET_MODE_REPLY[] = { 0x02, 0xfe, 0xef };
+// Start of the messages offering compression.
+static const unsigned char COMPRESSION_OFFER[] = { 0xfe, 0x5a };
+
+/*
+ * Append data to the buffer of data to write, growing it if need be.
+ * return: LIBNXT_SUCCESS, or
+ *         LIBNXT_OTHER_ERROR if memory could not be allocated.
+ */
+static libnxt_error queue( sim_link * link, const unsigned char * data,
+                           size_t length );
+
+/*
+ * Handle a frame received in a session.
+ * in: payload - The frame without its length.
+ * return: LIBNXT_SUCCESS, or
+ *         LIBNXT_OTHER_ERROR if a message was corrupt, or memory could not be
+ *         allocated.
+ */
+static libnxt_error handle_frame( sim_link * link,
+                                  const sim_link_handler * handler,
+                                  const unsigned char * payload,
+                                  uint16_t length );
+
+static libnxt_error queue( sim_link * link, const unsigned char * data,
+                           size_t length ) {
+    if ( link->outStart + link->outCount + length > link->outSize ) {
+        // Move the data waiting to the front before growing the buffer.
+        memmove( link->out, link->out + link->outStart, link->outCount );
+        link->outStart = 0;
+        size_t size = link->outSize;
+        while ( link->outCount + length > size )
+            size *= 2;
+        if ( size != link->outSize ) {
+            unsigned char * out = (unsigned char *) realloc( link->out, size );
+            if ( out == NULL )
+                return LIBNXT_OTHER_ERROR;
+            link->out = out;
+            link->outSize = size;
+        }
+    }
+    memcpy( link->out + link->outStart + link->outCount, data, length );
+    link->outCount += length;
+    return LIBNXT_SUCCESS;
+}
+
+static libnxt_error handle_frame( sim_link * link,
+                                  const sim_link_handler * handler,
+                                  const unsigned char * payload,
+                                  uint16_t length ) {
+    if ( ! link->compressed && ! link->received &&
+         length == sizeof ( COMPRESSION_OFFER ) + 1 &&
+         ! memcmp( payload, COMPRESSION_OFFER,
+                   sizeof ( COMPRESSION_OFFER ) ) ) {
+        unsigned char answer[sizeof ( COMPRESSION_OFFER ) + 1];
+        memcpy( answer, COMPRESSION_OFFER, sizeof ( COMPRESSION_OFFER ) );
+        answer[sizeof ( COMPRESSION_OFFER )] = COMPRESS_CODECS;
+        libnxt_error error = sim_link_send( link, answer, sizeof ( answer ) );
+        link->compressed = 1;
+        return error;
+    }
+
+    link->received = 1;
+    link->messagesIn++;
+    if ( link->compressed ) {
+        if ( length == 0 )
+            return LIBNXT_OTHER_ERROR;
+        int codec = payload[0];
+        payload++;
+        length--;
+        if ( codec != COMPRESS_NONE ) {
+            size_t decoded;
+            if ( decompress_message( codec, payload, length, link->scratch,
+                                     UINT16_MAX, &decoded ) )
+                return LIBNXT_OTHER_ERROR;
+            payload = link->scratch;
+            length = (uint16_t) decoded;
+        }
+    }
+    if ( handler->received )
+        handler->received( handler->context, payload, length );
+    return LIBNXT_SUCCESS;
+}
+
+libnxt_error init_sim_link( sim_link * link ) {
+    memset( link, 0, sizeof ( *link ) );
+    link->fd = -1;
+    link->in = (unsigned char *) malloc( MAX_FRAME );
+    link->out = (unsigned char *) malloc( INITIAL_OUT_SIZE );
+    link->scratch = (unsigned char *) malloc( UINT16_MAX );
+    if ( link->in == NULL || link->out == NULL || link->scratch == NULL ) {
+        free_sim_link( link );
+        return LIBNXT_OTHER_ERROR;
+    }
+    link->outSize = INITIAL_OUT_SIZE;
+    return LIBNXT_SUCCESS;
+}
+
+void free_sim_link( sim_link * link ) {
+    sim_link_close( link );
+    free( link->in );
+    free( link->out );
+    free( link->scratch );
+    link->in = link->out = link->scratch = NULL;
+}
+
+void sim_link_open( sim_link * link, int fd ) {
+    sim_link_close( link );
+    fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) | O_NONBLOCK );
+    link->fd = fd;
+    link->state = LINK_HANDSHAKE;
+}
+
+void sim_link_close( sim_link * link ) {
+    if ( link->fd >= 0 )
+        close( link->fd );
+    link->fd = -1;
+    link->state = LINK_CLOSED;
+    link->compressed = 0;
+    link->received = 0;
+    link->inCount = 0;
+    link->outStart = 0;
+    link->outCount = 0;
+}
+
+libnxt_error sim_link_read( sim_link * link,
+                            const sim_link_handler * handler ) {
+    if ( link->state == LINK_CLOSED )
+        return LIBNXT_NOT_OPENED;
+    ssize_t count = read( link->fd, link->in + link->inCount,
+                          MAX_FRAME - link->inCount );
+    if ( count == 0 )
+        return LIBNXT_DISCONNECTED;
+    if ( count < 0 ) {
+        if ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR )
+            return LIBNXT_SUCCESS;
+        return ( errno == ECONNRESET || errno == EIO ? LIBNXT_DISCONNECTED :
+                 LIBNXT_IO_ERROR );
+    }
+    link->bytesIn += (uint64_t) count;
+    link->inCount += (size_t) count;
+
+    size_t used = 0;
+    libnxt_error error = LIBNXT_SUCCESS;
+    while ( ! error ) {
+        const unsigned char * data = link->in + used;
+        size_t available = link->inCount - used;
+        if ( link->state == LINK_HANDSHAKE ) {
+            if ( available < sizeof ( PACKET_MODE_REQUEST ) )
+                break;
+            if ( memcmp( data, PACKET_MODE_REQUEST,
+                         sizeof ( PACKET_MODE_REQUEST ) ) )
+                return LIBNXT_OTHER_ERROR;
+            used += sizeof ( PACKET_MODE_REQUEST );
+            error = queue( link, PACKET_MODE_REPLY,
+                           sizeof ( PACKET_MODE_REPLY ) );
+            link->state = LINK_PACKET;
+            if ( handler->started )
+                handler->started( handler->context );
+            continue;
+        }
+        if ( available < HEADER_SIZE )
+            break;
+        uint16_t length = (uint16_t) ( data[0] | data[1] << 8 );
+        if ( available < HEADER_SIZE + (size_t) length )
+            break;
+        used += HEADER_SIZE + length;
+        if ( length == 0 ) {
+            // The host ends the session; answer it, as leJOS does on close.
+            error = queue( link, data, HEADER_SIZE );
+            link->state = LINK_HANDSHAKE;
+            link->compressed = 0;
+            link->received = 0;
+            if ( handler->ended )
+                handler->ended( handler->context );
+        } else {
+            error = handle_frame( link, handler, data + HEADER_SIZE, length );
+        }
+    }
+    memmove( link->in, link->in + used, link->inCount - used );
+    link->inCount -= used;
+    return error;
+}
+
+libnxt_error sim_link_send( sim_link * link, const unsigned char * message,
+                            uint16_t length ) {
+    if ( link->state != LINK_PACKET )
+        return LIBNXT_NOT_OPENED;
+    size_t codecSize = ( link->compressed ? 1 : 0 );
+    if ( length + codecSize > UINT16_MAX )
+        return LIBNXT_ILLEGAL_ARG;
+    size_t frameLength = length + codecSize;
+    unsigned char header[HEADER_SIZE + 1];
+    header[0] = (unsigned char) frameLength;
+    header[1] = (unsigned char) ( frameLength >> 8 );
+    header[2] = COMPRESS_NONE;
+    if ( queue( link, header, HEADER_SIZE + codecSize ) ||
+         queue( link, message, length ) )
+        return LIBNXT_OTHER_ERROR;
+    link->messagesOut++;
+    return LIBNXT_SUCCESS;
+}
+
+libnxt_error sim_link_flush( sim_link * link ) {
+    if ( link->state == LINK_CLOSED )
+        return LIBNXT_NOT_OPENED;
+    if ( link->outCount == 0 )
+        return LIBNXT_NO_EFFECT;
+    ssize_t count = write( link->fd, link->out + link->outStart,
+                           link->outCount );
+    if ( count < 0 ) {
+        if ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR )
+            return LIBNXT_NO_EFFECT;
+        return ( errno == EPIPE || errno == ECONNRESET || errno == EIO ?
+                 LIBNXT_DISCONNECTED : LIBNXT_IO_ERROR );
+    }
+    link->bytesOut += (uint64_t) count;
+    link->outStart += (size_t) count;
+    link->outCount -= (size_t) count;
+    if ( link->outCount == 0 )
+        link->outStart = 0;
+    return LIBNXT_SUCCESS;
+}
+
+short sim_link_events( const sim_link * link ) {
+    return (short) ( POLLIN | ( link->outCount > 0 ? POLLOUT : 0 ) );
+}
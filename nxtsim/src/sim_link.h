@@ -0,0 +1,157 @@
+/*! \file
+ * \brief The NXT's end of a link in packet mode, as leJOS gives it to
+ * `Controller.java`: answers the handshake sent by `messaging.c`, then
+ * exchanges messages in frames, each behind its length as 2 bytes, least
+ * significant first.
+ *
+ * A link works on a non-blocking file descriptor, such as a connected Unix
+ * domain socket or the master of a pty, and never blocks. Data read is kept
+ * until whole frames have arrived, and data to send is kept until the
+ * descriptor takes it, so that one thread can serve the links of many robots
+ * with `poll()`.
+ *
+ * If the host offers compression, the offer is answered as
+ * `Compression.negotiate()` does, with every codec of `compress.h`; messages
+ * received are then decompressed, and messages sent go behind
+ * `#COMPRESS_NONE`. An empty frame from the host ends the session: it is
+ * answered with an empty frame, and the link waits for the handshake again.
+ */
+#ifndef SIM_LINK_H
+#define SIM_LINK_H
+#include "error_codes.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*! \brief States of a link.
+ */
+typedef enum sim_link_state {
+    LINK_CLOSED, /*!< No descriptor is attached. */
+    LINK_HANDSHAKE, /*!< Waiting for the host to request packet mode. */
+    LINK_PACKET /*!< In a session, exchanging frames. */
+} sim_link_state;
+
+/*! \brief What a link calls on events of its session.
+ *
+ * Any of the functions may be NULL.
+ */
+typedef struct sim_link_handler {
+    /*! Called when the handshake completes, so a session starts. */
+    void ( * started )( void * context );
+    /*! Called with each message received, decompressed. The message is only
+     * valid during the call. */
+    void ( * received )( void * context, const unsigned char * message,
+                         uint16_t length );
+    /*! Called when the host ends the session. */
+    void ( * ended )( void * context );
+    void * context; /*!< Passed to each function. */
+} sim_link_handler;
+
+/*! \brief A link. Initialise with `init_sim_link()`.
+ */
+typedef struct sim_link {
+    int fd; /*!< The descriptor, or -1 when closed. */
+    sim_link_state state; /*!< The state of the link. */
+    int compressed; /*!< Boolean flag: compression was negotiated. */
+    int received; /*!< Boolean flag: a message arrived in this session. */
+    unsigned char * in; /*!< Data read and not yet handled. */
+    size_t inCount; /*!< Size of the data in `in`. */
+    unsigned char * out; /*!< Data waiting to be written. */
+    size_t outStart; /*!< Offset of the first byte waiting in `out`. */
+    size_t outCount; /*!< Number of bytes waiting in `out`. */
+    size_t outSize; /*!< Size of `out`, which grows as needed. */
+    unsigned char * scratch; /*!< Space to decompress messages into. */
+    uint64_t messagesIn; /*!< Messages received, over every session. */
+    uint64_t messagesOut; /*!< Messages sent, over every session. */
+    uint64_t bytesIn; /*!< Bytes read from the descriptor. */
+    uint64_t bytesOut; /*!< Bytes written to the descriptor. */
+} sim_link;
+
+/*! \brief Allocate the buffers of a closed link.
+ *
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_OTHER_ERROR} if memory could not be allocated.
+ * \endparblock
+ */
+libnxt_error init_sim_link( sim_link * link );
+
+/*! \brief Close a link, and free the buffers of a link initialised with
+ * `init_sim_link()`.
+ */
+void free_sim_link( sim_link * link );
+
+/*! \brief Attach a descriptor to a link, closing any attached before, and
+ * wait for the handshake.
+ *
+ * \param [in] fd A descriptor, which is made non-blocking, and closed when the
+ * link is closed.
+ */
+void sim_link_open( sim_link * link, int fd );
+
+/*! \brief Close the descriptor of a link and discard any data waiting.
+ */
+void sim_link_close( sim_link * link );
+
+/*! \brief Read what data the descriptor has, and handle every handshake and
+ * frame complete.
+ *
+ * \param [in] handler What to call on events of the session.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_NOT_OPENED} if the link is closed
+ *
+ * \linkerror{LIBNXT_DISCONNECTED} if the host closed its end
+ *
+ * \linkerror{LIBNXT_IO_ERROR} if the descriptor could not be read
+ *
+ * \linkerror{LIBNXT_OTHER_ERROR} if the host broke the protocol.
+ * \endparblock
+ */
+libnxt_error sim_link_read( sim_link * link,
+                            const sim_link_handler * handler );
+
+/*! \brief Frame a message to send to the host, to be written by
+ * `sim_link_flush()`.
+ *
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_NOT_OPENED} if the link is not in a session
+ *
+ * \linkerror{LIBNXT_ILLEGAL_ARG} if the message is too long for a frame
+ *
+ * \linkerror{LIBNXT_OTHER_ERROR} if memory could not be allocated.
+ * \endparblock
+ */
+libnxt_error sim_link_send( sim_link * link, const unsigned char * message,
+                            uint16_t length );
+
+/*! \brief Write as much of the data waiting as the descriptor takes.
+ *
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_NO_EFFECT} if no data was waiting, or none could be
+ * written
+ *
+ * \linkerror{LIBNXT_NOT_OPENED} if the link is closed
+ *
+ * \linkerror{LIBNXT_DISCONNECTED} if the host closed its end
+ *
+ * \linkerror{LIBNXT_IO_ERROR} if the descriptor could not be written.
+ * \endparblock
+ */
+libnxt_error sim_link_flush( sim_link * link );
+
+/*! \return The events to `poll()` the descriptor for: `POLLIN`, and
+ * `POLLOUT` while data is waiting to be written.
+ */
+short sim_link_events( const sim_link * link );
+
+#endif
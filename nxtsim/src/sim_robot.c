@@ -0,0 +1,562 @@
+#include "sim_robot.h"
+#include "allocate.h"
+#include "telemetry.h"
+#include <math.h>
+#include <string.h>
+
+#define PI 3.14159265358979323846
+// Default wheel speed, in degrees per second.
+#define DEFAULT_WHEEL_SPEED 640.0f
+// Default half angle of the cone of the ultrasonic sensor, in degrees.
+#define DEFAULT_SONAR_CONE 15.0f
+// Number of rays cast across the cone for each reading.
+#define SONAR_RAYS 5
+// Largest reading of the ultrasonic sensor that is a distance.
+#define SONAR_MAX_RANGE 254.0f
+// Size of the longest telemetry message.
+#define TELEMETRY_SIZE 24
+
+/*
+ * Encode a telemetry message stamped with the robot's time, and send it.
+ */
+static void report( sim_robot * robot, telemetry_message * message );
+
+/*
+ * Report that the robot could not continue, and stop it.
+ */
+static void fault( sim_robot * robot, telemetry_fault kind );
+
+/*
+ * Plan a path from one node to another, and start following it, as
+ * Controller.run() does. Does nothing if either node is not on the robot's
+ * map.
+ */
+static void run( sim_robot * robot, grid_node start, grid_node target );
+
+/*
+ * Start following the plan in robot->path, or report a fault if there is none.
+ * in: stage - How to report the new plan.
+ */
+static void execute( sim_robot * robot, telemetry_progress stage,
+                     plan_error planned );
+
+/*
+ * Start turning on the spot, as DifferentialPilot.rotate() does.
+ * in: degrees - Angle to turn, anticlockwise.
+ * return: 0 if the angle was too small to turn the wheels.
+ */
+static int start_turn( sim_robot * robot, double degrees );
+
+/*
+ * Start driving to the waypoint robot->path[robot->next], as the Navigator
+ * does: turn to face it, then travel straight.
+ */
+static void start_leg( sim_robot * robot );
+
+/*
+ * Start driving straight to the waypoint being driven to.
+ */
+static void start_travel( sim_robot * robot );
+
+/*
+ * Start listening for obstacles for two pulses of the ultrasonic sensor, as
+ * MoveAndSense.atWaypoint() does.
+ */
+static void start_scan( sim_robot * robot );
+
+/*
+ * Act on the end of a turn or of travel.
+ */
+static void motion_done( sim_robot * robot );
+
+/*
+ * Act on reaching a waypoint, as MoveAndSense.atWaypoint() and
+ * pathComplete() do.
+ * return: 0 if the plan is complete.
+ */
+static int at_waypoint( sim_robot * robot );
+
+/*
+ * Turn the wheels, updating the odometry with the degrees turned, and the true
+ * pose with the distance the wheels actually travelled.
+ * in: left, right - Degrees to turn each wheel.
+ */
+static void turn_wheels( sim_robot * robot, double left, double right );
+
+/*
+ * Take a reading of the ultrasonic sensor from the true pose.
+ * return: The distance in whole cm, or SONAR_NO_ECHO.
+ */
+static int sonar_reading( sim_robot * robot );
+
+/*
+ * Map the obstacle detected by a reading and plan around it, as
+ * Controller.featureDetected() does.
+ */
+static void feature_detected( sim_robot * robot, int reading );
+
+/*
+ * Take a reading while driving, and send it to the host if it is an echo, as
+ * Controller.reportRange() does.
+ */
+static void report_range( sim_robot * robot );
+
+/*
+ * Stop, map a node the host found blocked and plan around it, as
+ * Controller.blocked() does. Does nothing if the node is already blocked.
+ */
+static void blocked( sim_robot * robot, grid_node node );
+
+/*
+ * Convert an angle in radians to degrees in (-180, 180].
+ */
+static double normalised_degrees( double radians );
+
+/*
+ * Read the index of a node from a job, as a 4-byte big-endian integer.
+ */
+static grid_node read_node( const unsigned char * data );
+
+static void report( sim_robot * robot, telemetry_message * message ) {
+    unsigned char data[TELEMETRY_SIZE];
+    message->version = TELEMETRY_VERSION;
+    message->time = (uint32_t) robot->time;
+    size_t length = encode_telemetry( message, data, sizeof ( data ) );
+    if ( length > 0 )
+        robot->send( robot->sendContext, data, (uint16_t) length );
+}
+
+static void fault( sim_robot * robot, telemetry_fault kind ) {
+    telemetry_message message;
+    message.type = TELEMETRY_ERROR;
+    message.error.fault = kind;
+    report( robot, &message );
+    robot->faults++;
+    robot->state = ROBOT_IDLE;
+}
+
+static void run( sim_robot * robot, grid_node start, grid_node target ) {
+    robot->start = start;
+    robot->target = target;
+    if ( grid_is_blocked( &robot->map, start ) ||
+         grid_is_blocked( &robot->map, target ) ) {
+        robot->state = ROBOT_IDLE;
+        return;
+    }
+    plan_error planned = astar_find_path( &robot->planner, &robot->map, start,
+                                          target, robot->path,
+                                          grid_node_count( &robot->map ),
+                                          &robot->pathCount );
+    robot->planStart = robot->time;
+    execute( robot, PROGRESS_STARTED, planned );
+}
+
+static void execute( sim_robot * robot, telemetry_progress stage,
+                     plan_error planned ) {
+    if ( planned ) {
+        fault( robot, FAULT_NO_PATH );
+        return;
+    }
+    telemetry_message message;
+    message.type = TELEMETRY_PROGRESS;
+    message.progress.stage = stage;
+    message.progress.waypoints = (uint16_t) robot->pathCount;
+    report( robot, &message );
+    robot->next = 0;
+    start_leg( robot );
+}
+
+static int start_turn( sim_robot * robot, double degrees ) {
+    // The pilot turns each wheel through a whole number of degrees.
+    double wheel = trunc( degrees * TRACK_W / WHEEL_D );
+    if ( wheel == 0.0 )
+        return 0;
+    robot->leftLeft = -wheel;
+    robot->rightLeft = wheel;
+    robot->state = ROBOT_ROTATING;
+    return 1;
+}
+
+static void start_leg( sim_robot * robot ) {
+    float x, y;
+    grid_node_point( &robot->map, robot->path[robot->next], &x, &y );
+    double bearing = atan2( y - robot->odomY, x - robot->odomX );
+    robot->scanAfterTurn = 0;
+    // A waypoint closer than a degree of a wheel is already reached, so is not
+    // turned to.
+    double distance = hypot( y - robot->odomY, x - robot->odomX );
+    if ( trunc( distance * 360.0 / ( PI * WHEEL_D ) ) == 0.0 ||
+         ! start_turn( robot,
+                       normalised_degrees( bearing - robot->odomHeading ) ) )
+        start_travel( robot );
+}
+
+static void start_travel( sim_robot * robot ) {
+    float x, y;
+    grid_node_point( &robot->map, robot->path[robot->next], &x, &y );
+    double distance = hypot( y - robot->odomY, x - robot->odomX );
+    double wheel = trunc( distance * 360.0 / ( PI * WHEEL_D ) );
+    robot->leftLeft = wheel;
+    robot->rightLeft = wheel;
+    robot->state = ROBOT_TRAVELLING;
+}
+
+static void start_scan( sim_robot * robot ) {
+    robot->state = ROBOT_SCANNING;
+    robot->scanEnd = robot->time + 2 * SENS_P;
+    // The sensor pulses every SENS_P ms from the start of the session.
+    robot->nextPulse = ceil( robot->time / SENS_P ) * SENS_P;
+}
+
+static void motion_done( sim_robot * robot ) {
+    if ( robot->state == ROBOT_TRAVELLING ) {
+        if ( at_waypoint( robot ) )
+            return;
+        robot->plansComplete++;
+        robot->missionTime += robot->time - robot->planStart;
+        telemetry_message message;
+        message.type = TELEMETRY_PROGRESS;
+        message.progress.stage = PROGRESS_COMPLETE;
+        message.progress.waypoints = 0;
+        report( robot, &message );
+        // Follow the plan in reverse.
+        run( robot, robot->target, robot->start );
+    } else if ( robot->scanAfterTurn ) {
+        start_scan( robot );
+    } else {
+        start_travel( robot );
+    }
+}
+
+static int at_waypoint( sim_robot * robot ) {
+    telemetry_message message;
+    message.type = TELEMETRY_POSE;
+    message.pose.x = (float) robot->odomX;
+    message.pose.y = (float) robot->odomY;
+    message.pose.heading = (float) normalised_degrees( robot->odomHeading );
+    message.pose.waypoint = (uint16_t) robot->next;
+    report( robot, &message );
+    if ( robot->next + 1 >= robot->pathCount )
+        return 0;
+    if ( robot->continuous ) {
+        // Drive on to the next waypoint, still sensing.
+        robot->next++;
+        start_leg( robot );
+        return 1;
+    }
+
+    // Turn to face the next waypoint, then scan for an obstacle on it.
+    float x, y;
+    grid_node_point( &robot->map, robot->path[robot->next + 1], &x, &y );
+    double bearing = atan2( y - robot->odomY, x - robot->odomX );
+    robot->scanAfterTurn = 1;
+    if ( ! start_turn( robot,
+                       normalised_degrees( bearing - robot->odomHeading ) ) )
+        start_scan( robot );
+    return 1;
+}
+
+static void turn_wheels( sim_robot * robot, double left, double right ) {
+    double perDegree = PI * WHEEL_D / 360.0;
+    double odomLeft = left * perDegree;
+    double odomRight = right * perDegree;
+    double turn = ( odomRight - odomLeft ) / TRACK_W;
+    double middle = robot->odomHeading + turn / 2.0;
+    robot->odomX += ( odomLeft + odomRight ) / 2.0 * cos( middle );
+    robot->odomY += ( odomLeft + odomRight ) / 2.0 * sin( middle );
+    robot->odomHeading += turn;
+
+    double trueLeft = odomLeft *
+        ( 1.0 + sim_gaussian( &robot->random, robot->options.slip ) );
+    double trueRight = odomRight *
+        ( 1.0 + sim_gaussian( &robot->random, robot->options.slip ) );
+    turn = ( trueRight - trueLeft ) / TRACK_W;
+    middle = robot->heading + turn / 2.0;
+    robot->x += ( trueLeft + trueRight ) / 2.0 * cos( middle );
+    robot->y += ( trueLeft + trueRight ) / 2.0 * sin( middle );
+    robot->heading += turn;
+}
+
+static int sonar_reading( sim_robot * robot ) {
+    float heading = (float) ( robot->heading * 180.0 / PI );
+    float x = (float) ( robot->x + SENSOR_OFFSET * cos( robot->heading ) );
+    float y = (float) ( robot->y + SENSOR_OFFSET * sin( robot->heading ) );
+    float cone = robot->options.sonarCone;
+    float nearest = -1.0f;
+    int i;
+    for ( i = 0; i < SONAR_RAYS; i++ ) {
+        float angle = heading - cone +
+                      2.0f * cone * (float) i / ( SONAR_RAYS - 1 );
+        float range = sim_field_range( robot->field, x, y, angle,
+                                       SONAR_MAX_RANGE );
+        if ( range >= 0.0f && ( nearest < 0.0f || range < nearest ) )
+            nearest = range;
+    }
+    if ( nearest < 0.0f )
+        return SONAR_NO_ECHO;
+    nearest += sim_gaussian( &robot->random, robot->options.sonarNoise );
+    if ( nearest < 0.0f )
+        nearest = 0.0f;
+    return ( nearest > SONAR_MAX_RANGE ? SONAR_NO_ECHO : (int) nearest );
+}
+
+static void feature_detected( sim_robot * robot, int reading ) {
+    float realRange = (float) reading + SENSOR_OFFSET;
+    float detectedX = (float) ( robot->odomX +
+                                realRange * cos( robot->odomHeading ) );
+    float detectedY = (float) ( robot->odomY +
+                                realRange * sin( robot->odomHeading ) );
+
+    grid_node robotLoc = grid_nearest_node( &robot->map, (float) robot->odomX,
+                                            (float) robot->odomY );
+    if ( robotLoc == GRID_NO_NODE ) {
+        fault( robot, FAULT_LOCALISE );
+        return;
+    }
+    // The obstacle must lie in a square next to the robot's.
+    grid_node obstacleLoc = grid_cell_at( &robot->map, detectedX, detectedY );
+    grid_node neighbours[4];
+    size_t count = grid_neighbours( &robot->map, robotLoc, neighbours );
+    size_t i;
+    for ( i = 0; i < count && neighbours[i] != obstacleLoc; i++ );
+    if ( obstacleLoc == GRID_NO_NODE || i == count ) {
+        fault( robot, FAULT_MAPPING );
+        return;
+    }
+
+    telemetry_message message;
+    message.type = TELEMETRY_OBSTACLE;
+    grid_node_point( &robot->map, obstacleLoc, &message.obstacle.x,
+                     &message.obstacle.y );
+    message.obstacle.range = realRange;
+    report( robot, &message );
+    robot->obstaclesFound++;
+
+    grid_set_blocked( &robot->map, obstacleLoc, 1 );
+    plan_error planned = astar_find_path( &robot->planner, &robot->map,
+                                          robotLoc, robot->target, robot->path,
+                                          grid_node_count( &robot->map ),
+                                          &robot->pathCount );
+    execute( robot, PROGRESS_REPLANNED, planned );
+}
+
+static void report_range( sim_robot * robot ) {
+    int reading = sonar_reading( robot );
+    if ( reading == SONAR_NO_ECHO )
+        return;
+    telemetry_message message;
+    message.type = TELEMETRY_RANGE;
+    message.range.x = (float) robot->odomX;
+    message.range.y = (float) robot->odomY;
+    message.range.heading = (float) normalised_degrees( robot->odomHeading );
+    message.range.range = (float) reading + SENSOR_OFFSET;
+    // As Controller.reportRange(), a node whose index does not fit is not
+    // reported.
+    grid_node next = robot->path[robot->next];
+    message.range.next = (uint16_t) ( next < TELEMETRY_NO_NODE ? next :
+                                      TELEMETRY_NO_NODE );
+    report( robot, &message );
+    robot->readingsSent++;
+}
+
+static void blocked( sim_robot * robot, grid_node node ) {
+    if ( node >= grid_node_count( &robot->map ) ||
+         grid_is_blocked( &robot->map, node ) ) {
+        robot->messagesIgnored++;
+        return;
+    }
+    robot->leftLeft = robot->rightLeft = 0.0;
+    robot->stops++;
+
+    telemetry_message message;
+    message.type = TELEMETRY_OBSTACLE;
+    grid_node_point( &robot->map, node, &message.obstacle.x,
+                     &message.obstacle.y );
+    message.obstacle.range = (float) hypot( message.obstacle.y - robot->odomY,
+                                            message.obstacle.x - robot->odomX );
+    report( robot, &message );
+    robot->obstaclesFound++;
+
+    grid_set_blocked( &robot->map, node, 1 );
+    grid_node robotLoc = grid_nearest_node( &robot->map, (float) robot->odomX,
+                                            (float) robot->odomY );
+    if ( robotLoc == GRID_NO_NODE ) {
+        fault( robot, FAULT_LOCALISE );
+        return;
+    }
+    plan_error planned = astar_find_path( &robot->planner, &robot->map,
+                                          robotLoc, robot->target, robot->path,
+                                          grid_node_count( &robot->map ),
+                                          &robot->pathCount );
+    execute( robot, PROGRESS_REPLANNED, planned );
+}
+
+static double normalised_degrees( double radians ) {
+    double degrees = fmod( radians * 180.0 / PI, 360.0 );
+    if ( degrees <= -180.0 )
+        degrees += 360.0;
+    else if ( degrees > 180.0 )
+        degrees -= 360.0;
+    return degrees;
+}
+
+static grid_node read_node( const unsigned char * data ) {
+    return (grid_node) data[0] << 24 | (grid_node) data[1] << 16 |
+           (grid_node) data[2] << 8 | data[3];
+}
+
+libnxt_error init_sim_robot( sim_robot * robot, const sim_field * field,
+                             const sim_robot_options * options,
+                             uint64_t seed, sim_send_fn send,
+                             void * sendContext ) {
+    memset( robot, 0, sizeof ( *robot ) );
+    if ( options != NULL )
+        robot->options = *options;
+    if ( robot->options.wheelSpeed < 0.0f || robot->options.slip < 0.0f ||
+         robot->options.sonarNoise < 0.0f || robot->options.sonarCone < 0.0f )
+        return LIBNXT_ILLEGAL_ARG;
+    if ( robot->options.wheelSpeed == 0.0f )
+        robot->options.wheelSpeed = DEFAULT_WHEEL_SPEED;
+    if ( robot->options.sonarCone == 0.0f )
+        robot->options.sonarCone = DEFAULT_SONAR_CONE;
+
+    const grid_map * grid = &field->grid;
+    size_t nodes = grid_node_count( grid );
+    robot->path = (grid_node *) malloc( nodes * sizeof ( grid_node ) );
+    if ( robot->path == NULL ||
+         init_grid_map( &robot->map, grid->width, grid->height, grid->originX,
+                        grid->originY, grid->spacing ) ||
+         init_astar( &robot->planner, nodes ) ) {
+        free_sim_robot( robot );
+        return LIBNXT_OTHER_ERROR;
+    }
+    robot->field = field;
+    robot->seed = seed;
+    robot->send = send;
+    robot->sendContext = sendContext;
+    sim_robot_reset( robot );
+    return LIBNXT_SUCCESS;
+}
+
+void free_sim_robot( sim_robot * robot ) {
+    free_grid_map( &robot->map );
+    free_astar( &robot->planner );
+    free( robot->path );
+    robot->path = NULL;
+}
+
+void sim_robot_reset( sim_robot * robot ) {
+    size_t nodes = grid_node_count( &robot->map );
+    grid_node node;
+    for ( node = 0; node < nodes; node++ )
+        grid_set_blocked( &robot->map, node, 0 );
+    robot->random = robot->seed;
+    robot->pathCount = 0;
+    robot->state = ROBOT_WAITING;
+    robot->x = robot->y = robot->heading = 0.0;
+    robot->odomX = robot->odomY = robot->odomHeading = 0.0;
+    robot->leftLeft = robot->rightLeft = 0.0;
+    robot->continuous = 0;
+    robot->time = 0.0;
+}
+
+void sim_robot_receive( sim_robot * robot, const unsigned char * message,
+                        uint16_t length ) {
+    if ( robot->state != ROBOT_WAITING ) {
+        if ( robot->options.echo )
+            robot->send( robot->sendContext, message, length );
+        else if ( robot->continuous && robot->state != ROBOT_IDLE &&
+                  length == ROUTE_MESSAGE_SIZE && message[0] == ROUTE_BLOCKED )
+            blocked( robot, (grid_node) ( message[1] << 8 | message[2] ) );
+        else
+            robot->messagesIgnored++;
+        return;
+    }
+    // Controller.main() reads the indices of the start and target nodes from
+    // the first message, as a byte each, or as 4-byte integers in the longer
+    // jobs made by allocator_job_message().
+    grid_node start, target;
+    int flags;
+    if ( length >= JOB_MESSAGE_SIZE ) {
+        start = read_node( message );
+        target = read_node( message + 4 );
+        flags = ( length > JOB_MESSAGE_SIZE ? message[JOB_MESSAGE_SIZE] : 0 );
+    } else {
+        start = ( length > 0 ? message[0] : 0 );
+        target = ( length > 1 ? message[1] : 0 );
+        flags = ( length > 2 ? message[2] : 0 );
+    }
+    robot->continuous = ( robot->options.continuous ||
+                          ( flags & ROUTE_CONTINUOUS ) );
+    // The sensor pulses every SENS_P ms from the start of the session.
+    robot->nextPulse = ceil( robot->time / SENS_P ) * SENS_P;
+    if ( start >= grid_node_count( &robot->map ) ||
+         target >= grid_node_count( &robot->map ) ) {
+        fault( robot, FAULT_NO_PATH );
+        return;
+    }
+    run( robot, start, target );
+}
+
+void sim_robot_step( sim_robot * robot, uint32_t tick ) {
+    double end = robot->time + tick;
+    double speed = robot->options.wheelSpeed / 1000.0;
+    while ( robot->time < end ) {
+        double budget = end - robot->time;
+        if ( robot->state == ROBOT_ROTATING ||
+             robot->state == ROBOT_TRAVELLING ) {
+            // While sensing continuously, move only until the next pulse. The
+            // pulses missed while stopped are not heard.
+            if ( robot->continuous && robot->nextPulse < robot->time )
+                robot->nextPulse = ceil( robot->time / SENS_P ) * SENS_P;
+            int pulse = ( robot->continuous && robot->nextPulse < end );
+            if ( pulse )
+                budget = fmax( robot->nextPulse - robot->time, 0.0 );
+            // Both wheels turn through the same number of degrees.
+            double needed = fabs( robot->leftLeft );
+            double turned = fmin( needed, speed * budget );
+            double left = copysign( turned, robot->leftLeft );
+            double right = copysign( turned, robot->rightLeft );
+            turn_wheels( robot, left, right );
+            robot->leftLeft -= left;
+            robot->rightLeft -= right;
+            if ( turned < needed ) {
+                robot->time += budget;
+                if ( ! pulse )
+                    break;
+                robot->nextPulse += SENS_P;
+                report_range( robot );
+                continue;
+            }
+            robot->time += turned / speed;
+            int complete = ( robot->state == ROBOT_TRAVELLING &&
+                             robot->next + 1 >= robot->pathCount );
+            motion_done( robot );
+            // A plan completes at most once a tick, so that a plan with one
+            // waypoint cannot be repeated forever.
+            if ( complete )
+                break;
+        } else if ( robot->state == ROBOT_SCANNING ) {
+            if ( robot->nextPulse <= fmin( robot->scanEnd, end ) ) {
+                robot->time = robot->nextPulse;
+                robot->nextPulse += SENS_P;
+                int reading = sonar_reading( robot );
+                if ( reading <= MAX_SENS_R )
+                    feature_detected( robot, reading );
+            } else if ( robot->scanEnd <= end ) {
+                robot->time = robot->scanEnd;
+                robot->next++;
+                start_leg( robot );
+            } else {
+                robot->time = end;
+            }
+        } else {
+            robot->time = end;
+        }
+    }
+    robot->time = end;
+}
+
+int sim_robot_waiting( const sim_robot * robot ) {
+    return ( robot->state == ROBOT_WAITING || robot->state == ROBOT_IDLE );
+}
@@ -0,0 +1,203 @@
+/*! \file
+ * \brief A simulated robot, which behaves as the NXT does running
+ * `Controller.java`, on a `sim_field`.
+ *
+ * The robot is a differential drive with the wheels of `MoveAndSense.java`.
+ * Its pilot turns each wheel through a whole number of degrees to travel or
+ * rotate, as leJOS's `DifferentialPilot` does, and its pose is tracked by
+ * odometry from the degrees turned, as by `OdometryPoseProvider`. The wheels
+ * may slip, so that the true pose drifts from the odometry.
+ *
+ * Once a session starts, the robot waits for its first message, holding the
+ * indices of the start and target nodes, then plans a path between them with
+ * A* on its own map of the grid, which starts clear. It drives to each
+ * waypoint in turn; at each but the last, it turns to face the next and
+ * listens to its ultrasonic sensor for two pulses. An echo within
+ * `#MAX_SENS_R` is taken as an obstacle on the next node, which is reported,
+ * removed from the map, and planned around. At the end of a plan, the robot
+ * plans back to the start, and so on until the session ends. Its telemetry is
+ * sent as by `Telemetry.java`.
+ *
+ * If the first message has a third byte with `#ROUTE_CONTINUOUS` set, or the
+ * `continuous` option is on, the robot instead drives through the waypoints
+ * without stopping, and sends each echo its sensor hears as a
+ * `TELEMETRY_RANGE` message. It only stops when the host sends the message
+ * made by `route_check_stop_message()`, and then maps the node as an obstacle
+ * and plans around it as above.
+ *
+ * The robot is stepped through time in ticks by the caller, and draws any
+ * noise from its own generator, so a run depends only on the field, the seed,
+ * the options and the ticks at which messages arrive.
+ */
+#ifndef SIM_ROBOT_H
+#define SIM_ROBOT_H
+#include "astar.h"
+#include "route_check.h"
+#include "sim_field.h"
+#include <stdint.h>
+
+/*! \def WHEEL_D
+ * Diameter of the wheels (cm).
+ */
+#define WHEEL_D 4.32f
+
+/*! \def TRACK_W
+ * Distance between the centres of the wheels (cm).
+ */
+#define TRACK_W 11.7f
+
+/*! \def MAX_SENS_R
+ * Maximum distance at which the robot senses obstacles (cm).
+ */
+#define MAX_SENS_R 34.0f
+
+/*! \def SENS_P
+ * The number of ms between pulses of the ultrasonic sensor.
+ */
+#define SENS_P 250
+
+/*! \def SENSOR_OFFSET
+ * The distance from the front of the ultrasonic sensor to the centre of the
+ * robot (cm).
+ */
+#define SENSOR_OFFSET 9.0f
+
+/*! \def SONAR_NO_ECHO
+ * The reading of the ultrasonic sensor when nothing is in range.
+ */
+#define SONAR_NO_ECHO 255
+
+/*! \brief Settings for a robot, given when it is initialised.
+ *
+ * Fields left as 0 take their default values.
+ */
+typedef struct sim_robot_options {
+    /*! Speed each wheel turns at to travel and rotate, in degrees per second.
+     * Defaults to 640, the default speed of a `DifferentialPilot` with fresh
+     * batteries. */
+    float wheelSpeed;
+    /*! Standard deviation of the fraction by which each wheel's travel in a
+     * tick differs from what its encoder counts. Defaults to no slip. */
+    float slip;
+    /*! Standard deviation of the error of each reading of the ultrasonic
+     * sensor (cm). Defaults to no error. */
+    float sonarNoise;
+    /*! Half the angle of the cone within which the ultrasonic sensor hears
+     * echoes, in degrees. Defaults to 15. */
+    float sonarCone;
+    /*! Boolean flag to send back every message received after the first,
+     * so that the host can measure round trips. `Controller.java` ignores
+     * them. Defaults to off. */
+    int echo;
+    /*! Boolean flag to sense continuously whatever the first message asks.
+     * Defaults to off. */
+    int continuous;
+} sim_robot_options;
+
+/*! \brief What a robot is doing.
+ */
+typedef enum sim_robot_state {
+    ROBOT_WAITING, /*!< Waiting for the start and target nodes. */
+    ROBOT_ROTATING, /*!< Turning on the spot. */
+    ROBOT_TRAVELLING, /*!< Driving straight. */
+    ROBOT_SCANNING, /*!< Listening for obstacles at a waypoint. */
+    ROBOT_IDLE /*!< Stopped after a fault, until the session ends. */
+} sim_robot_state;
+
+/*! \brief Sends a message from a robot to the host.
+ *
+ * \return 0 if the message was sent.
+ */
+typedef int ( * sim_send_fn )( void * context, const unsigned char * message,
+                               uint16_t length );
+
+/*! \brief A robot. Initialise with `init_sim_robot()`.
+ */
+typedef struct sim_robot {
+    const sim_field * field; /*!< The field the robot drives on. */
+    sim_robot_options options; /*!< Settings, with defaults filled in. */
+    sim_send_fn send; /*!< Sends the robot's messages. */
+    void * sendContext; /*!< Passed to `send`. */
+    uint64_t seed; /*!< Seed of the generator at each session start. */
+    uint64_t random; /*!< State of the generator. */
+    grid_map map; /*!< The robot's map, with the obstacles it found. */
+    astar_planner planner; /*!< Plans paths on `map`. */
+    grid_node * path; /*!< Waypoints of the current plan. */
+    size_t pathCount; /*!< Number of waypoints in `path`. */
+    size_t next; /*!< Index in `path` of the waypoint being driven to. */
+    grid_node start; /*!< Node the current plan started from. */
+    grid_node target; /*!< Node the current plan leads to. */
+    sim_robot_state state; /*!< What the robot is doing. */
+    double x; /*!< True x coordinate. */
+    double y; /*!< True y coordinate. */
+    double heading; /*!< True heading, in radians anticlockwise from x. */
+    double odomX; /*!< x coordinate from odometry. */
+    double odomY; /*!< y coordinate from odometry. */
+    double odomHeading; /*!< Heading from odometry, in radians. */
+    double leftLeft; /*!< Degrees the left wheel has still to turn. */
+    double rightLeft; /*!< Degrees the right wheel has still to turn. */
+    int scanAfterTurn; /*!< Boolean flag: scan once the current turn ends. */
+    int continuous; /*!< Boolean flag: sense while driving, in this session. */
+    double time; /*!< Time since the session started, in ms. */
+    double scanEnd; /*!< Time at which the current scan ends. */
+    double nextPulse; /*!< Time of the next pulse of the sensor. */
+    double planStart; /*!< Time at which the current plan started. */
+    double missionTime; /*!< Time from the start to the end of each plan
+                         * executed, summed over every session, in ms. */
+    uint64_t readingsSent; /*!< Range readings sent, over every session. */
+    uint64_t stops; /*!< Stops ordered by the host, over every session. */
+    uint64_t messagesIgnored; /*!< Messages received and not acted on. */
+    uint64_t obstaclesFound; /*!< Obstacles detected, over every session. */
+    uint64_t plansComplete; /*!< Plans executed, over every session. */
+    uint64_t faults; /*!< Errors reported, over every session. */
+} sim_robot;
+
+/*! \brief Allocate a robot, waiting for a session to start.
+ *
+ * \param [out] robot The robot to initialise.
+ * \param [in] field The field to drive on, which must outlive the robot.
+ * \param [in] options Settings for the robot, or NULL for the defaults.
+ * \param [in] seed Seed of the robot's noise.
+ * \param [in] send Sends the robot's messages.
+ * \param [in] sendContext Passed to `send`.
+ * \return
+ * \parblock
+ * \linkerror{LIBNXT_SUCCESS}
+ *
+ * \linkerror{LIBNXT_ILLEGAL_ARG} if an option is negative
+ *
+ * \linkerror{LIBNXT_OTHER_ERROR} if memory could not be allocated.
+ * \endparblock
+ */
+libnxt_error init_sim_robot( sim_robot * robot, const sim_field * field,
+                             const sim_robot_options * options,
+                             uint64_t seed, sim_send_fn send,
+                             void * sendContext );
+
+/*! \brief Free the storage of a robot initialised with `init_sim_robot()`.
+ */
+void free_sim_robot( sim_robot * robot );
+
+/*! \brief Start the robot's program again, as when the NXT connects: the
+ * robot stands at the origin facing along x, with a clear map, and waits for
+ * the start and target nodes.
+ */
+void sim_robot_reset( sim_robot * robot );
+
+/*! \brief Hand the robot a message from the host.
+ */
+void sim_robot_receive( sim_robot * robot, const unsigned char * message,
+                        uint16_t length );
+
+/*! \brief Advance the robot through time.
+ *
+ * \param [in] tick Time to advance by, in ms.
+ */
+void sim_robot_step( sim_robot * robot, uint32_t tick );
+
+/*! \return A non-zero integer if the robot will do nothing until a message
+ * arrives or the session ends.
+ */
+int sim_robot_waiting( const sim_robot * robot );
+
+#endif